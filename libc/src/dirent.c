@@ -7,12 +7,14 @@
 
 #include <assert.h>
 #define MAX_FILENAME_LEN 512
+#define DIR_BUFFER_SIZE 4096 // fits at least one MAX_FILENAME_LEN entry
 
 DIR * fdopendir(int fd) {
     if (fd < 0) return NULL;
-    DIR * new = malloc(sizeof(DIR) + sizeof(struct dirent) + MAX_FILENAME_LEN);
+    DIR * new = malloc(sizeof(DIR) + DIR_BUFFER_SIZE);
     assert(new);
-    new->dent_size = sizeof(struct dirent) + MAX_FILENAME_LEN;
+    new->buf_size = DIR_BUFFER_SIZE;
+    new->buf_pos = new->buf_len = 0;
     new->fd = fd;
     return new;
 }
@@ -38,20 +40,29 @@ int closedir(DIR * dirp) {
 
 struct dirent * readdir(DIR * dirp) {
     if (dirp == NULL) return NULL;
-    ssize_t ret = syscall(SYSCALL_READDIR, dirp->fd, &dirp->dent, dirp->dent_size);
+    if (dirp->buf_pos >= dirp->buf_len) {
+        ssize_t ret = syscall(SYSCALL_GETDENTS, dirp->fd, dirp->buf, dirp->buf_size);
 
-    if (ret < 0)
-        ___set_errno(-ret);
-    if (ret <= 0) return NULL;
+        if (ret < 0)
+            ___set_errno(-ret);
+        if (ret <= 0) return NULL;
 
-    return &dirp->dent;
+        dirp->buf_pos = 0;
+        dirp->buf_len = ret;
+    }
+
+    struct dirent * dent = (struct dirent *)(dirp->buf + dirp->buf_pos);
+    dirp->buf_pos += dent->d_reclen;
+    return dent;
 }
 void rewinddir(DIR * dirp) {
     if (dirp == NULL) return;
+    dirp->buf_pos = dirp->buf_len = 0;
     lseek(dirp->fd, 0, SEEK_SET);
 }
 void seekdir(DIR * dirp, off_t loc) {
     if (dirp == NULL) return;
+    dirp->buf_pos = dirp->buf_len = 0;
     lseek(dirp->fd, loc, SEEK_SET);
 }
 off_t telldir(DIR * dirp) {
@@ -59,5 +70,8 @@ off_t telldir(DIR * dirp) {
         ___set_errno(EBADF);
         return -1;
     }
+    // the fd is already past everything that's buffered
+    if (dirp->buf_pos < dirp->buf_len)
+        return ((struct dirent *)(dirp->buf + dirp->buf_pos))->d_off;
     return lseek(dirp->fd, 0, SEEK_CUR);
 }
@@ -4,7 +4,7 @@
 #include "include/errno.h"
 #include <stdarg.h>
 
-int open(const char * path, unsigned short flags, ...) {
+int open(const char * path, unsigned int flags, ...) {
     va_list args;
     va_start(args, flags);
 
@@ -31,7 +31,7 @@ int mkdirat(int fd, const char *path, mode_t mode) {
     return open(path, O_CREAT | O_DIRECTORY, mode);
 }
 
-int openat(int fd, const char * path, unsigned short flags, ...) {
+int openat(int fd, const char * path, unsigned int flags, ...) {
     va_list args;
     va_start(args, flags);
 
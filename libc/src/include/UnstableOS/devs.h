@@ -49,6 +49,8 @@ enum dev_misc_min {
     DEV_MISC_ZERO,
     DEV_MISC_NULL,
     DEV_MISC_RANDOM,
+    DEV_MISC_EPOLL, // anonymous, every epoll_create() gets its own inode
+    DEV_MISC_URING, // anonymous, every uring_setup() gets its own inode
 };
 
 #define __TTY_CONSOLE 16
@@ -1,7 +1,10 @@
 #ifndef _UNSTABLEOS_MOUNT_H
 #define _UNSTABLEOS_MOUNT_H
 
-#define MOUNT_RDONLY 1
+#define MOUNT_RDONLY   1
+#define MOUNT_NOATIME  2 // reads don't update atime
+#define MOUNT_RELATIME 4 // reads update atime only if it's older than mtime/ctime or a day old
+#define MOUNT_LAZYTIME 8 // timestamps stay in memory until the file is released, fsync()ed or sync() is called
 #define SUPPORTED_FS_COUNT 3
 enum supported_filesystems {
     FS_TARFS,
@@ -0,0 +1,7 @@
+#ifndef _UNSTABLEOS_SWAP_H
+#define _UNSTABLEOS_SWAP_H
+
+// path is a regular file or a block device, only a single swap area can be active at a time
+int swapon(const char * path);
+int swapoff(const char * path);
+#endif
@@ -95,6 +95,30 @@ enum syscalls {
     SYSCALL_MMAP, // same as mmap(), but off is pointer to off_t
     SYSCALL_MUNMAP,
     SYSCALL_MPROTECT,
+
+    SYSCALL_SWAPON,
+    SYSCALL_SWAPOFF,
+
+    SYSCALL_GETDENTS, // fd, void * buf, size_t n; packs as many struct dirents as fit, walk them by d_reclen
+
+    SYSCALL_READV, // fd, const struct iovec * iov, int iovcnt
+    SYSCALL_WRITEV,
+    SYSCALL_PREADV, // same as READV, offset like PREAD
+    SYSCALL_PWRITEV,
+
+    SYSCALL_COPY_FILE_RANGE, // int fd_in, off_t * off_in, int fd_out, off_t * off_out, size_t len, unsigned int flags; NULL offsets use the fds' own
+
+    SYSCALL_POLL, // struct pollfd * fds, nfds_t nfds, int timeout
+    SYSCALL_EPOLL_CREATE, // int flags
+    SYSCALL_EPOLL_CTL, // int epfd, int op, int fd, struct epoll_event * event
+    SYSCALL_EPOLL_WAIT, // int epfd, struct epoll_event * events, int maxevents, int timeout
+
+    SYSCALL_URING_SETUP, // unsigned entries, struct uring_params * params
+    SYSCALL_URING_ENTER, // int fd, unsigned to_submit, unsigned min_complete, unsigned flags
+    SYSCALL_URING_REGISTER, // int fd, unsigned opcode, void * arg, unsigned nr_args
+
+    SYSCALL_FSYNC, // int fd
+    SYSCALL_FDATASYNC, // int fd
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,96 @@
+#ifndef _UNSTABLEOS_URING_H
+#define _UNSTABLEOS_URING_H
+
+#include <stdint.h>
+
+// asynchronous I/O rings
+// the submission queue (sq) and the completion queue (cq) live in memory shared with the kernel, mmap() the ring fd to get at them
+// userspace fills sqes and bumps sq.tail, the kernel bumps sq.head once it took them
+// the kernel fills cqes and bumps cq.tail, userspace bumps cq.head once it read them
+// cqes come in the order the requests finished, not the order they were submitted in
+
+#define URING_ENTRIES_MAX 256 // sq entries, the cq is twice as big
+#define URING_IO_MAX (1 << 18) // per read/write entry, longer ones complete short
+#define URING_FIXED_BUFFERS_MAX 16
+#define URING_FIXED_BUFFER_SIZE_MAX (1 << 20)
+#define URING_FIXED_FILES_MAX 32
+
+enum uring_op {
+    URING_OP_NOP,
+    URING_OP_READ, // fd, addr, len, off (-1 = file position); no pipes or character devices (-ESPIPE)
+    URING_OP_WRITE,
+    URING_OP_READ_FIXED, // same as READ, addr has to be inside the registered buffer buf_index
+    URING_OP_WRITE_FIXED,
+    URING_OP_FSYNC, // fd, op_flags (URING_FSYNC_*)
+    URING_OP_OPENAT, // fd (dirfd), addr (path), op_flags (open flags), len (mode); done by uring_enter() itself
+};
+
+// sqe flags
+#define URING_SQE_FIXED_FILE 0x1 // fd is an index into the registered files
+
+// URING_OP_FSYNC op_flags
+#define URING_FSYNC_DATASYNC 0x1 // fdatasync() instead of fsync()
+
+struct uring_sqe {
+    uint8_t opcode;
+    uint8_t flags;
+    uint16_t buf_index;
+    int32_t fd;
+    int64_t off;
+    uint64_t addr;
+    uint32_t len;
+    uint32_t op_flags;
+    uint64_t user_data; // copied into the cqe
+};
+
+struct uring_cqe {
+    uint64_t user_data;
+    int32_t res; // what the equivalent syscall would return, -errno on error
+    uint32_t flags;
+};
+
+struct uring_queue {
+    volatile uint32_t head, tail; // free running, index with & mask
+    uint32_t mask, entries;
+};
+
+// sq_flags
+#define URING_SQ_NEED_WAKEUP 0x1 // the sq poller went to sleep, call uring_enter() with URING_ENTER_SQ_WAKEUP
+#define URING_SQ_NEED_ENTER  0x2 // the sq poller stopped at an entry it can't take, call uring_enter() to submit it
+
+// at the start of the mapping
+struct uring_shared {
+    struct uring_queue sq, cq;
+    volatile uint32_t sq_flags;
+};
+
+// setup flags
+#define URING_SETUP_SQPOLL  0x1 // a kernel thread takes new entries without uring_enter(), only with registered files and buffers
+#define URING_SETUP_CLOEXEC 0x2
+
+struct uring_params {
+    uint32_t flags;
+    uint32_t sq_idle; // milliseconds without submissions before the sq poller sleeps, 0 = default
+    // filled in by uring_setup()
+    uint32_t sq_entries, cq_entries;
+    uint32_t sqes_off, cqes_off; // of the sqe and cqe arrays in the mapping
+    uint32_t ring_size; // to mmap() at offset 0, MAP_SHARED
+};
+
+// uring_enter() flags
+#define URING_ENTER_GETEVENTS 0x1 // wait until there's at least min_complete cqes
+#define URING_ENTER_SQ_WAKEUP 0x2
+
+// uring_register() opcodes, registering again requires unregistering first
+// unregistering fails with EBUSY while requests are in flight
+#define URING_REGISTER_BUFFERS   0 // arg = struct iovec[nr_args], pinned in memory until unregistered
+#define URING_UNREGISTER_BUFFERS 1
+#define URING_REGISTER_FILES     2 // arg = int[nr_args], -1 for an empty slot
+#define URING_UNREGISTER_FILES   3
+
+// returns the ring fd
+int uring_setup(unsigned entries, struct uring_params * params);
+// returns the amount of submitted entries
+int uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags);
+int uring_register(int fd, unsigned opcode, void * arg, unsigned nr_args);
+#endif
@@ -67,6 +67,66 @@ struct vesa_modeline {
 
 //#define FB_GET_EDID        __IOCTL_NO(DEV_MAJ_FB, 7)
 
+// drawing without mmap, done by the driver (and its accelerator, if any) in the current mode
+// rectangles get clipped to the display, colors are 0xRRGGBB and get converted to the mode's format
+struct fb_rect {
+    unsigned long x, y;
+    unsigned long width, height;
+};
+
+struct fb_fill {
+    struct fb_rect rect;
+    unsigned long color;
+};
+
+// overlapping rectangles are fine
+struct fb_copy {
+    struct fb_rect src;
+    unsigned long dest_x, dest_y;
+};
+
+enum fb_pixel_formats {
+    FB_FORMAT_XRGB8888, // 0xXXRRGGBB in a 32 bit word
+    FB_FORMAT_RGB888,   // b, g, r bytes
+    FB_FORMAT_RGB565,
+    FB_FORMAT_RGB332,
+};
+
+struct fb_blit {
+    struct fb_rect rect; // where on screen
+    const void * pixels; // the top left pixel of rect
+    unsigned long stride; // bytes between the starts of two rows
+    unsigned char format; // enum fb_pixel_formats
+};
+
+#define FB_PRESENT_MAX_RECTS 256
+struct fb_present {
+    const struct fb_rect * rects;
+    unsigned long count;
+};
+
+// ioctl(fd, FB_FILL, struct fb_fill * fill);
+// like FB_BLIT, some drivers show it right away
+#define FB_FILL            __IOCTL_NO(DEV_MAJ_FB, 8)
+// ioctl(fd, FB_COPY, struct fb_copy * copy);
+// copies what's visible on screen and shows it right away, present fills and blits into the source first
+#define FB_COPY            __IOCTL_NO(DEV_MAJ_FB, 9)
+// ioctl(fd, FB_BLIT, struct fb_blit * blit);
+// goes into the back buffer if the driver keeps one, FB_PRESENT it to make it visible
+#define FB_BLIT            __IOCTL_NO(DEV_MAJ_FB, 10)
+// ioctl(fd, FB_PRESENT, struct fb_present * damage);
+// swaps just the listed rectangles from the back buffer to the screen
+#define FB_PRESENT         __IOCTL_NO(DEV_MAJ_FB, 11)
+
+// page flipping, the VRAM holds pages of height scanlines, pitch * height bytes apart in the mmap (in each plane for mode X)
+// draw into a hidden one and flip to it, the kernel console keeps drawing into the one that's shown
+// ioctl(fd, FB_GET_PAGES, NULL);
+// returns the page count, 1 when the driver can't flip
+#define FB_GET_PAGES       __IOCTL_NO(DEV_MAJ_FB, 12)
+// ioctl(fd, FB_FLIP, unsigned long page);
+// returns once the page is being scanned out (past the next vertical retrace), so the previous one is free to draw into
+#define FB_FLIP            __IOCTL_NO(DEV_MAJ_FB, 13)
+
 // there's currently no way to set a custom 256 color palette
 // the default palette is RGB somewhat linearly mapped to 3:3:2
 // the mode12 palette is the standard xterm 16 color one
@@ -26,8 +26,10 @@ struct dirent {
 
 struct {
     int fd;
-    size_t dent_size;
-    struct dirent dent;
+    // entries from SYSCALL_GETDENTS, the ones between buf_pos and buf_len weren't returned by readdir() yet
+    size_t buf_size;
+    size_t buf_pos, buf_len;
+    _Alignas(struct dirent) char buf[];
 } typedef DIR;
 
 DIR * fdopendir(int fd);
@@ -39,13 +39,16 @@
 // when passed to openat_inode, won't resolve the final mountpoint
 #define O_NOXDEV    0x8000
 
+// file status flag, like O_SYNC, except that only the data and the metadata needed to read it back have to reach the disk
+#define O_DSYNC     0x10000
+
 #define AT_FDCWD (-1)
 #define AT_REMOVEDIR 1
 #include "sys/types.h"
 #include "sys/stat.h"
 
-int open(const char * path, unsigned short flags, ...);
-int openat(int fd, const char * path, unsigned short flags, ...);
+int open(const char * path, unsigned int flags, ...);
+int openat(int fd, const char * path, unsigned int flags, ...);
 int creat(const char * path, mode_t mode);
 int mkdirat(int fd, const char *path, mode_t mode);
 
@@ -0,0 +1,27 @@
+#ifndef _POLL_H
+#define _POLL_H
+
+#define POLLIN     0x1  // data other than high priority can be read without blocking
+#define POLLRDNORM 0x2  // normal data can be read without blocking
+#define POLLRDBAND 0x4  // priority data can be read without blocking
+#define POLLPRI    0x8  // high priority data can be read without blocking
+#define POLLOUT    0x10 // normal data can be written without blocking
+#define POLLWRNORM POLLOUT
+#define POLLWRBAND 0x20 // priority data can be written
+// revents only, always reported regardless of events
+#define POLLERR    0x40 // error on the device or the reading end of a pipe got closed
+#define POLLHUP    0x80 // hung up, e.g. the writing end of a pipe got closed
+#define POLLNVAL   0x100 // fd isn't open
+
+typedef unsigned long nfds_t;
+
+struct pollfd {
+    int fd; // negative fds are ignored
+    short events;
+    short revents;
+};
+
+// timeout in milliseconds, -1 to wait forever
+int poll(struct pollfd fds[], nfds_t nfds, int timeout);
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef _SYS_EPOLL_H
+#define _SYS_EPOLL_H
+
+#include <stdint.h>
+#include <poll.h>
+
+// the same values as the POLL* ones
+#define EPOLLIN     POLLIN
+#define EPOLLPRI    POLLPRI
+#define EPOLLOUT    POLLOUT
+#define EPOLLRDNORM POLLRDNORM
+#define EPOLLRDBAND POLLRDBAND
+#define EPOLLWRNORM POLLWRNORM
+#define EPOLLWRBAND POLLWRBAND
+#define EPOLLERR    POLLERR
+#define EPOLLHUP    POLLHUP
+
+#define EPOLLONESHOT (1U << 30) // disable the fd after one event, rearm with EPOLL_CTL_MOD
+#define EPOLLET      (1U << 31) // edge triggered, only reported once per readiness change
+
+#define EPOLL_CLOEXEC 0x1000 // O_CLOEXEC
+
+#define EPOLL_CTL_ADD 1
+#define EPOLL_CTL_DEL 2
+#define EPOLL_CTL_MOD 3
+
+typedef union epoll_data {
+    void * ptr;
+    int fd;
+    uint32_t u32;
+    uint64_t u64;
+} epoll_data_t;
+
+struct epoll_event {
+    uint32_t events;
+    epoll_data_t data;
+};
+
+int epoll_create(int size); // size is ignored, has to be positive
+int epoll_create1(int flags);
+int epoll_ctl(int epfd, int op, int fd, struct epoll_event * event);
+// timeout in milliseconds, -1 to wait forever
+int epoll_wait(int epfd, struct epoll_event * events, int maxevents, int timeout);
+
+#endif
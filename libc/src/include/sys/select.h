@@ -0,0 +1,29 @@
+#ifndef _SYS_SELECT_H
+#define _SYS_SELECT_H
+
+#include "types.h" // for time_t, suseconds_t
+
+// select() is implemented on top of poll(), this only limits the fd numbers an fd_set can hold
+#define FD_SETSIZE 1024
+
+struct timeval {
+    time_t tv_sec;
+    suseconds_t tv_usec;
+};
+
+typedef struct {
+    unsigned long fds_bits[FD_SETSIZE / (8 * sizeof(unsigned long))];
+} fd_set;
+
+#define __FD_ELT(fd) ((fd) / (8 * sizeof(unsigned long)))
+#define __FD_MASK(fd) (1UL << ((fd) % (8 * sizeof(unsigned long))))
+
+#define FD_ZERO(set) do { for (unsigned long __i = 0; __i < sizeof((set)->fds_bits) / sizeof((set)->fds_bits[0]); __i++) (set)->fds_bits[__i] = 0; } while (0)
+#define FD_SET(fd, set) ((void)((set)->fds_bits[__FD_ELT(fd)] |= __FD_MASK(fd)))
+#define FD_CLR(fd, set) ((void)((set)->fds_bits[__FD_ELT(fd)] &= ~__FD_MASK(fd)))
+#define FD_ISSET(fd, set) (((set)->fds_bits[__FD_ELT(fd)] & __FD_MASK(fd)) != 0)
+
+// timeout isn't updated with the time left
+int select(int nfds, fd_set *__restrict readfds, fd_set *__restrict writefds, fd_set *__restrict errorfds, struct timeval *__restrict timeout);
+
+#endif
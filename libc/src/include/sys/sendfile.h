@@ -0,0 +1,9 @@
+#ifndef _SYS_SENDFILE_H
+#define _SYS_SENDFILE_H
+
+#include "types.h" // for size_t, ssize_t, off_t
+
+// copy_file_range() with the output at out_fd's own offset, a NULL offset uses in_fd's own
+ssize_t sendfile(int out_fd, int in_fd, off_t * offset, size_t count);
+
+#endif
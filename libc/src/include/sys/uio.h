@@ -0,0 +1,17 @@
+#ifndef _SYS_UIO_H
+#define _SYS_UIO_H
+
+#include "types.h" // for size_t, ssize_t, off_t
+
+#define IOV_MAX 1024
+
+struct iovec {
+    void * iov_base;
+    size_t iov_len;
+};
+
+ssize_t readv (int fd, const struct iovec * iov, int iovcnt);
+ssize_t writev(int fd, const struct iovec * iov, int iovcnt);
+ssize_t preadv (int fd, const struct iovec * iov, int iovcnt, off_t offset);
+ssize_t pwritev(int fd, const struct iovec * iov, int iovcnt, off_t offset);
+#endif
@@ -4,7 +4,7 @@
 #define NCCS 11
 typedef unsigned char cc_t;
 typedef unsigned short tcflag_t;
-//typedef unsigned int speed_t;
+typedef unsigned int speed_t;
 
 struct termios {
     tcflag_t c_iflag;
@@ -13,6 +13,8 @@ struct termios {
     tcflag_t c_lflag;
 
     cc_t c_cc[NCCS];
+
+    speed_t c_ispeed, c_ospeed; // use cfgetispeed() and friends
 };
 
 // NC non-canonical, IC canonical ("line buffered")
@@ -76,7 +78,9 @@ struct termios {
 #define TOSTOP  128 // set SIGTTOU if background process group tries to write()
 #define ECHOCTL 256 // echo escapes as ^X
 
-/*
+// the B* constants are the rates themselves, only ones dividing 115200 are accepted by serial ttys
+// both speeds have to be the same (an input speed of 0 means the same as output)
+// B0 doesn't hang up, it leaves the speed as it was
 #define B0     0
 #define B50    50
 #define B75    75
@@ -93,7 +97,13 @@ struct termios {
 #define B9600  9600
 #define B19200 19200
 #define B38400 38400
-*/
+#define B57600 57600
+#define B115200 115200
+
+speed_t cfgetispeed(const struct termios *termios_p);
+speed_t cfgetospeed(const struct termios *termios_p);
+int cfsetispeed(struct termios *termios_p, speed_t speed);
+int cfsetospeed(struct termios *termios_p, speed_t speed);
 
 #define TCSANOW   0
 #define TCSADRAIN 1
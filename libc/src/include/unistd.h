@@ -26,7 +26,11 @@ ssize_t write(int fd, const void * buf, size_t count);
 ssize_t pread (int fd, void * buf, size_t count, off_t offset);
 ssize_t pwrite(int fd, const void * buf, size_t count, off_t offset);
 int ftruncate(int fildes, off_t length);
+// copies inside the kernel, NULL offsets use and advance the fds' own, flags must be 0
+ssize_t copy_file_range(int fd_in, off_t * off_in, int fd_out, off_t * off_out, size_t len, unsigned int flags);
 void sync();
+int fsync(int fildes);
+int fdatasync(int fildes);
 
 char *getcwd(char *buf, size_t size);
 
@@ -1,156 +1,446 @@
-// a copy of kalloc
+// size class segregated allocator
+// small chunks are kept in exact-size bins, larger ones in power of two bins,
+// boundary tags let free neighbours coalesce in O(1) and every thread keeps
+// a small lock-free cache of recently freed small chunks
 #include <stdint.h>
 #include <stddef.h>
-#include <stdalign.h>
+#include <limits.h>
 
 #include <unistd.h>
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <pthread.h>
+#include <sys/mman.h>
+#include <UnstableOS/syscalls.h>
 
 #include "errno.h"
 
-#define MALLOC_MAGIC "MAL"
-
 enum malloc_flags {
     MALLOC_CHUNK_USED = 1,
-    MALLOC_FIRST_CHUNK = 2, // prev_chunk = heap_struct_start
-    MALLOC_LAST_CHUNK = 4 // next_chunk = heap_top
+    MALLOC_PREV_USED = 2, // prev_size is only valid when this is clear
+    MALLOC_CHUNK_MMAPPED = 4
 };
 
-#define MALLOC_ALIGNMENT sizeof(unsigned long)
-#define MALLOC_OOM_INCREASE (0x10000)
-struct malloc_heap_header { // aligning so that we try to avoid alignment check
-    char magic[3];
-    uint8_t flags;
-    alignas(MALLOC_ALIGNMENT) struct malloc_heap_header * prev_chunk;
-    alignas(MALLOC_ALIGNMENT) struct malloc_heap_header * next_chunk;
+#define MALLOC_ALIGNMENT (2*sizeof(size_t))
+#define MALLOC_FLAGS_MASK (MALLOC_ALIGNMENT - 1)
+#define MALLOC_HEADER_SIZE (2*sizeof(size_t))
+#define MALLOC_MIN_CHUNK (sizeof(struct malloc_chunk))
+
+#define MALLOC_SMALL_BINS 64 // one bin per chunk size below MALLOC_SMALL_LIMIT
+#define MALLOC_SMALL_LIMIT (MALLOC_SMALL_BINS*MALLOC_ALIGNMENT)
+#define MALLOC_LARGE_BINS 24 // one bin per power of two above that
+#define MALLOC_BINS (MALLOC_SMALL_BINS + MALLOC_LARGE_BINS)
+#define MALLOC_MAP_BITS (sizeof(unsigned long)*CHAR_BIT)
+
+#define MALLOC_TOP_INCREASE (0x10000) // minimum heap growth, keep a multiple of PAGE_SIZE
+#define MALLOC_TRIM_THRESHOLD (0x40000) // top size at which we start shrinking the break
+#define MALLOC_MMAP_THRESHOLD (0x20000) // chunks this large get their own mapping
+
+#define MALLOC_TCACHE_LIMIT (256) // largest chunk kept in thread caches
+#define MALLOC_TCACHE_BINS (MALLOC_TCACHE_LIMIT/MALLOC_ALIGNMENT)
+#define MALLOC_TCACHE_DEPTH 8
+
+struct malloc_chunk {
+    size_t prev_size; // boundary tag, size of the previous chunk if it's free
+    size_t size; // including this header, lower bits are enum malloc_flags
+
+    // only valid in free or thread cached chunks, overlaps user data otherwise
+    struct malloc_chunk * next;
+    struct malloc_chunk * prev;
 };
 
-static void * heap_base = NULL;
-#define START_HEAP_SIZE 0x8000000 // 128MiB
+#define CHUNK_SIZE(c) ((c)->size & ~MALLOC_FLAGS_MASK)
+#define CHUNK_NEXT(c) ((struct malloc_chunk *)((char *)(c) + CHUNK_SIZE(c)))
+#define CHUNK_PREV(c) ((struct malloc_chunk *)((char *)(c) - (c)->prev_size))
+#define CHUNK_TO_MEM(c) ((void *)((char *)(c) + MALLOC_HEADER_SIZE))
+#define MEM_TO_CHUNK(p) ((struct malloc_chunk *)((char *)(p) - MALLOC_HEADER_SIZE))
+
+static struct malloc_chunk * bins[MALLOC_BINS];
+static unsigned long bin_map[(MALLOC_BINS + MALLOC_MAP_BITS - 1) / MALLOC_MAP_BITS];
+
+// the top chunk borders the program break and is never put into a bin
+static struct malloc_chunk * heap_top = NULL;
+static void * heap_start = NULL; // lowest address we ever got from sbrk
+static void * heap_segment = NULL; // start of the current contiguous part of the heap
+static void * heap_end = NULL;
 
 pthread_mutex_t allocator_mutex = PTHREAD_MUTEX_INITIALIZER;
-__attribute__((constructor(0))) void __malloc_init() {
-    heap_base = sbrk(START_HEAP_SIZE);
-    *(struct malloc_heap_header*)heap_base = (struct malloc_heap_header) {
-        .flags = MALLOC_FIRST_CHUNK | MALLOC_LAST_CHUNK,
-        .prev_chunk = heap_base,
-        .next_chunk = heap_base + START_HEAP_SIZE
-    };
-    memcpy(((struct malloc_heap_header*)heap_base)->magic, MALLOC_MAGIC, 3);
+
+struct malloc_tcache {
+    struct malloc_chunk * entries[MALLOC_TCACHE_BINS];
+    unsigned char counts[MALLOC_TCACHE_BINS];
+};
+static __thread struct malloc_tcache tcache;
+// marks chunks sitting in a thread cache, for cheap double free detection
+static const char tcache_key;
+#define MALLOC_TCACHE_KEY ((struct malloc_chunk *)&tcache_key)
+
+static void __attribute__((noreturn)) malloc_abort(const char * msg) {
+    printf("%s\n", msg);
+    exit(255);
 }
 
-void * __attribute__((malloc, malloc(free), weak)) malloc(size_t size) {
-    pthread_mutex_lock(&allocator_mutex);
-    if (size % MALLOC_ALIGNMENT != 0) size = size + MALLOC_ALIGNMENT - size%MALLOC_ALIGNMENT;
-
-    struct malloc_heap_header * current_heap_object;
-    again:
-    current_heap_object = heap_base;
-    while (current_heap_object->flags & MALLOC_CHUNK_USED || (void *)current_heap_object->next_chunk - (void *)current_heap_object < size + sizeof(struct malloc_heap_header)*2) { // one for the current struct, one for the newly generated at the start of the next chunk
-        if (current_heap_object->next_chunk == NULL) {
-            printf("malloc() current_heap_object->next_chunk == NULL\n");
-            exit(255);
-        }
-        if (current_heap_object->flags & MALLOC_LAST_CHUNK) {
-            if (sbrk(MALLOC_OOM_INCREASE) == (void *)-1) {
-                pthread_mutex_unlock(&allocator_mutex);
-                ___set_errno(ENOMEM);
-                return NULL; // -ENOMEM usually
-            }
-            goto again;
-        }
-        current_heap_object = current_heap_object->next_chunk;
+static inline size_t request_to_chunk_size(size_t size) {
+    size = (size + MALLOC_HEADER_SIZE + MALLOC_FLAGS_MASK) & ~MALLOC_FLAGS_MASK;
+    return size < MALLOC_MIN_CHUNK ? MALLOC_MIN_CHUNK : size;
+}
+
+static inline size_t bin_index(size_t size) {
+    if (size < MALLOC_SMALL_LIMIT)
+        return size / MALLOC_ALIGNMENT;
+
+    size_t idx = MALLOC_SMALL_BINS +
+        __builtin_clzl(MALLOC_SMALL_LIMIT) - __builtin_clzl(size);
+    return idx < MALLOC_BINS ? idx : MALLOC_BINS - 1;
+}
+
+// first non-empty bin at or above idx, MALLOC_BINS if there's none
+static size_t bin_find_next(size_t idx) {
+    for (size_t word = idx / MALLOC_MAP_BITS; word < sizeof(bin_map)/sizeof(bin_map[0]); word++) {
+        unsigned long bits = bin_map[word];
+        if (word == idx / MALLOC_MAP_BITS)
+            bits &= ~0UL << (idx % MALLOC_MAP_BITS);
+        if (bits)
+            return word * MALLOC_MAP_BITS + __builtin_ctzl(bits);
     }
-    current_heap_object->flags |= MALLOC_CHUNK_USED;
+    return MALLOC_BINS;
+}
 
-    struct malloc_heap_header * next_heap_object = (struct malloc_heap_header*)((void *)current_heap_object + sizeof(struct malloc_heap_header) + size);
+static void bin_insert(struct malloc_chunk * c) {
+    size_t idx = bin_index(CHUNK_SIZE(c));
+    c->prev = NULL;
+    c->next = bins[idx];
+    if (c->next)
+        c->next->prev = c;
+    bins[idx] = c;
+    bin_map[idx / MALLOC_MAP_BITS] |= 1UL << (idx % MALLOC_MAP_BITS);
+}
 
-    *next_heap_object = (struct malloc_heap_header) {
-        .flags = 0 | (current_heap_object->flags & MALLOC_LAST_CHUNK),
-        .prev_chunk = current_heap_object,
-        .next_chunk = current_heap_object->next_chunk
-    };
-    memcpy(next_heap_object->magic, MALLOC_MAGIC, 3);
+static void bin_unlink(struct malloc_chunk * c) {
+    size_t idx = bin_index(CHUNK_SIZE(c));
+    if (c->prev)
+        c->prev->next = c->next;
+    else
+        bins[idx] = c->next;
+    if (c->next)
+        c->next->prev = c->prev;
+    if (bins[idx] == NULL)
+        bin_map[idx / MALLOC_MAP_BITS] &= ~(1UL << (idx % MALLOC_MAP_BITS));
+}
 
-    if (current_heap_object->flags & MALLOC_LAST_CHUNK) current_heap_object->flags ^= MALLOC_LAST_CHUNK;
-    current_heap_object->next_chunk = next_heap_object;
+// marks a free chunk as used, returning the tail to the bins if it's big enough
+static void chunk_split(struct malloc_chunk * c, size_t size) {
+    size_t chunk_size = CHUNK_SIZE(c);
+    struct malloc_chunk * next = CHUNK_NEXT(c);
+
+    if (chunk_size - size >= MALLOC_MIN_CHUNK) {
+        struct malloc_chunk * rem = (struct malloc_chunk *)((char *)c + size);
+        rem->size = (chunk_size - size) | MALLOC_PREV_USED;
+        next->prev_size = chunk_size - size;
+        bin_insert(rem);
+        c->size = size | MALLOC_CHUNK_USED | MALLOC_PREV_USED;
+        return;
+    }
+    c->size |= MALLOC_CHUNK_USED;
+    next->size |= MALLOC_PREV_USED;
+}
 
-    if (!(next_heap_object->flags & MALLOC_LAST_CHUNK))
-        next_heap_object->next_chunk->prev_chunk = next_heap_object;
+// 0 on success, the heap may end up discontiguous if someone else moved the break
+static int heap_grow(size_t size) {
+    size_t needed = size + MALLOC_MIN_CHUNK;
+    if (heap_top)
+        needed -= CHUNK_SIZE(heap_top) < needed ? CHUNK_SIZE(heap_top) : needed;
+    if (needed > SIZE_MAX - MALLOC_TOP_INCREASE)
+        return -1;
+    size_t increase = (needed + MALLOC_TOP_INCREASE - 1) & ~(size_t)(MALLOC_TOP_INCREASE - 1);
+    if (increase > INTPTR_MAX)
+        return -1;
+
+    char * old_break = sbrk(increase);
+    if (old_break == (void *)-1)
+        return -1;
+
+    if (heap_top && (void *)old_break == heap_end) {
+        heap_top->size += increase;
+        heap_end = old_break + increase;
+        return 0;
+    }
 
-    pthread_mutex_unlock(&allocator_mutex);
-    return (void*)current_heap_object + sizeof(struct malloc_heap_header);
+    // fence off the old top, the gap after it isn't ours
+    if (heap_top)
+        heap_top->size |= MALLOC_CHUNK_USED;
+
+    char * base = (char *)(((uintptr_t)old_break + MALLOC_FLAGS_MASK) & ~(uintptr_t)MALLOC_FLAGS_MASK);
+    if (!heap_start)
+        heap_start = base;
+    heap_segment = base;
+    heap_end = old_break + increase;
+    heap_top = (struct malloc_chunk *)base;
+    heap_top->prev_size = 0;
+    heap_top->size = ((char *)heap_end - base) | MALLOC_PREV_USED;
+
+    if (CHUNK_SIZE(heap_top) < size + MALLOC_MIN_CHUNK)
+        return heap_grow(size);
+    return 0;
 }
-void * __attribute__((malloc, malloc(free))) calloc(size_t nelem, size_t elsize) {
-    void * ret = malloc(nelem*elsize);
-    if (ret == NULL) return NULL;
 
-    memset(ret, 0, nelem*elsize);
-    return ret;
+// gives the top of the heap back to the kernel once it gets too large
+static void heap_trim() {
+    size_t top_size = CHUNK_SIZE(heap_top);
+    if (top_size < MALLOC_TRIM_THRESHOLD)
+        return;
+
+    size_t release = (top_size - MALLOC_TOP_INCREASE) & ~(size_t)(PAGE_SIZE - 1);
+    if ((void *)_syscall(SYSCALL_BRK, NULL) != heap_end)
+        return; // someone else owns the memory above us
+    if (sbrk(-(intptr_t)release) == (void *)-1)
+        return;
+
+    heap_end = (char *)heap_end - release;
+    heap_top->size -= release;
 }
-void __attribute__((weak)) free(void * p) {
-    if (p == NULL) return;
+
+static struct malloc_chunk * heap_take_top(size_t size) {
+    if (!heap_top || CHUNK_SIZE(heap_top) < size + MALLOC_MIN_CHUNK)
+        if (heap_grow(size) != 0)
+            return NULL;
+
+    struct malloc_chunk * c = heap_top;
+    size_t top_size = CHUNK_SIZE(heap_top);
+
+    heap_top = (struct malloc_chunk *)((char *)c + size);
+    heap_top->size = (top_size - size) | MALLOC_PREV_USED;
+    c->size = size | MALLOC_CHUNK_USED | MALLOC_PREV_USED;
+    return c;
+}
+
+// requires allocator_mutex
+static struct malloc_chunk * heap_take_chunk(size_t size) {
+    size_t idx = bin_index(size);
+    struct malloc_chunk * c = bins[idx];
+
+    // small bins hold exactly one size, large bins need a first fit walk
+    if (idx >= MALLOC_SMALL_BINS)
+        while (c && CHUNK_SIZE(c) < size)
+            c = c->next;
+
+    if (!c) {
+        idx = bin_find_next(idx + 1);
+        if (idx == MALLOC_BINS)
+            return heap_take_top(size);
+        c = bins[idx];
+    }
+
+    bin_unlink(c);
+    chunk_split(c, size);
+    return c;
+}
+
+// requires allocator_mutex
+static void heap_release_chunk(struct malloc_chunk * c) {
+    size_t size = CHUNK_SIZE(c);
+    struct malloc_chunk * next = CHUNK_NEXT(c);
+
+    // a free chunk always has a used predecessor, so merging happens at most once per side
+    if (!(c->size & MALLOC_PREV_USED)) {
+        struct malloc_chunk * prev = CHUNK_PREV(c);
+        bin_unlink(prev);
+        size += CHUNK_SIZE(prev);
+        c = prev;
+    }
+
+    if (next == heap_top) {
+        c->size = (size + CHUNK_SIZE(heap_top)) | MALLOC_PREV_USED;
+        heap_top = c;
+        heap_trim();
+        return;
+    }
+
+    if (!(next->size & MALLOC_CHUNK_USED)) {
+        bin_unlink(next);
+        size += CHUNK_SIZE(next);
+    }
+
+    c->size = size | MALLOC_PREV_USED;
+    next = CHUNK_NEXT(c);
+    next->prev_size = size;
+    next->size &= ~MALLOC_PREV_USED;
+    bin_insert(c);
+}
+
+static inline struct malloc_chunk * tcache_get(size_t size) {
+    size_t idx = size / MALLOC_ALIGNMENT;
+    struct malloc_chunk * c = tcache.entries[idx];
+    if (!c)
+        return NULL;
+
+    tcache.entries[idx] = c->next;
+    tcache.counts[idx]--;
+    c->prev = NULL;
+    return c;
+}
+
+static inline int tcache_put(struct malloc_chunk * c) {
+    size_t size = CHUNK_SIZE(c);
+    size_t idx = size / MALLOC_ALIGNMENT;
+    if (size >= MALLOC_TCACHE_LIMIT || tcache.counts[idx] >= MALLOC_TCACHE_DEPTH)
+        return 0;
+
+    if (c->prev == MALLOC_TCACHE_KEY) // either user data that happens to match or a double free
+        for (struct malloc_chunk * i = tcache.entries[idx]; i; i = i->next)
+            if (i == c)
+                malloc_abort("free() double free");
+
+    c->next = tcache.entries[idx];
+    c->prev = MALLOC_TCACHE_KEY;
+    tcache.entries[idx] = c;
+    tcache.counts[idx]++;
+    return 1;
+}
+
+// moves a few more exact fits into the thread cache while we hold the lock anyway
+// requires allocator_mutex
+static void tcache_refill(size_t size) {
+    size_t idx = size / MALLOC_ALIGNMENT;
+    while (bins[idx] && tcache.counts[idx] < MALLOC_TCACHE_DEPTH / 2) {
+        struct malloc_chunk * c = bins[idx];
+        bin_unlink(c);
+        chunk_split(c, size);
+        tcache_put(c);
+    }
+}
+
+// called by pthread_exit(), otherwise the cached chunks would be lost with the thread
+void __malloc_thread_exit() {
     pthread_mutex_lock(&allocator_mutex);
-    struct malloc_heap_header * current_heap_object = (struct malloc_heap_header * ) (p - sizeof(struct malloc_heap_header));
+    for (size_t i = 0; i < MALLOC_TCACHE_BINS; i++) {
+        while (tcache.entries[i]) {
+            struct malloc_chunk * c = tcache.entries[i];
+            tcache.entries[i] = c->next;
+            heap_release_chunk(c);
+        }
+        tcache.counts[i] = 0;
+    }
+    pthread_mutex_unlock(&allocator_mutex);
+}
+
+static void * mmap_chunk(size_t size) {
+    if (size > SIZE_MAX - PAGE_SIZE)
+        return NULL;
+    size_t len = (size + PAGE_SIZE - 1) & ~(size_t)(PAGE_SIZE - 1);
 
-    if (memcmp(current_heap_object->magic, MALLOC_MAGIC, 3) != 0) {
-        printf("free() tried to free non-heap object\n");
-        exit(255);
+    struct malloc_chunk * c = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (c == MAP_FAILED)
+        return NULL;
+
+    c->prev_size = 0;
+    c->size = len | MALLOC_CHUNK_USED | MALLOC_CHUNK_MMAPPED;
+    return CHUNK_TO_MEM(c);
+}
+
+void * __attribute__((malloc, malloc(free), weak)) malloc(size_t size) {
+    if (size > SIZE_MAX - MALLOC_HEADER_SIZE - PAGE_SIZE) {
+        ___set_errno(ENOMEM);
+        return NULL;
     }
+    size = request_to_chunk_size(size);
+
+    struct malloc_chunk * c;
+    if (size < MALLOC_TCACHE_LIMIT && (c = tcache_get(size)) != NULL)
+        return CHUNK_TO_MEM(c);
 
-    if (current_heap_object->prev_chunk == NULL) {
-        printf("free() current_heap_object->prev_chunk == NULL\n");
-        exit(255);
+    if (size >= MALLOC_MMAP_THRESHOLD) {
+        void * ret = mmap_chunk(size);
+        if (ret != NULL)
+            return ret;
+        // fall back to the heap, the mmap()able area may just be fragmented
     }
 
-    if (!(current_heap_object->flags & MALLOC_CHUNK_USED)) {
-        printf("free() double free\n");
-        exit(255);
+    pthread_mutex_lock(&allocator_mutex);
+    c = heap_take_chunk(size);
+    if (c && size < MALLOC_TCACHE_LIMIT)
+        tcache_refill(size);
+    pthread_mutex_unlock(&allocator_mutex);
+
+    if (c == NULL) {
+        ___set_errno(ENOMEM);
+        return NULL;
     }
+    return CHUNK_TO_MEM(c);
+}
 
-    current_heap_object->flags &= ~MALLOC_CHUNK_USED;
+void * __attribute__((malloc, malloc(free))) calloc(size_t nelem, size_t elsize) {
+    if (elsize != 0 && nelem > SIZE_MAX / elsize) {
+        ___set_errno(ENOMEM);
+        return NULL;
+    }
 
-    if (current_heap_object->flags & MALLOC_FIRST_CHUNK) {
-        if (current_heap_object->flags & MALLOC_LAST_CHUNK) goto end;
-        if (current_heap_object->next_chunk->flags & MALLOC_CHUNK_USED) goto end;
+    void * ret = malloc(nelem*elsize);
+    if (ret == NULL) return NULL;
 
+    memset(ret, 0, nelem*elsize);
+    return ret;
+}
 
-        current_heap_object->flags |= current_heap_object->next_chunk->flags & MALLOC_LAST_CHUNK;
-        current_heap_object->next_chunk = current_heap_object->next_chunk->next_chunk;
+void __attribute__((weak)) free(void * p) {
+    if (p == NULL) return;
+    struct malloc_chunk * c = MEM_TO_CHUNK(p);
 
-        if (!(current_heap_object->flags & MALLOC_LAST_CHUNK))
-            current_heap_object->next_chunk->prev_chunk = current_heap_object;
+    if (!(c->size & MALLOC_CHUNK_USED))
+        malloc_abort("free() double free");
 
-        goto end;
-    } else if (current_heap_object->flags & MALLOC_LAST_CHUNK) {
-        if (current_heap_object->prev_chunk->flags & MALLOC_CHUNK_USED) goto end;
-        current_heap_object->prev_chunk->next_chunk = current_heap_object->next_chunk;
-        current_heap_object->prev_chunk->flags |= MALLOC_LAST_CHUNK;
-        goto end;
-    } else {
-        if (!(current_heap_object->next_chunk->flags & MALLOC_CHUNK_USED)) {
-            current_heap_object->flags |= current_heap_object->next_chunk->flags & MALLOC_LAST_CHUNK;
+    if (c->size & MALLOC_CHUNK_MMAPPED) {
+        if ((uintptr_t)c % PAGE_SIZE)
+            malloc_abort("free() tried to free non-heap object");
+        munmap(c, CHUNK_SIZE(c));
+        return;
+    }
 
-            current_heap_object->next_chunk = current_heap_object->next_chunk->next_chunk;
-            if (current_heap_object->flags & MALLOC_LAST_CHUNK) goto end;
+    if ((void *)c < heap_start || (void *)c >= heap_end)
+        malloc_abort("free() tried to free non-heap object");
 
-            current_heap_object->next_chunk->prev_chunk = current_heap_object;
-        }
-        if (!(current_heap_object->prev_chunk->flags & MALLOC_CHUNK_USED)) {
-            current_heap_object->prev_chunk->flags |= current_heap_object->flags & MALLOC_LAST_CHUNK;
+    if (tcache_put(c))
+        return;
 
-            current_heap_object->prev_chunk->next_chunk = current_heap_object->next_chunk;
-            if (current_heap_object->flags & MALLOC_LAST_CHUNK) goto end;
+    pthread_mutex_lock(&allocator_mutex);
+    heap_release_chunk(c);
+    pthread_mutex_unlock(&allocator_mutex);
+}
 
-            current_heap_object->next_chunk->prev_chunk = current_heap_object->prev_chunk;
+// tries to resize a heap chunk without moving it, 1 on success
+// requires allocator_mutex
+static int heap_resize_chunk(struct malloc_chunk * c, size_t size) {
+    size_t chunk_size = CHUNK_SIZE(c);
+    struct malloc_chunk * next = CHUNK_NEXT(c);
+
+    if (size > chunk_size) {
+        if (next == heap_top) {
+            if (CHUNK_SIZE(heap_top) < size - chunk_size + MALLOC_MIN_CHUNK)
+                return 0;
+            size_t top_size = CHUNK_SIZE(heap_top);
+            heap_top = (struct malloc_chunk *)((char *)c + size);
+            heap_top->size = (top_size - (size - chunk_size)) | MALLOC_PREV_USED;
+            c->size = size | (c->size & MALLOC_FLAGS_MASK);
+            return 1;
         }
+        if (next->size & MALLOC_CHUNK_USED || chunk_size + CHUNK_SIZE(next) < size)
+            return 0;
+
+        bin_unlink(next);
+        c->size += CHUNK_SIZE(next);
+        chunk_size = CHUNK_SIZE(c);
+        next = CHUNK_NEXT(c);
+        next->size |= MALLOC_PREV_USED;
     }
 
-    end:
-    pthread_mutex_unlock(&allocator_mutex);
+    if (chunk_size - size >= MALLOC_MIN_CHUNK) {
+        struct malloc_chunk * rem = (struct malloc_chunk *)((char *)c + size);
+        c->size = size | (c->size & MALLOC_FLAGS_MASK);
+        rem->size = (chunk_size - size) | MALLOC_CHUNK_USED | MALLOC_PREV_USED;
+        heap_release_chunk(rem);
+    }
+    return 1;
 }
 
 void * __attribute__((weak)) realloc(void * p, size_t size) {
@@ -161,12 +451,26 @@ void * __attribute__((weak)) realloc(void * p, size_t size) {
     if (p == NULL) {
         return malloc(size);
     }
+    if (size > SIZE_MAX - MALLOC_HEADER_SIZE - PAGE_SIZE) {
+        ___set_errno(ENOMEM);
+        return NULL;
+    }
 
-    size_t old_size = 0;
-    pthread_mutex_lock(&allocator_mutex);
-    struct malloc_heap_header * hdr = p - sizeof(struct malloc_heap_header);
-    old_size = hdr->next_chunk - hdr;
-    pthread_mutex_unlock(&allocator_mutex);
+    struct malloc_chunk * c = MEM_TO_CHUNK(p);
+    size_t chunk_size = request_to_chunk_size(size);
+    size_t old_size = CHUNK_SIZE(c) - MALLOC_HEADER_SIZE;
+
+    if (c->size & MALLOC_CHUNK_MMAPPED) {
+        // no mremap(), keep the mapping as long as it isn't mostly wasted
+        if (chunk_size <= CHUNK_SIZE(c) && chunk_size >= MALLOC_MMAP_THRESHOLD / 2)
+            return p;
+    } else {
+        pthread_mutex_lock(&allocator_mutex);
+        int resized = heap_resize_chunk(c, chunk_size);
+        pthread_mutex_unlock(&allocator_mutex);
+        if (resized)
+            return p;
+    }
 
     void * new_chunk = malloc(size);
     if (new_chunk == NULL) return NULL;
@@ -177,23 +481,29 @@ void * __attribute__((weak)) realloc(void * p, size_t size) {
     return new_chunk;
 }
 
-static void print_chunk_info(struct malloc_heap_header * header) {
-    printf("malloc: Heap 0x%p - 0x%p, size %lx, prev: 0x%p, ", header, header->next_chunk, (unsigned long)header->next_chunk - (unsigned long)header - sizeof(struct malloc_heap_header), header->prev_chunk);
-    if (header->flags & MALLOC_CHUNK_USED) printf("U, ");
-    if (header->flags & MALLOC_FIRST_CHUNK) printf("FC, ");
-    if (header->flags & MALLOC_LAST_CHUNK) printf("LC, ");
+static void print_chunk_info(struct malloc_chunk * c) {
+    printf("malloc: Heap 0x%p - 0x%p, size %lx, ", c, CHUNK_NEXT(c), (unsigned long)CHUNK_SIZE(c) - MALLOC_HEADER_SIZE);
+    if (c == heap_top) printf("T, ");
+    if (c->size & MALLOC_CHUNK_USED) printf("U, ");
+    if (c->size & MALLOC_PREV_USED) printf("PU, ");
+    if (!(c->size & MALLOC_CHUNK_USED) && c != heap_top) printf("prev: 0x%p, next: 0x%p, ", c->prev, c->next);
     printf("\n");
 }
 
+// only walks the current contiguous heap segment
 void malloc_print_heap_objects() {
     pthread_mutex_lock(&allocator_mutex);
-    struct malloc_heap_header * current_heap_object = heap_base;
+    if (heap_top == NULL) {
+        pthread_mutex_unlock(&allocator_mutex);
+        return;
+    }
 
-    while (!(current_heap_object->flags & MALLOC_LAST_CHUNK)) {
+    struct malloc_chunk * current_heap_object = heap_segment;
+    while (current_heap_object != heap_top) {
         print_chunk_info(current_heap_object);
-        current_heap_object = current_heap_object->next_chunk;
+        current_heap_object = CHUNK_NEXT(current_heap_object);
     }
 
     print_chunk_info(current_heap_object);
     pthread_mutex_unlock(&allocator_mutex);
-}
\ No newline at end of file
+}
@@ -0,0 +1,117 @@
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/select.h>
+#include <errno.h>
+#include <limits.h>
+#include <string.h>
+#include <UnstableOS/syscalls.h>
+#include <unistd.h>
+
+int poll(struct pollfd fds[], nfds_t nfds, int timeout) {
+    int ret = syscall(SYSCALL_POLL, fds, nfds, timeout);
+    if (ret < 0) {
+        ___set_errno(-ret);
+        return -1;
+    }
+    return ret;
+}
+
+// every set fd gets a pollfd, fds past OPEN_MAX can't be open anyway
+int select(int nfds, fd_set *__restrict readfds, fd_set *__restrict writefds, fd_set *__restrict errorfds, struct timeval *__restrict timeout) {
+    if (nfds < 0 || nfds > FD_SETSIZE ||
+        (timeout != NULL && (timeout->tv_sec < 0 || timeout->tv_usec < 0 || timeout->tv_usec >= 1000000))) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    struct pollfd pfds[OPEN_MAX];
+    nfds_t count = 0;
+    for (int fd = 0; fd < nfds; fd++) {
+        short events = 0;
+        if (readfds && FD_ISSET(fd, readfds)) events |= POLLIN;
+        if (writefds && FD_ISSET(fd, writefds)) events |= POLLOUT;
+        if (errorfds && FD_ISSET(fd, errorfds)) events |= POLLPRI;
+        if (!events) continue;
+        if (fd >= OPEN_MAX) {
+            errno = EBADF;
+            return -1;
+        }
+        pfds[count++] = (struct pollfd) {.fd = fd, .events = events};
+    }
+
+    int ms = -1;
+    if (timeout != NULL) {
+        // rounded up, so that we never return early
+        long long total = (long long)timeout->tv_sec * 1000 + (timeout->tv_usec + 999) / 1000;
+        ms = total > INT_MAX ? INT_MAX : total;
+    }
+
+    int ret = poll(pfds, count, ms);
+    if (ret < 0) return -1;
+
+    for (nfds_t i = 0; i < count; i++) {
+        if (pfds[i].revents & POLLNVAL) {
+            errno = EBADF;
+            return -1;
+        }
+    }
+
+    if (readfds) FD_ZERO(readfds);
+    if (writefds) FD_ZERO(writefds);
+    if (errorfds) FD_ZERO(errorfds);
+
+    // select counts bits, not fds
+    ret = 0;
+    for (nfds_t i = 0; i < count; i++) {
+        const short revents = pfds[i].revents;
+        const int fd = pfds[i].fd;
+        if (readfds && (pfds[i].events & POLLIN) && (revents & (POLLIN | POLLHUP | POLLERR))) {
+            FD_SET(fd, readfds);
+            ret++;
+        }
+        if (writefds && (pfds[i].events & POLLOUT) && (revents & (POLLOUT | POLLERR))) {
+            FD_SET(fd, writefds);
+            ret++;
+        }
+        if (errorfds && (pfds[i].events & POLLPRI) && (revents & POLLPRI)) {
+            FD_SET(fd, errorfds);
+            ret++;
+        }
+    }
+    return ret;
+}
+
+int epoll_create1(int flags) {
+    int ret = syscall(SYSCALL_EPOLL_CREATE, flags);
+    if (ret < 0) {
+        ___set_errno(-ret);
+        return -1;
+    }
+    return ret;
+}
+
+int epoll_create(int size) {
+    if (size <= 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    return epoll_create1(0);
+}
+
+int epoll_ctl(int epfd, int op, int fd, struct epoll_event * event) {
+    int ret = syscall(SYSCALL_EPOLL_CTL, epfd, op, fd, event);
+    if (ret < 0) {
+        ___set_errno(-ret);
+        return -1;
+    }
+    return ret;
+}
+
+int epoll_wait(int epfd, struct epoll_event * events, int maxevents, int timeout) {
+    int ret = syscall(SYSCALL_EPOLL_WAIT, epfd, events, maxevents, timeout);
+    if (ret < 0) {
+        ___set_errno(-ret);
+        return -1;
+    }
+    return ret;
+}
@@ -10,6 +10,8 @@
 
 static size_t thread_count = 1;
 
+extern void __malloc_thread_exit(); // malloc.c
+
 pthread_t pthread_self() {
     return (pthread_t)__tls_get_tcb();
 }
@@ -28,6 +30,7 @@ __attribute__((noreturn)) void pthread_exit(void *value_ptr) {
     if (__atomic_sub_fetch(&thread_count, 1, __ATOMIC_RELEASE) == 0)
         exit((long)value_ptr);
 
+    __malloc_thread_exit();
     _syscall(SYSCALL_EXIT_THREAD);
     __builtin_unreachable();
 }
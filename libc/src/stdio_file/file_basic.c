@@ -55,7 +55,7 @@ pthread_mutex_t __files_lock;
 #define OCREAT_FLAGS_FOPEN (S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH)
 
 static int fopen_get_flags(const char * mode) {
-    unsigned short flags = 0;
+    unsigned int flags = 0;
     switch (mode[0]) {
         case 'r':
             flags |= O_RDONLY;
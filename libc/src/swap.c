@@ -0,0 +1,29 @@
+#include <UnstableOS/swap.h>
+#include <UnstableOS/syscalls.h>
+#include <unistd.h>
+#include <errno.h>
+
+int swapon(const char * path) {
+    if (path == NULL) {
+        ___set_errno(EINVAL);
+        return -1;
+    }
+    long ret = syscall(SYSCALL_SWAPON, path);
+    if (ret < 0) {
+        ___set_errno(-ret);
+        return -1;
+    }
+    return ret;
+}
+int swapoff(const char * path) {
+    if (path == NULL) {
+        ___set_errno(EINVAL);
+        return -1;
+    }
+    long ret = syscall(SYSCALL_SWAPOFF, path);
+    if (ret < 0) {
+        ___set_errno(-ret);
+        return -1;
+    }
+    return ret;
+}
@@ -23,6 +23,24 @@ int tcsetattr(int fildes, int optional_actions, const struct termios *termios_p)
     }
 }
 
+speed_t cfgetispeed(const struct termios *termios_p) {
+    return termios_p->c_ispeed;
+}
+
+speed_t cfgetospeed(const struct termios *termios_p) {
+    return termios_p->c_ospeed;
+}
+
+int cfsetispeed(struct termios *termios_p, speed_t speed) {
+    termios_p->c_ispeed = speed;
+    return 0;
+}
+
+int cfsetospeed(struct termios *termios_p, speed_t speed) {
+    termios_p->c_ospeed = speed;
+    return 0;
+}
+
 int isatty(int fildes) {
     struct termios tty_info;
     if (ioctl(fildes, TCGETS, &tty_info) < 0)
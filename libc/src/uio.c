@@ -0,0 +1,40 @@
+#include <sys/uio.h>
+#include <errno.h>
+#include <UnstableOS/syscalls.h>
+#include <unistd.h>
+
+ssize_t readv(int fd, const struct iovec * iov, int iovcnt) {
+    ssize_t ret = syscall(SYSCALL_READV, fd, iov, iovcnt);
+    if (ret < 0) {
+        ___set_errno(-ret);
+        return -1;
+    }
+    return ret;
+}
+
+ssize_t writev(int fd, const struct iovec * iov, int iovcnt) {
+    ssize_t ret = syscall(SYSCALL_WRITEV, fd, iov, iovcnt);
+    if (ret < 0) {
+        ___set_errno(-ret);
+        return -1;
+    }
+    return ret;
+}
+
+ssize_t preadv(int fd, const struct iovec * iov, int iovcnt, off_t offset) {
+    ssize_t ret = syscall(SYSCALL_PREADV, fd, iov, iovcnt, offset);
+    if (ret < 0) {
+        ___set_errno(-ret);
+        return -1;
+    }
+    return ret;
+}
+
+ssize_t pwritev(int fd, const struct iovec * iov, int iovcnt, off_t offset) {
+    ssize_t ret = syscall(SYSCALL_PWRITEV, fd, iov, iovcnt, offset);
+    if (ret < 0) {
+        ___set_errno(-ret);
+        return -1;
+    }
+    return ret;
+}
@@ -12,6 +12,7 @@
 #include <endian.h>
 
 #include <fcntl.h>
+#include <sys/sendfile.h>
 
 void swab(const void *restrict src, void *restrict dest, ssize_t nbytes) {
     if (nbytes < 2) return;
@@ -70,7 +71,7 @@ ssize_t write(int fd, const void * buf, size_t count) {
 }
 
 ssize_t pread (int fd, void * buf, size_t count, off_t offset) {
-    ssize_t ret = syscall(SYSCALL_READ, fd, buf, count, offset);
+    ssize_t ret = syscall(SYSCALL_PREAD, fd, buf, count, offset);
     if (ret < 0) {
         ___set_errno(-ret);
         return -1;
@@ -78,7 +79,7 @@ ssize_t pread (int fd, void * buf, size_t count, off_t offset) {
     return ret;
 }
 ssize_t pwrite(int fd, const void * buf, size_t count, off_t offset) {
-    ssize_t ret = syscall(SYSCALL_WRITE, fd, buf, count, offset);
+    ssize_t ret = syscall(SYSCALL_PWRITE, fd, buf, count, offset);
     if (ret < 0) {
         ___set_errno(-ret);
         return -1;
@@ -86,10 +87,41 @@ ssize_t pwrite(int fd, const void * buf, size_t count, off_t offset) {
     return ret;
 }
 
+ssize_t copy_file_range(int fd_in, off_t * off_in, int fd_out, off_t * off_out, size_t len, unsigned int flags) {
+    ssize_t ret = syscall(SYSCALL_COPY_FILE_RANGE, fd_in, off_in, fd_out, off_out, len, flags);
+    if (ret < 0) {
+        ___set_errno(-ret);
+        return -1;
+    }
+    return ret;
+}
+
+ssize_t sendfile(int out_fd, int in_fd, off_t * offset, size_t count) {
+    return copy_file_range(in_fd, offset, out_fd, NULL, count, 0);
+}
+
 void sync() {
     syscall(SYSCALL_SYNC);
 }
 
+int fsync(int fildes) {
+    int ret = syscall(SYSCALL_FSYNC, fildes);
+    if (ret < 0) {
+        ___set_errno(-ret);
+        return -1;
+    }
+    return ret;
+}
+
+int fdatasync(int fildes) {
+    int ret = syscall(SYSCALL_FDATASYNC, fildes);
+    if (ret < 0) {
+        ___set_errno(-ret);
+        return -1;
+    }
+    return ret;
+}
+
 int pipe2(int fildes[2], int flags) {
     int ret = syscall(SYSCALL_PIPE2, fildes, flags);
     if (ret < 0) {
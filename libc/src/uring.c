@@ -0,0 +1,31 @@
+#include <UnstableOS/uring.h>
+#include <UnstableOS/syscalls.h>
+#include <errno.h>
+#include <unistd.h>
+
+int uring_setup(unsigned entries, struct uring_params * params) {
+    int ret = syscall(SYSCALL_URING_SETUP, entries, params);
+    if (ret < 0) {
+        ___set_errno(-ret);
+        return -1;
+    }
+    return ret;
+}
+
+int uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    int ret = syscall(SYSCALL_URING_ENTER, fd, to_submit, min_complete, flags);
+    if (ret < 0) {
+        ___set_errno(-ret);
+        return -1;
+    }
+    return ret;
+}
+
+int uring_register(int fd, unsigned opcode, void * arg, unsigned nr_args) {
+    int ret = syscall(SYSCALL_URING_REGISTER, fd, opcode, arg, nr_args);
+    if (ret < 0) {
+        ___set_errno(-ret);
+        return -1;
+    }
+    return ret;
+}
@@ -120,18 +120,48 @@ char ata_send_command(unsigned char bus_id, unsigned char drive_number, uint8_t
 }
 
 
+static void ata_set_sector_count(unsigned char bus_id, unsigned char drive_number, size_t count) {
+    // the LBA48 registers are two deep, high byte first
+    if (ata_buses[bus_id].drives[drive_number].has_lba48)
+        outb(ata_buses[bus_id].data_base + ATA_REGS_SECTOR_COUNT, count >> 8);
+    outb(ata_buses[bus_id].data_base + ATA_REGS_SECTOR_COUNT, count);
+}
+
+// waits for the drive to be done with a block of a multi sector transfer, call with interrupts off right after the previous block
+// the IRQ comes as soon as the drive is ready, a lost one only costs the timeout
+static struct ata_status_register ata_wait_block(unsigned char bus_id) {
+    struct ata_status_register status;
+    for (int attempts = 0; attempts < ATA_MAXIMUM_ATTEMPTS; attempts++) {
+        thread_queue_add_with_timeout(
+            &ata_buses[bus_id].drive_queue,
+            current_process, current_thread,
+            ata_command_timeout);
+        asm volatile ("sti;");
+
+        // unlike the alternate one, reading the normal status register acknowledges the IRQ, so that the next block can raise it again
+        status = (struct ata_status_register) {
+            .status_register = inb(ata_buses[bus_id].data_base + ATA_REGS_STATUS)
+        };
+        if (!status.busy)
+            return status;
+        asm volatile ("cli;");
+    }
+    asm volatile ("sti;");
+    return status;
+}
+
 /* return values for ata_read
  * -1 - device does not exist or disappeared
  * 0  - error
  * 1  - ok
  * 2  - ok, but corrected data
  */
-static char __ata_read(unsigned char bus_id, unsigned char drive_number, uint64_t lba, void * buf) {
+static char __ata_read(unsigned char bus_id, unsigned char drive_number, uint64_t lba, size_t count, void * const * bufs) {
     if (ata_select_drive(bus_id, drive_number) != 0) return 0;
 
     ata_seek_lba(bus_id, drive_number, lba);
 
-    outb(ata_buses[bus_id].data_base + ATA_REGS_SECTOR_COUNT, 1);
+    ata_set_sector_count(bus_id, drive_number, count);
 
     char ret = -1;
     if (ata_buses[bus_id].drives[drive_number].has_lba48)
@@ -145,34 +175,55 @@ static char __ata_read(unsigned char bus_id, unsigned char drive_number, uint64_
         dkprintf("--- ECC on read LBA %lld on bus %d drive %d\n", lba, bus_id, drive_number);
     }
 
-    ata_read_pending_block(bus_id, buf, ata_buses[bus_id].drives[drive_number].sector_size);
+    if (count > 1) // acknowledge the IRQ of the first block
+        inb(ata_buses[bus_id].data_base + ATA_REGS_STATUS);
+
+    for (size_t i = 0; i < count; i++) {
+        if (i != 0) {
+            struct ata_status_register status = ata_wait_block(bus_id);
+            if (status.busy || status.error || status.drive_fault || !status.data_request) {
+                dkprintf("Read of LBA %lld failed on bus %d drive %d, status %.2hhx\n", lba + i, bus_id, drive_number, status.status_register);
+                ata_bus_soft_reset(bus_id);
+                return 0;
+            }
+        }
+        // the drive raises the IRQ for the next block right after we take this one
+        if (i + 1 < count)
+            asm volatile ("cli;");
+        ata_read_pending_block(bus_id, bufs[i], ata_buses[bus_id].drives[drive_number].sector_size);
+    }
     return ret;
 }
 
-char ata_read(unsigned char bus_id, unsigned char drive_number, uint64_t lba, void * buf) {
+char ata_read_sectors(unsigned char bus_id, unsigned char drive_number, uint64_t lba, size_t count, void * const * bufs) {
     kassert(bus_id < 2);
     kassert(drive_number < 2);
+    kassert(count > 0 && count <= ATA_MAX_SECTORS);
     if (!ata_buses[bus_id].is_initialized)               return -1;
     if (!ata_buses[bus_id].drives[drive_number].present) return -1;
 
     spinlock_acquire(&ata_buses[bus_id].bus_lock);
-    char ret = __ata_read(bus_id, drive_number, lba, buf);
+    char ret = __ata_read(bus_id, drive_number, lba, count, bufs);
     spinlock_release(&ata_buses[bus_id].bus_lock);
     return ret;
 }
 
+char ata_read(unsigned char bus_id, unsigned char drive_number, uint64_t lba, void * buf) {
+    return ata_read_sectors(bus_id, drive_number, lba, 1, &buf);
+}
+
 /* return values for ata_write
  * -1 - device does not exist or disappeared
  * 0  - error
  * 1  - ok
  * 2  - ok, but corrected data
  */
-static char __ata_write(unsigned char bus_id, unsigned char drive_number, uint64_t lba, const void * buf) {
+static char __ata_write(unsigned char bus_id, unsigned char drive_number, uint64_t lba, size_t count, const void * const * bufs) {
     if (ata_select_drive(bus_id, drive_number) != 0) return 0;
 
     ata_seek_lba(bus_id, drive_number, lba);
 
-    outb(ata_buses[bus_id].data_base + ATA_REGS_SECTOR_COUNT, 1);
+    ata_set_sector_count(bus_id, drive_number, count);
 
     char ret = -1;
     if (ata_buses[bus_id].drives[drive_number].has_lba48)
@@ -186,7 +237,21 @@ static char __ata_write(unsigned char bus_id, unsigned char drive_number, uint64
         dkprintf("--- ECC on write LBA %lld on bus %d drive %d\n", lba, bus_id, drive_number);
     }
 
-    ata_write_pending_block(bus_id, buf, ata_buses[bus_id].drives[drive_number].sector_size);
+    if (count == 1) {
+        ata_write_pending_block(bus_id, bufs[0], ata_buses[bus_id].drives[drive_number].sector_size);
+    } else {
+        // every block, the last one included, ends with an IRQ once the drive took it
+        for (size_t i = 0; i < count; i++) {
+            asm volatile ("cli;");
+            ata_write_pending_block(bus_id, bufs[i], ata_buses[bus_id].drives[drive_number].sector_size);
+            struct ata_status_register status = ata_wait_block(bus_id);
+            if (status.busy || status.error || status.drive_fault || status.data_request != (i + 1 < count)) {
+                dkprintf("Write of LBA %lld failed on bus %d drive %d, status %.2hhx\n", lba + i, bus_id, drive_number, status.status_register);
+                ata_bus_soft_reset(bus_id);
+                return 0;
+            }
+        }
+    }
 
     if (ata_buses[bus_id].drives[drive_number].ata_version > 4)
         ata_send_command(bus_id, drive_number, ATA_FLUSH_CACHE);
@@ -194,14 +259,19 @@ static char __ata_write(unsigned char bus_id, unsigned char drive_number, uint64
     return ret;
 }
 
-char ata_write(unsigned char bus_id, unsigned char drive_number, uint64_t lba, const void * buf) {
+char ata_write_sectors(unsigned char bus_id, unsigned char drive_number, uint64_t lba, size_t count, const void * const * bufs) {
     kassert(bus_id < 2);
     kassert(drive_number < 2);
+    kassert(count > 0 && count <= ATA_MAX_SECTORS);
     if (!ata_buses[bus_id].is_initialized)               return -1;
     if (!ata_buses[bus_id].drives[drive_number].present) return -1;
 
     spinlock_acquire(&ata_buses[bus_id].bus_lock);
-    char ret = __ata_write(bus_id, drive_number, lba, buf);
+    char ret = __ata_write(bus_id, drive_number, lba, count, bufs);
     spinlock_release(&ata_buses[bus_id].bus_lock);
     return ret;
-}
\ No newline at end of file
+}
+
+char ata_write(unsigned char bus_id, unsigned char drive_number, uint64_t lba, const void * buf) {
+    return ata_write_sectors(bus_id, drive_number, lba, 1, &buf);
+}
@@ -0,0 +1,321 @@
+// generic block request layer, see block/blk.h
+// submitters queue requests and sleep, the driver thread of the queue picks the next run C-LOOK style
+// (the nearest one at or after where the last one ended, wrapping around), unless a request waited past its expiry
+// adjacent requests in the same direction get merged into runs on insertion, so that the driver can do them in one command
+// a request overlapping a queued write (or a write overlapping anything queued) waits for it first, so that reordering
+// can't change what ends up on the disk or what gets read
+
+#include "block/blk.h"
+#include "kernel.h"
+#include <errno.h>
+#include <string.h>
+
+struct blk_device {
+    char used;
+    dev_t dev;
+    struct blk_queue * q; // NULL for partitions
+    dev_t drive; // partitions only
+    uint64_t start, count; // in sectors of the drive
+    unsigned sector_size;
+};
+
+static struct blk_device blk_devices[BLK_DEVICES_MAX] = {0};
+static rw_spinlock_t blk_devices_lock = {0};
+
+// acquire blk_devices_lock before this
+static struct blk_device * blk_find(dev_t dev) {
+    for (int i = 0; i < BLK_DEVICES_MAX; i++) {
+        if (blk_devices[i].used && blk_devices[i].dev == dev)
+            return &blk_devices[i];
+    }
+    return NULL;
+}
+
+static long blk_add(struct blk_device bdev) {
+    rw_spinlock_acquire_write(&blk_devices_lock);
+    if (blk_find(bdev.dev) != NULL) {
+        rw_spinlock_release_write(&blk_devices_lock);
+        return -EEXIST;
+    }
+    if (bdev.q == NULL) {
+        struct blk_device * drive = blk_find(bdev.drive);
+        if (drive == NULL || drive->q == NULL) {
+            rw_spinlock_release_write(&blk_devices_lock);
+            return -ENODEV;
+        }
+        if (bdev.start + bdev.count > drive->count || bdev.start + bdev.count < bdev.start) {
+            rw_spinlock_release_write(&blk_devices_lock);
+            return -EINVAL;
+        }
+        bdev.sector_size = drive->sector_size;
+    }
+    for (int i = 0; i < BLK_DEVICES_MAX; i++) {
+        if (!blk_devices[i].used) {
+            blk_devices[i] = bdev;
+            blk_devices[i].used = 1;
+            rw_spinlock_release_write(&blk_devices_lock);
+            return 0;
+        }
+    }
+    rw_spinlock_release_write(&blk_devices_lock);
+    return -ENOSPC;
+}
+
+long blk_register(dev_t dev, struct blk_queue * q, unsigned sector_size, uint64_t sector_count) {
+    kassert(q);
+    if (sector_size == 0) return -EINVAL;
+    return blk_add((struct blk_device) {.dev = dev, .q = q, .count = sector_count, .sector_size = sector_size});
+}
+
+long blk_register_partition(dev_t part, dev_t drive, uint64_t start, uint64_t count) {
+    return blk_add((struct blk_device) {.dev = part, .drive = drive, .start = start, .count = count});
+}
+
+void blk_unregister(dev_t dev) {
+    rw_spinlock_acquire_write(&blk_devices_lock);
+    struct blk_device * bdev = blk_find(dev);
+    if (bdev != NULL)
+        bdev->used = 0;
+    rw_spinlock_release_write(&blk_devices_lock);
+}
+
+unsigned blk_sector_size(dev_t dev) {
+    rw_spinlock_acquire_read(&blk_devices_lock);
+    struct blk_device * bdev = blk_find(dev);
+    unsigned ret = bdev ? bdev->sector_size : 0;
+    rw_spinlock_release_read(&blk_devices_lock);
+    return ret;
+}
+
+static char blk_overlaps(const struct blk_request * run, const struct blk_request * req) {
+    if (run->dev != req->dev) return 0;
+    if (!run->write && !req->write) return 0;
+    return req->lba < run->lba + run->merged_count && run->lba < req->lba + req->count;
+}
+
+// acquire q->lock before this
+static char blk_conflicts(const struct blk_queue * q, const struct blk_request * req) {
+    if (q->active != NULL && blk_overlaps(q->active, req))
+        return 1;
+    for (const struct blk_request * run = q->head; run != NULL; run = run->next) {
+        if (blk_overlaps(run, req))
+            return 1;
+    }
+    return 0;
+}
+
+static char blk_can_merge(const struct blk_queue * q, const struct blk_request * run, const struct blk_request * req) {
+    return run->dev == req->dev && run->write == req->write &&
+        run->merged_count + req->merged_count <= q->max_sectors;
+}
+
+// appends the run next to the end of run
+static void blk_merge(struct blk_request * run, struct blk_request * next) {
+    run->merged_tail->merged = next;
+    run->merged_tail = next->merged_tail;
+    run->merged_count += next->merged_count;
+    if (next->expires < run->expires)
+        run->expires = next->expires;
+}
+
+// acquire q->lock before this
+static void blk_insert(struct blk_queue * q, struct blk_request * req) {
+    struct blk_request * prev = NULL, * run = q->head;
+    while (run != NULL && (run->dev < req->dev || (run->dev == req->dev && run->lba <= req->lba))) {
+        prev = run;
+        run = run->next;
+    }
+
+    if (prev != NULL && blk_can_merge(q, prev, req) && prev->lba + prev->merged_count == req->lba) {
+        blk_merge(prev, req);
+        // the gap between the two runs might be closed now
+        if (run != NULL && blk_can_merge(q, prev, run) && prev->lba + prev->merged_count == run->lba) {
+            blk_merge(prev, run);
+            prev->next = run->next;
+        }
+        return;
+    }
+
+    if (run != NULL && blk_can_merge(q, req, run) && req->lba + req->count == run->lba) {
+        blk_merge(req, run);
+        run = run->next;
+    }
+    req->next = run;
+    if (prev != NULL) prev->next = req;
+    else q->head = req;
+}
+
+// acquire q->lock before this
+static struct blk_request * blk_pick(struct blk_queue * q) {
+    const time_t now = uptime_clicks * RTC_TIME_RESOLUTION_USEC;
+
+    struct blk_request * pick = NULL;
+    for (struct blk_request * run = q->head; run != NULL; run = run->next) {
+        if (run->expires <= now && (pick == NULL || run->expires < pick->expires))
+            pick = run;
+    }
+    if (pick != NULL) return pick;
+
+    for (struct blk_request * run = q->head; run != NULL; run = run->next) {
+        if (run->dev > q->pos_dev || (run->dev == q->pos_dev && run->lba >= q->pos_lba))
+            return run;
+    }
+    return q->head;
+}
+
+static void blk_complete(struct blk_queue * q, struct blk_request * run, long ret) {
+    if (ret < 0)
+        kprintf("blk: %s: %s of %u sectors at dev %hx lba %llu failed (%ld)\n", q->name,
+            run->write ? "write" : "read", (unsigned)run->merged_count, run->dev, run->lba, ret);
+
+    // a waiter seeing done before we're through with its request could return and take the request with it
+    asm volatile("cli");
+    spinlock_acquire(&q->lock);
+    if (q->active == run)
+        q->active = NULL;
+    spinlock_release(&q->lock);
+
+    struct blk_request * async = NULL;
+    for (struct blk_request * req = run, * next; req != NULL; req = next) {
+        next = req->merged;
+        req->result = ret < 0 ? ret : (long)req->count;
+        if (req->end_io != NULL) {
+            req->merged = async;
+            async = req;
+            continue;
+        }
+        req->done = 1;
+        thread_queue_unblock_all_nonreentrant(&req->wait);
+    }
+    thread_queue_unblock_all_nonreentrant(&q->done_queue);
+    asm volatile("sti");
+
+    while (async != NULL) {
+        struct blk_request * next = async->merged;
+        async->done = 1;
+        async->end_io(async);
+        async = next;
+    }
+}
+
+static __attribute__((noreturn)) void blk_worker(void * arg) {
+    struct blk_queue * q = arg;
+    while (1) {
+        asm volatile("cli"); // a request queued between the check and the queue add would be missed otherwise
+        if (q->head == NULL) {
+            thread_queue_add(&q->worker_queue, kernel_task, current_thread, SCHED_UNINTERR_SLEEP);
+            asm volatile("sti");
+            continue;
+        }
+
+        spinlock_acquire(&q->lock);
+        struct blk_request * run = blk_pick(q);
+        struct blk_request ** link = &q->head;
+        while (*link != run)
+            link = &(*link)->next;
+        *link = run->next;
+        run->next = NULL;
+
+        q->active = run;
+        q->pos_dev = run->dev;
+        q->pos_lba = run->lba + run->merged_count;
+        spinlock_release(&q->lock);
+        asm volatile("sti");
+
+        blk_complete(q, run, q->do_request(q, run));
+    }
+}
+
+void blk_queue_init(struct blk_queue * q, const char * name, blk_do_request_t do_request, void * private, size_t max_sectors, char sync) {
+    kassert(max_sectors);
+    memset(q, 0, sizeof(struct blk_queue));
+    q->name = name;
+    q->do_request = do_request;
+    q->private = private;
+    q->max_sectors = max_sectors;
+    q->sync = sync;
+    if (sync) return;
+
+    spinlock_acquire(&scheduler_lock);
+    kassert(kernel_create_thread(kernel_task, current_thread, blk_worker, q, 0));
+    spinlock_release(&scheduler_lock);
+}
+
+long blk_submit(struct blk_request * req) {
+    kassert(req);
+    if (req->count == 0) return -EINVAL;
+
+    rw_spinlock_acquire_read(&blk_devices_lock);
+    struct blk_device * bdev = blk_find(req->dev);
+    if (bdev != NULL && bdev->q == NULL) {
+        if (req->lba + req->count > bdev->count || req->lba + req->count < req->lba) {
+            rw_spinlock_release_read(&blk_devices_lock);
+            return -EINVAL;
+        }
+        req->lba += bdev->start;
+        req->dev = bdev->drive;
+        bdev = blk_find(bdev->drive);
+    }
+    if (bdev == NULL || bdev->q == NULL) {
+        rw_spinlock_release_read(&blk_devices_lock);
+        return -ENODEV;
+    }
+    struct blk_queue * q = bdev->q;
+    if (req->lba + req->count > bdev->count || req->lba + req->count < req->lba || req->count > q->max_sectors) {
+        rw_spinlock_release_read(&blk_devices_lock);
+        return -EINVAL;
+    }
+    rw_spinlock_release_read(&blk_devices_lock);
+
+    req->done = 0;
+    req->result = 0;
+    req->wait = (thread_queue_t){0};
+    req->next = req->merged = NULL;
+    req->merged_tail = req;
+    req->merged_count = req->count;
+    req->expires = uptime_clicks * RTC_TIME_RESOLUTION_USEC +
+        (time_t)(req->write ? BLK_EXPIRE_WRITE_MSEC : BLK_EXPIRE_READ_MSEC) * 1000;
+
+    if (q->sync) {
+        blk_complete(q, req, q->do_request(q, req));
+        return 0;
+    }
+
+    asm volatile("cli");
+    spinlock_acquire(&q->lock);
+    while (blk_conflicts(q, req)) {
+        spinlock_release(&q->lock); // interrupts stay off, so the completion can't slip in before we're queued
+        thread_queue_add(&q->done_queue, current_process, current_thread, SCHED_UNINTERR_SLEEP);
+        asm volatile("cli");
+        spinlock_acquire(&q->lock);
+    }
+    blk_insert(q, req);
+    spinlock_release(&q->lock);
+    // no reschedule, so that a batch gets queued up (and merged) before the driver thread starts on it
+    thread_queue_unblock_nonreentrant(&q->worker_queue);
+    asm volatile("sti");
+    return 0;
+}
+
+long blk_wait(struct blk_request * req) {
+    while (1) {
+        asm volatile("cli");
+        if (req->done) break;
+        thread_queue_add(&req->wait, current_process, current_thread, SCHED_UNINTERR_SLEEP);
+    }
+    asm volatile("sti");
+    return req->result;
+}
+
+long blk_rw(dev_t dev, uint64_t lba, size_t count, void * buf, char write) {
+    struct blk_request req = {
+        .dev = dev,
+        .lba = lba,
+        .count = count,
+        .buf = buf,
+        .write = write,
+    };
+    long ret = blk_submit(&req);
+    if (ret < 0) return ret;
+    return blk_wait(&req);
+}
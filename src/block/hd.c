@@ -3,6 +3,7 @@
 #include "fs/fs.h"
 #include "kernel.h"
 #include "block/ata/ata.h"
+#include "block/blk.h"
 #include "block/partitions.h"
 #include <UnstableOS/devs.h>
 #include "dev_ops.h"
@@ -10,8 +11,10 @@
 
 #include <string.h>
 
-#define ATA_BUSID(dev)   (MAJOR((dev)) - DEV_MAJ_BLOCK0)
-#define ATA_DRIVEID(dev) (MINOR((dev)) / DRIVE_PART_LIMIT)
+// 8 drives per major, two per bus
+#define ATA_DRIVE_INDEX(dev) ((MAJOR((dev)) - DEV_MAJ_BLOCK0) * 8 + MINOR((dev)) / DRIVE_PART_LIMIT)
+#define ATA_BUSID(dev)   (ATA_DRIVE_INDEX(dev) / 2)
+#define ATA_DRIVEID(dev) (ATA_DRIVE_INDEX(dev) % 2)
 static struct ata_drive * hd_get_ata_drive(dev_t dev) {
     if (MAJOR(dev) > DEV_MAJ_BLOCK3 || MAJOR(dev) < DEV_MAJ_BLOCK0) // not a drive
         return NULL;
@@ -36,17 +39,33 @@ struct hd_sector_cache {
     dev_t dev;
     char is_dirty;
     rw_spinlock_t dirty_lock; // acquire "read" to set to 1, "write" to 0 (in sync)
+    time_t dirtied; // usec of uptime when is_dirty last went to 1
     uint64_t lba;
     void * data;
     struct hd_sector_cache *next;
 };
 
-// this basically results in 256*5*512 = 655K of cache, assuming 512 byte sectors
+// this basically results in 256*6*512 = 786K of cache, assuming 512 byte sectors
 #define HD_SECTOR_BUCKETS 256
 #define HD_SECTOR_LL_DEPTH 5 // length of a linked list before removing the oldest element
+#define HD_CACHE_SECTORS (HD_SECTOR_BUCKETS * (HD_SECTOR_LL_DEPTH + 1))
+
+// the flusher writes back sectors dirty for longer than the expiry, and everything once over the background ratio
+// writers get throttled only once the dirty ratio is reached
+#define HD_DIRTY_EXPIRE_MSEC 3000
+#define HD_WRITEBACK_INTERVAL_MSEC 500
+#define HD_DIRTY_BACKGROUND_RATIO 10 // % of the cache
+#define HD_DIRTY_RATIO 30
+#define HD_WRITEBACK_BATCH 64 // sectors per batch, sorted by lba
 
 struct hd_sector_cache hd_sector_cache[HD_SECTOR_BUCKETS];
 
+static volatile size_t hd_dirty_sectors = 0;
+
+static thread_queue_t hd_flusher_queue = {0};
+static volatile char hd_flusher_kicked = 0;
+static thread_queue_t hd_throttle_queue = {0}; // writers waiting for the dirty count to drop
+
 // the hashtable implementation from devs.c
 static unsigned int hd_get_key(dev_t dev, uint64_t lba) {
     uint64_t a = dev * 1103515245;
@@ -56,6 +75,26 @@ static unsigned int hd_get_key(dev_t dev, uint64_t lba) {
     return c % HD_SECTOR_BUCKETS;
 }
 
+static time_t hd_now() {
+    return uptime_clicks * RTC_TIME_RESOLUTION_USEC;
+}
+
+// call with the entry's dirty lock held for reading, or the cache lock for writing
+static void hd_mark_dirty(struct hd_sector_cache * entry) {
+    if (__atomic_exchange_n(&entry->is_dirty, 1, __ATOMIC_ACQ_REL))
+        return;
+    entry->dirtied = hd_now();
+    __atomic_add_fetch(&hd_dirty_sectors, 1, __ATOMIC_RELAXED);
+}
+
+// call with the entry's dirty lock held for writing, or the cache lock for writing
+static void hd_mark_clean(struct hd_sector_cache * entry) {
+    if (!entry->is_dirty)
+        return;
+    entry->is_dirty = 0;
+    __atomic_sub_fetch(&hd_dirty_sectors, 1, __ATOMIC_RELAXED);
+}
+
 // assumed to have read lock
 static char hd_cache_flush_entry(struct hd_sector_cache * entry) {
     rw_spinlock_acquire_write(&entry->dirty_lock);
@@ -63,35 +102,324 @@ static char hd_cache_flush_entry(struct hd_sector_cache * entry) {
         rw_spinlock_release_write(&entry->dirty_lock);
         return 1;
     }
-    char ret = ata_write(ATA_BUSID(entry->dev), ATA_DRIVEID(entry->dev),
-        entry->lba,
-        entry->data
-    );
-    entry->is_dirty = 0;
+    long ret = blk_rw(entry->dev, entry->lba, 1, entry->data, 1);
+    hd_mark_clean(entry);
     rw_spinlock_release_write(&entry->dirty_lock);
+    return ret > 0;
+}
+
+// a write back queued from the cache (a batch or an eviction), listed until it completes
+// so that sync can wait for the ones in its range, including the ones someone else queued
+struct hd_writeback {
+    struct blk_request req;
+    dev_t dev; // of the cache entry, blk_submit remaps req.dev to the drive
+    uint64_t lba;
+    unsigned long seq;
+    unsigned int refs; // the completion's, plus the submitter's and every waiter's
+    volatile char done;
+    thread_queue_t wait; // blk_complete() doesn't wake the waiters of requests with an end_io
+    struct hd_writeback * prev, * next;
+};
+
+static spinlock_t hd_writeback_lock = {0}; // the list and refs, the completion takes it from the driver thread
+static struct hd_writeback * hd_writeback_list = NULL;
+static unsigned long hd_writeback_seq = 0;
+
+static void hd_writeback_put(struct hd_writeback * wb) {
+    spinlock_acquire(&hd_writeback_lock);
+    const char last = --wb->refs == 0;
+    spinlock_release(&hd_writeback_lock);
+    if (!last) return;
+    kfree(wb->req.buf);
+    kfree(wb);
+}
+
+// drops the completion's reference, set req.result before this
+static void hd_writeback_finish(struct hd_writeback * wb) {
+    spinlock_acquire(&hd_writeback_lock);
+    if (wb->prev) wb->prev->next = wb->next;
+    else hd_writeback_list = wb->next;
+    if (wb->next) wb->next->prev = wb->prev;
+    wb->done = 1;
+    thread_queue_unblock_all_nonreentrant(&wb->wait);
+    spinlock_release(&hd_writeback_lock);
+    hd_writeback_put(wb);
+}
+
+static void hd_writeback_end(struct blk_request * req) {
+    struct hd_writeback * wb = (struct hd_writeback *)req;
+    if (req->result < 0)
+        kprintf("Cache layer: failed the write back of dev %hx lba %llu\n", wb->dev, wb->lba);
+    hd_writeback_finish(wb);
+}
+
+static long hd_writeback_wait_one(struct hd_writeback * wb) {
+    while (1) {
+        asm volatile("cli");
+        if (wb->done) break;
+        thread_queue_add(&wb->wait, current_process, current_thread, SCHED_UNINTERR_SLEEP);
+    }
+    asm volatile("sti");
+    return wb->req.result;
+}
+
+// queues a write of data to the cache's dev and lba without waiting for it, takes ownership of data on success
+// fails if it couldn't be queued, or when it already completed unsuccessfully (synchronous queues)
+static long hd_writeback_submit(dev_t dev, uint64_t lba, void * data) {
+    struct hd_writeback * wb = kalloc(sizeof(struct hd_writeback));
+    if (wb == NULL) return -ENOMEM;
+    *wb = (struct hd_writeback) {
+        .req = {
+            .dev = dev,
+            .lba = lba,
+            .count = 1,
+            .buf = data,
+            .write = 1,
+            .end_io = hd_writeback_end,
+        },
+        .dev = dev,
+        .lba = lba,
+        .refs = 2,
+    };
+
+    // listed before the submit, a synchronous queue completes it right away
+    spinlock_acquire(&hd_writeback_lock);
+    wb->seq = hd_writeback_seq++;
+    wb->next = hd_writeback_list;
+    if (hd_writeback_list) hd_writeback_list->prev = wb;
+    hd_writeback_list = wb;
+    spinlock_release(&hd_writeback_lock);
+
+    long ret = blk_submit(&wb->req);
+    if (ret < 0) {
+        wb->req.result = ret;
+        hd_writeback_finish(wb);
+    } else if (wb->done && wb->req.result < 0)
+        ret = wb->req.result;
+    if (ret < 0)
+        wb->req.buf = NULL; // the caller's again
+    hd_writeback_put(wb);
     return ret;
 }
-void hd_cache_flush() {
+
+// hands an evicted dirty sector to the disk without waiting for it, takes ownership of data
+static void hd_writeback_async(dev_t dev, uint64_t lba, void * data) {
+    if (hd_writeback_submit(dev, lba, data) >= 0)
+        return;
+    if (blk_rw(dev, lba, 1, data, 1) < 0)
+        kprintf("Cache layer: lost the write back of dev %hx lba %llu\n", dev, lba);
+    kfree(data);
+}
+
+// sectors [first, end) of one drive
+struct hd_sync_range {
+    dev_t dev;
+    uint64_t first, end;
+};
+
+static char hd_in_range(dev_t dev, uint64_t lba, const struct hd_sync_range * range) {
+    return range == NULL || (dev == range->dev && lba >= range->first && lba < range->end);
+}
+
+// waits for the write backs in range (everything if NULL) queued before seq, returns -EIO if any of them got lost
+static long hd_writeback_wait(const struct hd_sync_range * range, unsigned long seq) {
+    long ret = 0;
+    while (1) {
+        spinlock_acquire(&hd_writeback_lock);
+        struct hd_writeback * wb = hd_writeback_list;
+        while (wb != NULL && (wb->seq >= seq || !hd_in_range(wb->dev, wb->lba, range)))
+            wb = wb->next;
+        if (wb != NULL)
+            wb->refs++;
+        spinlock_release(&hd_writeback_lock);
+        if (wb == NULL) break;
+
+        // it's off the list once done, so the next pass doesn't find it again
+        if (hd_writeback_wait_one(wb) < 0)
+            ret = -EIO;
+        hd_writeback_put(wb);
+    }
+    return ret;
+}
+
+// queues writes of up to HD_WRITEBACK_BATCH dirty sectors (only the expired ones unless all, only the ones in range unless NULL)
+// from copies, so that the disk I/O happens without holding the cache
+// a sector is marked clean only once its write is queued, from then on a read of it waits for the write in the request queue
+// the held cache lock keeps it from being evicted (and read back in from the disk) before that
+// without memory for the copies, the sector gets written right away, failures of that or of queueing are counted in failed
+static size_t hd_writeback_collect(char all, const struct hd_sync_range * range, size_t * failed) {
+    const time_t now = hd_now();
+    size_t n = 0;
+
     rw_spinlock_acquire_read(&hd_cache_lock);
-    for (int i = 0; i < HD_SECTOR_BUCKETS; i++) {
-        for (struct hd_sector_cache * entry = &hd_sector_cache[i]; entry != NULL; entry = entry->next) {
-            hd_cache_flush_entry(entry);
+    for (int i = 0; i < HD_SECTOR_BUCKETS && n < HD_WRITEBACK_BATCH; i++) {
+        for (struct hd_sector_cache * entry = &hd_sector_cache[i]; entry != NULL && n < HD_WRITEBACK_BATCH; entry = entry->next) {
+            if (entry->data == NULL || !entry->is_dirty) continue;
+            if (!hd_in_range(entry->dev, entry->lba, range)) continue;
+            if (!all && now - entry->dirtied < (time_t)HD_DIRTY_EXPIRE_MSEC * 1000) continue;
+
+            const struct ata_drive * drive = hd_get_ata_drive(entry->dev);
+            kassert(drive);
+            void * copy = kalloc(drive->sector_size);
+            if (copy == NULL) {
+                kprintf("Out of memory on allocating for block cache write back!\n");
+                if (!hd_cache_flush_entry(entry) && failed)
+                    (*failed)++;
+                continue;
+            }
+
+            rw_spinlock_acquire_write(&entry->dirty_lock);
+            if (!entry->is_dirty) {
+                rw_spinlock_release_write(&entry->dirty_lock);
+                kfree(copy);
+                continue;
+            }
+            memcpy(copy, entry->data, drive->sector_size);
+            // the request queue sorts and merges the batch, the driver thread doesn't start on it until we sleep
+            long ret = hd_writeback_submit(entry->dev, entry->lba, copy);
+            if (ret == -ENOMEM) {
+                rw_spinlock_release_write(&entry->dirty_lock);
+                kfree(copy);
+                if (!hd_cache_flush_entry(entry) && failed)
+                    (*failed)++;
+                continue;
+            }
+            if (ret < 0) { // stays dirty for the next round
+                rw_spinlock_release_write(&entry->dirty_lock);
+                kfree(copy);
+                if (failed)
+                    (*failed)++;
+                continue;
+            }
+            hd_mark_clean(entry);
+            rw_spinlock_release_write(&entry->dirty_lock);
+            n++;
         }
     }
     rw_spinlock_release_read(&hd_cache_lock);
+    return n;
+}
+
+// all = everything dirty, otherwise only the expired sectors and whatever is over the background ratio
+static void hd_writeback(char all) {
+    while (1) {
+        const char over = hd_dirty_sectors > HD_CACHE_SECTORS * HD_DIRTY_BACKGROUND_RATIO / 100;
+        const size_t n = hd_writeback_collect(all || over, NULL, NULL);
+        if (n == 0) break;
+        hd_writeback_wait(NULL, __atomic_load_n(&hd_writeback_seq, __ATOMIC_ACQUIRE));
+        thread_queue_unblock_all(&hd_throttle_queue);
+    }
+}
+
+static __attribute__((noreturn)) void hd_flusher(void * arg) {
+    while (1) {
+        hd_writeback(0);
+
+        asm volatile("cli"); // a kick between the check and the queue add would be missed otherwise
+        if (!hd_flusher_kicked)
+            thread_queue_add_with_timeout(&hd_flusher_queue, kernel_task, current_thread,
+                (struct timespec){.tv_nsec = HD_WRITEBACK_INTERVAL_MSEC * 1000000});
+        hd_flusher_kicked = 0;
+        asm volatile("sti");
+    }
+}
+
+// waits for the flusher while there's too much dirty data, for writers about to dirty more
+static void hd_throttle_dirty() {
+    const size_t limit = HD_CACHE_SECTORS * HD_DIRTY_RATIO / 100;
+    while (1) {
+        asm volatile("cli");
+        if (hd_dirty_sectors < limit) break;
+        hd_flusher_kicked = 1;
+        thread_queue_unblock_nonreentrant(&hd_flusher_queue);
+        thread_queue_add(&hd_throttle_queue, current_process, current_thread, SCHED_UNINTERR_SLEEP);
+    }
+    asm volatile("sti");
+}
+
+void hd_cache_flush() {
+    hd_writeback(1);
+    // evicted sectors still on the way to the disk
+    hd_writeback_wait(NULL, __atomic_load_n(&hd_writeback_seq, __ATOMIC_ACQUIRE));
+}
+
+// fsync() of a part of the drive, only the dirty sectors in the range get written
+// the writes of the range already queued by the flusher or evictions are waited for as well, their failures count too
+long hd_sync_range_ata(file_descriptor_t *file, off_t offset, off_t len) {
+    kassert(file);
+    kassert(S_ISBLK(file->inode->mode));
+
+    struct ata_drive * drive = hd_get_ata_drive(file->inode->device);
+    if (drive == NULL) return -ENODEV;
+
+    const off_t max_off = drive->sector_count * drive->sector_size;
+    if (len == 0 || offset >= max_off) return 0;
+    if (len > max_off - offset)
+        len = max_off - offset;
+
+    const struct hd_sync_range range = {
+        .dev = file->inode->device,
+        .first = offset / drive->sector_size,
+        .end = (offset + len + drive->sector_size - 1) / drive->sector_size,
+    };
+
+    long ret = 0;
+    size_t failed = 0;
+    while (hd_writeback_collect(1, &range, &failed) > 0) {
+        if (hd_writeback_wait(&range, __atomic_load_n(&hd_writeback_seq, __ATOMIC_ACQUIRE)) < 0)
+            ret = -EIO;
+        thread_queue_unblock_all(&hd_throttle_queue);
+    }
+    if (hd_writeback_wait(&range, __atomic_load_n(&hd_writeback_seq, __ATOMIC_ACQUIRE)) < 0 || failed)
+        ret = -EIO;
+    return ret;
+}
+
+static void hd_cache_fill_entry(struct hd_sector_cache * entry, dev_t dev, uint64_t lba, void * data, char dirty) {
+    entry->dev  = dev;
+    entry->lba  = lba;
+    entry->data = data;
+    entry->is_dirty = 0;
+    entry->dirty_lock = (rw_spinlock_t){0}; // to be safe
+    if (dirty)
+        hd_mark_dirty(entry);
+}
+
+// acquire write lock before this
+// drops the oldest clean entry of the list, only if they're all dirty the oldest one gets written back in the background
+// keep is the entry just added, which stays
+static void hd_cache_evict(struct hd_sector_cache * head, struct hd_sector_cache * keep) {
+    struct hd_sector_cache * prev = NULL, * victim = head;
+    for (; victim != keep && victim->is_dirty; prev = victim, victim = victim->next);
+    if (victim == keep) {
+        prev = NULL;
+        victim = head;
+        // whoever caused the eviction doesn't wait for someone else's write
+        hd_writeback_async(victim->dev, victim->lba, victim->data);
+        hd_mark_clean(victim);
+    } else {
+        kfree(victim->data);
+    }
+
+    if (prev != NULL) {
+        prev->next = victim->next;
+        kfree(victim);
+        return;
+    }
+    // the list head lives in the table itself
+    struct hd_sector_cache * next = head->next;
+    memcpy(head, next, sizeof(struct hd_sector_cache));
+    kfree(next);
 }
 
-static void hd_cache_set(dev_t dev, uint64_t lba, void * data, char dirty) {
+// fill = data was just read from the disk, so an entry that appeared in the meantime is newer and wins
+static void hd_cache_set(dev_t dev, uint64_t lba, void * data, char dirty, char fill) {
     kassert(data);
     struct hd_sector_cache * hash_entry = &hd_sector_cache[hd_get_key(dev, lba)];
 
     rw_spinlock_acquire_write(&hd_cache_lock);
     if (hash_entry->data == NULL) {
-        hash_entry->dev  = dev;
-        hash_entry->lba  = lba;
-        hash_entry->data = data;
-        hash_entry->is_dirty = dirty;
-        hash_entry->dirty_lock = (rw_spinlock_t){0}; // to be safe
+        hd_cache_fill_entry(hash_entry, dev, lba, data, dirty);
         rw_spinlock_release_write(&hd_cache_lock);
         return;
     }
@@ -100,40 +428,28 @@ static void hd_cache_set(dev_t dev, uint64_t lba, void * data, char dirty) {
     unsigned int ll_len = 0;
     for (; hash_entry != NULL; last = hash_entry, hash_entry = hash_entry->next, ll_len ++) {
         if (hash_entry->dev == dev && hash_entry->lba == lba) { // found the entry, current behavior is to overwrite
+            if (fill) {
+                kfree(data);
+                rw_spinlock_release_write(&hd_cache_lock);
+                return;
+            }
+            // the new data covers the whole sector, so there's no point in writing back the old one
             // this assumes nothing can hold the dirty lock if we hold write lock for cache
-            if (hash_entry->is_dirty)
-                hd_cache_flush_entry(hash_entry);
-
             kfree(hash_entry->data);
+            hd_mark_clean(hash_entry);
 
-            hash_entry->data = data;
-            hash_entry->is_dirty = dirty;
-            hash_entry->dirty_lock = (rw_spinlock_t){0}; // to be safe
+            hd_cache_fill_entry(hash_entry, dev, lba, data, dirty);
             rw_spinlock_release_write(&hd_cache_lock);
             return;
         }
     }
     last->next = kalloc(sizeof(struct hd_sector_cache));
     kassert(last->next);
-    last->next->dev  = dev;
-    last->next->lba  = lba;
-    last->next->data = data;
-    last->next->is_dirty = dirty;
-    last->next->dirty_lock = (rw_spinlock_t){0};
+    hd_cache_fill_entry(last->next, dev, lba, data, dirty);
     last->next->next = NULL;
     if (ll_len > HD_SECTOR_LL_DEPTH) {
         //kprintf("Cache layer: removing cache entry for dev %hx lba %llu\n", dev, lba);
-        if (hd_sector_cache[hd_get_key(dev, lba)].is_dirty)
-            hd_cache_flush_entry(&hd_sector_cache[hd_get_key(dev, lba)]);
-
-        kfree(hd_sector_cache[hd_get_key(dev, lba)].data);
-
-        struct hd_sector_cache * next = hd_sector_cache[hd_get_key(dev, lba)].next;
-
-        memcpy(&hd_sector_cache[hd_get_key(dev, lba)],
-            hd_sector_cache[hd_get_key(dev, lba)].next,
-            sizeof(struct hd_sector_cache));
-        kfree(next);
+        hd_cache_evict(&hd_sector_cache[hd_get_key(dev, lba)], last->next);
     }
     rw_spinlock_release_write(&hd_cache_lock);
 }
@@ -157,49 +473,81 @@ static struct hd_sector_cache * hd_cache_get(dev_t dev, uint64_t lba) {
     return NULL;
 }
 
-static long hd_read_and_cache_ata(const struct ata_drive * drive, dev_t device, uint64_t lba) {
+#define HD_READ_BATCH 32 // sectors read ahead on a cache miss, the request queue merges them into one command
+
+// reads up to count sectors from lba on into the cache, stopping at the first one that's already cached
+static long hd_read_and_cache_ata(const struct ata_drive * drive, dev_t device, uint64_t lba, size_t count) {
     //kprintf("Cache layer: Fetching new block lba %llu\n", lba);
-    void * block = kalloc(drive->sector_size);
-    if (!block) {
+    if (count > HD_READ_BATCH)
+        count = HD_READ_BATCH;
+    if (count > drive->sector_count - lba)
+        count = drive->sector_count - lba;
+
+    struct blk_request * reqs = kalloc(count * sizeof(struct blk_request));
+    if (!reqs) {
         kprintf("Out of memory on allocating for block cache!\n");
         return -ENOMEM;
     }
 
-    char ret = ata_read(
-        ATA_BUSID(device), ATA_DRIVEID(device),
-        lba,
-        block
-    );
-    if (ret <= 0) {
-        kfree(block);
-        return -EIO;
+    size_t submitted = 0;
+    for (; submitted < count; submitted++) {
+        if (submitted != 0) {
+            rw_spinlock_acquire_read(&hd_cache_lock);
+            char cached = hd_cache_get(device, lba + submitted) != NULL;
+            rw_spinlock_release_read(&hd_cache_lock);
+            if (cached) break;
+        }
+
+        void * block = kalloc(drive->sector_size);
+        if (!block) {
+            kprintf("Out of memory on allocating for block cache!\n");
+            break;
+        }
+        reqs[submitted] = (struct blk_request) {
+            .dev = device,
+            .lba = lba + submitted,
+            .count = 1,
+            .buf = block,
+        };
+        if (blk_submit(&reqs[submitted]) < 0) {
+            kfree(block);
+            break;
+        }
     }
-    hd_cache_set(device, lba, block, 0);
 
-    return 0;
+    long ret = submitted ? 0 : -EIO;
+    for (size_t i = 0; i < submitted; i++) {
+        if (blk_wait(&reqs[i]) <= 0) {
+            kfree(reqs[i].buf);
+            if (i == 0) ret = -EIO;
+            continue;
+        }
+        hd_cache_set(device, lba + i, reqs[i].buf, 0, 1);
+    }
+    kfree(reqs);
+    return ret;
 }
 
-ssize_t hd_read_ata(file_descriptor_t *file, void *buf, size_t count, off_t offset) {
+// one pass over the sectors for the whole vector, segments don't have to line up with sectors
+ssize_t hd_readv_ata(file_descriptor_t *file, const struct iovec * iov, int iovcnt, off_t offset) {
     kassert(file);
     kassert(S_ISBLK(file->inode->mode));
 
-#ifdef E2BIG_ON_2G
-    if (count > SSIZE_MAX) return -E2BIG;
-#else
-    if (count > SSIZE_MAX) count = SSIZE_MAX;
-#endif
-    if (count == 0) return 0;
+    ssize_t total = iov_length(iov, iovcnt);
+    if (total <= 0) return total;
+    const size_t count = total;
 
     struct ata_drive * drive = hd_get_ata_drive(file->inode->device);
     if (drive == NULL) return -ENODEV;
 
+    struct iov_iter it = {.iov = iov, .iovcnt = iovcnt};
     size_t read = 0;
 
-    for (uint64_t lba = offset / drive->sector_size;
-        lba < (offset + count + drive->sector_size - 1) / drive->sector_size &&
-            lba < drive->sector_count;
-        lba++
-    ) {
+    while (read < count) {
+        const uint64_t lba = (offset + read) / drive->sector_size;
+        if (lba >= drive->sector_count)
+            break;
+
         lookup_again:
         if (check_eintr()) {
             if (read == 0)
@@ -212,35 +560,22 @@ ssize_t hd_read_ata(file_descriptor_t *file, void *buf, size_t count, off_t offs
         if (cached == NULL) {
             rw_spinlock_release_read(&hd_cache_lock);
 
-            long ret = hd_read_and_cache_ata(drive, file->inode->device, lba);
-            if (ret < 0) return ret;
+            const uint64_t last = (offset + count - 1) / drive->sector_size;
+            long ret = hd_read_and_cache_ata(drive, file->inode->device, lba, last - lba + 1);
+            if (ret < 0) return read ? (ssize_t)read : ret;
 
             // a little slower, however this makes the code cleaner, and we don't have to fight locking
             goto lookup_again;
         }
 
+        // only the first and last sectors can be partial
+        const size_t in_sector = (offset + read) % drive->sector_size;
+        size_t chunk = drive->sector_size - in_sector;
+        if (chunk > count - read)
+            chunk = count - read;
 
-        // because of how we do this, this means the first iteration
-        // theoretically +read is not required
-        if ((offset + read) % drive->sector_size) {
-            if (drive->sector_size - (offset + read) % drive->sector_size < count - read) {
-                memcpy(buf + read, cached->data + (offset + read) % drive->sector_size,
-                    drive->sector_size - (offset + read) % drive->sector_size);
-                read += drive->sector_size - (offset + read) % drive->sector_size;
-            } else { // also means the last iteration
-                memcpy(buf + read, cached->data + (offset + read) % drive->sector_size,
-                    count - read);
-                read += count;
-            }
-        } else { // block aligned reads
-            if (drive->sector_size > count - read) { // last iteration
-                memcpy(buf + read, cached->data, count - read);
-                read += count - read;
-            } else {
-                memcpy(buf + read, cached->data, drive->sector_size);
-                read += drive->sector_size;
-            }
-        }
+        iov_iter_copy_to(&it, cached->data + in_sector, chunk);
+        read += chunk;
 
         rw_spinlock_release_read(&hd_cache_lock);
     }
@@ -248,33 +583,47 @@ ssize_t hd_read_ata(file_descriptor_t *file, void *buf, size_t count, off_t offs
     return (ssize_t)read;
 }
 
-ssize_t hd_write_ata(file_descriptor_t *file, const void *buf, size_t count, off_t offset) {
-    kassert(file);
-    kassert(S_ISBLK(file->inode->mode));
-
+ssize_t hd_read_ata(file_descriptor_t *file, void *buf, size_t count, off_t offset) {
 #ifdef E2BIG_ON_2G
     if (count > SSIZE_MAX) return -E2BIG;
 #else
     if (count > SSIZE_MAX) count = SSIZE_MAX;
 #endif
-    if (count == 0) return 0;
+    return hd_readv_ata(file, &(struct iovec){.iov_base = buf, .iov_len = count}, 1, offset);
+}
+
+ssize_t hd_writev_ata(file_descriptor_t *file, const struct iovec * iov, int iovcnt, off_t offset) {
+    kassert(file);
+    kassert(S_ISBLK(file->inode->mode));
+
+    ssize_t total = iov_length(iov, iovcnt);
+    if (total <= 0) return total;
+    const size_t count = total;
 
     struct ata_drive * drive = hd_get_ata_drive(file->inode->device);
     if (drive == NULL) return -ENODEV;
 
+    struct iov_iter it = {.iov = iov, .iovcnt = iovcnt};
     size_t written = 0;
 
-    for (uint64_t lba = offset / drive->sector_size;
-        lba < (offset + count + drive->sector_size - 1) / drive->sector_size &&
-            lba < drive->sector_count;
-        lba++
-    ) {
+    while (written < count) {
+        const uint64_t lba = (offset + written) / drive->sector_size;
+        if (lba >= drive->sector_count)
+            break;
+
         lookup_again:
         if (check_eintr()) {
             if (written == 0)
                 return -EINTR;
             return (ssize_t)written;
         }
+        if (!(file->flags & (O_SYNC | O_DSYNC)))
+            hd_throttle_dirty();
+
+        const size_t in_sector = (offset + written) % drive->sector_size;
+        size_t chunk = drive->sector_size - in_sector;
+        if (chunk > count - written)
+            chunk = count - written;
 
         rw_spinlock_acquire_read(&hd_cache_lock);
         struct hd_sector_cache * cached = hd_cache_get(file->inode->device, lba);
@@ -282,72 +631,44 @@ ssize_t hd_write_ata(file_descriptor_t *file, const void *buf, size_t count, off
             rw_spinlock_release_read(&hd_cache_lock);
 
             // aligned write of the entire block
-            if ((offset + written) % drive->sector_size == 0 &&
-                count - written >= drive->sector_size
-            ) {
+            if (in_sector == 0 && chunk == drive->sector_size) {
                 void * block = kalloc(drive->sector_size);
                 if (!block) {
                     kprintf("Out of memory on allocating for block cache!\n");
-                    return -ENOMEM;
+                    return written ? (ssize_t)written : -ENOMEM;
                 }
-                memcpy(block, buf + written, drive->sector_size);
-                if (file->flags & O_SYNC) {
-                    char ret = ata_write(ATA_BUSID(file->inode->device), ATA_DRIVEID(file->inode->device),
-                        lba,
-                        block
-                    );
+                iov_iter_copy_from(&it, block, drive->sector_size);
+                if (file->flags & (O_SYNC | O_DSYNC)) {
+                    long ret = blk_rw(file->inode->device, lba, 1, block, 1);
                     if (ret <= 0) {
                         kfree(block);
-                        return -EIO;
+                        return written ? (ssize_t)written : -EIO;
                     }
-                    hd_cache_set(file->inode->device, lba, block, 0);
+                    hd_cache_set(file->inode->device, lba, block, 0, 0);
                 } else {
-                    hd_cache_set(file->inode->device, lba, block, 1);
+                    hd_cache_set(file->inode->device, lba, block, 1, 0);
                 }
                 written += drive->sector_size;
                 continue;
             }
 
-            long ret = hd_read_and_cache_ata(drive, file->inode->device, lba);
-            if (ret < 0) return ret;
+            long ret = hd_read_and_cache_ata(drive, file->inode->device, lba, 1);
+            if (ret < 0) return written ? (ssize_t)written : ret;
 
             // a little slower, however this makes the code cleaner, and we don't have to fight locking
             goto lookup_again;
         }
 
-
-        // because of how we do this, this means the first iteration
-        // theoretically +read is not required
-        if ((offset + written) % drive->sector_size) {
-            if (drive->sector_size - (offset + written) % drive->sector_size < count - written) {
-                memcpy(cached->data + (offset + written) % drive->sector_size,
-                    buf + written,
-                    drive->sector_size - (offset + written) % drive->sector_size);
-                written += drive->sector_size - (offset + written) % drive->sector_size;
-            } else { // also means the last iteration
-                memcpy(cached->data + (offset + written) % drive->sector_size,
-                    buf + written,
-                    count - written);
-                written += count;
-            }
-        } else { // block aligned write
-            if (drive->sector_size > count - written) { // last iteration
-                memcpy(cached->data, buf + written, count - written);
-                written += count - written;
-            } else {
-                memcpy(cached->data, buf + written, drive->sector_size);
-                written += drive->sector_size;
-            }
-        }
+        iov_iter_copy_from(&it, cached->data + in_sector, chunk);
+        written += chunk;
 
         char ret = 1;
 
-
         rw_spinlock_acquire_read(&cached->dirty_lock);
-        __atomic_store_n(&cached->is_dirty, 1, __ATOMIC_RELEASE);
+        hd_mark_dirty(cached);
         rw_spinlock_release_read(&cached->dirty_lock);
 
-        if (file->flags & O_SYNC)
+        if (file->flags & (O_SYNC | O_DSYNC))
             ret = hd_cache_flush_entry(cached);
 
         rw_spinlock_release_read(&hd_cache_lock);
@@ -358,6 +679,15 @@ ssize_t hd_write_ata(file_descriptor_t *file, const void *buf, size_t count, off
     return (ssize_t)written;
 }
 
+ssize_t hd_write_ata(file_descriptor_t *file, const void *buf, size_t count, off_t offset) {
+#ifdef E2BIG_ON_2G
+    if (count > SSIZE_MAX) return -E2BIG;
+#else
+    if (count > SSIZE_MAX) count = SSIZE_MAX;
+#endif
+    return hd_writev_ata(file, &(struct iovec){.iov_base = (void*)buf, .iov_len = count}, 1, offset);
+}
+
 off_t hd_seek_ata(file_descriptor_t *file, off_t off, int whence) {
     kassert(file);
     kassert(S_ISBLK(file->inode->mode));
@@ -369,7 +699,7 @@ off_t hd_seek_ata(file_descriptor_t *file, off_t off, int whence) {
     return generic_seek(file, off, whence, max_off);
 }
 
-long hd_open_ata(inode_t * inode, unsigned short flags) {
+long hd_open_ata(inode_t * inode, unsigned int flags) {
     kassert(inode);
     kassert(S_ISBLK(inode->mode));
 
@@ -384,29 +714,52 @@ long hd_open_ata(inode_t * inode, unsigned short flags) {
 static const struct dev_operations ata_ops = {
     .pread  = hd_read_ata,
     .pwrite = hd_write_ata,
+    .preadv = hd_readv_ata,
+    .pwritev = hd_writev_ata,
     .seek   = hd_seek_ata,
     .open   = hd_open_ata,
+    .sync_range = hd_sync_range_ata,
 };
 
-void hd_initialize_drive_devices() {
-    if (ata_buses[0].is_initialized) {
-        if (ata_buses[0].drives[0].present) {
-            dev_register_ops(GET_DEV(DEV_MAJ_BLOCK0, DEV_BLOCK_DRIVE0), &ata_ops);
-            mbr_parse_table(GET_DEV(DEV_MAJ_BLOCK0, DEV_BLOCK_DRIVE0));
-        }
-        if (ata_buses[0].drives[1].present) {
-            dev_register_ops(GET_DEV(DEV_MAJ_BLOCK0, DEV_BLOCK_DRIVE1), &ata_ops);
-            mbr_parse_table(GET_DEV(DEV_MAJ_BLOCK0, DEV_BLOCK_DRIVE1));
-        }
+// one queue per channel, the two drives of a channel can't transfer at the same time anyway
+static struct blk_queue hd_queues[2];
+
+static long hd_do_request(struct blk_queue * q, struct blk_request * run) {
+    const unsigned char bus_id = ATA_BUSID(run->dev), drive_number = ATA_DRIVEID(run->dev);
+    const unsigned int sector_size = ata_buses[bus_id].drives[drive_number].sector_size;
+    kassert(run->merged_count <= ATA_MAX_SECTORS);
+
+    void * bufs[ATA_MAX_SECTORS];
+    size_t n = 0;
+    for (struct blk_request * req = run; req != NULL; req = req->merged) {
+        for (size_t i = 0; i < req->count; i++)
+            bufs[n++] = req->buf + i * sector_size;
     }
-    if (ata_buses[1].is_initialized) {
-        if (ata_buses[1].drives[0].present) {
-            dev_register_ops(GET_DEV(DEV_MAJ_BLOCK0, DEV_BLOCK_DRIVE2), &ata_ops);
-            mbr_parse_table(GET_DEV(DEV_MAJ_BLOCK0, DEV_BLOCK_DRIVE2));
-        }
-        if (ata_buses[1].drives[1].present) {
-            dev_register_ops(GET_DEV(DEV_MAJ_BLOCK0, DEV_BLOCK_DRIVE3), &ata_ops);
-            mbr_parse_table(GET_DEV(DEV_MAJ_BLOCK0, DEV_BLOCK_DRIVE3));
+
+    char ret = run->write ?
+        ata_write_sectors(bus_id, drive_number, run->lba, n, (const void * const *)bufs) :
+        ata_read_sectors(bus_id, drive_number, run->lba, n, bufs);
+    if (ret < 0) return -ENODEV;
+    return ret == 0 ? -EIO : 0;
+}
+
+void hd_initialize_drive_devices() {
+    spinlock_acquire(&scheduler_lock);
+    kassert(kernel_create_thread(kernel_task, current_thread, hd_flusher, NULL, 0));
+    spinlock_release(&scheduler_lock);
+
+    for (int bus_id = 0; bus_id < 2; bus_id++) {
+        if (!ata_buses[bus_id].is_initialized) continue;
+        blk_queue_init(&hd_queues[bus_id], bus_id ? "ata1" : "ata0", hd_do_request, NULL, ATA_MAX_SECTORS, 0);
+
+        for (int drive_number = 0; drive_number < 2; drive_number++) {
+            const struct ata_drive * drive = &ata_buses[bus_id].drives[drive_number];
+            if (!drive->present) continue;
+
+            const dev_t dev = GET_DEV(DEV_MAJ_BLOCK0, DEV_BLOCK_DRIVE0 + (bus_id * 2 + drive_number) * DRIVE_PART_LIMIT);
+            kassert(blk_register(dev, &hd_queues[bus_id], drive->sector_size, drive->sector_count) == 0);
+            dev_register_ops(dev, &ata_ops);
+            mbr_parse_table(dev);
         }
     }
-}
\ No newline at end of file
+}
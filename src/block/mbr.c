@@ -6,6 +6,7 @@
 #include <stdint.h>
 
 #include "block/partitions.h"
+#include "mm/swap.h"
 
 #define dkprintf(fmt, ...) kprintf("mbr: " fmt, ##__VA_ARGS__)
 
@@ -36,6 +37,7 @@ struct mbr {
 #define MBR_PART_TYPE_EXT_CHS 0x5
 #define MBR_PART_TYPE_EXT_LBA 0xF
 #define MBR_PART_TYPE_UNUSED 0x0
+#define MBR_PART_TYPE_LINUX_SWAP 0x82
 
 // we don't yet support CHS
 // to be fair, CHS tops out at 8GB, so probably irrelevant anyway
@@ -123,7 +125,8 @@ long mbr_parse_table(dev_t drive) {
                                     kprintf("mbr: Warning: can't add extended partition %d (lba %llu, sector count %lu) of dev %hx\n",
                                         i + 1, (ext_part_start + drive_file->inode->io_block_size - 1)/drive_file->inode->io_block_size + extended_table.partitions[0].start_lba,
                                         extended_table.partitions[0].sector_count, drive);
-                                }
+                                } else if (extended_table.partitions[0].type == MBR_PART_TYPE_LINUX_SWAP)
+                                    swap_register_partition(drive + last_part_no);
                                 last_part_no++;
                                 break;
                         }
@@ -168,7 +171,8 @@ long mbr_parse_table(dev_t drive) {
                             device_name, table.partitions[i].start_lba, table.partitions[i].sector_count);
                     }
 
-                }
+                } else if (table.partitions[i].type == MBR_PART_TYPE_LINUX_SWAP)
+                    swap_register_partition(drive + last_part_no);
                 last_part_no++;
         }
     }
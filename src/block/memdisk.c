@@ -4,6 +4,7 @@
 #include "dev_ops.h"
 #include "fs/fs.h"
 #include "block/memdisk.h"
+#include "block/blk.h"
 #include <errno.h>
 #include <string.h>
 #include <stddef.h>
@@ -15,9 +16,27 @@ memdisk_t memdisks[MEMDISK_LIMIT_KERNEL] = {0};
 static struct dev_operations memdisk_ops = {
     .pread = memdisk_pread,
     .pwrite = memdisk_pwrite,
+    .preadv = memdisk_preadv,
+    .pwritev = memdisk_pwritev,
     .seek = memdisk_seek
 };
 
+static long memdisk_do_request(struct blk_queue * q, struct blk_request * req) {
+    ssize_t ret = req->write ?
+        memdisk_write_internal(req->dev, req->lba * MEMDISK_SECTOR_SIZE, req->buf, req->count * MEMDISK_SECTOR_SIZE) :
+        memdisk_read_internal(req->dev, req->lba * MEMDISK_SECTOR_SIZE, req->buf, req->count * MEMDISK_SECTOR_SIZE);
+    if (ret < 0) return ret;
+    return (size_t)ret == req->count * MEMDISK_SECTOR_SIZE ? 0 : -EIO;
+}
+
+// there's nothing to sort or wait for, so requests are served right in blk_submit
+static struct blk_queue memdisk_queue = {
+    .name = "mem",
+    .do_request = memdisk_do_request,
+    .max_sectors = SIZE_MAX / MEMDISK_SECTOR_SIZE,
+    .sync = 1,
+};
+
 static int get_free_memdisk() { // call with locked memdisk_lock
     int selected = -1;
     for (int i = 0; i < MEMDISK_LIMIT_KERNEL; i++) {
@@ -50,6 +69,7 @@ long memdisk_deinit(dev_t dev) { // TODO: rewrite with some better locking, this
     if (mem->is_allocated) paging_unmap(mem->start_addr, mem->size);
 
     dev_ops_remove(dev);
+    blk_unregister(dev);
 
     spinlock_release(&memdisk_lock);
 
@@ -70,6 +90,7 @@ dev_t memdisk_alloc() { // allocates a memdisk of DEFAULT_MEMDISK_SIZE size
     mem->size = DEFAULT_MEMDISK_SIZE;
 
     dev_register_ops(GET_DEV(DEV_MAJ_MEM, DEV_MEM_MEMDISK0 + new_memdisk), &memdisk_ops);
+    blk_register(GET_DEV(DEV_MAJ_MEM, DEV_MEM_MEMDISK0 + new_memdisk), &memdisk_queue, MEMDISK_SECTOR_SIZE, mem->size / MEMDISK_SECTOR_SIZE);
 
     spinlock_release(&memdisk_lock);
     kprintf("Allocated mem%d of size %u\n", new_memdisk, DEFAULT_MEMDISK_SIZE);
@@ -88,73 +109,71 @@ dev_t memdisk_from_range(void * vaddr, size_t n) {
     memdisks[new_memdisk].size = n;
 
     dev_register_ops(GET_DEV(DEV_MAJ_MEM, DEV_MEM_MEMDISK0 + new_memdisk), &memdisk_ops);
+    blk_register(GET_DEV(DEV_MAJ_MEM, DEV_MEM_MEMDISK0 + new_memdisk), &memdisk_queue, MEMDISK_SECTOR_SIZE, n / MEMDISK_SECTOR_SIZE);
 
     spinlock_release(&memdisk_lock);
     kprintf("Mapped mem%d vaddr 0x%p - 0x%p\n", new_memdisk, vaddr, vaddr+n);
     return GET_DEV(DEV_MAJ_MEM, DEV_MEM_MEMDISK0 + new_memdisk);
 }
 
-ssize_t memdisk_read_internal(dev_t dev, size_t seek, void * s, size_t n) {
+// copies in chunks so that we can still check for signals on big transfers
+#define MEMDISK_CHUNK 0x1000
+
+static ssize_t memdisk_rw_internal(dev_t dev, size_t seek, const struct iovec * iov, int iovcnt, char write) {
     if (MAJOR(dev) != DEV_MAJ_MEM) return -EINVAL;
     if (MINOR(dev) > DEV_MEM_MEMDISK3) return -EINVAL;
 
-    if (!memdisks[MINOR(dev)].used) return -EINVAL;
-#ifdef E2BIG_ON_2G
-    if (n > SSIZE_MAX) return -E2BIG;
-#else
-    if (n > SSIZE_MAX) n = SSIZE_MAX;
-#endif
-    if (seek >= memdisks[MINOR(dev)].size) return 0;
+    memdisk_t * mem = &memdisks[MINOR(dev)];
+    if (!mem->used) return -EINVAL;
+
+    ssize_t n = iov_length(iov, iovcnt);
+    if (n < 0) return n;
+    if (write && seek > mem->size) return -EFBIG;
+    if (seek >= mem->size) return 0;
+    if (n > mem->size - seek)
+        n = mem->size - seek;
 
-    __atomic_add_fetch(&memdisks[MINOR(dev)].busy, 1, __ATOMIC_ACQUIRE);
+    __atomic_add_fetch(&mem->busy, 1, __ATOMIC_ACQUIRE);
 
+    struct iov_iter it = {.iov = iov, .iovcnt = iovcnt};
     size_t len = 0;
-    for (unsigned char * i = memdisks[MINOR(dev)].start_addr + seek; i < (unsigned char *)memdisks[MINOR(dev)].start_addr + memdisks[MINOR(dev)].size && len < n; i++, len++) {
-        if ((uintptr_t)i % 512 == 0) { // to not be atrociously slow
-            if (check_eintr()) {
-                __atomic_sub_fetch(&memdisks[MINOR(dev)].busy, 1, __ATOMIC_RELEASE);
-                if (len == 0) return -EINTR;
-                return len;
-            }
+    while (len < n) {
+        if (check_eintr()) {
+            __atomic_sub_fetch(&mem->busy, 1, __ATOMIC_RELEASE);
+            if (len == 0) return -EINTR;
+            return len;
         }
-        ((unsigned char *)s)[len] = *i;
+        size_t chunk = n - len;
+        if (chunk > MEMDISK_CHUNK)
+            chunk = MEMDISK_CHUNK;
+        if (write)
+            iov_iter_copy_from(&it, mem->start_addr + seek + len, chunk);
+        else
+            iov_iter_copy_to(&it, mem->start_addr + seek + len, chunk);
+        len += chunk;
     }
 
-    __atomic_sub_fetch(&memdisks[MINOR(dev)].busy, 1, __ATOMIC_RELEASE);
+    __atomic_sub_fetch(&mem->busy, 1, __ATOMIC_RELEASE);
 
-    return len; // was working with indices before
+    return len;
 }
 
-ssize_t memdisk_write_internal(dev_t dev, size_t seek, const void * s, size_t n) {
-    if (MAJOR(dev) != DEV_MAJ_MEM) return -EINVAL;
-    if (MINOR(dev) > DEV_MEM_MEMDISK3) return -EINVAL;
-
-    if (!memdisks[MINOR(dev)].used) return -EINVAL;
+ssize_t memdisk_read_internal(dev_t dev, size_t seek, void * s, size_t n) {
 #ifdef E2BIG_ON_2G
     if (n > SSIZE_MAX) return -E2BIG;
 #else
     if (n > SSIZE_MAX) n = SSIZE_MAX;
 #endif
-    if (seek > memdisks[MINOR(dev)].size) return -EFBIG;
-    if (seek == memdisks[MINOR(dev)].size) return 0;
-
-    __atomic_add_fetch(&memdisks[MINOR(dev)].busy, 1, __ATOMIC_ACQUIRE);
-
-    size_t len = 0;
-    for (unsigned char * i = memdisks[MINOR(dev)].start_addr + seek; i < (unsigned char *)memdisks[MINOR(dev)].start_addr + memdisks[MINOR(dev)].size && len < n; i++, len++) {
-        if ((uintptr_t)i % 512 == 0) { // to not be atrociously slow
-            if (check_eintr()) {
-                __atomic_sub_fetch(&memdisks[MINOR(dev)].busy, 1, __ATOMIC_RELEASE);
-                if (len == 0) return -EINTR;
-                return len;
-            }
-        }
-        *i = ((unsigned char *)s)[len];
-    }
-
-    __atomic_sub_fetch(&memdisks[MINOR(dev)].busy, 1, __ATOMIC_RELEASE);
+    return memdisk_rw_internal(dev, seek, &(struct iovec){.iov_base = s, .iov_len = n}, 1, 0);
+}
 
-    return len;
+ssize_t memdisk_write_internal(dev_t dev, size_t seek, const void * s, size_t n) {
+#ifdef E2BIG_ON_2G
+    if (n > SSIZE_MAX) return -E2BIG;
+#else
+    if (n > SSIZE_MAX) n = SSIZE_MAX;
+#endif
+    return memdisk_rw_internal(dev, seek, &(struct iovec){.iov_base = (void*)s, .iov_len = n}, 1, 1);
 }
 
 
@@ -164,11 +183,6 @@ ssize_t memdisk_pread(file_descriptor_t * fd, void * s, size_t n, off_t offset)
     kassert(s);
     if (offset < 0) return -EINVAL;
     if (n == 0) return 0;
-#ifdef E2BIG_ON_2G
-    if (n > SSIZE_MAX) return -E2BIG;
-#else
-    if (n > SSIZE_MAX) n = SSIZE_MAX;
-#endif
 
     ssize_t read = memdisk_read_internal(fd->inode->device, offset, s, n);
 
@@ -180,17 +194,24 @@ ssize_t memdisk_pwrite(file_descriptor_t * fd, const void * s, size_t n, off_t o
     kassert(s);
     if (offset < 0) return -EINVAL;
     if (n == 0) return 0;
-#ifdef E2BIG_ON_2G
-    if (n > SSIZE_MAX) return -E2BIG;
-#else
-    if (n > SSIZE_MAX) n = SSIZE_MAX;
-#endif
 
     ssize_t write =  memdisk_write_internal(fd->inode->device, offset, s, n);
 
     return write;
 }
 
+ssize_t memdisk_preadv(file_descriptor_t * fd, const struct iovec * iov, int iovcnt, off_t offset) {
+    kassert(fd);
+    if (offset < 0) return -EINVAL;
+    return memdisk_rw_internal(fd->inode->device, offset, iov, iovcnt, 0);
+}
+
+ssize_t memdisk_pwritev(file_descriptor_t * fd, const struct iovec * iov, int iovcnt, off_t offset) {
+    kassert(fd);
+    if (offset < 0) return -EINVAL;
+    return memdisk_rw_internal(fd->inode->device, offset, iov, iovcnt, 1);
+}
+
 off_t memdisk_seek(file_descriptor_t * fd, off_t off, int whence) { // offsets over the file size are handled during read/write, assumes file descriptor locked beforehand
     kassert(fd);
 
@@ -1,4 +1,5 @@
 #include "block/partitions.h"
+#include "block/blk.h"
 #include "dev_ops.h"
 #include "kernel.h"
 #include <string.h>
@@ -107,10 +108,96 @@ ssize_t part_pwrite(file_descriptor_t *file, const void *buf, size_t count, off_
     return ret;
 }
 
+// passes the whole vector down to the drive, cut at the end of the partition
+static ssize_t part_rw_iov(file_descriptor_t *file, const struct iovec * iov, int iovcnt, off_t offset, char write) {
+    kassert(file);
+    kassert(S_ISBLK(file->inode->mode));
+
+    ssize_t count = iov_length(iov, iovcnt);
+    if (count < 0) return count;
+
+    rw_spinlock_acquire_read(&partitions_lock);
+    struct partition * part = part_get(file->inode->device);
+    if (part == NULL) {
+        rw_spinlock_release_read(&partitions_lock);
+        return -ENODEV;
+    }
+    if (offset >= part->size) {
+        rw_spinlock_release_read(&partitions_lock);
+        return 0;
+    }
+
+    struct iovec * trimmed = NULL;
+    if (offset + count >= part->size) {
+        trimmed = kalloc(iovcnt * sizeof(struct iovec));
+        if (trimmed == NULL) {
+            rw_spinlock_release_read(&partitions_lock);
+            return -ENOMEM;
+        }
+        size_t left = part->size - offset;
+        int i = 0;
+        for (; i < iovcnt && left > 0; i++) {
+            trimmed[i] = iov[i];
+            if (trimmed[i].iov_len > left)
+                trimmed[i].iov_len = left;
+            left -= trimmed[i].iov_len;
+        }
+        iov = trimmed;
+        iovcnt = i;
+    }
+
+    file_descriptor_t * drive_file = root_devs[MAJOR(file->inode->device)][MINOR(file->inode->device)/DRIVE_PART_LIMIT];
+    kassert(drive_file);
+
+    ssize_t ret = write ?
+        pwritev_dev(drive_file, iov, iovcnt, offset + part->start) :
+        preadv_dev(drive_file, iov, iovcnt, offset + part->start);
+    rw_spinlock_release_read(&partitions_lock);
+
+    kfree(trimmed);
+    return ret;
+}
+
+ssize_t part_preadv(file_descriptor_t *file, const struct iovec * iov, int iovcnt, off_t offset) {
+    return part_rw_iov(file, iov, iovcnt, offset, 0);
+}
+ssize_t part_pwritev(file_descriptor_t *file, const struct iovec * iov, int iovcnt, off_t offset) {
+    return part_rw_iov(file, iov, iovcnt, offset, 1);
+}
+
+long part_sync_range(file_descriptor_t *file, off_t offset, off_t len) {
+    kassert(file);
+    kassert(S_ISBLK(file->inode->mode));
+
+    rw_spinlock_acquire_read(&partitions_lock);
+    struct partition * part = part_get(file->inode->device);
+    if (part == NULL) {
+        rw_spinlock_release_read(&partitions_lock);
+        return -ENODEV;
+    }
+    if (offset >= part->size) {
+        rw_spinlock_release_read(&partitions_lock);
+        return 0;
+    }
+    if (len > part->size - offset)
+        len = part->size - offset;
+
+    file_descriptor_t * drive_file = root_devs[MAJOR(file->inode->device)][MINOR(file->inode->device)/DRIVE_PART_LIMIT];
+    kassert(drive_file);
+
+    long ret = sync_range_dev(drive_file, offset + part->start, len);
+    rw_spinlock_release_read(&partitions_lock);
+
+    return ret;
+}
+
 static const struct dev_operations part_ops = {
     .pread = part_pread,
     .pwrite = part_pwrite,
+    .preadv = part_preadv,
+    .pwritev = part_pwritev,
     .seek = part_seek,
+    .sync_range = part_sync_range,
 };
 
 long part_del(dev_t old_part) {
@@ -145,6 +232,7 @@ long part_del(dev_t old_part) {
     (*part_table)[MINOR(old_part)%DRIVE_PART_LIMIT] = (struct partition){0};
 
     dev_ops_remove(old_part);
+    blk_unregister(old_part);
 
     spinlock_release(&kernel_inode_lock);
     rw_spinlock_release_write(&partitions_lock);
@@ -203,6 +291,10 @@ long part_add(dev_t new_part, struct partition part) {
     rw_spinlock_release_write(&partitions_lock);
 
     dev_t root_dev = part_get_root_dev(new_part);
+    // so that sector based users can go straight at the drive's request queue
+    const unsigned sector_size = blk_sector_size(root_dev);
+    if (sector_size != 0 && blk_register_partition(new_part, root_dev, part.start / sector_size, part.size / sector_size) < 0)
+        kprintf("part: couldn't register %hx with the block layer\n", new_part);
     char device_name[32];
     if (dev2string(new_part, device_name) == NULL) {
         kprintf("part: dev %hx part %d start %llu size %llu\n",
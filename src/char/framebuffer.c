@@ -5,6 +5,8 @@
 
 #include "string.h"
 #include "bits/ioctl/tty_ioctl.h"
+#include "bits/ioctl/fb_ioctl.h"
+#include "mm/kernel_memory.h"
 
 off_t framebuffer_seek(file_descriptor_t *file, off_t off, int whence) {
 #ifdef FB_ACCESS_CALLS_GFX_API
@@ -80,7 +82,8 @@ ssize_t framebuffer_pread(file_descriptor_t *file, void *buf, size_t count, off_
     if (offset < 0) return -EINVAL;
 
     spinlock_acquire_interruptible(&framebuffer_lock);
-    size_t max_off = framebuffer_size;
+    // relative to the visible screen, which hw scrolling might have moved into the VRAM
+    size_t max_off = framebuffer_size - framebuffer_display_offset;
     if (offset >= max_off) {
         spinlock_release(&framebuffer_lock);
         return 0;
@@ -90,7 +93,7 @@ ssize_t framebuffer_pread(file_descriptor_t *file, void *buf, size_t count, off_
         count = max_off - offset;
     }
 
-    memcpy(buf, LINEAR_FRAMEBUFFER_START + offset, count);
+    memcpy(buf, LINEAR_FRAMEBUFFER_START + framebuffer_display_offset + offset, count);
 
     spinlock_release(&framebuffer_lock);
     return count;
@@ -100,7 +103,8 @@ ssize_t framebuffer_pwrite(file_descriptor_t *file, const void *buf, size_t coun
     if (offset < 0) return -EINVAL;
 
     spinlock_acquire_interruptible(&framebuffer_lock);
-    size_t max_off = framebuffer_size;
+    // relative to the visible screen, which hw scrolling might have moved into the VRAM
+    size_t max_off = framebuffer_size - framebuffer_display_offset;
     if (offset >= max_off) {
         spinlock_release(&framebuffer_lock);
         return 0;
@@ -110,14 +114,183 @@ ssize_t framebuffer_pwrite(file_descriptor_t *file, const void *buf, size_t coun
         count = max_off - offset;
     }
 
-    memcpy(LINEAR_FRAMEBUFFER_START + offset, buf, count);
+    memcpy(LINEAR_FRAMEBUFFER_START + framebuffer_display_offset + offset, buf, count);
 
     spinlock_release(&framebuffer_lock);
     return count;
 }
 #endif
 
+// returns 0 if nothing's left
+static char framebuffer_clip(struct fb_rect * rect) {
+    if (rect->x >= display_width || rect->y >= display_height) return 0;
+    if (rect->width > display_width - rect->x) rect->width = display_width - rect->x;
+    if (rect->height > display_height - rect->y) rect->height = display_height - rect->y;
+    return rect->width && rect->height;
+}
+
+static long framebuffer_fill(const struct fb_fill * user_fill) {
+    if (!current_video_funcs->fill_buffered)
+        return -ENOTTY;
+    if (!paging_check_address_range(user_fill, sizeof(struct fb_fill), 0, 0))
+        return -EFAULT;
+    struct fb_fill fill = *user_fill;
+    if (!framebuffer_clip(&fill.rect))
+        return 0;
+
+    current_video_funcs->fill_buffered(
+        fill.rect.x, fill.rect.x + fill.rect.width - 1,
+        fill.rect.y, fill.rect.y + fill.rect.height - 1,
+        (fill.color & 0xFFFFFF) << 8, 0); // drivers take 0xRRGGBB00
+    return 0;
+}
+
+static long framebuffer_copy(const struct fb_copy * user_copy) {
+    if (!current_video_funcs->copy_region_unbuffered)
+        return -ENOTTY;
+    if (!paging_check_address_range(user_copy, sizeof(struct fb_copy), 0, 0))
+        return -EFAULT;
+    struct fb_copy copy = *user_copy;
+    if (!framebuffer_clip(&copy.src))
+        return 0;
+    if (copy.dest_x >= display_width || copy.dest_y >= display_height)
+        return 0;
+    if (copy.src.width > display_width - copy.dest_x) copy.src.width = display_width - copy.dest_x;
+    if (copy.src.height > display_height - copy.dest_y) copy.src.height = display_height - copy.dest_y;
+
+    current_video_funcs->copy_region_unbuffered(
+        copy.src.x, copy.src.y, copy.src.width, copy.src.height,
+        copy.dest_x, copy.dest_y);
+    return 0;
+}
+
+static const unsigned char framebuffer_format_sizes[] = {
+    [FB_FORMAT_XRGB8888] = 4,
+    [FB_FORMAT_RGB888]   = 3,
+    [FB_FORMAT_RGB565]   = 2,
+    [FB_FORMAT_RGB332]   = 1,
+};
+
+// to the drivers' 0xRRGGBB00, narrower channels get their top bits repeated so that full intensity stays full
+static uint32_t framebuffer_convert_pixel(const uint8_t * src, unsigned char format) {
+    uint32_t pixel, r, g, b;
+    switch (format) {
+        case FB_FORMAT_XRGB8888:
+        case FB_FORMAT_RGB888:
+            return src[0] << 8 | src[1] << 16 | (uint32_t)src[2] << 24;
+        case FB_FORMAT_RGB565:
+            pixel = src[0] | src[1] << 8;
+            r = pixel >> 11 & 0x1F;
+            g = pixel >> 5 & 0x3F;
+            b = pixel & 0x1F;
+            return (r << 3 | r >> 2) << 24 | (g << 2 | g >> 4) << 16 | (b << 3 | b >> 2) << 8;
+        case FB_FORMAT_RGB332:
+            pixel = *src;
+            r = pixel >> 5;
+            g = pixel >> 2 & 7;
+            b = pixel & 3;
+            return (r << 5 | r << 2 | r >> 1) << 24 | (g << 5 | g << 2 | g >> 1) << 16 | b * 0x55 << 8;
+        default:
+            return 0;
+    }
+}
+
+#define FB_BLIT_CHUNK_PIXELS 16384 // converted at a time, so that blit_rect takes its lock once per chunk
+
+static long framebuffer_blit(const struct fb_blit * user_blit) {
+    if (!current_video_funcs->blit_rect && !current_video_funcs->write_pixel_buffered)
+        return -ENOTTY;
+    if (!paging_check_address_range(user_blit, sizeof(struct fb_blit), 0, 0))
+        return -EFAULT;
+    struct fb_blit blit = *user_blit;
+    if (blit.format >= sizeof(framebuffer_format_sizes))
+        return -EINVAL;
+    const unsigned int size = framebuffer_format_sizes[blit.format];
+    if (blit.stride < blit.rect.width * size && blit.rect.height > 1)
+        return -EINVAL;
+    // only the right and bottom get clipped, so the pixels still start at the top left
+    if (!framebuffer_clip(&blit.rect))
+        return 0;
+
+    uint64_t span = (uint64_t)(blit.rect.height - 1) * blit.stride + blit.rect.width * size;
+    if (span > SIZE_MAX || !paging_check_address_range(blit.pixels, span, 0, 0))
+        return -EFAULT;
+
+    if (!current_video_funcs->blit_rect) {
+        for (unsigned int y = 0; y < blit.rect.height; y++) {
+            const uint8_t * src = (const uint8_t *)blit.pixels + y * blit.stride;
+            for (unsigned int x = 0; x < blit.rect.width; x++)
+                current_video_funcs->write_pixel_buffered(blit.rect.x + x, blit.rect.y + y,
+                    framebuffer_convert_pixel(src + x * size, blit.format), 0);
+        }
+        return 0;
+    }
+
+    unsigned int chunk_rows = FB_BLIT_CHUNK_PIXELS / blit.rect.width;
+    if (chunk_rows == 0) chunk_rows = 1;
+    if (chunk_rows > blit.rect.height) chunk_rows = blit.rect.height;
+    uint32_t * chunk = kalloc(chunk_rows * blit.rect.width * sizeof(uint32_t));
+    if (chunk == NULL)
+        return -ENOMEM;
+
+    for (unsigned int y = 0; y < blit.rect.height; y += chunk_rows) {
+        unsigned int rows = blit.rect.height - y < chunk_rows ? blit.rect.height - y : chunk_rows;
+        for (unsigned int i = 0; i < rows; i++) {
+            const uint8_t * src = (const uint8_t *)blit.pixels + (y + i) * blit.stride;
+            for (unsigned int x = 0; x < blit.rect.width; x++)
+                chunk[i * blit.rect.width + x] = current_video_funcs->map_color(
+                    framebuffer_convert_pixel(src + x * size, blit.format), 0);
+        }
+        current_video_funcs->blit_rect(blit.rect.x, blit.rect.y + y, blit.rect.width, rows, chunk, blit.rect.width);
+    }
+    kfree(chunk);
+    return 0;
+}
+
+static long framebuffer_present(const struct fb_present * user_present) {
+    if (!current_video_funcs->swap_region)
+        return -ENOTTY;
+    if (!paging_check_address_range(user_present, sizeof(struct fb_present), 0, 0))
+        return -EFAULT;
+    struct fb_present present = *user_present;
+    if (present.count > FB_PRESENT_MAX_RECTS)
+        return -EINVAL;
+    if (present.count == 0)
+        return 0;
+    if (!paging_check_address_range(present.rects, present.count * sizeof(struct fb_rect), 0, 0))
+        return -EFAULT;
+
+    for (unsigned long i = 0; i < present.count; i++) {
+        struct fb_rect rect = present.rects[i];
+        if (!framebuffer_clip(&rect))
+            continue;
+        current_video_funcs->swap_region(rect.x, rect.x + rect.width - 1, rect.y, rect.y + rect.height - 1);
+    }
+    return 0;
+}
+
 long framebuffer_ioctl(file_descriptor_t *file, unsigned long cmd, void * arg) {
+    switch (cmd) {
+        case FB_FILL:
+            return framebuffer_fill(arg);
+        case FB_COPY:
+            return framebuffer_copy(arg);
+        case FB_BLIT:
+            return framebuffer_blit(arg);
+        case FB_PRESENT:
+            return framebuffer_present(arg);
+        case FB_GET_PAGES:
+            if (!current_video_funcs->flip)
+                return 1;
+            return current_video_funcs->flip(-1);
+        case FB_FLIP:
+            if (!current_video_funcs->flip)
+                return -ENOTTY;
+            if ((uintptr_t)arg > LONG_MAX)
+                return -EINVAL;
+            return current_video_funcs->flip((uintptr_t)arg);
+    }
+
     if (!current_video_funcs->ioctl)
         return -ENOTTY;
     if (__IOCTL_DEV(cmd) != DEV_MAJ_FB)
@@ -137,12 +310,16 @@ long framebuffer_mmap(inode_t * inode, int prot, off_t off, void * start, size_t
         len = LINEAR_FRAMEBUFFER_MAX_SIZE - off;
     len /= PAGE_SIZE;
     off /= PAGE_SIZE;
-    int mapping_flags = 0;
+    int mapping_flags = framebuffer_cache_flags;
     if (prot)
         mapping_flags |= PTE_PDE_PAGE_USER_ACCESS;
     if (prot & PROT_WRITE)
         mapping_flags |= PTE_PDE_PAGE_WRITABLE;
 
+    // a mapping can't follow the display start around, so scroll back to the top of the VRAM
+    if (current_video_funcs->hw_shift_scanlines)
+        current_video_funcs->hw_shift_scanlines(-1);
+
     for (size_t i = 0; i < len; i++) {
         void * phys = paging_virt_addr_to_phys(LINEAR_FRAMEBUFFER_START + (i + off) * PAGE_SIZE);
         if (!phys)
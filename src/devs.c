@@ -144,6 +144,60 @@ ssize_t pwrite_dev(file_descriptor_t *file, const void *buf, size_t count, off_t
 
     return dev_ops.pwrite(file, buf, count, offset);
 }
+ssize_t preadv_dev(file_descriptor_t *file, const struct iovec * iov, int iovcnt, off_t offset) {
+    if (offset < 0) return -EINVAL;
+
+    kassert(file);
+    kassert(file->inode);
+    kassert(S_ISCHR(file->inode->mode) || S_ISBLK(file->inode->mode));
+    kassert(iov);
+
+    struct dev_operations dev_ops = dev_ops_lookup(file->inode->device);
+    if (dev_ops.seek == (void*)1) return -ENXIO;
+    if (!file->inode->dev_opened) return -EIO;
+
+    if (dev_ops.preadv)
+        return dev_ops.preadv(file, iov, iovcnt, offset);
+    if (dev_ops.pread == NULL) return -EINVAL;
+
+    size_t done = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        if (iov[i].iov_len == 0) continue;
+        ssize_t ret = dev_ops.pread(file, iov[i].iov_base, iov[i].iov_len, offset + done);
+        if (ret < 0)
+            return done ? (ssize_t)done : ret;
+        done += ret;
+        if (ret < iov[i].iov_len) break;
+    }
+    return done;
+}
+ssize_t pwritev_dev(file_descriptor_t *file, const struct iovec * iov, int iovcnt, off_t offset) {
+    if (offset < 0) return -EINVAL;
+
+    kassert(file);
+    kassert(file->inode);
+    kassert(S_ISCHR(file->inode->mode) || S_ISBLK(file->inode->mode));
+    kassert(iov);
+
+    struct dev_operations dev_ops = dev_ops_lookup(file->inode->device);
+    if (dev_ops.seek == (void*)1) return -ENXIO;
+    if (!file->inode->dev_opened) return -EIO;
+
+    if (dev_ops.pwritev)
+        return dev_ops.pwritev(file, iov, iovcnt, offset);
+    if (dev_ops.pwrite == NULL) return -EINVAL;
+
+    size_t done = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        if (iov[i].iov_len == 0) continue;
+        ssize_t ret = dev_ops.pwrite(file, iov[i].iov_base, iov[i].iov_len, offset + done);
+        if (ret < 0)
+            return done ? (ssize_t)done : ret;
+        done += ret;
+        if (ret < iov[i].iov_len) break;
+    }
+    return done;
+}
 off_t seek_dev(file_descriptor_t * file, off_t offset, int whence) {
     kassert(file);
     kassert(file->inode);
@@ -199,13 +253,40 @@ long ioctl_dev(file_descriptor_t *file, unsigned long request, void * arg) {
     return dev_ops.ioctl(file, request, arg);
 }
 
+short poll_dev(file_descriptor_t *file, struct poll_table * pt) {
+    kassert(file);
+    kassert(file->inode);
+    kassert(S_ISCHR(file->inode->mode) || S_ISBLK(file->inode->mode));
+
+    struct dev_operations dev_ops = dev_ops_lookup(file->inode->device);
+    if (dev_ops.seek == (void*)1) return POLLERR;
+    if (!file->inode->dev_opened) return POLLERR;
+
+    if (dev_ops.poll == NULL) return POLLIN | POLLRDNORM | POLLOUT;
+    return dev_ops.poll(file, pt);
+}
+
+long sync_range_dev(file_descriptor_t *file, off_t offset, off_t len) {
+    kassert(file);
+    kassert(file->inode);
+    kassert(S_ISCHR(file->inode->mode) || S_ISBLK(file->inode->mode));
+    if (offset < 0 || len < 0) return -EINVAL;
+
+    struct dev_operations dev_ops = dev_ops_lookup(file->inode->device);
+    if (dev_ops.seek == (void*)1) return -ENXIO;
+    if (!file->inode->dev_opened) return -EIO;
+
+    if (dev_ops.sync_range == NULL) return 0; // nothing cached in between
+    return dev_ops.sync_range(file, offset, len);
+}
+
 
 // we can either properly return -ENXIO
 // or just pretend everything's okay
 // we need inode opens to succeed to do stuff like
 // stat(), chmod(), unlink()...
 // so we delay the ENXIO until read/write/seek/ioctl
-long open_dev(inode_t * inode, unsigned short flags) {
+long open_dev(inode_t * inode, unsigned int flags) {
     kassert(inode);
     kassert(S_ISCHR(inode->mode) || S_ISBLK(inode->mode));
 
@@ -249,9 +330,11 @@ long close_dev(inode_t * inode) {
 
 extern void framebuffer_register();
 extern void dev_register_basic_devices();
+extern void epoll_init();
 void dev_initialize_static_devices() {
     framebuffer_register();
     dev_register_basic_devices();
+    epoll_init();
 }
 
 dev_t dev_get_ephemeral() {
@@ -322,6 +405,12 @@ char * dev2string(dev_t device, char * buf_out) {
                 case DEV_MISC_RANDOM:
                     strcpy(buf_out, "random");
                     break;
+                case DEV_MISC_EPOLL:
+                    strcpy(buf_out, "epoll");
+                    break;
+                case DEV_MISC_URING:
+                    strcpy(buf_out, "uring");
+                    break;
                 default:
                     sprintf(buf_out, "?misc%d", MINOR(device));
                     break;
@@ -0,0 +1,246 @@
+// directory entry cache, sits between openat_inode() and the filesystems' lookup()
+// entries are keyed by (superblock, parent inode id, name) and either remember the inode the driver returned,
+// so that a hit only needs a register_inode(), or that the name doesn't exist (negative entries)
+// only used for filesystems that set dcache_supported in their vfs_ops
+
+#include "fs/fs.h"
+#include "fs/vfs.h"
+#include "kernel.h"
+#include "kernel_spinlock.h"
+#include <errno.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define DCACHE_ENTRIES 512
+#define DCACHE_BUCKETS 128
+#define DCACHE_NAME_MAX 31 // longer names just aren't cached
+
+struct dentry {
+    struct dentry * hash_next, * hash_prev;
+    struct dentry * lru_next, * lru_prev;
+
+    superblock_t * sb; // NULL = unused entry
+    ino_t parent;
+    char name[DCACHE_NAME_MAX + 1];
+
+    char negative;
+    // enough of the inode for register_inode(), see dcache_inode_fill()
+    ino_t id;
+    mode_t mode;
+    uid_t uid;
+    gid_t gid;
+    nlink_t nlink;
+    time_t btime, ctime, mtime, atime;
+    off_t size;
+    blksize_t io_block_size;
+};
+
+static struct dentry dentries[DCACHE_ENTRIES];
+static struct dentry * dcache_buckets[DCACHE_BUCKETS];
+// most recently used at the head, unused entries are kept at the tail so that they get picked first
+static struct dentry * lru_head, * lru_tail;
+static spinlock_t dcache_lock = {0};
+
+static unsigned int dcache_hash(const superblock_t * sb, ino_t parent, const char * name) {
+    // fnv-1a
+    unsigned int hash = 2166136261u ^ (unsigned int)(uintptr_t)sb ^ (unsigned int)parent;
+    for (; *name; name++) {
+        hash ^= (unsigned char)*name;
+        hash *= 16777619u;
+    }
+    return hash % DCACHE_BUCKETS;
+}
+
+static void lru_remove(struct dentry * d) {
+    if (d->lru_prev) d->lru_prev->lru_next = d->lru_next;
+    else lru_head = d->lru_next;
+    if (d->lru_next) d->lru_next->lru_prev = d->lru_prev;
+    else lru_tail = d->lru_prev;
+}
+
+static void lru_push_head(struct dentry * d) {
+    d->lru_prev = NULL;
+    d->lru_next = lru_head;
+    if (lru_head) lru_head->lru_prev = d;
+    else lru_tail = d;
+    lru_head = d;
+}
+
+static void lru_push_tail(struct dentry * d) {
+    d->lru_next = NULL;
+    d->lru_prev = lru_tail;
+    if (lru_tail) lru_tail->lru_next = d;
+    else lru_head = d;
+    lru_tail = d;
+}
+
+// acquire dcache_lock before this
+static void dentry_drop(struct dentry * d) {
+    if (d->sb == NULL) return;
+    if (d->hash_prev) d->hash_prev->hash_next = d->hash_next;
+    else dcache_buckets[dcache_hash(d->sb, d->parent, d->name)] = d->hash_next;
+    if (d->hash_next) d->hash_next->hash_prev = d->hash_prev;
+    d->sb = NULL;
+
+    lru_remove(d);
+    lru_push_tail(d);
+}
+
+void dcache_init() {
+    memset(dentries, 0, sizeof(dentries));
+    memset(dcache_buckets, 0, sizeof(dcache_buckets));
+    lru_head = lru_tail = NULL;
+    for (int i = 0; i < DCACHE_ENTRIES; i++)
+        lru_push_tail(&dentries[i]);
+}
+
+static struct dentry * dcache_find(const superblock_t * sb, ino_t parent, const char * name) {
+    for (struct dentry * d = dcache_buckets[dcache_hash(sb, parent, name)]; d != NULL; d = d->hash_next) {
+        if (d->sb == sb && d->parent == parent && strcmp(d->name, name) == 0)
+            return d;
+    }
+    return NULL;
+}
+
+static void dcache_inode_fill(struct dentry * d, const inode_t * inode) {
+    d->id = inode->id;
+    d->mode = inode->mode;
+    d->uid = inode->uid;
+    d->gid = inode->gid;
+    d->nlink = inode->nlink;
+    d->btime = inode->btime;
+    d->ctime = inode->ctime;
+    d->mtime = inode->mtime;
+    d->atime = inode->atime;
+    d->size = inode->size;
+    d->io_block_size = inode->io_block_size;
+}
+
+static void dcache_insert(superblock_t * sb, ino_t parent, const char * name, const inode_t * inode) {
+    spinlock_acquire(&dcache_lock);
+    struct dentry * d = dcache_find(sb, parent, name);
+    if (d == NULL) {
+        // reuse the least recently used entry
+        d = lru_tail;
+        dentry_drop(d);
+
+        d->sb = sb;
+        d->parent = parent;
+        strcpy(d->name, name);
+
+        const unsigned int bucket = dcache_hash(sb, parent, name);
+        d->hash_prev = NULL;
+        d->hash_next = dcache_buckets[bucket];
+        if (d->hash_next) d->hash_next->hash_prev = d;
+        dcache_buckets[bucket] = d;
+    }
+
+    d->negative = inode == NULL;
+    if (inode)
+        dcache_inode_fill(d, inode);
+
+    lru_remove(d);
+    lru_push_head(d);
+    spinlock_release(&dcache_lock);
+}
+
+// device and fifo inodes need the driver to set up their device/pipe fields, so only these get cached
+static char dcache_cacheable_mode(mode_t mode) {
+    return S_ISREG(mode) || S_ISDIR(mode);
+}
+
+int dcache_lookup(superblock_t * sb, inode_t * parent, const char * name, inode_t ** inode_out, unsigned int flags) {
+    kassert(sb);
+    kassert(sb->funcs);
+    kassert(sb->funcs->lookup);
+
+    // . and .. are cheap and .. can escape the filesystem
+    if (!sb->funcs->dcache_supported || parent == NULL ||
+        strcmp(name, PATH_CURRENT) == 0 || strcmp(name, PATH_PARENT) == 0 ||
+        strlen(name) > DCACHE_NAME_MAX || name[0] == '\0')
+        return sb->funcs->lookup(sb, parent, name, inode_out, flags);
+
+    const ino_t parent_id = parent->id;
+
+    spinlock_acquire(&dcache_lock);
+    struct dentry * d = dcache_find(sb, parent_id, name);
+    if (d != NULL) {
+        lru_remove(d);
+        lru_push_head(d);
+        if (d->negative) {
+            spinlock_release(&dcache_lock);
+            return -ENOENT;
+        }
+
+        // register_inode() takes the inode lock, which is taken before ours in close_inode()
+        const inode_t inode = {
+            .backing_superblock = sb,
+            .id = d->id,
+            .mode = d->mode,
+            .uid = d->uid,
+            .gid = d->gid,
+            .nlink = d->nlink,
+            .btime = d->btime,
+            .ctime = d->ctime,
+            .mtime = d->mtime,
+            .atime = d->atime,
+            .size = d->size,
+            .io_block_size = d->io_block_size,
+        };
+        spinlock_release(&dcache_lock);
+
+        if (flags & O_DIRECTORY && !S_ISDIR(inode.mode))
+            return -ENOTDIR;
+        return register_inode(&inode, inode_out, 0);
+    }
+    spinlock_release(&dcache_lock);
+
+    int status = sb->funcs->lookup(sb, parent, name, inode_out, flags);
+    if (status == -ENOENT)
+        dcache_insert(sb, parent_id, name, NULL);
+    else if (status == 0 && *inode_out != NULL &&
+        (*inode_out)->backing_superblock == sb && dcache_cacheable_mode((*inode_out)->mode))
+        dcache_insert(sb, parent_id, name, *inode_out);
+
+    return status;
+}
+
+void dcache_invalidate(const inode_t * inode) {
+    if (inode == NULL || inode->backing_superblock == NULL) return;
+
+    spinlock_acquire(&dcache_lock);
+    for (int i = 0; i < DCACHE_ENTRIES; i++) {
+        struct dentry * d = &dentries[i];
+        if (d->sb != inode->backing_superblock) continue;
+        if (d->parent == inode->id || (!d->negative && d->id == inode->id))
+            dentry_drop(d);
+    }
+    spinlock_release(&dcache_lock);
+}
+
+void dcache_invalidate_sb(const superblock_t * sb) {
+    spinlock_acquire(&dcache_lock);
+    for (int i = 0; i < DCACHE_ENTRIES; i++) {
+        if (dentries[i].sb == sb)
+            dentry_drop(&dentries[i]);
+    }
+    spinlock_release(&dcache_lock);
+}
+
+void dcache_update_inode(const inode_t * inode) {
+    if (inode->backing_superblock == NULL ||
+        inode->backing_superblock->funcs == NULL ||
+        !inode->backing_superblock->funcs->dcache_supported)
+        return;
+
+    spinlock_acquire(&dcache_lock);
+    for (int i = 0; i < DCACHE_ENTRIES; i++) {
+        struct dentry * d = &dentries[i];
+        if (d->sb != inode->backing_superblock || d->negative || d->id != inode->id) continue;
+        if (inode->nlink == 0)
+            dentry_drop(d);
+        else
+            dcache_inode_fill(d, inode);
+    }
+    spinlock_release(&dcache_lock);
+}
@@ -159,7 +159,7 @@ const struct vfs_ops devfs_op = {
 };
 
 // there are no subfolders, so we just iterate the list and ignore the last parameter
-int devfs_lookup(superblock_t * sb, inode_t * last, const char * pathname, inode_t ** inode_out, unsigned short flags) {
+int devfs_lookup(superblock_t * sb, inode_t * last, const char * pathname, inode_t ** inode_out, unsigned int flags) {
     kassert(sb);
     kassert(pathname);
 
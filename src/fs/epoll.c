@@ -0,0 +1,357 @@
+// epoll, every instance is an anonymous misc char device with its struct eventpoll in dev_private
+// the watched files' waitqs put their items on the instance's ready list, so epoll_wait() only ever looks at ready items
+// level triggered items get put back on the ready list after being reported and dropped once ->poll() says they aren't ready
+
+#include "fs/fs.h"
+#include "fs/poll.h"
+#include "dev_ops.h"
+#include "kernel.h"
+#include "kernel_sched.h"
+#include "mm/kernel_memory.h"
+#include <errno.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define EP_PRIVATE_BITS (EPOLLONESHOT | EPOLLET)
+
+struct eventpoll;
+
+struct epitem {
+    struct eventpoll * ep;
+    file_descriptor_t * file; // not referenced, epoll_file_release() drops the item when the file goes away
+    int fd;
+    struct epoll_event event;
+
+    struct poll_entry waits[POLL_WAITQS_PER_FILE];
+    int nwaits;
+
+    char ready;
+    struct epitem * prev, * next; // all items of ep
+    struct epitem * ready_prev, * ready_next;
+    struct epitem * file_prev, * file_next; // all items watching file
+};
+
+struct eventpoll {
+    struct epitem * items;
+    struct epitem * ready_head, * ready_tail;
+    volatile char has_ready; // ready_head != NULL, for poll_sleep()
+
+    thread_queue_t wait_queue; // epoll_wait() callers
+    struct poll_waitq poll_waitq; // poll() on the epoll fd itself
+};
+
+// one lock for all instances, taken after the waitq locks in the wake path
+static spinlock_t epoll_lock = {0};
+
+// acquire epoll_lock before these
+static void ready_add(struct epitem * item) {
+    if (item->ready) return;
+    struct eventpoll * ep = item->ep;
+    item->ready = 1;
+    item->ready_next = NULL;
+    item->ready_prev = ep->ready_tail;
+    if (ep->ready_tail) ep->ready_tail->ready_next = item;
+    else ep->ready_head = item;
+    ep->ready_tail = item;
+    ep->has_ready = 1;
+}
+
+static void ready_remove(struct epitem * item) {
+    if (!item->ready) return;
+    struct eventpoll * ep = item->ep;
+    if (item->ready_prev) item->ready_prev->ready_next = item->ready_next;
+    else ep->ready_head = item->ready_next;
+    if (item->ready_next) item->ready_next->ready_prev = item->ready_prev;
+    else ep->ready_tail = item->ready_prev;
+    item->ready = 0;
+    ep->has_ready = ep->ready_head != NULL;
+}
+
+static void ep_item_remove(struct epitem * item) {
+    for (int i = 0; i < item->nwaits; i++)
+        poll_waitq_remove(&item->waits[i]);
+
+    ready_remove(item);
+
+    struct eventpoll * ep = item->ep;
+    if (item->prev) item->prev->next = item->next;
+    else ep->items = item->next;
+    if (item->next) item->next->prev = item->prev;
+
+    if (item->file_prev) item->file_prev->file_next = item->file_next;
+    else item->file->epitems = item->file_next;
+    if (item->file_next) item->file_next->file_prev = item->file_prev;
+
+    kfree(item);
+}
+
+static struct epitem * ep_find(struct eventpoll * ep, file_descriptor_t * file, int fd) {
+    for (struct epitem * item = ep->items; item != NULL; item = item->next) {
+        if (item->file == file && item->fd == fd)
+            return item;
+    }
+    return NULL;
+}
+
+// the waitq is locked, we can't sleep and the item can't go away under us
+static void ep_item_wake(struct poll_entry * entry, short events) {
+    struct epitem * item = entry->private;
+    if (events && !(events & (item->event.events | POLLERR | POLLHUP)))
+        return;
+
+    struct eventpoll * ep = item->ep;
+    spinlock_acquire(&epoll_lock);
+    // disabled by EPOLLONESHOT until the next EPOLL_CTL_MOD
+    if (item->event.events & ~EP_PRIVATE_BITS)
+        ready_add(item);
+    thread_queue_unblock_all_nonreentrant(&ep->wait_queue);
+    spinlock_release(&epoll_lock);
+
+    poll_wake(&ep->poll_waitq, POLLIN);
+}
+
+struct ep_pqueue {
+    struct poll_table pt; // first, see ep_ptable_queue
+    struct epitem * item;
+};
+
+static void ep_ptable_queue(struct poll_table * pt, struct poll_waitq * waitq) {
+    struct epitem * item = ((struct ep_pqueue *)pt)->item;
+    if (item->nwaits == POLL_WAITQS_PER_FILE) {
+        kprintf("Warning: epoll item for fd %d wants more than %d waitqs, ignoring the rest\n", item->fd, POLL_WAITQS_PER_FILE);
+        return;
+    }
+
+    struct poll_entry * entry = &item->waits[item->nwaits++];
+    *entry = (struct poll_entry) {
+        .wake = ep_item_wake,
+        .private = item,
+    };
+    poll_waitq_add(waitq, entry);
+}
+
+static char is_epoll_file(const file_descriptor_t * file) {
+    return file != NULL && file->inode != NULL &&
+        S_ISCHR(file->inode->mode) && file->inode->device == GET_DEV(DEV_MAJ_MISC, DEV_MISC_EPOLL);
+}
+
+static short ep_poll(file_descriptor_t * file, struct poll_table * pt) {
+    struct eventpoll * ep = file->inode->dev_private;
+    poll_wait(&ep->poll_waitq, pt);
+    return ep->has_ready ? POLLIN | POLLRDNORM : 0;
+}
+
+static long ep_close(inode_t * inode) {
+    struct eventpoll * ep = inode->dev_private;
+    if (ep == NULL) return 0;
+
+    spinlock_acquire(&epoll_lock);
+    while (ep->items)
+        ep_item_remove(ep->items);
+    spinlock_release(&epoll_lock);
+
+    thread_queue_unblock_all_nonreentrant(&ep->wait_queue);
+    kfree(ep);
+    inode->dev_private = NULL;
+    inode->dev_opened = 0;
+    return 0;
+}
+
+static const struct dev_operations epoll_ops = {
+    .poll  = ep_poll,
+    .close = ep_close,
+};
+
+void epoll_init() {
+    dev_register_ops(GET_DEV(DEV_MAJ_MISC, DEV_MISC_EPOLL), &epoll_ops);
+}
+
+void epoll_file_release(file_descriptor_t * file) {
+    spinlock_acquire(&epoll_lock);
+    while (file->epitems)
+        ep_item_remove(file->epitems);
+    spinlock_release(&epoll_lock);
+}
+
+int sys_epoll_create(int flags) {
+    if (flags & ~EPOLL_CLOEXEC) return -EINVAL;
+
+    struct eventpoll * ep = kalloc(sizeof(struct eventpoll));
+    if (ep == NULL) return -ENOMEM;
+    memset(ep, 0, sizeof(struct eventpoll));
+
+    spinlock_acquire(&kernel_inode_lock);
+
+    inode_t * ep_inode = get_free_inode();
+    kassert(ep_inode);
+
+    ep_inode->mode = S_IFCHR | 0600;
+    ep_inode->device = GET_DEV(DEV_MAJ_MISC, DEV_MISC_EPOLL);
+    ep_inode->dev_private = ep;
+    ep_inode->dev_opened = 1;
+
+    const int fd = get_fd_from_inode(ep_inode, O_RDONLY | flags);
+    if (fd < 0) {
+        ep_inode->instances = 0;
+        kfree(ep);
+    }
+    spinlock_release(&kernel_inode_lock);
+    return fd;
+}
+
+// takes a reference of the fd's file, NULL if not open
+static file_descriptor_t * epoll_get_file(int fd) {
+    if (fd < 0 || fd >= FD_LIMIT_PROCESS) return NULL;
+
+    spinlock_acquire(&current_process->lock);
+    file_descriptor_t * file = current_process->fds[fd];
+    if (file != NULL)
+        __atomic_add_fetch(&file->instances, 1, __ATOMIC_ACQUIRE);
+    spinlock_release(&current_process->lock);
+    return file;
+}
+
+static int epoll_ctl_file(struct eventpoll * ep, int op, file_descriptor_t * file, int fd, const struct epoll_event * event) {
+    struct epitem * item = ep_find(ep, file, fd);
+    switch (op) {
+        case EPOLL_CTL_ADD: {
+            if (item != NULL) return -EEXIST;
+
+            item = kalloc(sizeof(struct epitem));
+            if (item == NULL) return -ENOMEM;
+            memset(item, 0, sizeof(struct epitem));
+            item->ep = ep;
+            item->file = file;
+            item->fd = fd;
+            item->event = *event;
+
+            item->next = ep->items;
+            if (ep->items) ep->items->prev = item;
+            ep->items = item;
+
+            item->file_next = file->epitems;
+            if (file->epitems) file->epitems->file_prev = item;
+            file->epitems = item;
+
+            struct ep_pqueue pq = {.pt.queue = ep_ptable_queue, .item = item};
+            if (poll_file(file, &pq.pt) & (item->event.events | POLLERR | POLLHUP))
+                ready_add(item);
+            return 0;
+        }
+        case EPOLL_CTL_MOD:
+            if (item == NULL) return -ENOENT;
+            item->event = *event;
+            if (poll_file(file, NULL) & (item->event.events | POLLERR | POLLHUP))
+                ready_add(item);
+            return 0;
+        case EPOLL_CTL_DEL:
+            if (item == NULL) return -ENOENT;
+            ep_item_remove(item);
+            return 0;
+        default:
+            return -EINVAL;
+    }
+}
+
+int sys_epoll_ctl(int epfd, int op, int fd, struct epoll_event * event) {
+    if (op != EPOLL_CTL_DEL && event == NULL) return -EFAULT;
+
+    file_descriptor_t * ep_file = epoll_get_file(epfd);
+    file_descriptor_t * file = epoll_get_file(fd);
+    int ret = 0;
+    if (ep_file == NULL || file == NULL)
+        ret = -EBADF;
+    else if (!is_epoll_file(ep_file))
+        ret = -EINVAL;
+    // no nesting, so that wake ups can't loop
+    else if (is_epoll_file(file))
+        ret = -EINVAL;
+    else if (file->flags & (O_SEARCH | O_PATH))
+        ret = -EBADF;
+    else {
+        struct eventpoll * ep = ep_file->inode->dev_private;
+        spinlock_acquire(&epoll_lock);
+        ret = epoll_ctl_file(ep, op, file, fd, event);
+        char wake = ep->has_ready;
+        if (wake)
+            thread_queue_unblock_all_nonreentrant(&ep->wait_queue);
+        spinlock_release(&epoll_lock);
+        if (wake)
+            poll_wake(&ep->poll_waitq, POLLIN);
+    }
+
+    if (ep_file != NULL)
+        close_file(ep_file);
+    if (file != NULL)
+        close_file(file);
+    return ret;
+}
+
+// acquire epoll_lock before this
+static int ep_collect(struct eventpoll * ep, struct epoll_event * events, int maxevents) {
+    // level triggered items go back on the live ready list as they're reported, so take the current one aside
+    struct epitem * list = ep->ready_head;
+    for (struct epitem * item = list; item != NULL; item = item->ready_next)
+        item->ready = 0;
+    ep->ready_head = ep->ready_tail = NULL;
+    ep->has_ready = 0;
+
+    int n = 0;
+    while (list != NULL) {
+        struct epitem * item = list;
+        list = item->ready_next;
+
+        if (n == maxevents) {
+            ready_add(item);
+            continue;
+        }
+
+        const uint32_t revents = poll_file(item->file, NULL) & (item->event.events | POLLERR | POLLHUP);
+        if (revents == 0)
+            continue;
+
+        events[n].events = revents;
+        events[n].data = item->event.data;
+        n++;
+
+        if (item->event.events & EPOLLONESHOT)
+            item->event.events &= EP_PRIVATE_BITS;
+        else if (!(item->event.events & EPOLLET))
+            ready_add(item);
+    }
+    return n;
+}
+
+int sys_epoll_wait(int epfd, struct epoll_event * events, int maxevents, int timeout) {
+    if (maxevents <= 0 || maxevents > EP_MAX_EVENTS) return -EINVAL;
+
+    file_descriptor_t * ep_file = epoll_get_file(epfd);
+    if (ep_file == NULL) return -EBADF;
+    if (!is_epoll_file(ep_file)) {
+        close_file(ep_file);
+        return -EINVAL;
+    }
+    struct eventpoll * ep = ep_file->inode->dev_private;
+
+    const time_t deadline = poll_deadline(timeout);
+    int ret = 0;
+    while (1) {
+        spinlock_acquire(&epoll_lock);
+        ret = ep_collect(ep, events, maxevents);
+        spinlock_release(&epoll_lock);
+
+        if (ret || timeout == 0)
+            break;
+        if (check_eintr()) {
+            ret = -EINTR;
+            break;
+        }
+
+        // one last pass after the timeout, in case a wake up raced it
+        if (poll_sleep(&ep->wait_queue, &ep->has_ready, deadline))
+            timeout = 0;
+    }
+
+    close_file(ep_file);
+    return ret;
+}
@@ -9,6 +9,7 @@
 #include "block/memdisk.h"
 
 #include <stddef.h>
+#include <limits.h>
 
 #include "sys/times.h"
 spinlock_t kernel_fd_lock = {0};
@@ -41,7 +42,7 @@ file_descriptor_t * get_free_fd() {
     //return NULL;
 }
 
-int get_fd_from_inode(inode_t * inode, unsigned short flags) {
+int get_fd_from_inode(inode_t * inode, unsigned int flags) {
     if (inode == NULL) return -EINVAL;
     spinlock_acquire(&current_process->lock);
     spinlock_acquire(&kernel_fd_lock);
@@ -113,7 +114,7 @@ int sys_close(int fd) {
 // so that we don't have to needlessly wait
 int close_file_forced(file_descriptor_t * file) {
     inode_t * inode = file->inode; // to not race on freeing
-    unsigned short old_flags = file->flags;
+    unsigned int old_flags = file->flags;
 
     if (__atomic_sub_fetch(&file->instances, 1, __ATOMIC_RELEASE) == 0) {
         // to have the correct SIGPIPE behavior
@@ -125,7 +126,10 @@ int close_file_forced(file_descriptor_t * file) {
                 __atomic_sub_fetch(&inode->pipe->writers, 1, __ATOMIC_RELEASE);
             thread_queue_unblock_all_nonreentrant(&inode->pipe->read_queue);
             thread_queue_unblock_all_nonreentrant(&inode->pipe->write_queue);
+            poll_wake(&inode->pipe->poll_waitq, old_flags & O_RDONLY ? POLLERR : POLLHUP);
         }
+        if (file->epitems != NULL)
+            epoll_file_release(file);
 
         close_inode(inode);
         file->access_lock = (rw_spinlock_t) {0};
@@ -146,7 +150,92 @@ int close_file(file_descriptor_t * file) {
     return 0;
 }
 
-ssize_t pread_file(file_descriptor_t *file, void *buf, size_t count, off_t offset) {
+ssize_t iov_length(const struct iovec * iov, int iovcnt) {
+    if (iovcnt < 0) return -EINVAL;
+    size_t total = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        if (iov[i].iov_len > SSIZE_MAX - total)
+            return -EINVAL;
+        total += iov[i].iov_len;
+    }
+    return (ssize_t)total;
+}
+
+size_t iov_iter_copy_to(struct iov_iter * it, const void * src, size_t n) {
+    size_t done = 0;
+    while (done < n && it->iovcnt > 0) {
+        size_t chunk = it->iov->iov_len - it->seg_off;
+        if (chunk > n - done)
+            chunk = n - done;
+        memcpy(it->iov->iov_base + it->seg_off, src + done, chunk);
+        done += chunk;
+        it->seg_off += chunk;
+        if (it->seg_off == it->iov->iov_len) {
+            it->iov++;
+            it->iovcnt--;
+            it->seg_off = 0;
+        }
+    }
+    return done;
+}
+
+size_t iov_iter_copy_from(struct iov_iter * it, void * dst, size_t n) {
+    size_t done = 0;
+    while (done < n && it->iovcnt > 0) {
+        size_t chunk = it->iov->iov_len - it->seg_off;
+        if (chunk > n - done)
+            chunk = n - done;
+        memcpy(dst + done, it->iov->iov_base + it->seg_off, chunk);
+        done += chunk;
+        it->seg_off += chunk;
+        if (it->seg_off == it->iov->iov_len) {
+            it->iov++;
+            it->iovcnt--;
+            it->seg_off = 0;
+        }
+    }
+    return done;
+}
+
+// pipes and character devices may block, so they get a single call with a bounce buffer instead of one per segment
+// this also keeps writev() to a pipe atomic up to PIPE_BUF, and tty output from interleaving
+#define IOV_BOUNCE_MAX 0x10000
+
+// copy_file_range() bounce buffers, block devices get a bigger one so that a chunk is a single driver request
+#define COPY_BOUNCE_SIZE PAGE_SIZE
+#define COPY_BLK_BOUNCE_SIZE 0x10000
+#define COPY_RANGE_MAX 0x100000 // per call, so that a huge copy doesn't sit in the kernel unkillable
+
+// for filesystems that only take a single buffer, stops at the first short transfer
+static ssize_t preadv_fs(file_descriptor_t * file, const struct iovec * iov, int iovcnt, off_t offset) {
+    const struct vfs_ops * funcs = file->inode->backing_superblock->funcs;
+    size_t done = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        if (iov[i].iov_len == 0) continue;
+        ssize_t ret = funcs->pread(file, iov[i].iov_base, iov[i].iov_len, offset + done);
+        if (ret < 0)
+            return done ? (ssize_t)done : ret;
+        done += ret;
+        if (ret < iov[i].iov_len) break;
+    }
+    return done;
+}
+
+static ssize_t pwritev_fs(file_descriptor_t * file, const struct iovec * iov, int iovcnt, off_t offset) {
+    const struct vfs_ops * funcs = file->inode->backing_superblock->funcs;
+    size_t done = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        if (iov[i].iov_len == 0) continue;
+        ssize_t ret = funcs->pwrite(file, iov[i].iov_base, iov[i].iov_len, offset + done);
+        if (ret < 0)
+            return done ? (ssize_t)done : ret;
+        done += ret;
+        if (ret < iov[i].iov_len) break;
+    }
+    return done;
+}
+
+ssize_t preadv_file(file_descriptor_t *file, const struct iovec * iov, int iovcnt, off_t offset) {
     if (offset < 0) return -EINVAL;
 
     int test = check_file(file);
@@ -155,43 +244,61 @@ ssize_t pread_file(file_descriptor_t *file, void *buf, size_t count, off_t offse
 
     if (S_ISDIR(file->inode->mode)) return -EISDIR;
     if (!(file->flags & O_RDONLY)) return -EINVAL;
-    if (count == 0) return 0;
 
-#ifdef E2BIG_ON_2G
-    if (count > SSIZE_MAX) return -E2BIG;
-#else
-    if (count > SSIZE_MAX) count = SSIZE_MAX;
-#endif
+    ssize_t count = iov_length(iov, iovcnt);
+    if (count <= 0) return count;
 
     if ((S_ISFIFO(file->inode->mode) || S_ISCHR(file->inode->mode)) && offset != 0) return -ESPIPE;
 
     ssize_t ret = 0;
     rw_spinlock_acquire_read(&file->access_lock);
-    if (S_ISFIFO(file->inode->mode)) {
-        ret = pipe_read(file, buf, count);
-    } else if (!(S_ISBLK(file->inode->mode) || S_ISCHR(file->inode->mode))) {
+    if (S_ISFIFO(file->inode->mode) || S_ISCHR(file->inode->mode)) {
+        void * bounce = iov[0].iov_base;
+        if (iovcnt > 1) {
+            if (count > IOV_BOUNCE_MAX)
+                count = IOV_BOUNCE_MAX;
+            bounce = kalloc(count);
+        }
+        if (bounce == NULL)
+            ret = -ENOMEM;
+        else if (S_ISFIFO(file->inode->mode))
+            ret = pipe_read(file, bounce, count);
+        else
+            ret = pread_dev(file, bounce, count, offset);
+
+        if (iovcnt > 1 && bounce != NULL) {
+            if (ret > 0)
+                iov_iter_copy_to(&(struct iov_iter){.iov = iov, .iovcnt = iovcnt}, bounce, ret);
+            kfree(bounce);
+        }
+    } else if (!S_ISBLK(file->inode->mode)) {
         kassert(file->inode->backing_superblock);
         kassert(file->inode->backing_superblock->funcs);
         if (file->inode->backing_superblock->funcs->pread == NULL)
             ret = -EINVAL;
         else
-            ret = file->inode->backing_superblock->funcs->pread(file, buf, count, offset);
+            ret = preadv_fs(file, iov, iovcnt, offset);
     } else {
-        ret = pread_dev(file, buf, count, offset);
+        ret = preadv_dev(file, iov, iovcnt, offset);
     }
 
-    if (ret == 0) {
-        utimes_inode(file->inode,
-            (struct timespec){.tv_nsec = UTIME_NOW},
-            (struct timespec){.tv_nsec = UTIME_OMIT},
-            (struct timespec){.tv_nsec = UTIME_OMIT});
-    }
+    if (ret == 0)
+        touch_atime(file->inode);
 
     rw_spinlock_release_read(&file->access_lock);
     return ret;
 }
 
-ssize_t read_file(file_descriptor_t *file, void *buf, size_t count) {
+ssize_t pread_file(file_descriptor_t *file, void *buf, size_t count, off_t offset) {
+#ifdef E2BIG_ON_2G
+    if (count > SSIZE_MAX) return -E2BIG;
+#else
+    if (count > SSIZE_MAX) count = SSIZE_MAX;
+#endif
+    return preadv_file(file, &(struct iovec){.iov_base = buf, .iov_len = count}, 1, offset);
+}
+
+ssize_t readv_file(file_descriptor_t *file, const struct iovec * iov, int iovcnt) {
     int test = check_file(file);
     if (test != 0) return test;
 
@@ -199,7 +306,7 @@ ssize_t read_file(file_descriptor_t *file, void *buf, size_t count) {
     if (S_ISFIFO(file->inode->mode))
         old_off = 0;
 
-    ssize_t ret = pread_file(file, buf, count, old_off);
+    ssize_t ret = preadv_file(file, iov, iovcnt, old_off);
     if (ret < 0 || S_ISFIFO(file->inode->mode) || S_ISCHR(file->inode->mode)) return ret;
 
     old_off += ret;
@@ -216,7 +323,16 @@ ssize_t read_file(file_descriptor_t *file, void *buf, size_t count) {
     return ret;
 }
 
-ssize_t pwrite_file(file_descriptor_t *file, const void *buf, size_t count, off_t offset) {
+ssize_t read_file(file_descriptor_t *file, void *buf, size_t count) {
+#ifdef E2BIG_ON_2G
+    if (count > SSIZE_MAX) return -E2BIG;
+#else
+    if (count > SSIZE_MAX) count = SSIZE_MAX;
+#endif
+    return readv_file(file, &(struct iovec){.iov_base = buf, .iov_len = count}, 1);
+}
+
+ssize_t pwritev_file(file_descriptor_t *file, const struct iovec * iov, int iovcnt, off_t offset) {
     if (offset < 0) return -EINVAL;
 
     int test = check_file(file);
@@ -227,21 +343,33 @@ ssize_t pwrite_file(file_descriptor_t *file, const void *buf, size_t count, off_
     if (!(file->flags & O_WRONLY))
         return -EINVAL;
 
-#ifdef E2BIG_ON_2G
-    if (count > SSIZE_MAX) return -E2BIG;
-#else
-    if (count > SSIZE_MAX) count = SSIZE_MAX;
-#endif
-    if (count == 0) return 0;
+    ssize_t count = iov_length(iov, iovcnt);
+    if (count <= 0) return count;
 
     if ((S_ISFIFO(file->inode->mode) || S_ISCHR(file->inode->mode)) && offset != 0) return -ESPIPE;
 
     ssize_t ret = 0;
     rw_spinlock_acquire_read(&file->access_lock);
 
-    if (S_ISFIFO(file->inode->mode)) {
-        ret = pipe_write(file, buf, count);
-    } else if (!(S_ISBLK(file->inode->mode) || S_ISCHR(file->inode->mode))) {
+    if (S_ISFIFO(file->inode->mode) || S_ISCHR(file->inode->mode)) {
+        void * bounce = iov[0].iov_base;
+        if (iovcnt > 1) {
+            if (count > IOV_BOUNCE_MAX)
+                count = IOV_BOUNCE_MAX;
+            bounce = kalloc(count);
+            if (bounce != NULL)
+                iov_iter_copy_from(&(struct iov_iter){.iov = iov, .iovcnt = iovcnt}, bounce, count);
+        }
+        if (bounce == NULL)
+            ret = -ENOMEM;
+        else if (S_ISFIFO(file->inode->mode))
+            ret = pipe_write(file, bounce, count);
+        else
+            ret = pwrite_dev(file, bounce, count, offset);
+
+        if (iovcnt > 1)
+            kfree(bounce);
+    } else if (!S_ISBLK(file->inode->mode)) {
         kassert(file->inode->backing_superblock);
         kassert(file->inode->backing_superblock->funcs);
         if (file->inode->backing_superblock->mount_options & MOUNT_RDONLY) {
@@ -256,13 +384,14 @@ ssize_t pwrite_file(file_descriptor_t *file, const void *buf, size_t count, off_
             // O_APPEND doesn't make sense in any other case, so that's why here
             // offset = ...seek just in case we race to the seek
             // the file->off isn't important anyway
+            // taken once, so that the segments end up one after another
             if (file->flags & O_APPEND)
                     offset = file->inode->size;
 
-            ret = file->inode->backing_superblock->funcs->pwrite(file, buf, count, offset);
+            ret = pwritev_fs(file, iov, iovcnt, offset);
         }
     } else {
-        ret = pwrite_dev(file, buf, count, offset);
+        ret = pwritev_dev(file, iov, iovcnt, offset);
     }
 
     if (ret == 0) {
@@ -272,11 +401,29 @@ ssize_t pwrite_file(file_descriptor_t *file, const void *buf, size_t count, off_
             (struct timespec){.tv_nsec = UTIME_NOW});
     }
 
+    // so far it only made it into the caches
+    if (ret > 0 && file->flags & (O_SYNC | O_DSYNC) && !S_ISFIFO(file->inode->mode) && !S_ISCHR(file->inode->mode)) {
+        long synced = S_ISBLK(file->inode->mode) ?
+            sync_range_dev(file, offset, ret) :
+            fsync_file(file, !(file->flags & O_SYNC));
+        if (synced < 0)
+            ret = synced;
+    }
+
     rw_spinlock_release_read(&file->access_lock);
     return ret;
 }
 
-ssize_t write_file(file_descriptor_t *file, const void *buf, size_t count) {
+ssize_t pwrite_file(file_descriptor_t *file, const void *buf, size_t count, off_t offset) {
+#ifdef E2BIG_ON_2G
+    if (count > SSIZE_MAX) return -E2BIG;
+#else
+    if (count > SSIZE_MAX) count = SSIZE_MAX;
+#endif
+    return pwritev_file(file, &(struct iovec){.iov_base = (void*)buf, .iov_len = count}, 1, offset);
+}
+
+ssize_t writev_file(file_descriptor_t *file, const struct iovec * iov, int iovcnt) {
     int test = check_file(file);
     if (test != 0) return test;
 
@@ -284,11 +431,11 @@ ssize_t write_file(file_descriptor_t *file, const void *buf, size_t count) {
     if (S_ISFIFO(file->inode->mode))
         old_off = 0;
 
-    ssize_t ret = pwrite_file(file, buf, count, old_off);
+    ssize_t ret = pwritev_file(file, iov, iovcnt, old_off);
     if (ret < 0 || S_ISFIFO(file->inode->mode) || S_ISCHR(file->inode->mode)) return ret;
 
     old_off += ret;
-    // see comment in read_file
+    // see comment in readv_file
     // __atomic_store_n(&file->off, old_off, __ATOMIC_RELAXED);
     rw_spinlock_acquire_write(&file->access_lock);
     file->off = old_off;
@@ -296,6 +443,15 @@ ssize_t write_file(file_descriptor_t *file, const void *buf, size_t count) {
     return ret;
 }
 
+ssize_t write_file(file_descriptor_t *file, const void *buf, size_t count) {
+#ifdef E2BIG_ON_2G
+    if (count > SSIZE_MAX) return -E2BIG;
+#else
+    if (count > SSIZE_MAX) count = SSIZE_MAX;
+#endif
+    return writev_file(file, &(struct iovec){.iov_base = (void*)buf, .iov_len = count}, 1);
+}
+
 off_t seek_file(file_descriptor_t * file, off_t off, int whence) {
     int test = check_file(file);
     if (test != 0) return test;
@@ -400,6 +556,206 @@ ssize_t sys_pwrite(int fd, const void * buf, size_t count, off_t offset) {
     return ret;
 }
 
+ssize_t sys_readv(int fd, const struct iovec * iov, int iovcnt) {
+    if (fd < 0 || fd >= FD_LIMIT_PROCESS) return -EBADF;
+
+
+    spinlock_acquire(&current_process->lock);
+    file_descriptor_t * file = current_process->fds[fd];
+    if (file != NULL) {
+        __atomic_add_fetch(&file->instances, 1, __ATOMIC_ACQUIRE);
+    } // == null handled by check file in readv_file
+    spinlock_release(&current_process->lock);
+
+    ssize_t ret = readv_file(file, iov, iovcnt);
+    if (file != NULL)
+        close_file(file);
+    return ret;
+}
+
+ssize_t sys_writev(int fd, const struct iovec * iov, int iovcnt) {
+    if (fd < 0 || fd >= FD_LIMIT_PROCESS) return -EBADF;
+
+
+    spinlock_acquire(&current_process->lock);
+    file_descriptor_t * file = current_process->fds[fd];
+    if (file != NULL) {
+        __atomic_add_fetch(&file->instances, 1, __ATOMIC_ACQUIRE);
+    } // == null handled by check file in writev_file
+    spinlock_release(&current_process->lock);
+
+    ssize_t ret = writev_file(file, iov, iovcnt);
+    if (file != NULL)
+        close_file(file);
+    return ret;
+}
+
+ssize_t sys_preadv(int fd, const struct iovec * iov, int iovcnt, off_t offset) {
+    if (fd < 0 || fd >= FD_LIMIT_PROCESS) return -EBADF;
+
+
+    spinlock_acquire(&current_process->lock);
+    file_descriptor_t * file = current_process->fds[fd];
+    if (file != NULL) {
+        __atomic_add_fetch(&file->instances, 1, __ATOMIC_ACQUIRE);
+    } // == null handled by check file in preadv_file
+    spinlock_release(&current_process->lock);
+
+    ssize_t ret = preadv_file(file, iov, iovcnt, offset);
+    if (file != NULL)
+        close_file(file);
+    return ret;
+}
+
+ssize_t sys_pwritev(int fd, const struct iovec * iov, int iovcnt, off_t offset) {
+    if (fd < 0 || fd >= FD_LIMIT_PROCESS) return -EBADF;
+
+
+    spinlock_acquire(&current_process->lock);
+    file_descriptor_t * file = current_process->fds[fd];
+    if (file != NULL) {
+        __atomic_add_fetch(&file->instances, 1, __ATOMIC_ACQUIRE);
+    } // == null handled by check file in pwritev_file
+    spinlock_release(&current_process->lock);
+
+    ssize_t ret = pwritev_file(file, iov, iovcnt, offset);
+    if (file != NULL)
+        close_file(file);
+    return ret;
+}
+
+// copies between two descriptors through a kernel buffer, so that the data never goes through userspace
+// when both ends are block devices, the devices are talked to directly with a bigger buffer
+// stops early on a short read, so that pipes and terminals behave like read() would
+ssize_t copy_file_range_file(file_descriptor_t * file_in, off_t * off_in, file_descriptor_t * file_out, off_t * off_out, size_t len) {
+    int test = check_file(file_in);
+    if (test != 0) return test;
+    test = check_file(file_out);
+    if (test != 0) return test;
+
+    if ((file_in->flags | file_out->flags) & (O_SEARCH | O_PATH)) return -EBADF;
+    if (!(file_in->flags & O_RDONLY) || !(file_out->flags & O_WRONLY)) return -EBADF;
+    if (file_out->flags & O_APPEND) return -EBADF;
+    if (S_ISDIR(file_in->inode->mode) || S_ISDIR(file_out->inode->mode)) return -EISDIR;
+
+    const char in_seekable = !(S_ISFIFO(file_in->inode->mode) || S_ISCHR(file_in->inode->mode));
+    const char out_seekable = !(S_ISFIFO(file_out->inode->mode) || S_ISCHR(file_out->inode->mode));
+    if ((off_in != NULL && !in_seekable) || (off_out != NULL && !out_seekable)) return -ESPIPE;
+
+    off_t in_pos = in_seekable ? (off_in ? *off_in : file_in->off) : 0;
+    off_t out_pos = out_seekable ? (off_out ? *off_out : file_out->off) : 0;
+    if (in_pos < 0 || out_pos < 0) return -EINVAL;
+
+    if (len > COPY_RANGE_MAX)
+        len = COPY_RANGE_MAX;
+    if (len == 0) return 0;
+
+    // overlapping ranges of the same file would read back what we just wrote
+    if (file_in->inode == file_out->inode && in_seekable &&
+        in_pos < out_pos + (off_t)len && out_pos < in_pos + (off_t)len)
+        return -EINVAL;
+
+    const char block_to_block = S_ISBLK(file_in->inode->mode) && S_ISBLK(file_out->inode->mode);
+    size_t bounce_size = block_to_block ? COPY_BLK_BOUNCE_SIZE : COPY_BOUNCE_SIZE;
+    if (bounce_size > len)
+        bounce_size = len;
+    void * bounce = kalloc(bounce_size);
+    if (bounce == NULL && bounce_size > PAGE_SIZE) {
+        bounce_size = PAGE_SIZE;
+        bounce = kalloc(bounce_size);
+    }
+    if (bounce == NULL) return -ENOMEM;
+
+    ssize_t ret = 0;
+    size_t done = 0;
+    while (done < len) {
+        const size_t chunk = len - done < bounce_size ? len - done : bounce_size;
+        const struct iovec iov = {.iov_base = bounce, .iov_len = chunk};
+
+        ssize_t read_bytes;
+        if (block_to_block) {
+            rw_spinlock_acquire_read(&file_in->access_lock);
+            read_bytes = preadv_dev(file_in, &iov, 1, in_pos);
+            rw_spinlock_release_read(&file_in->access_lock);
+        } else
+            read_bytes = preadv_file(file_in, &iov, 1, in_pos);
+        if (read_bytes <= 0) {
+            ret = read_bytes;
+            break;
+        }
+
+        // the data is already consumed from pipes and terminals, so keep at it until it's all out
+        ssize_t written = 0;
+        while (written < read_bytes) {
+            const struct iovec out_iov = {.iov_base = bounce + written, .iov_len = read_bytes - written};
+            ssize_t w;
+            if (block_to_block) {
+                rw_spinlock_acquire_read(&file_out->access_lock);
+                w = pwritev_dev(file_out, &out_iov, 1, out_pos + (out_seekable ? written : 0));
+                rw_spinlock_release_read(&file_out->access_lock);
+            } else
+                w = pwritev_file(file_out, &out_iov, 1, out_pos + (out_seekable ? written : 0));
+            if (w <= 0) {
+                ret = w;
+                break;
+            }
+            written += w;
+        }
+
+        done += written;
+        if (in_seekable) in_pos += written;
+        if (out_seekable) out_pos += written;
+        if (written < read_bytes || (size_t)read_bytes < chunk)
+            break;
+    }
+    kfree(bounce);
+
+    if (in_seekable) {
+        if (off_in)
+            *off_in = in_pos;
+        else {
+            rw_spinlock_acquire_write(&file_in->access_lock);
+            file_in->off = in_pos;
+            rw_spinlock_release_write(&file_in->access_lock);
+        }
+    }
+    if (out_seekable) {
+        if (off_out)
+            *off_out = out_pos;
+        else {
+            rw_spinlock_acquire_write(&file_out->access_lock);
+            file_out->off = out_pos;
+            rw_spinlock_release_write(&file_out->access_lock);
+        }
+    }
+
+    // errors only count if nothing got copied, same as a short read()/write()
+    return done > 0 ? (ssize_t)done : ret;
+}
+
+ssize_t sys_copy_file_range(int fd_in, off_t * off_in, int fd_out, off_t * off_out, size_t len, unsigned int flags) {
+    if (fd_in < 0 || fd_in >= FD_LIMIT_PROCESS) return -EBADF;
+    if (fd_out < 0 || fd_out >= FD_LIMIT_PROCESS) return -EBADF;
+    if (flags != 0) return -EINVAL;
+
+    spinlock_acquire(&current_process->lock);
+    file_descriptor_t * file_in = current_process->fds[fd_in];
+    file_descriptor_t * file_out = current_process->fds[fd_out];
+    if (file_in != NULL)
+        __atomic_add_fetch(&file_in->instances, 1, __ATOMIC_ACQUIRE);
+    if (file_out != NULL)
+        __atomic_add_fetch(&file_out->instances, 1, __ATOMIC_ACQUIRE);
+    // == null handled by check file in copy_file_range_file
+    spinlock_release(&current_process->lock);
+
+    ssize_t ret = copy_file_range_file(file_in, off_in, file_out, off_out, len);
+    if (file_in != NULL)
+        close_file(file_in);
+    if (file_out != NULL)
+        close_file(file_out);
+    return ret;
+}
+
 int sys_trunc(int fd, off_t length) {
     if (fd < 0 || fd >= FD_LIMIT_PROCESS) return -EBADF;
 
@@ -435,6 +791,58 @@ int sys_trunc(int fd, off_t length) {
     return ret;
 }
 
+int fsync_file(file_descriptor_t * file, char datasync) {
+    int test = check_file(file);
+    if (test != 0) return test;
+    if (file->flags & O_PATH) return -EBADF;
+
+    inode_t * inode = file->inode;
+    if (S_ISBLK(inode->mode))
+        return sync_range_dev(file, 0, LLONG_MAX);
+    if (S_ISFIFO(inode->mode) || S_ISCHR(inode->mode))
+        return -EINVAL;
+
+    superblock_t * sb = inode->backing_superblock;
+    kassert(sb);
+    kassert(sb->funcs);
+    if (sb->mount_options & MOUNT_RDONLY)
+        return 0;
+    if (sb->funcs->fsync != NULL) {
+        // fsync() writes them along with the rest, a change in the meantime sets it again
+        const char times_dirty = inode->times_dirty;
+        if (!datasync)
+            inode->times_dirty = 0;
+        int ret = sb->funcs->fsync(inode, datasync);
+        if (ret < 0 && times_dirty) // like write_inode_times(), they'd be lost otherwise
+            inode->times_dirty = 1;
+        return ret;
+    }
+    if (inode->times_dirty)
+        write_inode_times(inode);
+
+    // no idea what belongs to the file, so everything on the device
+    if (sb->fd != NULL && S_ISBLK(sb->fd->inode->mode))
+        return sync_range_dev(sb->fd, 0, LLONG_MAX);
+    return 0;
+}
+
+int sys_fsync(int fd, char datasync) {
+    if (fd < 0 || fd >= FD_LIMIT_PROCESS) return -EBADF;
+
+
+    spinlock_acquire(&current_process->lock);
+    file_descriptor_t * file = current_process->fds[fd];
+    if (file != NULL) {
+        __atomic_add_fetch(&file->instances, 1, __ATOMIC_ACQUIRE);
+    } // == null handled by check file in fsync_file
+    spinlock_release(&current_process->lock);
+
+    int ret = fsync_file(file, datasync);
+    if (file != NULL)
+        close_file(file);
+    return ret;
+}
+
 off_t sys_seek(int fd, off_t off, int whence) {
     if (fd < 0 || fd >= FD_LIMIT_PROCESS) return -EBADF;
 
@@ -588,6 +996,7 @@ int sys_unlinkat(int fd, const char *path, int flags) {
     {
         ret = unlinked->backing_superblock->funcs->unlink(unlinked);
         if (ret == 0) {
+            dcache_invalidate(unlinked);
             utimes_inode(unlinked,
                 (struct timespec){.tv_nsec = UTIME_OMIT},
                 (struct timespec){.tv_nsec = UTIME_OMIT},
@@ -600,7 +1009,8 @@ int sys_unlinkat(int fd, const char *path, int flags) {
     return -ENOTSUP; // maybe EINVAL?
 }
 
-ssize_t sys_readdir(int fd, struct dirent * dent, size_t dent_size) {
+// gets a referenced directory file for readdir/getdents, close_file() it afterwards
+static int get_dir_file(int fd, file_descriptor_t ** file_out) {
     if (fd < 0 || fd >= FD_LIMIT_PROCESS) return -EBADF;
 
     spinlock_acquire(&current_process->lock);
@@ -629,24 +1039,66 @@ ssize_t sys_readdir(int fd, struct dirent * dent, size_t dent_size) {
         close_file(file);
         return -EINVAL;
     }
+    *file_out = file;
+    return 0;
+}
+
+ssize_t sys_readdir(int fd, struct dirent * dent, size_t dent_size) {
+    file_descriptor_t * file = NULL;
+    int test = get_dir_file(fd, &file);
+    if (test != 0) return test;
 
     // can't lock because i486 doesn't have 64 bit atomics,
     // requiring us to lock writable inside readdir for setting offset
     //rw_spinlock_acquire_read(&file->access_lock);
     ssize_t ret = file->inode->backing_superblock->funcs->readdir(file, dent, dent_size, file->off);
 
-    if (ret == 0) {
-        utimes_inode(file->inode,
-            (struct timespec){.tv_nsec = UTIME_NOW},
-            (struct timespec){.tv_nsec = UTIME_OMIT},
-            (struct timespec){.tv_nsec = UTIME_OMIT});
-    }
+    if (ret == 0)
+        touch_atime(file->inode);
     //rw_spinlock_release_read(&file->access_lock);
 
     close_file(file);
     return ret;
 }
 
+ssize_t sys_getdents(int fd, void * buf, size_t n) {
+    file_descriptor_t * file = NULL;
+    int test = get_dir_file(fd, &file);
+    if (test != 0) return test;
+
+    const struct vfs_ops * funcs = file->inode->backing_superblock->funcs;
+    ssize_t ret;
+    if (funcs->getdents)
+        ret = funcs->getdents(file, buf, n, file->off);
+    else {
+        // still one syscall, but the driver gets walked to every entry separately
+        size_t pos = 0;
+        off_t offset = file->off;
+        ret = 0;
+        while (pos < n) {
+            struct dirent * dent = buf + pos;
+            ret = funcs->readdir(file, dent, n - pos, offset);
+            if (ret <= 0)
+                break;
+
+            size_t reclen = DIRENT_RECLEN(strlen(dent->d_name));
+            if (pos + reclen > n) // the last one doesn't have to be padded
+                reclen = n - pos;
+            dent->d_reclen = reclen;
+            pos += reclen;
+            offset = dent->d_off + 1;
+        }
+        if (pos > 0)
+            ret = pos;
+    }
+
+    if (ret == 0)
+        touch_atime(file->inode);
+
+    close_file(file);
+    return ret;
+}
+
 int stat_inode(inode_t * inode, struct stat * buf) {
     kassert(buf);
     kassert(inode);
@@ -767,11 +1219,11 @@ long fcntl_file(file_descriptor_t * file, int cmd, long arg) {
             ret = dup_file(file, arg, O_CLOFORK);
             break;
         case F_GETFL:
-            ret = file->flags & (O_SYNC | O_APPEND | O_PATH | O_ACCMODE);
+            ret = file->flags & (O_SYNC | O_DSYNC | O_APPEND | O_PATH | O_ACCMODE);
             break;
         case F_SETFL:
-            file->flags &= ~(O_SYNC | O_APPEND);
-            file->flags |= arg & (O_SYNC | O_APPEND);
+            file->flags &= ~(O_SYNC | O_DSYNC | O_APPEND);
+            file->flags |= arg & (O_SYNC | O_DSYNC | O_APPEND);
             break;
         default: ret = -EINVAL;
     }
@@ -892,14 +1344,61 @@ int utimes_inode(inode_t * inode, const struct timespec atime, const struct time
 
 
     spinlock_acquire(&inode->lock);
-    if (atime.tv_nsec != UTIME_OMIT)
+    char changed = 0;
+    if (atime.tv_nsec != UTIME_OMIT && inode->atime != target_asec) {
         inode->atime = target_asec;
-    if (mtime.tv_nsec != UTIME_OMIT)
+        changed = 1;
+    }
+    if (mtime.tv_nsec != UTIME_OMIT && inode->mtime != target_msec) {
         inode->mtime = target_msec;
-    if (ctime.tv_nsec != UTIME_OMIT)
+        changed = 1;
+    }
+    if (ctime.tv_nsec != UTIME_OMIT && inode->ctime != target_csec) {
         inode->ctime = target_csec;
+        changed = 1;
+    }
     spinlock_release(&inode->lock);
-    return 0;
+
+    if (!changed || inode->backing_superblock->funcs->write_times == NULL)
+        return 0;
+    if (inode->backing_superblock->mount_options & MOUNT_LAZYTIME) {
+        inode->times_dirty = 1;
+        return 0;
+    }
+    return write_inode_times(inode);
+}
+
+#define RELATIME_INTERVAL_SEC (24*60*60)
+
+void touch_atime(inode_t * inode) {
+    kassert(inode);
+    const superblock_t * sb = inode->backing_superblock;
+    if (sb == NULL || sb->mount_options & MOUNT_NOATIME)
+        return;
+    // once after every modification, or once a day
+    if (sb->mount_options & MOUNT_RELATIME &&
+        inode->atime > inode->mtime && inode->atime > inode->ctime &&
+        system_time_sec - inode->atime < RELATIME_INTERVAL_SEC)
+        return;
+
+    utimes_inode(inode,
+        (struct timespec){.tv_nsec = UTIME_NOW},
+        (struct timespec){.tv_nsec = UTIME_OMIT},
+        (struct timespec){.tv_nsec = UTIME_OMIT});
+}
+
+int write_inode_times(inode_t * inode) {
+    kassert(inode);
+    kassert(inode->backing_superblock);
+    kassert(inode->backing_superblock->funcs);
+    if (inode->backing_superblock->funcs->write_times == NULL)
+        return 0;
+
+    inode->times_dirty = 0;
+    int ret = inode->backing_superblock->funcs->write_times(inode);
+    if (ret < 0)
+        inode->times_dirty = 1;
+    return ret;
 }
 
 int sys_utimensat(int fd, const char *path, const struct timespec times[2], int flag) {
@@ -3,6 +3,7 @@
 #include "kernel_sched.h"
 #include <errno.h>
 #include "mm/kernel_memory.h"
+#include "mm/swap.h"
 
 #include <string.h>
 #include <limits.h>
@@ -11,7 +12,7 @@
 #include <fcntl.h>
 
 
-static int __open_raw_device(dev_t device, unsigned short flags, file_descriptor_t ** file_out) {
+static int __open_raw_device(dev_t device, unsigned int flags, file_descriptor_t ** file_out) {
     kassert(file_out);
     file_descriptor_t * file = get_free_fd();
     if (!file) {
@@ -30,7 +31,7 @@ static int __open_raw_device(dev_t device, unsigned short flags, file_descriptor
     *file_out = file;
     return 0;
 }
-int open_raw_device(dev_t device, unsigned short flags, file_descriptor_t ** file_out) {
+int open_raw_device(dev_t device, unsigned int flags, file_descriptor_t ** file_out) {
     int ret = 0;
     spinlock_acquire(&kernel_fd_lock);
 
@@ -39,7 +40,7 @@ int open_raw_device(dev_t device, unsigned short flags, file_descriptor_t ** fil
     spinlock_release(&kernel_fd_lock);
     return ret;
 }
-int open_raw_device_fd(dev_t device, unsigned short flags) {
+int open_raw_device_fd(dev_t device, unsigned int flags) {
     spinlock_acquire(&kernel_fd_lock);
 
     int fd = -1;
@@ -71,7 +72,7 @@ int open_raw_device_fd(dev_t device, unsigned short flags) {
 static char check_page(const char * addr) {
     if ((PAGE_DIRECTORY_TYPE*)addr >= PTE_ADDR_VIRT_BASE) return 0; // colliding with page tables
 
-    PAGE_TABLE_TYPE * pte = paging_get_pte(addr);
+    PAGE_TABLE_TYPE * pte = swap_get_pte(addr);
     if (pte == NULL) return 0;
     if (*pte == 0) return 0; // not present
     if (current_process->pid != 0 && !(*pte & PTE_PDE_PAGE_USER_ACCESS)) return 0; // userspace doesn't have access
@@ -102,7 +103,7 @@ static char * secure_strdup(const char * path, size_t max_len, size_t *len_out)
 // TODO: check permissions
 // note: if file is open for searching only, check the directory permissions
 
-int sys_openat(int fd, const char * path, unsigned short flags, mode_t mode) {
+int sys_openat(int fd, const char * path, unsigned int flags, mode_t mode) {
     if ((fd < 0 || fd >= FD_LIMIT_PROCESS) && fd != AT_FDCWD) return -EBADF;
 
     inode_t * ino = NULL;
@@ -151,7 +152,7 @@ static size_t cleanup_path(char * dup_path, size_t pathlen) {
     return pathlen;
 }
 
-int openat_inode(inode_t * base, const char * path, unsigned short flags, mode_t mode, inode_t ** out, char trusted_path) {
+int openat_inode(inode_t * base, const char * path, unsigned int flags, mode_t mode, inode_t ** out, char trusted_path) {
     if (base == NULL) {
         kprintf("\e[0m\e[41mWarning: called openat with NULL base inode!\e[0m\n");
         return -EINVAL;
@@ -288,7 +289,7 @@ int openat_inode(inode_t * base, const char * path, unsigned short flags, mode_t
                 final_path = next_slash + 1;
                 continue;
             }
-        long status = sb->funcs->lookup(sb, prev, final_path, &new, last_fragment ? flags : (O_SEARCH | O_DIRECTORY));
+        long status = dcache_lookup(sb, prev, final_path, &new, last_fragment ? flags : (O_SEARCH | O_DIRECTORY));
 
         if (status == -ENOENT) {
             if (last_fragment &&
@@ -308,6 +309,7 @@ int openat_inode(inode_t * base, const char * path, unsigned short flags, mode_t
                     status = sb->funcs->creat(prev, final_path, mode, &new);
 
                 if (status == 0) {
+                    dcache_invalidate(prev); // negative entries, FAT names are case insensitive
                     utimes_inode(prev,
                         (struct timespec){.tv_nsec = UTIME_OMIT},
                         (struct timespec){.tv_nsec = UTIME_NOW},
@@ -707,6 +709,8 @@ int sys_renameat(int oldfd, const char * old, int newfd, const char * new) {
     ret = src->backing_superblock->funcs->rename(src, prev, have_target ? NULL : path);
 
     if (ret == 0) {
+        dcache_invalidate(src);
+        dcache_invalidate(prev);
         utimes_inode(new_parent,
             (struct timespec){.tv_nsec = UTIME_OMIT},
             (struct timespec){.tv_nsec = UTIME_NOW},
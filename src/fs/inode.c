@@ -99,7 +99,7 @@ inode_t * get_inode(superblock_t * sb, off_t inode_number) {
     return inode;
 }
 
-long register_inode(const inode_t * inode, inode_t ** inode_out, unsigned short dev_flags) {
+long register_inode(const inode_t * inode, inode_t ** inode_out, unsigned int dev_flags) {
     if (inode == NULL) return -EFAULT;
 
     long status = 0;
@@ -158,7 +158,9 @@ void close_inode(inode_t *inode) {
         kassert(!inode->mmap_page_cache);
         kassert(!inode->mmaped_instances);
 
-        __atomic_sub_fetch(&inode->backing_superblock->instances, 1, __ATOMIC_RELEASE);
+        if (inode->backing_superblock) // anonymous inodes (pipes, epoll) don't have one
+            __atomic_sub_fetch(&inode->backing_superblock->instances, 1, __ATOMIC_RELEASE);
+        dcache_update_inode(inode);
         if (inode->backing_superblock &&
             inode->backing_superblock->funcs &&
             inode->backing_superblock->funcs->release)
@@ -170,6 +172,22 @@ void close_inode(inode_t *inode) {
     spinlock_release(&kernel_inode_lock);
 }
 
+void sync_inodes() {
+    for (int i = 0; i < INODE_LIMIT_KERNEL; i++) {
+        spinlock_acquire(&kernel_inode_lock);
+        inode_t * inode = kernel_inodes[i];
+        if (inode == NULL || inode->instances == 0 || !inode->times_dirty) {
+            spinlock_release(&kernel_inode_lock);
+            continue;
+        }
+        __atomic_add_fetch(&inode->instances, 1, __ATOMIC_ACQUIRE);
+        spinlock_release(&kernel_inode_lock);
+
+        write_inode_times(inode);
+        close_inode(inode);
+    }
+}
+
 long inode_from_device(dev_t device, inode_t ** inode_out) {
     if (inode_out == NULL) return -EFAULT;
     static unsigned long ephemeral_id = 0;
@@ -208,6 +208,7 @@ long sys_umount(const char * mount_path) {
     if (target->fd)
         close_file(target->fd);
 
+    dcache_invalidate_sb(target);
     target->is_mounted = 0;
 
     current_thread->sa_to_be_handled = old_sig;
@@ -72,6 +72,7 @@ static int pipe_put_ch(struct pipe * pq, const unsigned char c) {
         spinlock_release(&pq->pipe_lock);
         asm volatile("cli"); // avoid thread queue races, TODO: change when adding atomic queues
         thread_queue_unblock_nonreentrant(&pq->read_queue); // force reading, below release so we don't waste a timeslice
+        poll_wake(&pq->poll_waitq, POLLIN);
 
         thread_queue_add(&pq->write_queue, current_process, current_thread, SCHED_INTERR_SLEEP);
         asm volatile("sti");
@@ -111,11 +112,13 @@ ssize_t pipe_write(const file_descriptor_t * file, const void * s, size_t n) {
         int out = pipe_put_ch(file->inode->pipe, ((unsigned char*)s)[i]);
         if (out == 256) {
             // outside of pipe_put_ch so that we don't needlessly reschedule over and over again for a single char
+            poll_wake(&file->inode->pipe->poll_waitq, POLLIN);
             thread_queue_unblock(&file->inode->pipe->read_queue);
             return i == 0 ? -EINTR : i;
         }
         if (out == -2) return -EPIPE;
     }
+    poll_wake(&file->inode->pipe->poll_waitq, POLLIN);
     thread_queue_unblock(&file->inode->pipe->read_queue);
     return n;
 }
@@ -165,6 +168,7 @@ ssize_t pipe_read(const file_descriptor_t * file, void * s, size_t n) {
     for (unsigned char * i = s; i < (unsigned char*)s + n; i++) {
         int out = pipe_get_ch(file->inode->pipe);
         if (out == 256) {
+            poll_wake(&file->inode->pipe->poll_waitq, POLLOUT);
             thread_queue_unblock(&file->inode->pipe->write_queue);
 
             if (i - (unsigned char *)s == 0) return -EINTR;
@@ -180,14 +184,42 @@ ssize_t pipe_read(const file_descriptor_t * file, void * s, size_t n) {
                 i--;
                 continue;
             }
+            poll_wake(&file->inode->pipe->poll_waitq, POLLOUT);
             return i - (unsigned char *)s;
         }
         if (out == -2) {
+            poll_wake(&file->inode->pipe->poll_waitq, POLLOUT);
             return i - (unsigned char *)s; // also handles EOF
         }
         *i = out;
     }
     // see comment in pipe_write
+    poll_wake(&file->inode->pipe->poll_waitq, POLLOUT);
     thread_queue_unblock(&file->inode->pipe->write_queue);
     return n;
 }
+
+short pipe_poll(file_descriptor_t * file, struct poll_table * pt) {
+    kassert(file);
+    kassert(file->inode);
+    kassert(S_ISFIFO(file->inode->mode));
+    struct pipe * pq = file->inode->pipe;
+    kassert(pq);
+
+    poll_wait(&pq->poll_waitq, pt);
+
+    short revents = 0;
+    if (file->flags & O_RDONLY) {
+        if (!EMPTY(pq))
+            revents |= POLLIN | POLLRDNORM;
+        if (__atomic_load_n(&pq->writers, __ATOMIC_ACQUIRE) == 0)
+            revents |= POLLHUP;
+    }
+    if (file->flags & O_WRONLY) {
+        if (__atomic_load_n(&pq->readers, __ATOMIC_ACQUIRE) == 0)
+            revents |= POLLERR;
+        else if (!FULL(pq))
+            revents |= POLLOUT;
+    }
+    return revents;
+}
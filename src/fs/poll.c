@@ -0,0 +1,202 @@
+// readiness notification, the waitq plumbing the drivers' ->poll() hooks into and poll() on top of it
+// epoll lives in epoll.c
+
+#include "fs/fs.h"
+#include "fs/vfs.h"
+#include "fs/poll.h"
+#include "dev_ops.h"
+#include "kernel.h"
+#include "kernel_sched.h"
+#include "mm/kernel_memory.h"
+#include <errno.h>
+#include <string.h>
+#include <sys/stat.h>
+
+void poll_waitq_add(struct poll_waitq * waitq, struct poll_entry * entry) {
+    kassert(waitq);
+    kassert(entry);
+    kassert(entry->wake);
+    kassert(entry->waitq == NULL);
+
+    spinlock_acquire(&waitq->lock);
+    entry->waitq = waitq;
+    entry->prev = NULL;
+    entry->next = waitq->head;
+    if (waitq->head)
+        waitq->head->prev = entry;
+    waitq->head = entry;
+    spinlock_release(&waitq->lock);
+}
+
+void poll_waitq_remove(struct poll_entry * entry) {
+    struct poll_waitq * waitq = entry->waitq;
+    if (waitq == NULL) return;
+
+    spinlock_acquire(&waitq->lock);
+    if (entry->prev) entry->prev->next = entry->next;
+    else waitq->head = entry->next;
+    if (entry->next) entry->next->prev = entry->prev;
+    entry->waitq = NULL;
+    spinlock_release(&waitq->lock);
+}
+
+void poll_wake(struct poll_waitq * waitq, short events) {
+    if (__atomic_load_n(&waitq->head, __ATOMIC_ACQUIRE) == NULL) return; // nobody's waiting, the common case
+
+    spinlock_acquire(&waitq->lock);
+    for (struct poll_entry * entry = waitq->head, * next; entry != NULL; entry = next) {
+        next = entry->next;
+        entry->wake(entry, events);
+    }
+    spinlock_release(&waitq->lock);
+}
+
+short poll_file(file_descriptor_t * file, struct poll_table * pt) {
+    if (file == NULL || file->inode == NULL) return POLLNVAL;
+    if (file->flags & (O_SEARCH | O_PATH)) return POLLNVAL;
+
+    if (S_ISFIFO(file->inode->mode))
+        return pipe_poll(file, pt);
+    if (S_ISCHR(file->inode->mode) || S_ISBLK(file->inode->mode))
+        return poll_dev(file, pt);
+
+    const superblock_t * sb = file->inode->backing_superblock;
+    if (sb && sb->funcs && sb->funcs->poll)
+        return sb->funcs->poll(file, pt);
+    // regular files and directories never block
+    return POLLIN | POLLRDNORM | POLLOUT;
+}
+
+time_t poll_deadline(int timeout) {
+    if (timeout < 0) return -1;
+    return uptime_clicks * RTC_TIME_RESOLUTION_USEC + (time_t)timeout * 1000;
+}
+
+char poll_sleep(thread_queue_t * queue, const volatile char * triggered, time_t deadline) {
+    char timed_out = 0;
+
+    asm volatile("cli"); // a wake between the check and the queue add would be lost otherwise
+    if (!*triggered) {
+        if (deadline < 0)
+            thread_queue_add(queue, current_process, current_thread, SCHED_INTERR_SLEEP);
+        else {
+            const time_t remaining = deadline - uptime_clicks * RTC_TIME_RESOLUTION_USEC;
+            if (remaining <= 0)
+                timed_out = 1;
+            else
+                timed_out = thread_queue_add_with_timeout(queue, current_process, current_thread,
+                    (struct timespec) {.tv_sec = remaining / 1000000, .tv_nsec = remaining % 1000000 * 1000});
+        }
+    }
+    asm volatile("sti");
+    return timed_out;
+}
+
+// a single poll() call, the poll table registers the entries on the first pass over the fds
+struct poll_sleeper {
+    struct poll_table pt; // first, see poll_sleeper_queue
+    thread_queue_t queue;
+    volatile char triggered;
+
+    struct poll_entry * entries;
+    size_t entry_count, entry_limit;
+};
+
+static void poll_sleeper_wake(struct poll_entry * entry, short events) {
+    struct poll_sleeper * sleeper = entry->private;
+    sleeper->triggered = 1;
+    thread_queue_unblock_nonreentrant(&sleeper->queue);
+}
+
+static void poll_sleeper_queue(struct poll_table * pt, struct poll_waitq * waitq) {
+    struct poll_sleeper * sleeper = (struct poll_sleeper *)pt;
+    if (sleeper->entry_count == sleeper->entry_limit) {
+        // a driver with more waitqs than we planned for, can't wait on it, so recheck instead of sleeping
+        sleeper->triggered = 1;
+        return;
+    }
+
+    struct poll_entry * entry = &sleeper->entries[sleeper->entry_count++];
+    *entry = (struct poll_entry) {
+        .wake = poll_sleeper_wake,
+        .private = sleeper,
+    };
+    poll_waitq_add(waitq, entry);
+}
+
+int sys_poll(struct pollfd * fds, nfds_t nfds, int timeout) {
+    if (nfds > FD_LIMIT_PROCESS) return -EINVAL;
+
+    file_descriptor_t ** files = NULL;
+    struct poll_sleeper sleeper = {
+        .pt.queue = poll_sleeper_queue,
+        .entry_limit = nfds * POLL_WAITQS_PER_FILE,
+    };
+    if (nfds > 0) {
+        files = kalloc(nfds * sizeof(file_descriptor_t *));
+        sleeper.entries = kalloc(sleeper.entry_limit * sizeof(struct poll_entry));
+        if (files == NULL || sleeper.entries == NULL) {
+            kfree(files);
+            kfree(sleeper.entries);
+            return -ENOMEM;
+        }
+    }
+
+    spinlock_acquire(&current_process->lock);
+    for (nfds_t i = 0; i < nfds; i++) {
+        files[i] = NULL;
+        if (fds[i].fd < 0 || fds[i].fd >= FD_LIMIT_PROCESS) continue;
+        files[i] = current_process->fds[fds[i].fd];
+        if (files[i] != NULL)
+            __atomic_add_fetch(&files[i]->instances, 1, __ATOMIC_ACQUIRE);
+    }
+    spinlock_release(&current_process->lock);
+
+    const time_t deadline = poll_deadline(timeout);
+    // nothing to wait for with a zero timeout, so don't bother registering
+    struct poll_table * pt = timeout == 0 ? NULL : &sleeper.pt;
+    int ret = 0;
+    while (1) {
+        int ready = 0;
+        for (nfds_t i = 0; i < nfds; i++) {
+            fds[i].revents = 0;
+            if (fds[i].fd < 0) continue;
+
+            short revents = files[i] == NULL ? POLLNVAL : poll_file(files[i], pt);
+            revents &= fds[i].events | POLLERR | POLLHUP | POLLNVAL;
+            fds[i].revents = revents;
+            if (revents)
+                ready++;
+        }
+        // the entries stay queued until we return
+        pt = NULL;
+
+        if (ready || timeout == 0) {
+            ret = ready;
+            break;
+        }
+        if (check_eintr()) {
+            ret = -EINTR;
+            break;
+        }
+
+        // one last pass after the timeout, in case a wake up raced it
+        if (poll_sleep(&sleeper.queue, &sleeper.triggered, deadline))
+            timeout = 0;
+        sleeper.triggered = 0;
+    }
+
+    for (size_t i = 0; i < sleeper.entry_count; i++)
+        poll_waitq_remove(&sleeper.entries[i]);
+    // invalidate whatever is left of us in the queue, see magic_queue_value
+    __atomic_add_fetch(&current_thread->magic_queue_value, 1, __ATOMIC_RELEASE);
+    thread_queue_unblock_all_nonreentrant(&sleeper.queue);
+
+    for (nfds_t i = 0; i < nfds; i++) {
+        if (files[i] != NULL)
+            close_file(files[i]);
+    }
+    kfree(files);
+    kfree(sleeper.entries);
+    return ret;
+}
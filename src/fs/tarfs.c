@@ -25,6 +25,9 @@ const struct vfs_ops tar_op = {
     .seek = tarfs_seek,
     .pread = tarfs_pread,
     .readdir = tarfs_readdir,
+    .getdents = tarfs_getdents,
+
+    .dcache_supported = 1,
 };
 
 static inline unsigned long long oct2int(const char * oct_data, size_t n) {
@@ -295,7 +298,7 @@ static char is_valid_node(const struct tar_node * root, const struct tar_node *
     return 1;
 }
 
-int tarfs_lookup(superblock_t * sb, inode_t * last, const char * pathname, inode_t ** inode_out, unsigned short flags) {
+int tarfs_lookup(superblock_t * sb, inode_t * last, const char * pathname, inode_t ** inode_out, unsigned int flags) {
     if (!pathname) return -EFAULT;
     if (!sb) return -EFAULT;
     if (!inode_out) return -EFAULT;
@@ -473,4 +476,70 @@ ssize_t tarfs_readdir(file_descriptor_t * fd, struct dirent * dent, size_t dent_
     fd->off = offset;
     rw_spinlock_release_write(&fd->access_lock);
     return dent->d_reclen;
-}
\ No newline at end of file
+}
+
+// walks the inner list once instead of from the start for every entry
+ssize_t tarfs_getdents(file_descriptor_t * fd, void * buf, size_t n, off_t offset) {
+    kassert(buf);
+
+    kassert(fd);
+    kassert(fd->inode);
+    kassert(fd->inode->id);
+    kassert(fd->inode->backing_superblock);
+
+    superblock_t * sb = fd->inode->backing_superblock;
+    struct tar_node * root = sb->data;
+    const struct tar_node * this = (void*)(uintptr_t)fd->inode->id;
+
+    if (!is_valid_node(root, this)) panic("Invalid this/root TARFS node combo!");
+
+    const struct tar_node * entry = this->inner;
+    for (off_t i = 2; i < offset && entry != NULL; i++)
+        entry = entry->next;
+
+    size_t pos = 0;
+    for (;; offset++) {
+        const char * name;
+        ino_t ino;
+        unsigned char type;
+        if (offset == 0) {
+            name = ".";
+            ino = this->record_offset;
+            type = DT_DIR;
+        } else if (offset == 1) {
+            name = "..";
+            ino = this->upper->record_offset;
+            type = DT_DIR;
+        } else {
+            if (entry == NULL)
+                break;
+            name = entry->path_fragment;
+            ino = entry->record_offset;
+            type = IFTODT(entry->mode);
+        }
+
+        const size_t reclen = DIRENT_RECLEN(strlen(name));
+        if (pos + reclen > n) {
+            if (pos == 0)
+                return -EINVAL;
+            break;
+        }
+        struct dirent * dent = buf + pos;
+        *dent = (struct dirent) {
+            .d_ino = ino,
+            .d_off = offset,
+            .d_reclen = reclen,
+            .d_type = type,
+        };
+        memcpy(dent->d_name, name, strlen(name) + 1);
+        pos += reclen;
+
+        if (offset >= 2)
+            entry = entry->next;
+    }
+
+    rw_spinlock_acquire_write(&fd->access_lock);
+    fd->off = offset;
+    rw_spinlock_release_write(&fd->access_lock);
+    return pos;
+}
@@ -0,0 +1,839 @@
+// asynchronous I/O rings, every ring is an anonymous misc char device like epoll, with its struct uring in dev_private
+// uring_enter() prepares the submitted entries in the process' context (resolving the fds, pinning the buffers' frames)
+// and hands them to a pool of kernel workers, which do the I/O through a kernel mapping of the pinned frames
+// with URING_SETUP_SQPOLL, a kernel thread takes new entries by itself, but it can't look into the process,
+// so it only takes entries with registered files and buffers and leaves the rest to uring_enter()
+
+#include "fs/fs.h"
+#include "fs/poll.h"
+#include "fs/uring.h"
+#include "dev_ops.h"
+#include "kernel.h"
+#include "kernel_sched.h"
+#include "mm/kernel_memory.h"
+#include <errno.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+
+#define URING_WORKERS 4
+#define URING_SQPOLL_MAX 8 // rings with an sq poller at once
+#define URING_SQ_IDLE_DEFAULT 1000 // ms
+
+#define URING_REQ_RELEASE 0xFF // not an sqe opcode, drops the inode's reference from a worker, see uring_close
+
+struct uring;
+
+struct uring_req {
+    struct uring * ring; // referenced
+    uint64_t user_data;
+    uint8_t opcode;
+    uint32_t op_flags;
+
+    file_descriptor_t * file; // referenced
+    off_t off; // -1 = file position
+    size_t len;
+
+    size_t page_off; // of the buffer in its first page
+    size_t page_count;
+    char pinned; // the frames are ours to unpin, otherwise they belong to a registered buffer
+    void ** pages; // physical
+
+    struct uring_req * next;
+};
+
+struct uring_fixed_buf {
+    uintptr_t addr;
+    size_t len;
+    void ** pages; // pinned frames
+};
+
+struct uring {
+    spinlock_t lock; // the cq, inflight and refs
+    spinlock_t submit_lock; // the sq and the registered files and buffers, may be held across sleeps
+    size_t refs; // the inode, every request in flight and the sq poller during its pass
+
+    // the shared pages, mapped into the kernel at shared
+    void ** frames;
+    size_t frame_count;
+    struct uring_shared * shared;
+    struct uring_sqe * sqes;
+    struct uring_cqe * cqes;
+    uint32_t sqes_off, cqes_off;
+
+    // our own copies of the indexes, the shared ones are only ever written to
+    uint32_t sq_entries, cq_entries;
+    uint32_t sq_head, cq_tail;
+    size_t inflight; // cqes reserved by submitted requests that didn't complete yet, so that the cq can't overflow
+
+    thread_queue_t cq_queue; // URING_ENTER_GETEVENTS
+    volatile char cq_triggered;
+    struct poll_waitq poll_waitq;
+
+    file_descriptor_t * files[URING_FIXED_FILES_MAX]; // referenced
+    size_t file_count;
+    struct uring_fixed_buf bufs[URING_FIXED_BUFFERS_MAX];
+    size_t buf_count;
+
+    char sqpoll;
+    char sq_asleep;
+    int sq_idle;
+    time_t sq_deadline;
+
+    struct uring_req release;
+};
+
+static spinlock_t uring_work_lock = {0};
+static struct uring_req * uring_work_head = NULL, * uring_work_tail = NULL;
+static thread_queue_t uring_work_queue = {0};
+
+static spinlock_t uring_sqpoll_lock = {0};
+static struct uring * uring_sqpoll_rings[URING_SQPOLL_MAX] = {0};
+static thread_queue_t uring_sqpoll_queue = {0};
+static volatile char uring_sqpoll_wanted = 0;
+
+static void uring_get(struct uring * ring) {
+    spinlock_acquire(&ring->lock);
+    ring->refs++;
+    spinlock_release(&ring->lock);
+}
+
+static void uring_unpin(void ** pages, size_t count) {
+    for (size_t i = 0; i < count; i++)
+        pffree(pages[i]);
+}
+
+// don't call with kernel_inode_lock held, closes the registered files
+static void uring_put(struct uring * ring) {
+    spinlock_acquire(&ring->lock);
+    const size_t refs = --ring->refs;
+    spinlock_release(&ring->lock);
+    if (refs != 0) return;
+
+    for (size_t i = 0; i < ring->buf_count; i++) {
+        uring_unpin(ring->bufs[i].pages, (ring->bufs[i].addr % PAGE_SIZE + ring->bufs[i].len + PAGE_SIZE - 1) / PAGE_SIZE);
+        kfree(ring->bufs[i].pages);
+    }
+    for (size_t i = 0; i < ring->file_count; i++) {
+        if (ring->files[i] != NULL)
+            close_file(ring->files[i]);
+    }
+
+    paging_unmap(ring->shared, ring->frame_count * PAGE_SIZE);
+    kvaddr_free(ring->shared);
+    for (size_t i = 0; i < ring->frame_count; i++)
+        pffree(ring->frames[i]);
+    kfree(ring->frames);
+    kfree(ring);
+}
+
+static void uring_queue_work(struct uring_req * req) {
+    req->next = NULL;
+    spinlock_acquire(&uring_work_lock);
+    if (uring_work_tail) uring_work_tail->next = req;
+    else uring_work_head = req;
+    uring_work_tail = req;
+    spinlock_release(&uring_work_lock);
+    // no reschedule, so that a batch gets queued up before the workers start taking it apart
+    thread_queue_unblock_nonreentrant(&uring_work_queue);
+}
+
+// takes a cq slot for an entry about to be submitted, 0 if the cq could overflow
+static char uring_reserve_cqe(struct uring * ring) {
+    char ret = 0;
+    spinlock_acquire(&ring->lock);
+    uint32_t unread = ring->cq_tail - __atomic_load_n(&ring->shared->cq.head, __ATOMIC_ACQUIRE);
+    if (unread > ring->cq_entries) // garbage from userspace
+        unread = ring->cq_entries;
+    if (unread + ring->inflight < ring->cq_entries) {
+        ring->inflight++;
+        ret = 1;
+    }
+    spinlock_release(&ring->lock);
+    return ret;
+}
+
+// fills the slot reserved by uring_reserve_cqe
+static void uring_post_cqe(struct uring * ring, uint64_t user_data, int32_t res) {
+    spinlock_acquire(&ring->lock);
+    ring->cqes[ring->cq_tail & (ring->cq_entries - 1)] = (struct uring_cqe) {
+        .user_data = user_data,
+        .res = res,
+    };
+    __atomic_store_n(&ring->shared->cq.tail, ++ring->cq_tail, __ATOMIC_RELEASE);
+    ring->inflight--;
+    ring->cq_triggered = 1;
+    thread_queue_unblock_all_nonreentrant(&ring->cq_queue);
+    spinlock_release(&ring->lock);
+
+    poll_wake(&ring->poll_waitq, POLLIN);
+}
+
+static void uring_complete(struct uring_req * req, long res) {
+    struct uring * ring = req->ring;
+    uring_post_cqe(ring, req->user_data, res);
+
+    if (req->pinned)
+        uring_unpin(req->pages, req->page_count);
+    if (req->file != NULL)
+        close_file(req->file);
+    kfree(req);
+    uring_put(ring);
+}
+
+// the buffer gets mapped into the kernel only for the duration of the I/O, so that requests sitting in the queue don't eat up the arena
+static long uring_do_rw(struct uring_req * req) {
+    void * buf = kvaddr_alloc(req->page_count);
+    if (buf == NULL) return -ENOMEM;
+    for (size_t i = 0; i < req->page_count; i++)
+        paging_map_phys_addr(req->pages[i], buf + i * PAGE_SIZE, PTE_PDE_PAGE_WRITABLE);
+
+    long ret;
+    if (req->opcode == URING_OP_READ || req->opcode == URING_OP_READ_FIXED)
+        ret = req->off < 0 ?
+            read_file(req->file, buf + req->page_off, req->len) :
+            pread_file(req->file, buf + req->page_off, req->len, req->off);
+    else
+        ret = req->off < 0 ?
+            write_file(req->file, buf + req->page_off, req->len) :
+            pwrite_file(req->file, buf + req->page_off, req->len, req->off);
+
+    paging_unmap(buf, req->page_count * PAGE_SIZE);
+    kvaddr_free(buf);
+    return ret;
+}
+
+static __attribute__((noreturn)) void uring_worker(void * arg) {
+    while (1) {
+        asm volatile("cli"); // a request queued between the check and the queue add would be missed otherwise
+        if (uring_work_head == NULL) {
+            thread_queue_add(&uring_work_queue, kernel_task, current_thread, SCHED_UNINTERR_SLEEP);
+            asm volatile("sti");
+            continue;
+        }
+        spinlock_acquire(&uring_work_lock);
+        struct uring_req * req = uring_work_head;
+        uring_work_head = req->next;
+        if (uring_work_head == NULL)
+            uring_work_tail = NULL;
+        spinlock_release(&uring_work_lock);
+        asm volatile("sti");
+
+        long ret = 0;
+        switch (req->opcode) {
+            case URING_REQ_RELEASE:
+                uring_put(req->ring);
+                continue;
+            case URING_OP_READ:
+            case URING_OP_WRITE:
+            case URING_OP_READ_FIXED:
+            case URING_OP_WRITE_FIXED:
+                ret = uring_do_rw(req);
+                break;
+            case URING_OP_FSYNC:
+                ret = fsync_file(req->file, (req->op_flags & URING_FSYNC_DATASYNC) != 0);
+                break;
+            default:
+                ret = -EINVAL;
+                break;
+        }
+        uring_complete(req, ret);
+    }
+}
+
+// pins the frames of a userspace buffer of the current process
+// needs to be called inside a syscall, the held vm_lock keeps kswapd away until the frames are pinned
+static long uring_pin_user(uintptr_t addr, size_t len, char writable, void ** pages) {
+    const uintptr_t first = addr & ~(PAGE_SIZE - 1);
+    const size_t count = (addr - first + len + PAGE_SIZE - 1) / PAGE_SIZE;
+    for (size_t i = 0; i < count; i++) {
+        void * page = (void*)(first + i * PAGE_SIZE);
+        // faults the page in, and breaks CoW if we're going to write into it
+        if (!paging_check_address_range(page, PAGE_SIZE, writable, 0)) {
+            uring_unpin(pages, i);
+            return -EFAULT;
+        }
+        const PAGE_TABLE_TYPE * pte = paging_get_pte(page);
+        void * frame = pte ? (void*)(*pte & ~(PAGE_SIZE - 1)) : NULL;
+        // not a frame we manage, device mappings for example
+        if (frame == NULL || !(*pte & PTE_PDE_PAGE_PRESENT) || pf_get_refcount(frame) == 0) {
+            uring_unpin(pages, i);
+            return -EFAULT;
+        }
+        // a saturated reference counter hands out a copy, which wouldn't be the process' page anymore
+        void * pinned = pfalloc_ref_inc(frame);
+        if (pinned != frame) {
+            if (pinned != NULL)
+                pffree(pinned);
+            uring_unpin(pages, i);
+            return -ENOMEM;
+        }
+        pages[i] = frame;
+    }
+    return 0;
+}
+
+static char is_uring_file(const file_descriptor_t * file) {
+    return file != NULL && file->inode != NULL &&
+        S_ISCHR(file->inode->mode) && file->inode->device == GET_DEV(DEV_MAJ_MISC, DEV_MISC_URING);
+}
+
+// takes a reference of the fd's file, NULL if not open
+static file_descriptor_t * uring_get_fd(int fd) {
+    if (fd < 0 || fd >= FD_LIMIT_PROCESS) return NULL;
+
+    spinlock_acquire(&current_process->lock);
+    file_descriptor_t * file = current_process->fds[fd];
+    if (file != NULL)
+        __atomic_add_fetch(&file->instances, 1, __ATOMIC_ACQUIRE);
+    spinlock_release(&current_process->lock);
+    return file;
+}
+
+// the sq poller can only do entries that don't need the submitting process
+static char uring_sqe_pollable(const struct uring_sqe * sqe) {
+    switch (sqe->opcode) {
+        case URING_OP_NOP:
+            return 1;
+        case URING_OP_READ_FIXED:
+        case URING_OP_WRITE_FIXED:
+        case URING_OP_FSYNC:
+            return (sqe->flags & URING_SQE_FIXED_FILE) != 0;
+        default:
+            return 0;
+    }
+}
+
+// acquire submit_lock before this
+// returns a request for the workers in req_out, or 0/-errno to complete with right away
+static long uring_prep(struct uring * ring, const struct uring_sqe * sqe, char from_poller, struct uring_req ** req_out) {
+    *req_out = NULL;
+
+    file_descriptor_t * file = NULL;
+    if (sqe->flags & URING_SQE_FIXED_FILE) {
+        if (sqe->fd < 0 || (size_t)sqe->fd >= ring->file_count || ring->files[sqe->fd] == NULL)
+            return -EBADF;
+        file = ring->files[sqe->fd];
+        __atomic_add_fetch(&file->instances, 1, __ATOMIC_ACQUIRE);
+    } else {
+        kassert(!from_poller);
+        file = uring_get_fd(sqe->fd);
+        if (file == NULL)
+            return -EBADF;
+    }
+
+    // pipes and ttys can block for as long as they like, which would take a worker away from every ring
+    if (sqe->opcode != URING_OP_FSYNC && (S_ISFIFO(file->inode->mode) || S_ISCHR(file->inode->mode))) {
+        close_file(file);
+        return -ESPIPE;
+    }
+
+    const char fixed = sqe->opcode == URING_OP_READ_FIXED || sqe->opcode == URING_OP_WRITE_FIXED;
+    const char reading = sqe->opcode == URING_OP_READ || sqe->opcode == URING_OP_READ_FIXED;
+    const size_t len = sqe->len > URING_IO_MAX ? URING_IO_MAX : sqe->len;
+    const uintptr_t addr = sqe->addr;
+
+    if (sqe->opcode == URING_OP_FSYNC || len == 0) {
+        if (sqe->opcode != URING_OP_FSYNC) {
+            close_file(file);
+            return 0;
+        }
+        struct uring_req * req = kalloc(sizeof(struct uring_req));
+        if (req == NULL) {
+            close_file(file);
+            return -ENOMEM;
+        }
+        *req = (struct uring_req) {.opcode = sqe->opcode, .op_flags = sqe->op_flags, .file = file};
+        *req_out = req;
+        return 0;
+    }
+
+    if (addr + len < addr) {
+        close_file(file);
+        return -EFAULT;
+    }
+    const size_t page_count = (addr % PAGE_SIZE + len + PAGE_SIZE - 1) / PAGE_SIZE;
+
+    struct uring_req * req = kalloc(sizeof(struct uring_req) + (fixed ? 0 : page_count * sizeof(void*)));
+    if (req == NULL) {
+        close_file(file);
+        return -ENOMEM;
+    }
+    *req = (struct uring_req) {
+        .opcode = sqe->opcode,
+        .file = file,
+        .off = sqe->off < 0 ? -1 : sqe->off,
+        .len = len,
+        .page_off = addr % PAGE_SIZE,
+        .page_count = page_count,
+    };
+
+    long ret = 0;
+    if (fixed) {
+        const struct uring_fixed_buf * buf = sqe->buf_index < ring->buf_count ? &ring->bufs[sqe->buf_index] : NULL;
+        if (buf == NULL || addr < buf->addr || addr + len > buf->addr + buf->len)
+            ret = -EFAULT;
+        else
+            req->pages = buf->pages + (addr / PAGE_SIZE - buf->addr / PAGE_SIZE);
+    } else {
+        req->pages = (void**)(req + 1);
+        ret = uring_pin_user(addr, len, reading, req->pages);
+        req->pinned = ret == 0;
+    }
+    if (ret < 0) {
+        close_file(file);
+        kfree(req);
+        return ret;
+    }
+    *req_out = req;
+    return 0;
+}
+
+// acquire submit_lock before this, the cqe is already reserved
+static void uring_issue(struct uring * ring, const struct uring_sqe * sqe, char from_poller) {
+    long ret = 0;
+    struct uring_req * req = NULL;
+    switch (sqe->opcode) {
+        case URING_OP_NOP:
+            break;
+        case URING_OP_OPENAT:
+            kassert(!from_poller);
+            if (sqe->flags & URING_SQE_FIXED_FILE)
+                ret = -EINVAL;
+            else
+                ret = sys_openat(sqe->fd, (const char *)(uintptr_t)sqe->addr, sqe->op_flags, sqe->len);
+            break;
+        case URING_OP_READ:
+        case URING_OP_WRITE:
+        case URING_OP_READ_FIXED:
+        case URING_OP_WRITE_FIXED:
+        case URING_OP_FSYNC:
+            ret = uring_prep(ring, sqe, from_poller, &req);
+            break;
+        default:
+            ret = -EINVAL;
+            break;
+    }
+
+    if (req != NULL) {
+        req->ring = ring;
+        req->user_data = sqe->user_data;
+        uring_get(ring);
+        uring_queue_work(req);
+        return;
+    }
+    uring_post_cqe(ring, sqe->user_data, ret);
+}
+
+// takes up to to_submit entries off the sq
+// from_poller = called by the sq poller, which stops at the first entry it can't do
+static int uring_submit(struct uring * ring, unsigned to_submit, char from_poller) {
+    int submitted = 0;
+    spinlock_acquire_interruptible(&ring->submit_lock);
+    while ((unsigned)submitted < to_submit) {
+        const uint32_t tail = __atomic_load_n(&ring->shared->sq.tail, __ATOMIC_ACQUIRE);
+        if (ring->sq_head == tail)
+            break;
+
+        // copied, so that userspace can't change it under us
+        const struct uring_sqe sqe = ring->sqes[ring->sq_head & (ring->sq_entries - 1)];
+        if (from_poller && !uring_sqe_pollable(&sqe)) {
+            __atomic_or_fetch(&ring->shared->sq_flags, URING_SQ_NEED_ENTER, __ATOMIC_RELEASE);
+            break;
+        }
+        if (!uring_reserve_cqe(ring)) {
+            if (submitted == 0)
+                submitted = -EBUSY;
+            break;
+        }
+        __atomic_store_n(&ring->shared->sq.head, ++ring->sq_head, __ATOMIC_RELEASE);
+
+        uring_issue(ring, &sqe, from_poller);
+        submitted++;
+    }
+    spinlock_release(&ring->submit_lock);
+    return submitted;
+}
+
+static char uring_sq_empty(struct uring * ring) {
+    return ring->sq_head == __atomic_load_n(&ring->shared->sq.tail, __ATOMIC_ACQUIRE);
+}
+
+static __attribute__((noreturn)) void uring_sqpoll_loop(void * arg) {
+    while (1) {
+        char active = 0;
+        for (int i = 0; i < URING_SQPOLL_MAX; i++) {
+            spinlock_acquire(&uring_sqpoll_lock);
+            struct uring * ring = uring_sqpoll_rings[i];
+            if (ring != NULL && !ring->sq_asleep)
+                uring_get(ring);
+            else
+                ring = NULL;
+            spinlock_release(&uring_sqpoll_lock);
+            if (ring == NULL) continue;
+
+            if (uring_submit(ring, ring->sq_entries, 1) > 0)
+                ring->sq_deadline = poll_deadline(ring->sq_idle);
+            else if (uptime_clicks * RTC_TIME_RESOLUTION_USEC >= ring->sq_deadline) {
+                // tell userspace first and look again, so that an entry submitted in between isn't left behind
+                __atomic_or_fetch(&ring->shared->sq_flags, URING_SQ_NEED_WAKEUP, __ATOMIC_SEQ_CST);
+                if (!uring_sq_empty(ring) && !(ring->shared->sq_flags & URING_SQ_NEED_ENTER))
+                    __atomic_and_fetch(&ring->shared->sq_flags, ~URING_SQ_NEED_WAKEUP, __ATOMIC_RELEASE);
+                else
+                    ring->sq_asleep = 1;
+            }
+            if (!ring->sq_asleep)
+                active = 1;
+            uring_put(ring);
+        }
+
+        if (active) {
+            // polling, but let everyone else run in between the passes
+            reschedule();
+            continue;
+        }
+        asm volatile("cli");
+        if (!uring_sqpoll_wanted)
+            thread_queue_add(&uring_sqpoll_queue, kernel_task, current_thread, SCHED_UNINTERR_SLEEP);
+        uring_sqpoll_wanted = 0;
+        asm volatile("sti");
+    }
+}
+
+static void uring_sqpoll_wake(struct uring * ring) {
+    spinlock_acquire(&uring_sqpoll_lock);
+    ring->sq_deadline = poll_deadline(ring->sq_idle);
+    ring->sq_asleep = 0;
+    __atomic_and_fetch(&ring->shared->sq_flags, ~URING_SQ_NEED_WAKEUP, __ATOMIC_RELEASE);
+    uring_sqpoll_wanted = 1;
+    thread_queue_unblock_nonreentrant(&uring_sqpoll_queue);
+    spinlock_release(&uring_sqpoll_lock);
+}
+
+static short uring_poll(file_descriptor_t * file, struct poll_table * pt) {
+    struct uring * ring = file->inode->dev_private;
+    poll_wait(&ring->poll_waitq, pt);
+    return ring->cq_tail != __atomic_load_n(&ring->shared->cq.head, __ATOMIC_ACQUIRE) ? POLLIN | POLLRDNORM : 0;
+}
+
+static long uring_mmap(inode_t * inode, int prot, off_t off, void * start, size_t len) {
+    struct uring * ring = inode->dev_private;
+    if (off != 0 || len > ring->frame_count * PAGE_SIZE)
+        return -EINVAL;
+
+    int mapping_flags = 0;
+    if (prot)
+        mapping_flags |= PTE_PDE_PAGE_USER_ACCESS;
+    if (prot & PROT_WRITE)
+        mapping_flags |= PTE_PDE_PAGE_WRITABLE;
+    for (size_t i = 0; i < (len + PAGE_SIZE - 1) / PAGE_SIZE; i++)
+        paging_map_phys_addr(ring->frames[i], start + i * PAGE_SIZE, mapping_flags);
+    return 0;
+}
+
+static long uring_close(inode_t * inode) {
+    struct uring * ring = inode->dev_private;
+    if (ring == NULL) return 0;
+
+    if (ring->sqpoll) {
+        spinlock_acquire(&uring_sqpoll_lock);
+        for (int i = 0; i < URING_SQPOLL_MAX; i++) {
+            if (uring_sqpoll_rings[i] == ring)
+                uring_sqpoll_rings[i] = NULL;
+        }
+        spinlock_release(&uring_sqpoll_lock);
+    }
+    inode->dev_private = NULL;
+    inode->dev_opened = 0;
+
+    // we're under kernel_inode_lock and closing the registered files would take it again, so a worker drops the reference
+    ring->release = (struct uring_req) {.ring = ring, .opcode = URING_REQ_RELEASE};
+    uring_queue_work(&ring->release);
+    return 0;
+}
+
+static const struct dev_operations uring_ops = {
+    .poll  = uring_poll,
+    .mmap  = uring_mmap,
+    .close = uring_close,
+};
+
+void uring_init() {
+    dev_register_ops(GET_DEV(DEV_MAJ_MISC, DEV_MISC_URING), &uring_ops);
+
+    spinlock_acquire(&scheduler_lock);
+    for (int i = 0; i < URING_WORKERS; i++)
+        kassert(kernel_create_thread(kernel_task, current_thread, uring_worker, NULL, 0));
+    kassert(kernel_create_thread(kernel_task, current_thread, uring_sqpoll_loop, NULL, 0));
+    spinlock_release(&scheduler_lock);
+}
+
+static struct uring * uring_alloc(unsigned entries) {
+    struct uring * ring = kalloc(sizeof(struct uring));
+    if (ring == NULL) return NULL;
+    memset(ring, 0, sizeof(struct uring));
+
+    ring->refs = 1;
+    ring->sq_entries = entries;
+    ring->cq_entries = entries * 2;
+    ring->sqes_off = (sizeof(struct uring_shared) + 63) & ~63;
+    ring->cqes_off = (ring->sqes_off + entries * sizeof(struct uring_sqe) + 63) & ~63;
+    const size_t size = ring->cqes_off + ring->cq_entries * sizeof(struct uring_cqe);
+    ring->frame_count = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+
+    ring->frames = kalloc(ring->frame_count * sizeof(void*));
+    if (ring->frames == NULL) {
+        kfree(ring);
+        return NULL;
+    }
+    ring->shared = kvaddr_alloc(ring->frame_count);
+    if (ring->shared == NULL) {
+        kfree(ring->frames);
+        kfree(ring);
+        return NULL;
+    }
+    for (size_t i = 0; i < ring->frame_count; i++) {
+        ring->frames[i] = pfalloc();
+        if (ring->frames[i] == NULL) {
+            paging_unmap(ring->shared, i * PAGE_SIZE);
+            kvaddr_free(ring->shared);
+            for (size_t j = 0; j < i; j++)
+                pffree(ring->frames[j]);
+            kfree(ring->frames);
+            kfree(ring);
+            return NULL;
+        }
+        paging_map_phys_addr(ring->frames[i], (void*)ring->shared + i * PAGE_SIZE, PTE_PDE_PAGE_WRITABLE);
+    }
+    memset(ring->shared, 0, ring->frame_count * PAGE_SIZE);
+
+    ring->sqes = (void*)ring->shared + ring->sqes_off;
+    ring->cqes = (void*)ring->shared + ring->cqes_off;
+    ring->shared->sq.mask = ring->sq_entries - 1;
+    ring->shared->sq.entries = ring->sq_entries;
+    ring->shared->cq.mask = ring->cq_entries - 1;
+    ring->shared->cq.entries = ring->cq_entries;
+    return ring;
+}
+
+int sys_uring_setup(unsigned entries, struct uring_params * params) {
+    if (entries == 0 || entries > URING_ENTRIES_MAX) return -EINVAL;
+    if (params->flags & ~(URING_SETUP_SQPOLL | URING_SETUP_CLOEXEC)) return -EINVAL;
+
+    unsigned rounded = 1;
+    while (rounded < entries)
+        rounded <<= 1;
+
+    struct uring * ring = uring_alloc(rounded);
+    if (ring == NULL) return -ENOMEM;
+
+    int slot = -1;
+    if (params->flags & URING_SETUP_SQPOLL) {
+        ring->sqpoll = 1;
+        ring->sq_idle = params->sq_idle ? params->sq_idle : URING_SQ_IDLE_DEFAULT;
+        ring->sq_deadline = poll_deadline(ring->sq_idle);
+
+        spinlock_acquire(&uring_sqpoll_lock);
+        for (int i = 0; i < URING_SQPOLL_MAX; i++) {
+            if (uring_sqpoll_rings[i] == NULL) {
+                slot = i;
+                uring_sqpoll_rings[i] = (void*)1; // taken, the ring isn't usable until we have an fd
+                break;
+            }
+        }
+        spinlock_release(&uring_sqpoll_lock);
+        if (slot < 0) {
+            uring_put(ring);
+            return -EAGAIN;
+        }
+    }
+
+    spinlock_acquire(&kernel_inode_lock);
+
+    inode_t * ring_inode = get_free_inode();
+    kassert(ring_inode);
+
+    ring_inode->mode = S_IFCHR | 0600;
+    ring_inode->device = GET_DEV(DEV_MAJ_MISC, DEV_MISC_URING);
+    ring_inode->dev_private = ring;
+    ring_inode->dev_opened = 1;
+
+    const int fd = get_fd_from_inode(ring_inode, O_RDWR | (params->flags & URING_SETUP_CLOEXEC ? O_CLOEXEC : 0));
+    if (fd < 0)
+        ring_inode->instances = 0;
+    spinlock_release(&kernel_inode_lock);
+
+    if (slot >= 0) {
+        spinlock_acquire(&uring_sqpoll_lock);
+        uring_sqpoll_rings[slot] = fd < 0 ? NULL : ring;
+        spinlock_release(&uring_sqpoll_lock);
+    }
+    if (fd < 0) {
+        uring_put(ring);
+        return fd;
+    }
+    if (ring->sqpoll)
+        uring_sqpoll_wake(ring);
+
+    params->sq_entries = ring->sq_entries;
+    params->cq_entries = ring->cq_entries;
+    params->sqes_off = ring->sqes_off;
+    params->cqes_off = ring->cqes_off;
+    params->ring_size = ring->frame_count * PAGE_SIZE;
+    return fd;
+}
+
+static int uring_wait_cqes(struct uring * ring, unsigned min_complete) {
+    if (min_complete > ring->cq_entries)
+        min_complete = ring->cq_entries;
+    while (1) {
+        ring->cq_triggered = 0;
+        const uint32_t unread = ring->cq_tail - __atomic_load_n(&ring->shared->cq.head, __ATOMIC_ACQUIRE);
+        if (unread >= min_complete)
+            return 0;
+        if (check_eintr())
+            return -EINTR;
+        poll_sleep(&ring->cq_queue, &ring->cq_triggered, -1);
+    }
+}
+
+int sys_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    if (flags & ~(URING_ENTER_GETEVENTS | URING_ENTER_SQ_WAKEUP)) return -EINVAL;
+
+    file_descriptor_t * file = uring_get_fd(fd);
+    if (file == NULL) return -EBADF;
+    if (!is_uring_file(file)) {
+        close_file(file);
+        return -EINVAL;
+    }
+    struct uring * ring = file->inode->dev_private;
+
+    if (ring->sqpoll && flags & URING_ENTER_SQ_WAKEUP)
+        uring_sqpoll_wake(ring);
+
+    int ret = 0;
+    if (to_submit) {
+        __atomic_and_fetch(&ring->shared->sq_flags, ~URING_SQ_NEED_ENTER, __ATOMIC_RELEASE);
+        ret = uring_submit(ring, to_submit, 0);
+    }
+    if (ret >= 0 && flags & URING_ENTER_GETEVENTS) {
+        int wait = uring_wait_cqes(ring, min_complete);
+        if (wait < 0 && ret == 0)
+            ret = wait;
+    }
+
+    close_file(file);
+    return ret;
+}
+
+static int uring_register_buffers(struct uring * ring, const struct iovec * iov, unsigned nr) {
+    if (ring->buf_count) return -EBUSY;
+    if (nr == 0 || nr > URING_FIXED_BUFFERS_MAX) return -EINVAL;
+
+    for (unsigned i = 0; i < nr; i++) {
+        const uintptr_t addr = (uintptr_t)iov[i].iov_base;
+        const size_t len = iov[i].iov_len;
+        long ret = 0;
+        if (len == 0 || len > URING_FIXED_BUFFER_SIZE_MAX || addr + len < addr)
+            ret = -EINVAL;
+
+        void ** pages = NULL;
+        if (ret == 0) {
+            pages = kalloc((addr % PAGE_SIZE + len + PAGE_SIZE - 1) / PAGE_SIZE * sizeof(void*));
+            ret = pages == NULL ? -ENOMEM : uring_pin_user(addr, len, 1, pages);
+        }
+        if (ret < 0) {
+            kfree(pages);
+            for (unsigned j = 0; j < i; j++) {
+                uring_unpin(ring->bufs[j].pages, (ring->bufs[j].addr % PAGE_SIZE + ring->bufs[j].len + PAGE_SIZE - 1) / PAGE_SIZE);
+                kfree(ring->bufs[j].pages);
+            }
+            return ret;
+        }
+        ring->bufs[i] = (struct uring_fixed_buf) {.addr = addr, .len = len, .pages = pages};
+    }
+    ring->buf_count = nr;
+    return 0;
+}
+
+static int uring_register_files(struct uring * ring, const int * fds, unsigned nr) {
+    if (ring->file_count) return -EBUSY;
+    if (nr == 0 || nr > URING_FIXED_FILES_MAX) return -EINVAL;
+
+    for (unsigned i = 0; i < nr; i++) {
+        ring->files[i] = NULL;
+        if (fds[i] == -1) continue;
+
+        file_descriptor_t * file = uring_get_fd(fds[i]);
+        // a ring holding a reference of itself (or of another ring holding one of it) would never get closed
+        if (file == NULL || is_uring_file(file)) {
+            if (file != NULL)
+                close_file(file);
+            for (unsigned j = 0; j < i; j++) {
+                if (ring->files[j] != NULL)
+                    close_file(ring->files[j]);
+                ring->files[j] = NULL;
+            }
+            return file == NULL ? -EBADF : -EINVAL;
+        }
+        ring->files[i] = file;
+    }
+    ring->file_count = nr;
+    return 0;
+}
+
+int sys_uring_register(int fd, unsigned opcode, const void * arg, unsigned nr_args) {
+    file_descriptor_t * file = uring_get_fd(fd);
+    if (file == NULL) return -EBADF;
+    if (!is_uring_file(file)) {
+        close_file(file);
+        return -EINVAL;
+    }
+    struct uring * ring = file->inode->dev_private;
+
+    spinlock_acquire_interruptible(&ring->submit_lock);
+    spinlock_acquire(&ring->lock);
+    const size_t inflight = ring->inflight;
+    spinlock_release(&ring->lock);
+
+    int ret = 0;
+    switch (opcode) {
+        case URING_REGISTER_BUFFERS:
+            ret = uring_register_buffers(ring, arg, nr_args);
+            break;
+        case URING_REGISTER_FILES:
+            ret = uring_register_files(ring, arg, nr_args);
+            break;
+        case URING_UNREGISTER_BUFFERS:
+            if (ring->buf_count == 0) ret = -ENXIO;
+            else if (inflight) ret = -EBUSY;
+            else {
+                for (size_t i = 0; i < ring->buf_count; i++) {
+                    uring_unpin(ring->bufs[i].pages, (ring->bufs[i].addr % PAGE_SIZE + ring->bufs[i].len + PAGE_SIZE - 1) / PAGE_SIZE);
+                    kfree(ring->bufs[i].pages);
+                }
+                ring->buf_count = 0;
+            }
+            break;
+        case URING_UNREGISTER_FILES:
+            if (ring->file_count == 0) ret = -ENXIO;
+            else {
+                // requests hold their own references
+                for (size_t i = 0; i < ring->file_count; i++) {
+                    if (ring->files[i] != NULL)
+                        close_file(ring->files[i]);
+                    ring->files[i] = NULL;
+                }
+                ring->file_count = 0;
+            }
+            break;
+        default:
+            ret = -EINVAL;
+            break;
+    }
+    spinlock_release(&ring->submit_lock);
+
+    close_file(file);
+    return ret;
+}
@@ -3,6 +3,7 @@
 #include "fat_structs.h"
 #include "fat_internal.h"
 #include "kernel.h"
+#include "dev_ops.h"
 #include <errno.h>
 #include <string.h>
 #include <sys/stat.h>
@@ -337,6 +338,173 @@ ssize_t fat_readdir(file_descriptor_t * fd, struct dirent * dent, size_t dent_si
     return dent->d_reclen;
 }
 
+// returns 0 if the entry doesn't fit anymore
+static char fat_getdents_emit(void * buf, size_t n, size_t * pos, ino_t ino, off_t offset, unsigned char type, const char * name) {
+    const size_t reclen = DIRENT_RECLEN(strlen(name));
+    if (*pos + reclen > n)
+        return 0;
+
+    struct dirent * dent = buf + *pos;
+    *dent = (struct dirent) {
+        .d_ino = ino,
+        .d_off = offset,
+        .d_reclen = reclen,
+        .d_type = type,
+    };
+    strcpy(dent->d_name, name);
+    *pos += reclen;
+    return 1;
+}
+
+// unlike fat_readdir, walks the directory just once and reads it a sector at a time
+ssize_t fat_getdents(file_descriptor_t * fd, void * buf, size_t n, off_t offset) {
+    kassert(fd);
+    kassert(fd->inode);
+    kassert(fd->inode->backing_superblock);
+    kassert(fd->inode->backing_superblock->data);
+
+    if (!buf)
+        return -EFAULT;
+
+    struct fat_info * fi = fd->inode->backing_superblock->data;
+    superblock_t * sb = fd->inode->backing_superblock;
+
+    size_t pos = 0;
+    ssize_t ret = 0;
+    char full = 0;
+
+    // . and .. are made up in fat_readdir for the root directory, reuse it
+    while (offset < 2) {
+        _Alignas(struct dirent) char dent_buf[sizeof(struct dirent) + 13];
+        struct dirent * dent = (struct dirent *)dent_buf;
+        ret = fat_readdir(fd, dent, sizeof(dent_buf), offset);
+        if (ret <= 0)
+            return ret;
+        if (!fat_getdents_emit(buf, n, &pos, dent->d_ino, offset, dent->d_type, dent->d_name)) {
+            full = 1;
+            goto end;
+        }
+        offset++;
+    }
+
+    struct fat_dir_entry * sector = kalloc(fi->bytes_per_sector);
+    if (sector == NULL)
+        return pos ? (ssize_t)pos : -ENOMEM;
+
+    sigset_t mask = PAUSE_SIGNALS();
+    if (check_eintr()) {
+        RESTORE_SIGNALS(mask);
+        kfree(sector);
+        return pos ? (ssize_t)pos : -EINTR;
+    }
+
+    const size_t entries_per_sector = fi->bytes_per_sector / sizeof(struct fat_dir_entry);
+    off_t current_offset = fd->inode->id ? 0 : 2; // root doesn't have "." and ".."
+    char done = 0;
+    ret = 0;
+
+    size_t dir_cluster = 0;
+    if (fd->inode->id) {
+        struct fat_dir_entry dentry_buf;
+        if (pread_file(sb->fd,
+                &dentry_buf, sizeof(dentry_buf),
+                fd->inode->id) != sizeof(dentry_buf)
+        ) {
+            ret = -EIO;
+            goto err;
+        }
+        dir_cluster = dentry_buf.start_cluster;
+        if (fi->type == FAT32)
+            dir_cluster |= dentry_buf.fat32_cluster_hi << 16;
+    } else if (fi->type == FAT32)
+        dir_cluster = fi->root_dir_cluster;
+
+    size_t cluster_limit = fi->type == FAT12 ?
+        FAT_CLUSTER_END_FAT12 :
+        fi->type == FAT16 ?
+            FAT_CLUSTER_END_FAT16 :
+            FAT_CLUSTER_END_FAT32;
+
+    rw_spinlock_acquire_read(&fi->fs_lock);
+    size_t visited_clusters = 0;
+    while (!done) {
+        // the fat12/16 root directory is a single run of sectors outside of the data area
+        off_t run_start;
+        size_t run_sectors;
+        if (!fd->inode->id && fi->type != FAT32) {
+            run_start = fi->fat12.root_dir_sector * fi->bytes_per_sector;
+            run_sectors = (fi->fat12.root_dir_entries + entries_per_sector - 1) / entries_per_sector;
+        } else {
+            if (dir_cluster < 2) {
+                ret = -EIO;
+                break;
+            }
+            if (dir_cluster >= cluster_limit || visited_clusters >= fi->max_chain_len)
+                break;
+            run_start = (fi->data_sector_start + (dir_cluster - 2) * fi->sectors_per_cluster) * (off_t)fi->bytes_per_sector;
+            run_sectors = fi->sectors_per_cluster;
+        }
+
+        for (size_t s = 0; s < run_sectors && !done; s++) {
+            const off_t sector_off = run_start + s * fi->bytes_per_sector;
+            if (pread_file(sb->fd, sector, fi->bytes_per_sector, sector_off) != fi->bytes_per_sector) {
+                ret = -EIO;
+                done = 1;
+                break;
+            }
+            for (size_t i = 0; i < entries_per_sector; i++) {
+                const struct fat_dir_entry * e = &sector[i];
+                if ((unsigned char)e->name[0] == FAT_DIR_FREE) continue;
+                if (e->name[0] == FAT_DIR_END) {
+                    done = 1;
+                    break;
+                }
+                if (e->attr & FAT_DENTRY_ATTR_VOLLBL) continue;
+                if (current_offset >= offset) {
+                    char name[13];
+                    fat_short_to_name(e->name, name);
+                    if (!fat_getdents_emit(buf, n, &pos,
+                            sector_off + i * sizeof(struct fat_dir_entry), current_offset,
+                            e->attr & FAT_DENTRY_ATTR_SUBDIR ? DT_DIR : DT_REG, name)) {
+                        full = 1;
+                        done = 1;
+                        break;
+                    }
+                    offset = current_offset + 1;
+                }
+                current_offset++;
+            }
+        }
+        if (done)
+            break;
+
+        if (!fd->inode->id && fi->type != FAT32)
+            break;
+        dir_cluster = fat_next_in_chain(dir_cluster, sb);
+        if (dir_cluster < 2 || dir_cluster == -1) {
+            ret = -EIO;
+            break;
+        }
+        visited_clusters++;
+    }
+    rw_spinlock_release_read(&fi->fs_lock);
+
+    err:
+    RESTORE_SIGNALS(mask);
+    kfree(sector);
+    // an error after some entries were already filled in gets reported on the next call
+    if (ret < 0 && pos == 0)
+        return ret;
+
+    end:
+    if (pos == 0 && full)
+        return -EINVAL;
+    rw_spinlock_acquire_write(&fd->access_lock);
+    fd->off = offset;
+    rw_spinlock_release_write(&fd->access_lock);
+    return pos;
+}
+
 off_t fat_seek(file_descriptor_t * fd, off_t off, int whence) {
     kassert(fd);
     kassert(fd->inode);
@@ -1388,31 +1556,19 @@ int fat_trunc(inode_t * file, off_t length) {
     return ret;
 }
 
-int fat_release(inode_t * file) {
-    kassert(file);
-    kassert(file->backing_superblock);
-    kassert(file->backing_superblock->data);
-    superblock_t * sb = file->backing_superblock;
-    struct fat_info * fi = sb->data;
-    if (file->id == 0) return 0;
-    if (file->nlink == 0) return 0; // nothing to sync
-
-    int ret = 0;
-
-    rw_spinlock_acquire_write(&fi->fs_lock);
-    sigset_t mask = PAUSE_SIGNALS();
-    int old_sig = current_thread->sa_to_be_handled;
-    current_thread->sa_to_be_handled = 0;
-
+// writes the size and timestamps the vfs keeps in the inode into the dentry
+// the sector doesn't get dirtied if nothing changed, atime only has a granularity of a day
+// requires the fs lock for writing and signals paused
+static int fat_store_dentry(inode_t * file, superblock_t * sb) {
     struct fat_dir_entry dentry_buf = {0};
 
     if (pread_file(sb->fd,
         &dentry_buf, sizeof(dentry_buf),
         file->id) != sizeof(dentry_buf)
     ) {
-        ret = -EIO;
-        goto err;
+        return -EIO;
     }
+    const struct fat_dir_entry old = dentry_buf;
 
     dentry_buf.size = (size_t)file->size;
     struct fat_date fd;
@@ -1423,14 +1579,176 @@ int fat_release(inode_t * file) {
     fat_epoch_to_time(file->atime, &ft, &fd);
     dentry_buf.adate = fd;
 
+    if (memcmp(&old, &dentry_buf, sizeof(dentry_buf)) == 0)
+        return 0;
+
     if (pwrite_file(sb->fd,
         &dentry_buf, sizeof(dentry_buf),
         file->id) != sizeof(dentry_buf)
+    ) {
+        return -EIO;
+    }
+    return 0;
+}
+
+int fat_write_times(inode_t * file) {
+    kassert(file);
+    kassert(file->backing_superblock);
+    kassert(file->backing_superblock->data);
+    superblock_t * sb = file->backing_superblock;
+    struct fat_info * fi = sb->data;
+    if (file->id == 0) return 0; // the root directory has no dentry
+    if (file->nlink == 0) return 0;
+
+    rw_spinlock_acquire_write(&fi->fs_lock);
+    sigset_t mask = PAUSE_SIGNALS();
+    int old_sig = current_thread->sa_to_be_handled;
+    current_thread->sa_to_be_handled = 0;
+
+    int ret = fat_store_dentry(file, sb);
+
+    current_thread->sa_to_be_handled = old_sig;
+    RESTORE_SIGNALS(mask);
+    rw_spinlock_release_write(&fi->fs_lock);
+    return ret;
+}
+
+// everything but the timestamps is written as it changes
+int fat_release(inode_t * file) {
+    return fat_write_times(file);
+}
+
+// writes back a run of consecutive clusters and their entries in all copies of the FAT
+// requires the fs lock
+static int fat_sync_run(size_t first, size_t count, superblock_t * sb) {
+    struct fat_info * fi = sb->data;
+    int ret = 0;
+
+    if (sync_range_dev(sb->fd,
+        (off_t)(fi->data_sector_start + (first - 2) * fi->sectors_per_cluster) * fi->bytes_per_sector,
+        (off_t)count * fi->sectors_per_cluster * fi->bytes_per_sector) < 0
     ) {
         ret = -EIO;
     }
 
-    err:
+    off_t entries_start, entries_end;
+    switch (fi->type) {
+        case FAT12:
+            entries_start = first * 3 / 2;
+            entries_end = (first + count - 1) * 3 / 2 + sizeof(uint16_t);
+            break;
+        case FAT16:
+            entries_start = first * sizeof(uint16_t);
+            entries_end = (first + count) * sizeof(uint16_t);
+            break;
+        default:
+            entries_start = (off_t)first * sizeof(uint32_t);
+            entries_end = (off_t)(first + count) * sizeof(uint32_t);
+            break;
+    }
+    for (size_t i = 0; i < fi->fat_copies; i++) {
+        if (sync_range_dev(sb->fd,
+            (off_t)(fi->fat_start_sector + i*fi->sectors_per_fat)*fi->bytes_per_sector + entries_start,
+            entries_end - entries_start) < 0
+        ) {
+            ret = -EIO;
+        }
+    }
+    return ret;
+}
+
+// only what belongs to the file goes to the disk: its clusters, their FAT entries and its dentry
+// clusters freed by a truncation aren't tracked, at worst they stay allocated after a crash
+int fat_fsync(inode_t * file, char datasync) {
+    kassert(file);
+    kassert(file->backing_superblock);
+    kassert(file->backing_superblock->data);
+    superblock_t * sb = file->backing_superblock;
+    struct fat_info * fi = sb->data;
+
+    size_t cluster_limit = fi->type == FAT12 ?
+        FAT_CLUSTER_END_FAT12 :
+        fi->type == FAT16 ?
+            FAT_CLUSTER_END_FAT16 :
+            FAT_CLUSTER_END_FAT32;
+
+    int ret = 0;
+
+    rw_spinlock_acquire_write(&fi->fs_lock);
+    sigset_t mask = PAUSE_SIGNALS();
+    int old_sig = current_thread->sa_to_be_handled;
+    current_thread->sa_to_be_handled = 0;
+
+    size_t cluster;
+    if (file->id == 0) {
+        // the root directory has no dentry, and outside of FAT32 no clusters either
+        if (fi->type != FAT32) {
+            if (sync_range_dev(sb->fd,
+                (off_t)fi->fat12.root_dir_sector * fi->bytes_per_sector,
+                fi->fat12.root_dir_entries * sizeof(struct fat_dir_entry)) < 0
+            ) {
+                ret = -EIO;
+            }
+            goto end_write;
+        }
+        cluster = fi->root_dir_cluster;
+    } else {
+        if (file->nlink == 0) // the dentry and clusters are gone already
+            goto end_write;
+
+        // size and allocation are written to the dentry as they change, the timestamps only on release
+        if (!datasync) {
+            ret = fat_store_dentry(file, sb);
+            if (ret < 0)
+                goto end_write;
+        }
+
+        struct fat_dir_entry dentry_buf = {0};
+        if (pread_file(sb->fd,
+            &dentry_buf, sizeof(dentry_buf),
+            file->id) != sizeof(dentry_buf)
+        ) {
+            ret = -EIO;
+            goto end_write;
+        }
+        cluster = dentry_buf.start_cluster;
+        if (fi->type == FAT32)
+            cluster |= dentry_buf.fat32_cluster_hi << 16;
+
+        if (sync_range_dev(sb->fd, file->id, sizeof(dentry_buf)) < 0)
+            ret = -EIO;
+    }
+
+    // nothing gets allocated from here on
+    rw_spinlock_downgrade(&fi->fs_lock);
+
+    // consecutive clusters are synced as one range
+    size_t run_start = 0, run_len = 0;
+    for (size_t i = 0; cluster >= 2 && cluster < cluster_limit && i <= fi->data_clusters; i++) {
+        if (run_len != 0 && cluster != run_start + run_len) {
+            if (fat_sync_run(run_start, run_len, sb) < 0)
+                ret = -EIO;
+            run_len = 0;
+        }
+        if (run_len == 0)
+            run_start = cluster;
+        run_len++;
+
+        cluster = fat_next_in_chain(cluster, sb);
+        if (cluster == -1) {
+            ret = -EIO;
+            break;
+        }
+    }
+    if (run_len != 0 && fat_sync_run(run_start, run_len, sb) < 0)
+        ret = -EIO;
+
+    current_thread->sa_to_be_handled = old_sig;
+    RESTORE_SIGNALS(mask);
+    rw_spinlock_release_read(&fi->fs_lock);
+    return ret;
+
+    end_write:
     current_thread->sa_to_be_handled = old_sig;
     RESTORE_SIGNALS(mask);
     rw_spinlock_release_write(&fi->fs_lock);
@@ -1442,6 +1760,7 @@ const struct vfs_ops fat_op = {
     .fs_deinit = fat_deinit,
     .lookup    = fat_lookup,
     .readdir   = fat_readdir,
+    .getdents  = fat_getdents,
     .seek      = fat_seek,
     .pread     = fat_pread,
     .pwrite    = fat_pwrite,
@@ -1450,9 +1769,12 @@ const struct vfs_ops fat_op = {
     .mkdir     = fat_mkdir,
     .rename    = fat_rename,
     .trunc     = fat_trunc,
+    .fsync     = fat_fsync,
     .release   = fat_release,
+    .write_times = fat_write_times,
 
     .utimes_supported = 1,
+    .dcache_supported = 1,
     .min_atime = 315532800, // 01/01/1980 00:00:00
     .min_mtime = 315532800,
     .min_ctime = 315532800,
@@ -176,7 +176,7 @@ off_t fat_get_parent(off_t dentry, superblock_t * sb, struct fat_dir_entry * out
     return -ENOENT;
 }
 
-int fat_lookup(superblock_t * sb, inode_t * last, const char * pathname, inode_t ** inode_out, unsigned short flags) {
+int fat_lookup(superblock_t * sb, inode_t * last, const char * pathname, inode_t ** inode_out, unsigned int flags) {
     if (!pathname) return -EFAULT;
     if (!sb) return -EFAULT;
     if (!inode_out) return -EFAULT;
@@ -42,29 +42,54 @@ void gfx_swap_buffers() {
     current_video_funcs->swap_region(0, display_width - 1, 0, display_height - 1);
 }
 
+// pre-expanded glyphs, keyed by the raw colors of the driver, so mode switches don't need a flush
+// (the same raw values always expand to the same pixels, interpreting them is up to blit_rect)
+// direct mapped, a collision just means expanding the glyph again
+#define GLYPH_CACHE_SLOTS 128
+#define GLYPH_CACHE_MAX_PIXELS 256 // 8x16 at 1x, 8x8 at 2x, bigger glyphs get expanded a row at a time
+#define GLYPH_ROW_MAX_PIXELS 128
+
+struct glyph_cache_entry {
+    char valid;
+    unsigned int c;
+    unsigned int size_mult;
+    uint32_t fg, bg;
+    uint32_t pixels[GLYPH_CACHE_MAX_PIXELS];
+};
+static struct glyph_cache_entry glyph_cache[GLYPH_CACHE_SLOTS];
+spinlock_t glyph_cache_lock = {0};
+
 void load_font(
     const unsigned char * console_font_bitmap, unsigned int chars,
     unsigned int char_width, unsigned int char_height
 ) {
     if (char_width == 0 || char_height == 0) return;
+    spinlock_acquire_interruptible(&glyph_cache_lock);
     console_font_width = char_width;
     console_font_height = char_height;
 
     console_font = console_font_bitmap;
     console_font_chars = chars;
+
+    for (int i = 0; i < GLYPH_CACHE_SLOTS; i++)
+        glyph_cache[i].valid = 0;
+    spinlock_release(&glyph_cache_lock);
 }
 
-void gfx_blit_char_buffered(
+static void gfx_expand_glyph_row(uint32_t * row, unsigned int c, unsigned int fy, uint32_t fg, uint32_t bg, unsigned int size_mult) {
+    unsigned char bits = console_font[c * console_font_height + fy/size_mult];
+    for (unsigned int fx = 0; fx < console_font_width * size_mult; fx++)
+        row[fx] = bits & (1 << (7 - fx/size_mult)) ? fg : bg;
+}
+
+// for drivers without blit_rect and glyphs too wide for the row buffer
+static void gfx_blit_char_pixelwise(
     unsigned int c,
     unsigned int x, unsigned int y,
     uint32_t fg_color, uint32_t bg_color,
     char use_palette,
     unsigned int size_mult
 ) {
-    if (size_mult == 0) return;
-    if (c >= console_font_chars) return;
-    if (x >= display_width || y >= display_height) return;
-
     for (unsigned int fy = 0; fy < console_font_height * size_mult; fy++) {
         if (fy + y >= display_height) break;
         for (unsigned int fx = 0; fx < console_font_width * size_mult; fx++) {
@@ -80,6 +105,53 @@ void gfx_blit_char_buffered(
     }
 }
 
+void gfx_blit_char_buffered(
+    unsigned int c,
+    unsigned int x, unsigned int y,
+    uint32_t fg_color, uint32_t bg_color,
+    char use_palette,
+    unsigned int size_mult
+) {
+    if (size_mult == 0) return;
+    if (c >= console_font_chars) return;
+    if (x >= display_width || y >= display_height) return;
+
+    const struct gfx_funcs * funcs = current_video_funcs;
+    unsigned int width  = console_font_width * size_mult;
+    unsigned int height = console_font_height * size_mult;
+    if (funcs->blit_rect == NULL || funcs->map_color == NULL || width > GLYPH_ROW_MAX_PIXELS) {
+        gfx_blit_char_pixelwise(c, x, y, fg_color, bg_color, use_palette, size_mult);
+        return;
+    }
+
+    uint32_t fg = funcs->map_color(fg_color, use_palette);
+    uint32_t bg = funcs->map_color(bg_color, use_palette);
+
+    if (width * height > GLYPH_CACHE_MAX_PIXELS) {
+        uint32_t row[GLYPH_ROW_MAX_PIXELS];
+        for (unsigned int fy = 0; fy < height && fy + y < display_height; fy++) {
+            gfx_expand_glyph_row(row, c, fy, fg, bg, size_mult);
+            funcs->blit_rect(x, y + fy, width, 1, row, width);
+        }
+        return;
+    }
+
+    // the cursor blinks from the RTC interrupt and skips drawing while this is held
+    spinlock_acquire_interruptible(&glyph_cache_lock);
+    struct glyph_cache_entry * entry = &glyph_cache[(c * 31 + fg * 17 + bg * 7 + size_mult) % GLYPH_CACHE_SLOTS];
+    if (!entry->valid || entry->c != c || entry->size_mult != size_mult || entry->fg != fg || entry->bg != bg) {
+        for (unsigned int fy = 0; fy < height; fy++)
+            gfx_expand_glyph_row(entry->pixels + fy * width, c, fy, fg, bg, size_mult);
+        entry->c = c;
+        entry->size_mult = size_mult;
+        entry->fg = fg;
+        entry->bg = bg;
+        entry->valid = 1;
+    }
+    funcs->blit_rect(x, y, width, height, entry->pixels, width);
+    spinlock_release(&glyph_cache_lock);
+}
+
 void gfx_blit_char(
     unsigned int c,
     unsigned int x, unsigned int y,
@@ -99,35 +171,42 @@ void gfx_hw_scroll_scanlines(unsigned int scanline) {
 }
 
 #include "mm/kernel_memory.h"
+#include "lowlevel.h"
 // part of early init
 // not thread safe, so disables interrupts
 spinlock_t framebuffer_lock = {0};
-uint32_t * back_framebuffer = NULL;
+void * back_framebuffer = NULL;
 size_t back_framebuffer_w = 0;
 size_t back_framebuffer_h = 0;
+size_t back_framebuffer_pitch = 0;
+unsigned int back_framebuffer_pixel_size = 0;
 
 void gfx_unmap_back_framebuffer() {
     spinlock_acquire(&framebuffer_lock);
 
     back_framebuffer_w = 0;
     back_framebuffer_h = 0;
+    back_framebuffer_pitch = 0;
+    back_framebuffer_pixel_size = 0;
     kfree(back_framebuffer);
     back_framebuffer = NULL;
 
     spinlock_release(&framebuffer_lock);
 }
 
-void * gfx_realloc_back_framebuffer(size_t width, size_t height) {
+void * gfx_realloc_back_framebuffer(size_t width, size_t height, size_t pitch, unsigned int pixel_size) {
     spinlock_acquire(&framebuffer_lock); // needs to disable interrupts
     kfree(back_framebuffer);
 
-    if (width * height * sizeof(uint32_t) <= BACK_FRAMEBUFFER_MAX_SIZE &&
-        kalloc_get_free_memory() > width * height * sizeof(uint32_t) * 2 &&
-        pf_get_free_memory() > width * height * sizeof(uint32_t) * 10
+    if (height * pitch <= BACK_FRAMEBUFFER_MAX_SIZE &&
+        kalloc_get_free_memory() > height * pitch * 2 &&
+        pf_get_free_memory() > height * pitch * 10
     ) {
-        back_framebuffer = kalloc(width * height * sizeof(uint32_t));
+        back_framebuffer = kalloc(height * pitch);
         back_framebuffer_w = width;
         back_framebuffer_h = height;
+        back_framebuffer_pitch = pitch;
+        back_framebuffer_pixel_size = pixel_size;
 
         if (back_framebuffer == NULL) {
             alloc_failed:
@@ -143,7 +222,7 @@ void * gfx_realloc_back_framebuffer(size_t width, size_t height) {
 
             return NULL;
         }
-        memset(back_framebuffer, 0, width * height * sizeof(uint32_t));
+        memset(back_framebuffer, 0, height * pitch);
     } else goto alloc_failed;
     spinlock_release(&framebuffer_lock);
 
@@ -151,6 +230,8 @@ void * gfx_realloc_back_framebuffer(size_t width, size_t height) {
 }
 
 size_t framebuffer_size = 0;
+size_t framebuffer_display_offset = 0;
+unsigned int framebuffer_cache_flags = 0;
 void * gfx_remap_framebuffer(void * phys_start, size_t fb_size, unsigned int flags) {
     if (phys_start == NULL) {
         kprintf("Warning: specified NULL framebuffer address, ignoring request\n");
@@ -167,18 +248,52 @@ void * gfx_remap_framebuffer(void * phys_start, size_t fb_size, unsigned int fla
         fb_size = LINEAR_FRAMEBUFFER_MAX_SIZE;
     }
 
+    // write-combining turns swaps and userspace pixel writes into burst transfers
+    unsigned int large_flags = flags;
+    if (!(flags & (PTE_PDE_PAGE_WRITE_THROUGH | PTE_PDE_PAGE_DONT_CACHE))) {
+        if (memtype_wc_flags(0)) {
+            flags |= memtype_wc_flags(0);
+            large_flags |= memtype_wc_flags(1);
+        } else if (mtrr_available) {
+            long ret = memtype_mtrr_set_wc(phys_start, fb_size);
+            if (ret < 0)
+                kprintf("Warning: couldn't make the framebuffer write-combining (%ld)\n", ret);
+        }
+    }
+
+    // nobody may copy the kernel page directory until the new PDEs are synced everywhere
+    spinlock_acquire(&address_spaces_lock);
     spinlock_acquire(&framebuffer_lock); // needs to disable interrupts
 
     framebuffer_size = fb_size;
+    framebuffer_cache_flags = flags;
+
+    // mapped the same way in every address space
+    if (pge_available) {
+        flags |= PTE_PDE_PAGE_GLOBAL;
+        large_flags |= PTE_PDE_PAGE_GLOBAL;
+    }
 
     // first unmap everything so that we don't try to doublemap later
     paging_unmap(LINEAR_FRAMEBUFFER_START, LINEAR_FRAMEBUFFER_MAX_SIZE);
-    for (size_t chunk = 0; chunk < fb_size / PAGE_SIZE_NO_PAE; chunk++) {
-        paging_map_phys_addr(phys_start + chunk*PAGE_SIZE_NO_PAE,
-            LINEAR_FRAMEBUFFER_START + chunk*PAGE_SIZE_NO_PAE,
+
+    // as much as possible in 4MiB pages, a full redraw then needs a handful of tlb entries instead of hundreds
+    size_t mapped = 0;
+    if (pse_available && !((unsigned long)phys_start & (PAGE_SIZE_LARGE_NO_PAE - 1))) {
+        for (; mapped + PAGE_SIZE_LARGE_NO_PAE <= fb_size; mapped += PAGE_SIZE_LARGE_NO_PAE)
+            paging_map_phys_addr_large(phys_start + mapped,
+                LINEAR_FRAMEBUFFER_START + mapped,
+                PTE_PDE_PAGE_WRITABLE | large_flags);
+    }
+    for (; mapped < fb_size; mapped += PAGE_SIZE_NO_PAE) {
+        paging_map_phys_addr(phys_start + mapped,
+            LINEAR_FRAMEBUFFER_START + mapped,
             PTE_PDE_PAGE_WRITABLE | flags);
     }
+    paging_sync_kernel_pdes(LINEAR_FRAMEBUFFER_START, LINEAR_FRAMEBUFFER_MAX_SIZE);
+
     spinlock_release(&framebuffer_lock);
+    spinlock_release(&address_spaces_lock);
 
     return LINEAR_FRAMEBUFFER_START;
 }
\ No newline at end of file
@@ -53,6 +53,7 @@ void bga_set_res(unsigned int x, unsigned int y);
 static unsigned int bga_max_xres   = 0;
 static unsigned int bga_max_yres   = 0;
 static void * bga_framebuffer_phys = NULL;
+static size_t bga_framebuffer_size = 0; // the whole VRAM, the screen pans around in it
 
 char bga_init(struct pci_device device) {
     extern char vga_only;
@@ -60,6 +61,7 @@ char bga_init(struct pci_device device) {
         return -1;
     struct pci_bar framebuffer_bar = pci_get_bar(device.bus, device.device, device.function, 0);
     bga_framebuffer_phys = framebuffer_bar.base_address;
+    bga_framebuffer_size = framebuffer_bar.size;
 
     uint16_t bga_version = bga_read_register(BGA_REG_ID);
     if (bga_version < BGA_MINIMUM_SUPPORTED_VERSION) {
@@ -80,11 +82,19 @@ char bga_init(struct pci_device device) {
         kprintf("bga: Device doesn't support at least 32 bpp");
         return -1;
     }
+    if (bga_framebuffer_size < bga_max_xres * bga_max_yres * 4)
+        bga_framebuffer_size = bga_max_xres * bga_max_yres * 4;
+    if (bga_framebuffer_size > LINEAR_FRAMEBUFFER_MAX_SIZE)
+        bga_framebuffer_size = LINEAR_FRAMEBUFFER_MAX_SIZE;
     bga_set_res(bga_max_xres, bga_max_yres);
 
     return 0;
 }
 
+static void bga_set_display_start(unsigned int scanline) {
+    bga_write_register(BGA_REG_Y_OFFSET, scanline);
+}
+
 void bga_set_res(unsigned int x, unsigned int y) {
     if (x > bga_max_xres || y > bga_max_yres) {
         kprintf("bga: Warning: tried to set a resolution too high\n");
@@ -111,16 +121,23 @@ void bga_set_res(unsigned int x, unsigned int y) {
     bga_write_register(BGA_REG_BPP, 32);
 
     // bga is fast enough that it doesn't require double buffering
-    //gfx_realloc_back_framebuffer(bga_max_xres, bga_max_yres);
+    //gfx_realloc_back_framebuffer(bga_max_xres, bga_max_yres, bga_max_xres * 4, 4);
     gfx_unmap_back_framebuffer();
 
-    gfx_remap_framebuffer(bga_framebuffer_phys, bga_max_xres * bga_max_yres * 4, 0);
+    gfx_remap_framebuffer(bga_framebuffer_phys, bga_framebuffer_size, 0);
 
     bga_write_register(BGA_REG_ENABLE, 1 | BGA_LFB_ENABLE);
 
+    // the rest of the VRAM below the screen is room for hw scrolling
+    // the device clamps the virtual height to its memory, so read back what we actually got
+    unsigned int virtual_height = bga_framebuffer_size / (bga_max_xres * 4);
+    if (virtual_height > 0xFFFF) virtual_height = 0xFFFF;
+    bga_write_register(BGA_REG_VIRT_YRES, virtual_height);
+    virtual_height = bga_read_register(BGA_REG_VIRT_YRES);
+
     // assuming BGA has a larger/the same framebuffer size as VBE, which it should
     extern size_t vbe_framebuffer_size;
-    vbe_framebuffer_size = bga_max_xres * bga_max_yres * 4;
+    vbe_framebuffer_size = bga_framebuffer_size;
 
     // having these numbers wrong just means broken video for a short while so no framebuffer locking needed
     // in case of pitch, nothing happens
@@ -140,6 +157,7 @@ void bga_set_res(unsigned int x, unsigned int y) {
     display_width  = bga_max_xres;
     display_height = bga_max_yres;
 
+    vbe_set_panning(virtual_height, bga_set_display_start);
 
     spinlock_release(&gfx_spinlock);
 }
@@ -0,0 +1,194 @@
+// Cirrus Logic GD5446 (qemu -vga cirrus), driven as a VBE linear framebuffer with the BitBLT engine doing fills and copies
+// the card is set up through VBE, so the accelerated ops replace the vbe_funcs ones
+// and fall back to them for modes the engine can't address
+
+#include "kernel.h"
+#include "lowlevel.h"
+#include "pci/pci.h"
+#include "cirrus.h"
+#include "gfx/vbe.h"
+#include "gfx/vga.h"
+#include "gfx.h"
+#include <string.h>
+
+extern const struct VBE_modes_list * vbe_current_mode;
+static void * cirrus_framebuffer_phys = NULL;
+
+static char cirrus_usable() {
+    if (vbe_current_mode == NULL) return 0;
+    if (vbe_current_mode->info.framebuffer_paddr != (uintptr_t)cirrus_framebuffer_phys) return 0; // mode set by something else
+    if (vbe_current_mode->info.pitch > CIRRUS_BLT_MAX_PITCH) return 0;
+    if (vbe_current_mode->info.pitch * display_height > CIRRUS_BLT_MAX_ADDR) return 0;
+    if (display_height > CIRRUS_BLT_MAX_HEIGHT) return 0;
+    switch (vbe_current_mode->info.bpp) {
+        case 8: case 15: case 16: case 24: case 32:
+            return display_width * ((vbe_current_mode->info.bpp + 7) / 8) <= CIRRUS_BLT_MAX_WIDTH;
+        default:
+            return 0;
+    }
+}
+
+static unsigned int cirrus_bytes_per_pixel() {
+    return (vbe_current_mode->info.bpp + 7) / 8;
+}
+
+static uint8_t cirrus_pixel_width() {
+    switch (vbe_current_mode->info.bpp) {
+        case 15:
+        case 16: return CIRRUS_BLTMODE_PIXELWIDTH16;
+        case 24: return CIRRUS_BLTMODE_PIXELWIDTH24;
+        case 32: return CIRRUS_BLTMODE_PIXELWIDTH32;
+        default: return CIRRUS_BLTMODE_PIXELWIDTH8;
+    }
+}
+
+static void cirrus_wreg16(uint8_t index, uint16_t value) {
+    vga_wreg(VGA_GC_DATA_REG, index, value);
+    vga_wreg(VGA_GC_DATA_REG, index + 1, value >> 8);
+}
+
+static void cirrus_wreg24(uint8_t index, uint32_t value) {
+    cirrus_wreg16(index, value);
+    vga_wreg(VGA_GC_DATA_REG, index + 2, value >> 16);
+}
+
+// acquire framebuffer_lock before this, addresses are byte offsets into the VRAM
+static void cirrus_blt(uint32_t dest, uint32_t src, unsigned int width_bytes, unsigned int height, uint8_t mode, uint8_t mode_ext) {
+    unsigned int pitch = vbe_current_mode->info.pitch;
+
+    cirrus_wreg16(CIRRUS_GR_BLT_WIDTH, width_bytes - 1);
+    cirrus_wreg16(CIRRUS_GR_BLT_HEIGHT, height - 1);
+    cirrus_wreg16(CIRRUS_GR_BLT_DEST_PITCH, pitch);
+    cirrus_wreg16(CIRRUS_GR_BLT_SRC_PITCH, pitch);
+    cirrus_wreg24(CIRRUS_GR_BLT_DEST_ADDR, dest);
+    cirrus_wreg24(CIRRUS_GR_BLT_SRC_ADDR, src);
+    vga_wreg(VGA_GC_DATA_REG, CIRRUS_GR_BLT_MODE, mode | cirrus_pixel_width());
+    vga_wreg(VGA_GC_DATA_REG, CIRRUS_GR_BLT_MODE_EXT, mode_ext);
+    vga_wreg(VGA_GC_DATA_REG, CIRRUS_GR_BLT_ROP, CIRRUS_ROP_SRC);
+
+    vga_wreg(VGA_GC_DATA_REG, CIRRUS_GR_BLT_STATUS, CIRRUS_BLT_START);
+    while (vga_rreg(VGA_GC_DATA_REG, CIRRUS_GR_BLT_STATUS) & CIRRUS_BLT_BUSY)
+        asm volatile("pause");
+}
+
+// acquire framebuffer_lock before this
+static void cirrus_blt_copy(unsigned int x, unsigned int y, unsigned int width, unsigned int height, unsigned int final_x, unsigned int final_y) {
+    unsigned int bpp = cirrus_bytes_per_pixel();
+    unsigned int pitch = vbe_current_mode->info.pitch;
+    uint32_t src  = y * pitch + x * bpp;
+    uint32_t dest = final_y * pitch + final_x * bpp;
+
+    if (dest > src) { // overlapping copies downwards have to go from the end
+        uint32_t last = (height - 1) * pitch + width * bpp - 1;
+        cirrus_blt(dest + last, src + last, width * bpp, height, CIRRUS_BLTMODE_BACKWARDS, 0);
+    } else
+        cirrus_blt(dest, src, width * bpp, height, 0, 0);
+}
+
+// the back framebuffer gets the same treatment in ram so that later swaps agree with the VRAM
+void cirrus_fill_buffered(unsigned int start_x, unsigned int end_x, unsigned start_y, unsigned int end_y, uint32_t color, char use_palette) {
+    if (!cirrus_usable()) {
+        vbe_fill_buffered(start_x, end_x, start_y, end_y, color, use_palette);
+        return;
+    }
+    if (start_x >= display_width)  start_x = display_width - 1;
+    if (start_y >= display_height) start_y = display_height - 1;
+
+    if (end_x >= display_width) end_x = display_width - 1;
+    if (end_y >= display_height) end_y = display_height - 1;
+    if (end_x < start_x || end_y < start_y) return;
+
+    uint32_t raw = vbe_map_color(color, use_palette);
+
+    spinlock_acquire_interruptible(&framebuffer_lock);
+    if (back_framebuffer != NULL &&
+        display_width == back_framebuffer_w &&
+        display_height == back_framebuffer_h)
+    {
+        vbe_fill_back_framebuffer(start_x, end_x, start_y, end_y, raw);
+    }
+
+    vga_wreg(VGA_GC_DATA_REG, CIRRUS_GR_FG_COLOR_0, raw);
+    vga_wreg(VGA_GC_DATA_REG, CIRRUS_GR_FG_COLOR_1, raw >> 8);
+    vga_wreg(VGA_GC_DATA_REG, CIRRUS_GR_FG_COLOR_2, raw >> 16);
+    vga_wreg(VGA_GC_DATA_REG, CIRRUS_GR_FG_COLOR_3, raw >> 24);
+    cirrus_blt(start_y * vbe_current_mode->info.pitch + start_x * cirrus_bytes_per_pixel(), 0,
+        (end_x - start_x + 1) * cirrus_bytes_per_pixel(), end_y - start_y + 1,
+        CIRRUS_BLTMODE_PATTERNCOPY | CIRRUS_BLTMODE_COLOREXPAND, CIRRUS_BLTMODEEXT_SOLIDFILL);
+    spinlock_release(&framebuffer_lock);
+}
+
+// copies what's on screen, anything only drawn into the back framebuffer has to be swapped first
+void cirrus_copy_region_unbuffered(unsigned int x, unsigned int y, unsigned int width, unsigned int height, unsigned int final_x, unsigned int final_y) {
+    if (!cirrus_usable()) {
+        vbe_copy_region_unbuffered(x, y, width, height, final_x, final_y);
+        return;
+    }
+    if (final_x >= display_width || final_y >= display_height) return;
+    if (final_x == x && final_y == y) return;
+
+    if (x >= display_width)  x = display_width - 1;
+    if (y >= display_height) y = display_height - 1;
+
+    if (x + width > display_width) width = display_width - x;
+    if (y + height > display_height) height = display_height - y;
+
+    if (final_x + width > display_width) width = display_width - final_x;
+    if (final_y + height > display_height) height = display_height - final_y;
+    if (width == 0 || height == 0) return;
+
+    spinlock_acquire_interruptible(&framebuffer_lock);
+    if (back_framebuffer != NULL &&
+        display_width == back_framebuffer_w &&
+        display_height == back_framebuffer_h)
+    {
+        vbe_copy_back_framebuffer(x, y, width, height, final_x, final_y);
+    }
+    cirrus_blt_copy(x, y, width, height, final_x, final_y);
+    spinlock_release(&framebuffer_lock);
+}
+
+void cirrus_hw_shift_scanlines(unsigned int scanlines) {
+    if (!cirrus_usable()) {
+        vbe_hw_shift_scanlines(scanlines);
+        return;
+    }
+    if (scanlines == -1) return; // the display start never moves
+    if (scanlines == 0) return;
+    if (scanlines >= display_height) scanlines = display_height - 1;
+
+    spinlock_acquire_interruptible(&framebuffer_lock);
+    if (back_framebuffer != NULL) {
+        memmove(back_framebuffer,
+                (uint8_t *)back_framebuffer + scanlines * back_framebuffer_pitch,
+                (back_framebuffer_h - scanlines) * back_framebuffer_pitch);
+    }
+    cirrus_blt_copy(0, scanlines, display_width, display_height - scanlines, 0, 0);
+    spinlock_release(&framebuffer_lock);
+}
+
+char cirrus_init(struct pci_device device) {
+    extern char vga_only;
+    if (vga_only || vbe_current_mode == NULL)
+        return -1;
+
+    struct pci_bar framebuffer_bar = pci_get_bar(device.bus, device.device, device.function, 0);
+    cirrus_framebuffer_phys = framebuffer_bar.base_address;
+
+    vga_wreg(VGA_SEQ_DATA_REG, CIRRUS_SR_UNLOCK, CIRRUS_SR_UNLOCK_KEY);
+    if (vga_rreg(VGA_SEQ_DATA_REG, CIRRUS_SR_UNLOCK) != CIRRUS_SR_UNLOCK_KEY) {
+        kprintf("cirrus: Extended registers didn't unlock, not accelerating\n");
+        return -1;
+    }
+    vga_wreg(VGA_GC_DATA_REG, CIRRUS_GR_EXT_MODE,
+        vga_rreg(VGA_GC_DATA_REG, CIRRUS_GR_EXT_MODE) | CIRRUS_EXT_MODE_8BIT_COLORS);
+
+    if (!cirrus_usable())
+        kprintf("cirrus: Current mode can't be accelerated, using the BitBLT engine only in ones that can\n");
+
+    vbe_funcs.fill_buffered = cirrus_fill_buffered;
+    vbe_funcs.copy_region_unbuffered = cirrus_copy_region_unbuffered;
+    vbe_funcs.hw_shift_scanlines = cirrus_hw_shift_scanlines;
+    kprintf("cirrus: Using the BitBLT engine for fills, copies and scrolling\n");
+    return 0;
+}
@@ -0,0 +1,48 @@
+#ifndef CIRRUS_H
+#define CIRRUS_H
+#include <stdint.h>
+
+// extended graphics controller registers, see the CL-GD5446 technical reference manual
+// (or https://github.com/qemu/qemu/blob/master/hw/display/cirrus_vga.c)
+#define CIRRUS_SR_UNLOCK 0x06 // write CIRRUS_SR_UNLOCK_KEY, reads back 0x12 on cirrus chips
+#define CIRRUS_SR_UNLOCK_KEY 0x12
+
+#define CIRRUS_GR_FG_COLOR_0 0x01 // + 0x11, 0x13, 0x15 for bytes 1-3
+#define CIRRUS_GR_FG_COLOR_1 0x11
+#define CIRRUS_GR_FG_COLOR_2 0x13
+#define CIRRUS_GR_FG_COLOR_3 0x15
+#define CIRRUS_GR_EXT_MODE   0x0B
+#define CIRRUS_EXT_MODE_8BIT_COLORS 0x04 // GR0/GR1 are 8 bits wide
+
+#define CIRRUS_GR_BLT_WIDTH       0x20 // 13 bits, in bytes - 1
+#define CIRRUS_GR_BLT_HEIGHT      0x22 // 11 bits, in lines - 1
+#define CIRRUS_GR_BLT_DEST_PITCH  0x24 // 13 bits
+#define CIRRUS_GR_BLT_SRC_PITCH   0x26
+#define CIRRUS_GR_BLT_DEST_ADDR   0x28 // 22 bits
+#define CIRRUS_GR_BLT_SRC_ADDR    0x2C
+#define CIRRUS_GR_BLT_MODE        0x30
+#define CIRRUS_GR_BLT_STATUS      0x31
+#define CIRRUS_GR_BLT_ROP         0x32
+#define CIRRUS_GR_BLT_MODE_EXT    0x33
+
+#define CIRRUS_BLT_MAX_WIDTH  (1 << 13)
+#define CIRRUS_BLT_MAX_HEIGHT (1 << 11)
+#define CIRRUS_BLT_MAX_PITCH  ((1 << 13) - 1)
+#define CIRRUS_BLT_MAX_ADDR   (1 << 22)
+
+#define CIRRUS_BLTMODE_BACKWARDS   0x01 // addresses point to the last byte, for overlapping copies downwards
+#define CIRRUS_BLTMODE_PATTERNCOPY 0x40
+#define CIRRUS_BLTMODE_COLOREXPAND 0x80
+#define CIRRUS_BLTMODE_PIXELWIDTH8  0x00
+#define CIRRUS_BLTMODE_PIXELWIDTH16 0x10
+#define CIRRUS_BLTMODE_PIXELWIDTH24 0x20
+#define CIRRUS_BLTMODE_PIXELWIDTH32 0x30
+
+#define CIRRUS_BLT_BUSY  0x01
+#define CIRRUS_BLT_START 0x02
+
+#define CIRRUS_ROP_SRC 0x0D
+
+#define CIRRUS_BLTMODEEXT_SOLIDFILL 0x04 // with PATTERNCOPY | COLOREXPAND, fills with the fg color
+
+#endif
@@ -6,6 +6,7 @@
 #include "lowlevel.h"
 #include "kernel.h"
 #include <string.h>
+#include <errno.h>
 
 #include "endian.h"
 #include "mm/kernel_memory.h"
@@ -26,6 +27,50 @@ const struct VBE_modes_list * vbe_current_mode = NULL;
 
 size_t vbe_framebuffer_size = 0;
 
+// the visible screen starts vbe_display_start scanlines into the VRAM
+// hw scrolling advances it while the VRAM has room (vbe_virtual_height scanlines) and copies back to the top only once it runs out
+// the BIOS can only do this (4F07) from a v86 task, which is way too heavy per scroll, so drivers with registers for it set it up
+static unsigned int vbe_virtual_height = 0;
+static unsigned int vbe_display_start = 0;
+static void (*vbe_display_start_hook)(unsigned int scanline) = NULL;
+
+#define VBE_VRAM_ROW(y) (LINEAR_FRAMEBUFFER_START + ((y) + vbe_display_start) * vbe_current_mode->info.pitch)
+#define VBE_BACK_ROW(y) ((uint8_t *)back_framebuffer + (y) * back_framebuffer_pitch)
+#define VBE_PIXEL_SIZE() ((vbe_current_mode->info.bpp + 7) / 8) // 15 bpp takes 2 bytes
+
+// raw values in the native layout, the 24 bpp ones are unaligned
+static inline void vbe_store_raw(uint8_t * dest, uint32_t raw, unsigned int size) {
+    switch (size) {
+        case 1: *dest = raw; break;
+        case 2: *(uint16_t *)dest = raw; break;
+        case 3:
+            dest[0] = raw;
+            dest[1] = raw >> 8;
+            dest[2] = raw >> 16;
+            break;
+        case 4: *(uint32_t *)dest = raw; break;
+    }
+}
+
+static inline uint32_t vbe_load_raw(const uint8_t * src, unsigned int size) {
+    switch (size) {
+        case 1: return *src;
+        case 2: return *(const uint16_t *)src;
+        case 3: return src[0] | src[1] << 8 | src[2] << 16;
+        case 4: return *(const uint32_t *)src;
+        default: return 0;
+    }
+}
+
+static void vbe_fill_raw(uint8_t * dest, uint32_t raw, unsigned int count, unsigned int size) {
+    if (size == 1) {
+        memset(dest, raw, count);
+        return;
+    }
+    for (unsigned int i = 0; i < count; i++)
+        vbe_store_raw(dest + i * size, raw, size);
+}
+
 #define VBE_SIGNATURE "VESA"
 #define VBE2_SIGNATURE "VBE2"
 #define VBE_SUCCESS_AX 0x004F
@@ -170,7 +215,7 @@ unsigned char vbe_set_info(const struct VBE_modes_list * mode) {
     }
     // before mode setting in order for warnings from the realloc to go through with the old callbacks
     // for example VGA (that doesn't use the framebuffer) -> VBE, where reallocating printing a warning would page fault
-    gfx_realloc_back_framebuffer(mode->info.width, mode->info.height);
+    gfx_realloc_back_framebuffer(mode->info.width, mode->info.height, mode->info.pitch, (mode->info.bpp + 7) / 8);
 
     // this will momentarily break all colors :P
     // -> white = blue on mode 12
@@ -178,6 +223,7 @@ unsigned char vbe_set_info(const struct VBE_modes_list * mode) {
 
     vbe_current_mode = mode;
     current_video_funcs = &vbe_funcs;
+    vbe_set_panning(0, NULL);
 
     // ifs to avoid locking operations
     if (display_width > mode->info.width)
@@ -468,55 +514,26 @@ __attribute__((optimize("O3"))) static uint32_t vbe_get_direct_color(uint32_t co
     return direct_color;
 }
 
-// these are unrolled on purpose to minimize conditionals!
+// the back framebuffer has the layout of the VRAM, so this is a straight copy per scanline (24 bpp included)
 __attribute__((optimize("O3"))) void vbe_swap_region(unsigned int start_x, unsigned int end_x, unsigned int start_y, unsigned int end_y) {
     if (back_framebuffer == NULL) return;
     spinlock_acquire_interruptible(&framebuffer_lock);
-    if (start_x >= back_framebuffer_w || start_y >= back_framebuffer_h) {
+    if (start_x >= back_framebuffer_w || start_y >= back_framebuffer_h ||
+        back_framebuffer_pixel_size != VBE_PIXEL_SIZE() // mid mode switch
+    ) {
         spinlock_release(&framebuffer_lock);
         return;
     }
     if (end_x >= back_framebuffer_w) end_x = back_framebuffer_w - 1;
     if (end_y >= back_framebuffer_h) end_y = back_framebuffer_h - 1;
 
-    switch (vbe_current_mode->info.bpp) {
-        case 32:
-            for (unsigned int y = start_y; y <= end_y; y++) {
-                    memcpy(((uint32_t *)LINEAR_FRAMEBUFFER_START) + y * vbe_current_mode->info.pitch / 4 + start_x,
-                        back_framebuffer + y * back_framebuffer_w + start_x,
-                        (end_x - start_x) * (32/8));
-            }
-            break;
-        case 24:
-            for (unsigned int y = start_y; y <= end_y; y++) {
-                for (unsigned int x = start_x; x <= end_x; x++) {
-                    ((uint8_t *)LINEAR_FRAMEBUFFER_START)[y * vbe_current_mode->info.pitch + x * 3 + 0] =
-                        back_framebuffer[y * back_framebuffer_w + x] & 0xFF;
-                    ((uint8_t *)LINEAR_FRAMEBUFFER_START)[y * vbe_current_mode->info.pitch + x * 3 + 1] =
-                        back_framebuffer[y * back_framebuffer_w + x] >> 8 & 0xFF;
-                    ((uint8_t *)LINEAR_FRAMEBUFFER_START)[y * vbe_current_mode->info.pitch + x * 3 + 2] =
-                        back_framebuffer[y * back_framebuffer_w + x] >> 16 & 0xFF;
-                }
-            }
-            break;
-        case 16:
-        case 15:
-            for (unsigned int y = start_y; y <= end_y; y++) {
-                for (unsigned int x = start_x; x <= end_x; x++) {
-                    ((uint16_t *)LINEAR_FRAMEBUFFER_START)[y * vbe_current_mode->info.pitch / 2 + x] =
-                        back_framebuffer[y * back_framebuffer_w + x] & 0xFFFF;
-                }
-            }
-            break;
-        case 8:
-            for (unsigned int y = start_y; y <= end_y; y++) {
-                for (unsigned int x = start_x; x <= end_x; x++) {
-                    ((uint8_t *)LINEAR_FRAMEBUFFER_START)[y * vbe_current_mode->info.pitch + x] =
-                        back_framebuffer[y * back_framebuffer_w + x] & 0xFF;
-                }
-            }
-        default:
-            break;
+    if (start_x == 0 && end_x == back_framebuffer_w - 1 && back_framebuffer_pitch == vbe_current_mode->info.pitch) {
+        memcpy(VBE_VRAM_ROW(start_y), VBE_BACK_ROW(start_y), (end_y - start_y + 1) * back_framebuffer_pitch);
+    } else {
+        size_t offset = start_x * back_framebuffer_pixel_size;
+        size_t len = (end_x - start_x + 1) * back_framebuffer_pixel_size;
+        for (unsigned int y = start_y; y <= end_y; y++)
+            memcpy(VBE_VRAM_ROW(y) + offset, VBE_BACK_ROW(y) + offset, len);
     }
     spinlock_release(&framebuffer_lock);
 }
@@ -528,11 +545,14 @@ struct gfx_funcs vbe_funcs = {
     .clear_screen = vbe_clear,
     .swap_region = vbe_swap_region,
     .write_pixel_buffered = vbe_write_pixel_buffered,
+    .map_color = vbe_map_color,
+    .blit_rect = vbe_blit_rect,
     .fill_buffered = vbe_fill_buffered,
     .copy_region_unbuffered = vbe_copy_region_unbuffered,
     .read_framebuffer = vbe_read_framebuffer,
     .hw_shift_pixels = vbe_hw_shift_pixels,
     .hw_shift_scanlines = vbe_hw_shift_scanlines,
+    .flip = vbe_flip,
     .ioctl = vbe_ioctl
 };
 
@@ -548,7 +568,7 @@ __attribute__((optimize("O3"))) uint32_t vbe_read_framebuffer(unsigned int x, un
         if (y < back_framebuffer_h &&
             x < back_framebuffer_w
         ) {
-            uint32_t color = back_framebuffer[y * back_framebuffer_w + x];
+            uint32_t color = vbe_load_raw(VBE_BACK_ROW(y) + x * back_framebuffer_pixel_size, back_framebuffer_pixel_size);
             spinlock_release(&framebuffer_lock);
             return color;
         }
@@ -556,7 +576,7 @@ __attribute__((optimize("O3"))) uint32_t vbe_read_framebuffer(unsigned int x, un
     spinlock_release(&framebuffer_lock);
 
     // fall back to unbuffered VRAM read - very slow
-    void * dest = LINEAR_FRAMEBUFFER_START + y * vbe_current_mode->info.pitch + x * vbe_current_mode->info.bpp/8;
+    void * dest = VBE_VRAM_ROW(y) + x * VBE_PIXEL_SIZE();
 
     uint32_t read_color = 0;
     switch(vbe_current_mode->info.memory_model) {
@@ -587,7 +607,7 @@ void vbe_clear() {
     spinlock_acquire_interruptible(&framebuffer_lock);
     memset(LINEAR_FRAMEBUFFER_START, 0, vbe_framebuffer_size);
     if (back_framebuffer != NULL) {
-        memset(back_framebuffer, 0, back_framebuffer_w * back_framebuffer_h * sizeof(*back_framebuffer));
+        memset(back_framebuffer, 0, back_framebuffer_h * back_framebuffer_pitch);
     }
     spinlock_release(&framebuffer_lock);
 }
@@ -599,7 +619,7 @@ void vbe_write_framebuffer_buffered(unsigned int x, unsigned int y, uint32_t raw
         if (y < back_framebuffer_h &&
             x < back_framebuffer_w
         ) {
-            back_framebuffer[y * back_framebuffer_w + x] = raw;
+            vbe_store_raw(VBE_BACK_ROW(y) + x * back_framebuffer_pixel_size, raw, back_framebuffer_pixel_size);
         }
     } else
         __vbe_write_framebuffer_unbuffered(x, y, raw);
@@ -609,18 +629,17 @@ void vbe_write_pixel_buffered(unsigned int x, unsigned int y, uint32_t color, ch
     if (y >= display_height) return;
     if (x >= display_width) return;
 
+    vbe_write_framebuffer_buffered(x, y, vbe_map_color(color, use_palette));
+}
+uint32_t vbe_map_color(uint32_t color, char use_palette) {
     if (use_palette) color = console_colors[color & 0xF];
 
-    uint32_t direct_color = vbe_get_direct_color(color);
-    uint32_t packed_color = VGA_RGB32_TO_RGB8(color);
-    if (vbe_current_mode->info.memory_model == VBE_MEMORY_MODEL_PACKED) {
-        vbe_write_framebuffer_buffered(x, y, packed_color);
-    } else {
-        vbe_write_framebuffer_buffered(x, y, direct_color);
-    }
+    if (vbe_current_mode->info.memory_model == VBE_MEMORY_MODEL_PACKED)
+        return VGA_RGB32_TO_RGB8(color);
+    return vbe_get_direct_color(color);
 }
 static void __vbe_write_framebuffer_unbuffered(unsigned int x, unsigned int y, uint32_t raw) {
-    void * dest = LINEAR_FRAMEBUFFER_START + y * vbe_current_mode->info.pitch + x * vbe_current_mode->info.bpp/8;
+    void * dest = VBE_VRAM_ROW(y) + x * VBE_PIXEL_SIZE();
 
     switch(vbe_current_mode->info.memory_model) {
         // 0x00 - 0x03 aren't used at all by us and aren't that common
@@ -666,41 +685,83 @@ static void __vbe_write_framebuffer_unbuffered(unsigned int x, unsigned int y, u
     }
 }
 
-static void __vbe_copy_region_buffered(unsigned int x, unsigned int y, unsigned int width, unsigned int height, unsigned final_x, unsigned int final_y) {
+void vbe_blit_rect(unsigned int x, unsigned int y, unsigned int width, unsigned int height, const uint32_t * pixels, unsigned int stride) {
+    if (x >= display_width || y >= display_height) return;
+    if (x + width > display_width) width = display_width - x;
+    if (y + height > display_height) height = display_height - y;
+
+    spinlock_acquire_interruptible(&framebuffer_lock);
+    if (back_framebuffer != NULL) {
+        if (x < back_framebuffer_w && y < back_framebuffer_h) {
+            if (x + width > back_framebuffer_w) width = back_framebuffer_w - x;
+            if (y + height > back_framebuffer_h) height = back_framebuffer_h - y;
+            for (unsigned int i = 0; i < height; i++) {
+                uint8_t * row = VBE_BACK_ROW(y + i) + x * back_framebuffer_pixel_size;
+                if (back_framebuffer_pixel_size == sizeof(uint32_t)) {
+                    memcpy(row, pixels + i * stride, width * sizeof(uint32_t));
+                    continue;
+                }
+                for (unsigned int j = 0; j < width; j++)
+                    vbe_store_raw(row + j * back_framebuffer_pixel_size, pixels[i * stride + j], back_framebuffer_pixel_size);
+            }
+        }
+    } else if (vbe_current_mode->info.memory_model == VBE_MEMORY_MODEL_DIRECT && vbe_current_mode->info.bpp == 32) {
+        // raw values are already what the VRAM wants, e.g. BGA without a back framebuffer
+        for (unsigned int i = 0; i < height; i++) {
+            memcpy(VBE_VRAM_ROW(y + i) + x * sizeof(uint32_t),
+                pixels + i * stride, width * sizeof(uint32_t));
+        }
+    } else {
+        for (unsigned int i = 0; i < height; i++) {
+            for (unsigned int j = 0; j < width; j++) {
+                __vbe_write_framebuffer_unbuffered(x + j, y + i, pixels[i * stride + j]);
+            }
+        }
+    }
+    spinlock_release(&framebuffer_lock);
+}
+
+void vbe_copy_back_framebuffer(unsigned int x, unsigned int y, unsigned int width, unsigned int height, unsigned int final_x, unsigned int final_y) {
+    size_t size = back_framebuffer_pixel_size;
     if (final_y > y + height || final_y < y) {
         for (unsigned int i = 0; i < height; i++) {
             memmove(
-                back_framebuffer + (final_y + i) * back_framebuffer_w + final_x,
-                back_framebuffer + (y + i)       * back_framebuffer_w + x,
-                width * sizeof(*back_framebuffer)
+                VBE_BACK_ROW(final_y + i) + final_x * size,
+                VBE_BACK_ROW(y + i)       + x * size,
+                width * size
             );
         }
     } else {
         for (unsigned int i = height; i > 0; i--) {
             memmove(
-                back_framebuffer + (final_y + i - 1) * back_framebuffer_w + final_x,
-                back_framebuffer + (y + i - 1)       * back_framebuffer_w + x,
-                width * sizeof(*back_framebuffer)
+                VBE_BACK_ROW(final_y + i - 1) + final_x * size,
+                VBE_BACK_ROW(y + i - 1)       + x * size,
+                width * size
             );
         }
     }
 }
 
+void vbe_fill_back_framebuffer(unsigned int start_x, unsigned int end_x, unsigned int start_y, unsigned int end_y, uint32_t raw) {
+    for (unsigned int y = start_y; y <= end_y; y++)
+        vbe_fill_raw(VBE_BACK_ROW(y) + start_x * back_framebuffer_pixel_size, raw, end_x - start_x + 1, back_framebuffer_pixel_size);
+}
+
 static void __vbe_copy_region_unbuffered(unsigned int x, unsigned int y, unsigned int width, unsigned int height, unsigned final_x, unsigned int final_y) {
     if (final_y > y + height || final_y < y) {
         for (unsigned int i = 0; i < height; i++) {
             memmove(
-                (void*)back_framebuffer + (final_y + i) * vbe_current_mode->info.pitch + final_x * vbe_current_mode->info.bpp/8,
-                (void*)back_framebuffer + (final_y + i) * vbe_current_mode->info.pitch + x * vbe_current_mode->info.bpp/8,
-                width * vbe_current_mode->info.bpp/8
+                VBE_VRAM_ROW(final_y + i) + final_x * VBE_PIXEL_SIZE(),
+                VBE_VRAM_ROW(y + i)       + x * VBE_PIXEL_SIZE(),
+                width * VBE_PIXEL_SIZE()
             );
         }
     } else {
         for (unsigned int i = height; i > 0; i--) {
             memmove(
-                (void*)back_framebuffer + (final_y + i - 1) * vbe_current_mode->info.pitch + final_x * vbe_current_mode->info.bpp/8,
-                (void*)back_framebuffer + (final_y + i - 1) * vbe_current_mode->info.pitch + x * vbe_current_mode->info.bpp/8,
-                width * vbe_current_mode->info.bpp/8
+                VBE_VRAM_ROW(final_y + i - 1) + final_x * VBE_PIXEL_SIZE(),
+                VBE_VRAM_ROW(y + i - 1)       + x * VBE_PIXEL_SIZE(),
+                width * VBE_PIXEL_SIZE()
             );
         }
     }
@@ -725,7 +786,7 @@ void vbe_copy_region_unbuffered(unsigned int x, unsigned int y, unsigned int wid
         display_width == back_framebuffer_w &&
         display_height == back_framebuffer_h // couldn't be bother checking everything again
     ) {
-        __vbe_copy_region_buffered(x, y, width, height, final_x, final_y);
+        vbe_copy_back_framebuffer(x, y, width, height, final_x, final_y);
     } else {
         __vbe_copy_region_unbuffered(x, y, width, height, final_x, final_y);
     }
@@ -741,10 +802,7 @@ void vbe_fill_buffered(unsigned int start_x, unsigned int end_x, unsigned start_
     if (end_x >= display_width) end_x = display_width - 1;
     if (end_y >= display_height) end_y = display_height - 1;
 
-    if (use_palette) color = console_colors[color & 0xF];
-
-    uint32_t direct_color = vbe_get_direct_color(color);
-    uint32_t packed_color = VGA_RGB32_TO_RGB8(color);
+    uint32_t raw = vbe_map_color(color, use_palette);
 
     spinlock_acquire_interruptible(&framebuffer_lock);
 
@@ -752,44 +810,65 @@ void vbe_fill_buffered(unsigned int start_x, unsigned int end_x, unsigned start_
         display_width == back_framebuffer_w &&
         display_height == back_framebuffer_h)
     {
-        if (vbe_current_mode->info.memory_model == VBE_MEMORY_MODEL_PACKED) {
-            for (unsigned int y = start_y; y <= end_y; y++) {
-                memset(back_framebuffer + y * back_framebuffer_w + start_x, packed_color, end_x - start_x);
-            }
-        } else {
-            for (unsigned int y = start_y; y <= end_y; y++) {
-                for (unsigned int x = start_x; x <= end_x; x++) {
-                    back_framebuffer[y * back_framebuffer_w + x] = direct_color;
-                }
-            }
-        }
+        vbe_fill_back_framebuffer(start_x, end_x, start_y, end_y, raw);
     } else {
-        if (vbe_current_mode->info.memory_model == VBE_MEMORY_MODEL_PACKED) {
-            for (unsigned int y = start_y; y <= end_y; y++) {
-                for (unsigned int x = start_x; x <= end_x; x++) {
-                    __vbe_write_framebuffer_unbuffered(x, y, packed_color);
-                }
-            }
-        } else {
-            for (unsigned int y = start_y; y <= end_y; y++) {
-                for (unsigned int x = start_x; x <= end_x; x++) {
-                    __vbe_write_framebuffer_unbuffered(x, y, direct_color);
-                }
-            }
-        }
+        for (unsigned int y = start_y; y <= end_y; y++)
+            vbe_fill_raw(VBE_VRAM_ROW(y) + start_x * VBE_PIXEL_SIZE(), raw, end_x - start_x + 1, VBE_PIXEL_SIZE());
     }
 
     spinlock_release(&framebuffer_lock);
     if (back_framebuffer != NULL) vbe_swap_region(start_x, end_x, start_y, end_y);
 }
+void vbe_set_panning(unsigned int virtual_height, void (*set_display_start)(unsigned int scanline)) {
+    spinlock_acquire_interruptible(&framebuffer_lock);
+    vbe_virtual_height = virtual_height;
+    vbe_display_start_hook = set_display_start;
+    vbe_display_start = 0;
+    framebuffer_display_offset = 0;
+    if (set_display_start != NULL)
+        set_display_start(0);
+    spinlock_release(&framebuffer_lock);
+}
+
+// acquire framebuffer_lock before this
+static void vbe_move_display_start(unsigned int scanline) {
+    vbe_display_start = scanline;
+    framebuffer_display_offset = scanline * vbe_current_mode->info.pitch;
+    vbe_display_start_hook(scanline);
+}
+
 void vbe_hw_shift_scanlines(unsigned int scanlines) {
-    if (scanlines == -1)
-        return; // the reset case, we don't support hw scrolling so nothing to do
+    char panning = vbe_display_start_hook != NULL && vbe_virtual_height >= display_height;
+    if (scanlines == -1) {
+        if (!panning || vbe_display_start == 0) return;
+        spinlock_acquire_interruptible(&framebuffer_lock);
+        memmove(LINEAR_FRAMEBUFFER_START, VBE_VRAM_ROW(0), display_height * vbe_current_mode->info.pitch);
+        vbe_move_display_start(0);
+        spinlock_release(&framebuffer_lock);
+        return;
+    }
+    if (scanlines > display_height) scanlines = display_height;
+
     spinlock_acquire_interruptible(&framebuffer_lock);
     if (back_framebuffer != NULL) {
-        memcpy(back_framebuffer,
-                back_framebuffer + scanlines * back_framebuffer_w,
-                (back_framebuffer_h - scanlines) * back_framebuffer_w * sizeof(*back_framebuffer));
+        memmove(back_framebuffer,
+                VBE_BACK_ROW(scanlines),
+                (back_framebuffer_h - scanlines) * back_framebuffer_pitch);
+    }
+
+    if (panning) {
+        // what stays visible is already in the VRAM, the caller redraws the uncovered bottom
+        if (vbe_display_start + scanlines + display_height <= vbe_virtual_height) {
+            vbe_move_display_start(vbe_display_start + scanlines);
+        } else {
+            memmove(LINEAR_FRAMEBUFFER_START, VBE_VRAM_ROW(scanlines), (display_height - scanlines) * vbe_current_mode->info.pitch);
+            vbe_move_display_start(0);
+        }
+        spinlock_release(&framebuffer_lock);
+        return;
+    }
+
+    if (back_framebuffer != NULL) {
         spinlock_release(&framebuffer_lock);
         vbe_swap_region(0, display_width, 0, display_height - scanlines);
     } else {
@@ -799,3 +878,21 @@ void vbe_hw_shift_scanlines(unsigned int scanlines) {
         spinlock_release(&framebuffer_lock);
     }
 }
+
+long vbe_flip(long page) {
+    long pages = 1;
+    if (vbe_display_start_hook != NULL && display_height)
+        pages = vbe_virtual_height / display_height;
+    if (page == -1) return pages;
+    if (page < 0 || page >= pages) return -EINVAL;
+
+    if (pages > 1) {
+        spinlock_acquire_interruptible(&framebuffer_lock);
+        vbe_move_display_start(page * display_height);
+        spinlock_release(&framebuffer_lock);
+    }
+    // modes without VGA compatibility might not have the input status register
+    if (!vbe_current_mode->info.attributes.vga_incom)
+        vga_wait_vretrace();
+    return 0;
+}
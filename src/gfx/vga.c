@@ -33,6 +33,13 @@ uint8_t vga_rreg(uint16_t data_reg, uint8_t index) {
 }
 
 
+#define VGA_VRETRACE_SPIN_MAX 1000000 // input status reads, ~1s; in case there's no retrace to see
+void vga_wait_vretrace() {
+    unsigned int spins = 0;
+    while ((inb(VGA_INPUT_STATUS_1_REGISTER) & VGA_INPUT_STATUS_1_VRETRACE) && spins++ < VGA_VRETRACE_SPIN_MAX); // one in progress is too late
+    while (!(inb(VGA_INPUT_STATUS_1_REGISTER) & VGA_INPUT_STATUS_1_VRETRACE) && spins++ < VGA_VRETRACE_SPIN_MAX);
+}
+
 void vga_disable_scan() {
     vga_wreg(VGA_CRTC_DATA_REG, VGA_CRTC_MODE_CONTROL, 0);
 }
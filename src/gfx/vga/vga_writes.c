@@ -1,6 +1,7 @@
 #include "../../include/gfx/vga.h"
 #include "kernel_spinlock.h"
 #include <string.h>
+#include <errno.h>
 #include "gfx.h"
 
 extern long vga_ioctl(file_descriptor_t * file, unsigned long cmd, void * arg);
@@ -8,10 +9,13 @@ struct gfx_funcs vga_funcs = {
     .clear_screen = vga_clear_screen,
     .swap_region = vga_swap_region,
     .write_pixel_buffered = vga_write_pixel_buffered,
+    .map_color = vga_map_color,
+    .blit_rect = vga_blit_rect,
     .fill_buffered = vga_fill_buffered,
     .copy_region_unbuffered = vga_copy_region,
     .read_framebuffer = vga_read_pixel,
     .hw_shift_pixels = vga_hw_shift_pixels,
+    .flip = vga_flip,
     .ioctl = vga_ioctl
 };
 
@@ -28,8 +32,9 @@ unsigned int vga_pixel_offset = 0;
 
 extern spinlock_t gfx_spinlock;
 
+static int last_plane = 0; // -1 once something wrote another map mask
+
 static inline void vga_set_plane(int plane) {
-    static int last_plane = 0;
     plane &= 3;
     if (last_plane != plane) // io operations are costly
         vga_wreg(VGA_SEQ_DATA_REG, 2, 1<<plane);
@@ -48,15 +53,46 @@ uint32_t vga_read_pixel(unsigned int x, unsigned int y) {
 void vga_write_pixel_buffered(unsigned int x, unsigned int y, uint32_t color, char use_palette) {
     if (x >= display_width || y >= display_height) return;
 
-    if (current_vga_mode == MODE12) {
-        shadow_framebuffer[y * display_width + x] = color;
-        return;
+    shadow_framebuffer[y * display_width + x] = vga_map_color(color, use_palette);
+}
+
+// mode 12 only has the 16 console colors, so anything else gets the closest of them
+static uint8_t vga_nearest_palette_index(uint32_t color) {
+    uint8_t best = 0;
+    uint32_t best_distance = UINT32_MAX;
+    for (int i = 0; i < 16; i++) {
+        int dr = (int)(color >> 24 & 0xFF) - (int)(console_colors[i] >> 24 & 0xFF);
+        int dg = (int)(color >> 16 & 0xFF) - (int)(console_colors[i] >> 16 & 0xFF);
+        int db = (int)(color >> 8 & 0xFF) - (int)(console_colors[i] >> 8 & 0xFF);
+        uint32_t distance = dr * dr + dg * dg + db * db;
+        if (distance < best_distance) {
+            best_distance = distance;
+            best = i;
+        }
     }
+    return best;
+}
+
+uint32_t vga_map_color(uint32_t color, char use_palette) {
+    if (current_vga_mode == MODE12)
+        return use_palette ? color & 0xF : vga_nearest_palette_index(color);
 
     if (use_palette)
         color = console_colors[color & 0xF];
+    return VGA_RGB32_TO_RGB8(color);
+}
+
+void vga_blit_rect(unsigned int x, unsigned int y, unsigned int width, unsigned int height, const uint32_t * pixels, unsigned int stride) {
+    if (x >= display_width || y >= display_height) return;
+    if (x + width > display_width) width = display_width - x;
+    if (y + height > display_height) height = display_height - y;
 
-    shadow_framebuffer[y * display_width + x] = VGA_RGB32_TO_RGB8(color);
+    for (unsigned int i = 0; i < height; i++) {
+        unsigned char * row = shadow_framebuffer + (y + i) * display_width + x;
+        for (unsigned int j = 0; j < width; j++) {
+            row[j] = pixels[i * stride + j];
+        }
+    }
 }
 
 // /4 for planes
@@ -67,31 +103,129 @@ void vga_clear_screen() {
     memset(shadow_framebuffer, 0, display_height * display_width);
     // select all planes to speed up clear
     vga_wreg(VGA_SEQ_DATA_REG, 2, 0xF);
+    last_plane = -1;
     
     memset(VGA_PAGE_ADDR, 0, VGA_VRAM_SIZE);
     spinlock_release(&gfx_spinlock);
 }
 
-static inline unsigned char mode12_construct_pixel_from_shadow(unsigned int x, unsigned int y, int plane) {
-    unsigned char out = 0;
-    x &= ~7;
-    unsigned char * fb = shadow_framebuffer + y*display_width + x;
-    asm volatile (
-        "movb $8, %%cl\n"
-        "1:\n"
-        "shlb $1, %%al\n"
-        "test %%edx, (%%esi)\n"
-        "jz 2f\n"
-        "orb $1, %%al\n"
-        "2:\n"
-        "inc %%esi\n"
-        "dec %%cl\n"
-        "jnz 1b\n"
-        :"=a"(out), "+S"(fb)
-        :"d"(1 << plane)
-        :"memory", "ecx"
-    );
-    return out;
+// mode 12 keeps 4 bit palette indices in the shadow framebuffer, the VRAM has one bit of each in every plane
+// so a byte of a plane holds bit p of 8 neighbouring pixels, leftmost at the top
+#define MODE12_VRAM_ADDR(x, y) ((((y) * display_width + (x) + vga_pixel_offset) / 8) & 0xFFFF)
+
+// bit p of a pixel, as the top bit of byte p; shifted right by the pixel's position within its byte
+#define MODE12_EXPAND(v) (\
+    ((v) & 1 ? 0x80u : 0) | ((v) & 2 ? 0x8000u : 0) | ((v) & 4 ? 0x800000u : 0) | ((v) & 8 ? 0x80000000u : 0))
+static const uint32_t mode12_expand[16] = {
+    MODE12_EXPAND(0),  MODE12_EXPAND(1),  MODE12_EXPAND(2),  MODE12_EXPAND(3),
+    MODE12_EXPAND(4),  MODE12_EXPAND(5),  MODE12_EXPAND(6),  MODE12_EXPAND(7),
+    MODE12_EXPAND(8),  MODE12_EXPAND(9),  MODE12_EXPAND(10), MODE12_EXPAND(11),
+    MODE12_EXPAND(12), MODE12_EXPAND(13), MODE12_EXPAND(14), MODE12_EXPAND(15),
+};
+
+// spans of several rows get converted at once, so that every plane gets selected once per chunk instead of once per byte
+#define MODE12_CHUNK_BYTES 2048
+static uint8_t mode12_planes[4][MODE12_CHUNK_BYTES];
+
+// acquire gfx_spinlock before this
+static void mode12_swap_region(unsigned int start_x, unsigned int end_x, unsigned int start_y, unsigned int end_y) {
+    unsigned int first_byte = start_x / 8;
+    unsigned int bytes = end_x / 8 - first_byte + 1;
+    unsigned int chunk_rows = MODE12_CHUNK_BYTES / bytes;
+
+    for (unsigned int y = start_y; y <= end_y; y += chunk_rows) {
+        unsigned int rows = end_y - y + 1 < chunk_rows ? end_y - y + 1 : chunk_rows;
+
+        for (unsigned int r = 0; r < rows; r++) {
+            const unsigned char * pixels = shadow_framebuffer + (y + r) * display_width + first_byte * 8;
+            for (unsigned int b = 0; b < bytes; b++, pixels += 8) {
+                uint32_t planes = 0;
+                for (int k = 0; k < 8; k++)
+                    planes |= mode12_expand[pixels[k] & 0xF] >> k;
+                for (int p = 0; p < 4; p++)
+                    mode12_planes[p][r * bytes + b] = planes >> (p * 8);
+            }
+        }
+
+        for (int p = 0; p < 4; p++) {
+            vga_set_plane(p);
+            for (unsigned int r = 0; r < rows; r++) {
+                size_t addr = MODE12_VRAM_ADDR(first_byte * 8, y + r);
+                const uint8_t * src = &mode12_planes[p][r * bytes];
+                if (addr + bytes <= VGA_VRAM_SIZE) {
+                    memcpy(VGA_PAGE_ADDR + addr, src, bytes);
+                    continue;
+                }
+                for (unsigned int b = 0; b < bytes; b++) // wraps around the window
+                    VGA_PAGE_ADDR[(addr + b) & 0xFFFF] = src[b];
+            }
+        }
+    }
+}
+
+// write mode 2 spreads the low 4 bits of the written byte over the planes, the bit mask keeps the pixels outside the span
+// from the latches, loaded by reading the byte first; all in one pass over the VRAM
+// acquire gfx_spinlock before this
+static void mode12_fill(unsigned int start_x, unsigned int end_x, unsigned int start_y, unsigned int end_y, uint8_t color) {
+    volatile uint8_t * vram = VGA_PAGE_ADDR;
+    unsigned int first_byte = start_x / 8, last_byte = end_x / 8;
+    uint8_t left_mask = 0xFF >> (start_x % 8);
+    uint8_t right_mask = 0xFF << (7 - end_x % 8);
+    if (first_byte == last_byte)
+        left_mask &= right_mask;
+
+    vga_wreg(VGA_SEQ_DATA_REG, 2, 0xF);
+    last_plane = -1;
+    vga_wreg(VGA_GC_DATA_REG, 5, 2);
+
+    vga_wreg(VGA_GC_DATA_REG, 8, left_mask);
+    for (unsigned int y = start_y; y <= end_y; y++) {
+        size_t addr = MODE12_VRAM_ADDR(first_byte * 8, y);
+        (void)vram[addr];
+        vram[addr] = color;
+    }
+    if (last_byte > first_byte) {
+        vga_wreg(VGA_GC_DATA_REG, 8, 0xFF);
+        for (unsigned int y = start_y; y <= end_y; y++) {
+            size_t addr = MODE12_VRAM_ADDR(first_byte * 8, y);
+            for (unsigned int b = 1; b < last_byte - first_byte; b++)
+                vram[(addr + b) & 0xFFFF] = color;
+        }
+        vga_wreg(VGA_GC_DATA_REG, 8, right_mask);
+        for (unsigned int y = start_y; y <= end_y; y++) {
+            size_t addr = MODE12_VRAM_ADDR(last_byte * 8, y);
+            (void)vram[addr];
+            vram[addr] = color;
+        }
+    }
+
+    vga_wreg(VGA_GC_DATA_REG, 8, 0xFF);
+    vga_wreg(VGA_GC_DATA_REG, 5, 0);
+}
+
+// write mode 1 stores the latches (all 4 planes of a byte, loaded by a read) as they are, so a byte is one read and one write
+// byte aligned spans only, acquire gfx_spinlock before this
+static void mode12_latch_copy(unsigned int x, unsigned int y, unsigned int width, unsigned int height, unsigned int final_x, unsigned int final_y) {
+    volatile uint8_t * vram = VGA_PAGE_ADDR; // byte accesses only, a wider read would leave just its last byte in the latches
+    unsigned int bytes = width / 8;
+    char backwards = final_y > y || (final_y == y && final_x > x);
+
+    vga_wreg(VGA_SEQ_DATA_REG, 2, 0xF);
+    last_plane = -1;
+    vga_wreg(VGA_GC_DATA_REG, 5, 1);
+
+    for (unsigned int i = 0; i < height; i++) {
+        unsigned int row = backwards ? height - 1 - i : i;
+        size_t src = MODE12_VRAM_ADDR(x, y + row);
+        size_t dest = MODE12_VRAM_ADDR(final_x, final_y + row);
+        for (unsigned int j = 0; j < bytes; j++) {
+            unsigned int b = backwards ? bytes - 1 - j : j;
+            uint8_t latched = vram[(src + b) & 0xFFFF];
+            vram[(dest + b) & 0xFFFF] = latched;
+        }
+    }
+
+    vga_wreg(VGA_GC_DATA_REG, 5, 0);
 }
 
 void vga_swap_region(unsigned int start_x, unsigned int end_x, unsigned int start_y, unsigned int end_y) {
@@ -132,15 +266,7 @@ void vga_swap_region(unsigned int start_x, unsigned int end_x, unsigned int star
             }
             break;
         case MODE12:
-            for (int i = 0; i < 4; i++) {
-                vga_set_plane(i);
-                for (unsigned int y = start_y; y <= end_y; y++) {
-                    size_t idx = ((y*display_width + start_x + vga_pixel_offset)/8) & 0xFFFF;
-                    for (unsigned int x = start_x; x <= end_x; x+=8) {
-                        VGA_PAGE_ADDR[idx++ & 0xFFFF] = mode12_construct_pixel_from_shadow(x, y, i);
-                    }
-                }
-            }
+            mode12_swap_region(start_x, end_x, start_y, end_y);
             break;
     }
     spinlock_release(&gfx_spinlock);
@@ -151,16 +277,18 @@ void vga_fill_buffered(unsigned int start_x, unsigned int end_x, unsigned start_
     if (start_y >= display_height) start_y = display_height - 1;
     if (end_x >= display_width) end_x = display_width - 1;
     if (end_y >= display_height) end_y = display_height - 1;
+    if (end_x < start_x || end_y < start_y) return;
 
-    if (use_palette && current_vga_mode != MODE12)
-        color = console_colors[color & 0xF];
-    if (current_vga_mode != MODE12)
-        color = VGA_RGB32_TO_RGB8(color);
+    color = vga_map_color(color, use_palette);
 
-    for (unsigned int y = start_y; y <= end_y; y++) {
-        for (unsigned int x = start_x; x <= end_x; x++) {
-            shadow_framebuffer[y*display_width + x] = color;
-        }
+    for (unsigned int y = start_y; y <= end_y; y++)
+        memset(shadow_framebuffer + y*display_width + start_x, color, end_x - start_x + 1);
+
+    // cheaper to do in the VRAM right away than to swap in later
+    if (current_vga_mode == MODE12) {
+        spinlock_acquire_interruptible(&gfx_spinlock);
+        mode12_fill(start_x, end_x, start_y, end_y, color);
+        spinlock_release(&gfx_spinlock);
     }
 }
 
@@ -202,6 +330,24 @@ void vga_hw_shift_pixels(unsigned int pixels) {
     #endif
 }
 
+long vga_flip(long page) {
+    long pages = 1;
+    if (current_vga_mode == UNCHAINED)
+        pages = VGA_VRAM_SIZE / (display_width / 4 * display_height);
+    if (page == -1) return pages;
+    if (page < 0 || page >= pages) return -EINVAL;
+
+    if (pages > 1) {
+        spinlock_acquire_interruptible(&gfx_spinlock);
+        vga_pixel_offset = page * display_width * display_height;
+        vga_wreg(VGA_CRTC_DATA_REG, 0xD, vga_pixel_offset / 4);
+        vga_wreg(VGA_CRTC_DATA_REG, 0xC, vga_pixel_offset / 4 >> 8);
+        spinlock_release(&gfx_spinlock);
+    }
+    vga_wait_vretrace();
+    return 0;
+}
+
 void vga_copy_region(unsigned int x, unsigned int y, unsigned int width, unsigned int height, unsigned int final_x, unsigned int final_y) {
     if (x >= display_width || y >= display_height) return;
 
@@ -229,6 +375,13 @@ void vga_copy_region(unsigned int x, unsigned int y, unsigned int width, unsigne
         }
     }
 
+    if (current_vga_mode == MODE12 && x % 8 == 0 && final_x % 8 == 0 && final_width % 8 == 0) {
+        spinlock_acquire_interruptible(&gfx_spinlock);
+        mode12_latch_copy(x, y, final_width, final_height, final_x, final_y);
+        spinlock_release(&gfx_spinlock);
+        return;
+    }
+
     vga_swap_region(x, x+width - 1, y, y+height - 1);
     vga_swap_region(final_x, final_x+final_width - 1, final_y, final_y+final_height - 1);
 }
\ No newline at end of file
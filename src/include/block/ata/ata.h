@@ -1,6 +1,7 @@
 #ifndef BLOCK_ATA_H
 #define BLOCK_ATA_H
 
+#include <stddef.h>
 #include <stdint.h>
 
 #define ATA_LEGACY_P_BASE 0x1F0
@@ -168,4 +169,10 @@ char ata_read(unsigned char bus_id, unsigned char drive_number, uint64_t lba, vo
  * 2  - ok, but corrected data
  */
 char ata_write(unsigned char bus_id, unsigned char drive_number, uint64_t lba, const void * buf);
+
+#define ATA_MAX_SECTORS 128 // per command, fits the sector count register of non-LBA48 drives as well
+
+// same as ata_read/ata_write, but for count consecutive sectors in one command, one buffer per sector
+char ata_read_sectors(unsigned char bus_id, unsigned char drive_number, uint64_t lba, size_t count, void * const * bufs);
+char ata_write_sectors(unsigned char bus_id, unsigned char drive_number, uint64_t lba, size_t count, const void * const * bufs);
 #endif
\ No newline at end of file
@@ -0,0 +1,79 @@
+#ifndef BLOCK_BLK_H
+#define BLOCK_BLK_H
+// generic block request layer between the sector cache and the drivers
+// every device has a request queue, queues with a driver thread sort and merge the requests (C-LOOK with expiry)
+// partitions are registered as ranges of their drive and get remapped on submission
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include <UnstableOS/devs.h>
+#include "kernel_sched.h"
+#include "kernel_spinlock.h"
+
+#define BLK_DEVICES_MAX 64
+#define BLK_EXPIRE_READ_MSEC  250 // after which a request gets served regardless of the elevator position
+#define BLK_EXPIRE_WRITE_MSEC 2000
+
+struct blk_request;
+typedef void (*blk_end_io_t)(struct blk_request * req);
+
+struct blk_request {
+    dev_t dev; // remapped to the drive by blk_submit
+    uint64_t lba;
+    size_t count; // sectors
+    void * buf;
+    char write;
+
+    blk_end_io_t end_io; // called from the driver thread on completion, NULL = someone blk_wait()s
+    void * private;
+
+    volatile char done;
+    long result; // sectors transferred or -errno
+
+    // private to the queue
+    thread_queue_t wait;
+    time_t expires;
+    struct blk_request * next; // in the queue, only set on the first request of a merged run
+    struct blk_request * merged; // the rest of the run, consecutive sectors in the same direction
+    struct blk_request * merged_tail;
+    size_t merged_count; // sectors of the whole run
+};
+
+struct blk_queue;
+// serves a run of requests, req->lba and req->merged_count describe the whole run, returns 0 or -errno
+typedef long (*blk_do_request_t)(struct blk_queue * q, struct blk_request * req);
+
+struct blk_queue {
+    const char * name;
+    blk_do_request_t do_request;
+    void * private;
+    size_t max_sectors; // of a merged run
+    char sync; // no driver thread, requests get served right away in the submitter's context
+
+    spinlock_t lock;
+    struct blk_request * head; // sorted by dev and lba
+    struct blk_request * active; // being served by the driver thread
+    dev_t pos_dev; // where the last run ended, for C-LOOK
+    uint64_t pos_lba;
+
+    thread_queue_t worker_queue;
+    thread_queue_t done_queue; // submitters waiting for a conflicting request to finish
+};
+
+// spawns the driver thread unless q->sync
+void blk_queue_init(struct blk_queue * q, const char * name, blk_do_request_t do_request, void * private, size_t max_sectors, char sync);
+
+long blk_register(dev_t dev, struct blk_queue * q, unsigned sector_size, uint64_t sector_count);
+// start and count in sectors of the drive
+long blk_register_partition(dev_t part, dev_t drive, uint64_t start, uint64_t count);
+void blk_unregister(dev_t dev);
+unsigned blk_sector_size(dev_t dev); // 0 if not registered
+
+// requests are never split, the device has to fit the whole range; completion errors show up in req->result
+long blk_submit(struct blk_request * req);
+long blk_wait(struct blk_request * req);
+// synchronous helper, returns sectors transferred or -errno
+long blk_rw(dev_t dev, uint64_t lba, size_t count, void * buf, char write);
+
+#endif
@@ -11,6 +11,7 @@
 
 #define MEMDISKS_BASE ((void*)___MEMDISKS_BASE)
 #define DEFAULT_MEMDISK_SIZE 0x007FF000 // ~8.3 MB per memdisk
+#define MEMDISK_SECTOR_SIZE 512 // only for the block layer, reads and writes through the fd are byte granular
 
 #define GET_MEMDISK_IDX(ptr) (((unsigned long)(ptr)-0x03000000)/DEFAULT_MEMDISK_SIZE)
 
@@ -44,6 +45,8 @@ ssize_t memdisk_write_internal(dev_t dev, size_t seek, const void * s, size_t n)
 #include "../../include/fs/fs.h"
 ssize_t memdisk_pread(file_descriptor_t * fd, void * s, size_t n, off_t offset);
 ssize_t memdisk_pwrite(file_descriptor_t * fd, const void * s, size_t n, off_t offset);
+ssize_t memdisk_preadv(file_descriptor_t * fd, const struct iovec * iov, int iovcnt, off_t offset);
+ssize_t memdisk_pwritev(file_descriptor_t * fd, const struct iovec * iov, int iovcnt, off_t offset);
 off_t memdisk_seek(file_descriptor_t * fd, off_t off, int whence);
 
 #endif
\ No newline at end of file
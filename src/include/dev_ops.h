@@ -10,10 +10,20 @@ struct dev_operations {
     ssize_t (*pread) (file_descriptor_t *file, void *buf, size_t count, off_t offset);
     ssize_t (*pwrite)(file_descriptor_t *file, const void *buf, size_t count, off_t pread);
     off_t   (*seek) (file_descriptor_t *file, off_t offset, int whence);
+    // optional, for block devices that can do all of the segments in one go
+    // otherwise preadv_dev/pwritev_dev call pread/pwrite for each segment
+    ssize_t (*preadv) (file_descriptor_t *file, const struct iovec * iov, int iovcnt, off_t offset);
+    ssize_t (*pwritev)(file_descriptor_t *file, const struct iovec * iov, int iovcnt, off_t offset);
     long    (*ioctl)(file_descriptor_t *file, unsigned long request, void * arg);
+    // optional, returns POLL* readiness and hooks pt onto the device's waitqs with poll_wait()
+    // devices without it never block
+    short   (*poll) (file_descriptor_t *file, struct poll_table * pt);
+    // optional, writes back what the device caches of the byte range and waits for it to reach the medium
+    // devices without a write cache don't need it
+    long    (*sync_range)(file_descriptor_t *file, off_t offset, off_t len);
 
     // takes an inode and de/initializes a device specified by it
-    long    (*open) (inode_t * inode, unsigned short flags);
+    long    (*open) (inode_t * inode, unsigned int flags);
     long    (*close)(inode_t * inode);
 
     // it is assumed that mmap pages are not reference tracked
@@ -23,9 +33,13 @@ struct dev_operations {
 
 ssize_t pread_dev(file_descriptor_t *file, void *buf, size_t count, off_t offset);
 ssize_t pwrite_dev(file_descriptor_t *file, const void *buf, size_t count, off_t offset);
+ssize_t preadv_dev(file_descriptor_t *file, const struct iovec * iov, int iovcnt, off_t offset);
+ssize_t pwritev_dev(file_descriptor_t *file, const struct iovec * iov, int iovcnt, off_t offset);
 off_t seek_dev(file_descriptor_t * file, off_t offset, int whence);
 long ioctl_dev(file_descriptor_t *file, unsigned long request, void * arg);
-long open_dev(inode_t * inode, unsigned short flags);
+short poll_dev(file_descriptor_t *file, struct poll_table * pt);
+long sync_range_dev(file_descriptor_t *file, off_t offset, off_t len);
+long open_dev(inode_t * inode, unsigned int flags);
 long close_dev(inode_t * inode);
 long mmap_dev(inode_t * inode, int prot, off_t off, void * start, size_t len);
 // if one already exists, it gets overwritten!
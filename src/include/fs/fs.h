@@ -14,6 +14,7 @@
 
 #include <unistd.h> // for off_t, and seek modes
 #include <fcntl.h> // for O_* and I_* macros
+#include <sys/uio.h> // for struct iovec
 
 
 struct pipe;
@@ -36,6 +37,7 @@ struct inode_t {
     nlink_t nlink;
 
     time_t btime, ctime, mtime, atime;
+    char times_dirty; // lazytime, changed timestamps not written to the fs yet
 
     size_t instances; // how many descriptors (and therefore processes) use this inode, 0 is considered an unused inode
     size_t mmaped_instances; // to refuse any ioctls for devices when mmaped
@@ -63,13 +65,14 @@ struct inode_t {
         struct {
             dev_t device; // if S_ISBLK(mode) | S_ISCHR(mode)
             char dev_opened;
+            void * dev_private; // for devices without a static instance, e.g. epoll
         };
         struct pipe * pipe; // if S_ISFIFO(mode); extra field so that named pipes can be more easily implemented
     };
 } typedef inode_t;
 
 struct {
-    unsigned short flags;
+    unsigned int flags;
 
     size_t instances; // how many processes have this descriptor opened (for fork()/dup*() duplication)
 
@@ -78,6 +81,8 @@ struct {
     off_t off;
 
     rw_spinlock_t access_lock; // so that thread io operations are atomic
+
+    struct epitem * epitems; // epoll instances watching this file, see epoll_file_release()
 } typedef file_descriptor_t; // userspace will use an int as an index to per-process array of file_descriptor_t pointers
 
 // intended way of accessing superblocks and
@@ -111,6 +116,7 @@ extern superblock_t ** kernel_superblocks;
 
 #include <limits.h>
 #include "../kernel_sched_queues.h"
+#include "poll.h"
 
 struct pipe {
     spinlock_t pipe_lock;
@@ -120,6 +126,8 @@ struct pipe {
 
     size_t readers; // SIGPIPE
     size_t writers; // EOF on read
+
+    struct poll_waitq poll_waitq;
 };
 
 void init_fds();
@@ -147,19 +155,19 @@ long inode_from_device(dev_t device, inode_t ** inode_out);
 // locks inode lock itself
 inode_t * get_inode(superblock_t * sb, off_t inode_number);
 // exactly the same but increases instances if found and creates if not
-long register_inode(const inode_t * inode, inode_t ** inode_out, unsigned short dev_flags);
+long register_inode(const inode_t * inode, inode_t ** inode_out, unsigned int dev_flags);
 void close_inode(inode_t * inode);
-int open_raw_device(dev_t device, unsigned short flags, file_descriptor_t ** file_out); // locks file descriptor lock itself
-int open_raw_device_fd(dev_t device, unsigned short flags); // locks file descriptor lock itself
+int open_raw_device(dev_t device, unsigned int flags, file_descriptor_t ** file_out); // locks file descriptor lock itself
+int open_raw_device_fd(dev_t device, unsigned int flags); // locks file descriptor lock itself
 
 void inode_change_mode(inode_t * inode, unsigned short new_mode);
 
 // puts a new fd into the current process
-int get_fd_from_inode(inode_t * inode, unsigned short flags);
+int get_fd_from_inode(inode_t * inode, unsigned int flags);
 
-int sys_openat(int fd, const char * path, unsigned short flags, mode_t mode);
+int sys_openat(int fd, const char * path, unsigned int flags, mode_t mode);
 // the kernel function itself
-int openat_inode(inode_t * base, const char * path, unsigned short flags, mode_t mode, inode_t ** out, char trusted_path);
+int openat_inode(inode_t * base, const char * path, unsigned int flags, mode_t mode, inode_t ** out, char trusted_path);
 
 int sys_chdir(const char * path);
 int sys_chroot(const char * path);
@@ -172,9 +180,17 @@ ssize_t sys_read(int fd, void * buf, size_t count);
 ssize_t sys_write(int fd, const void * buf, size_t count);
 ssize_t sys_pread(int fd, void * buf, size_t count, off_t offset);
 ssize_t sys_pwrite(int fd, const void * buf, size_t count, off_t offset);
+// the iovec arrays are kernel copies, see the syscall dispatcher
+ssize_t sys_readv(int fd, const struct iovec * iov, int iovcnt);
+ssize_t sys_writev(int fd, const struct iovec * iov, int iovcnt);
+ssize_t sys_preadv(int fd, const struct iovec * iov, int iovcnt, off_t offset);
+ssize_t sys_pwritev(int fd, const struct iovec * iov, int iovcnt, off_t offset);
+// offsets are kernel accessible pointers, NULL uses and advances the descriptor's own offset
+ssize_t sys_copy_file_range(int fd_in, off_t * off_in, int fd_out, off_t * off_out, size_t len, unsigned int flags);
 off_t sys_seek(int fd, off_t off, int whence);
 
 int sys_trunc(int fd, off_t length);
+int sys_fsync(int fd, char datasync);
 
 long sys_ioctl(int fd, unsigned long request, void * arg);
 
@@ -182,6 +198,8 @@ long sys_fcntl(int fd, int cmd, long arg);
 
 #include <dirent.h>
 ssize_t sys_readdir(int fd, struct dirent * dent, size_t dent_size);
+// fills buf with as many entries as fit, each d_reclen long, returns the amount of bytes used, 0 at the end
+ssize_t sys_getdents(int fd, void * buf, size_t n);
 
 // because we want drivers' file objects to be file descriptors as well
 // and we don't want them in user processes,
@@ -199,6 +217,31 @@ ssize_t write_file(file_descriptor_t * file, const void * buf, size_t count);
 ssize_t pread_file(file_descriptor_t * file, void * buf, size_t count, off_t offset);
 ssize_t pwrite_file(file_descriptor_t * file, const void * buf, size_t count, off_t offset);
 
+// vectored versions of the above, the single buffer ones are wrappers around these
+ssize_t readv_file(file_descriptor_t * file, const struct iovec * iov, int iovcnt);
+ssize_t writev_file(file_descriptor_t * file, const struct iovec * iov, int iovcnt);
+ssize_t preadv_file(file_descriptor_t * file, const struct iovec * iov, int iovcnt, off_t offset);
+ssize_t pwritev_file(file_descriptor_t * file, const struct iovec * iov, int iovcnt, off_t offset);
+
+// moves up to len bytes between descriptors without going through userspace, see sys_copy_file_range
+ssize_t copy_file_range_file(file_descriptor_t * file_in, off_t * off_in, file_descriptor_t * file_out, off_t * off_out, size_t len);
+
+// writes back what's cached of the file, see vfs_ops fsync
+int fsync_file(file_descriptor_t * file, char datasync);
+
+// total length of an iovec array, -EINVAL if it doesn't fit ssize_t
+ssize_t iov_length(const struct iovec * iov, int iovcnt);
+
+// walks an iovec array for drivers that copy in pieces not matching the segments (e.g. sectors)
+struct iov_iter {
+    const struct iovec * iov;
+    int iovcnt;
+    size_t seg_off; // already processed bytes of iov[0]
+};
+// both return the amount of bytes copied, less than n only when the vector ran out
+size_t iov_iter_copy_to(struct iov_iter * it, const void * src, size_t n);
+size_t iov_iter_copy_from(struct iov_iter * it, void * dst, size_t n);
+
 off_t seek_file(file_descriptor_t * file, off_t off, int whence);
 long fcntl_file(file_descriptor_t * file, int cmd, long arg);
 
@@ -224,6 +267,12 @@ long sys_umount(const char * mount_path);
 off_t generic_seek(file_descriptor_t *file, off_t off, int whence, off_t max_off);
 
 int utimes_inode(inode_t * inode, struct timespec atime, struct timespec mtime, struct timespec ctime);
+// atime update after a read, subject to the noatime/relatime mount options
+void touch_atime(inode_t * inode);
+// writes the in memory timestamps to the fs, see vfs_ops write_times
+int write_inode_times(inode_t * inode);
+// write_inode_times() for every inode with times_dirty, for sync()
+void sync_inodes();
 int sys_utimensat(int fd, const char *path, const struct timespec times[2], int flag);
 
 #endif
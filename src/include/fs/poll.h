@@ -0,0 +1,70 @@
+// fs.h includes this in the middle, once file_descriptor_t is defined and before struct pipe needs the waitq
+#include "fs.h"
+
+#ifndef FS_POLL_H
+#define FS_POLL_H
+
+#include <stddef.h>
+#include <limits.h>
+#include <poll.h>
+#include <sys/epoll.h>
+
+#define POLL_WAITQS_PER_FILE 2 // the most waitqs a single ->poll() registers on
+#define EP_MAX_EVENTS (INT_MAX / sizeof(struct epoll_event)) // so that the size of the events array can't overflow
+
+struct poll_entry;
+
+// readiness wait queue, lives next to whatever the file's data lives in (pipe, tty queue, driver)
+// woken by the driver whenever the readiness of the file might have changed
+struct poll_waitq {
+    spinlock_t lock;
+    struct poll_entry * head;
+};
+
+// one waiter hooked onto a poll_waitq
+// wake gets called with the waitq locked (possibly from an IRQ), so it can't sleep or touch the same waitq
+struct poll_entry {
+    struct poll_waitq * waitq; // NULL = not queued anywhere
+    struct poll_entry * prev, * next;
+    void (*wake)(struct poll_entry * entry, short events);
+    void * private;
+};
+
+// passed to ->poll() by the waiter, NULL when the caller only wants the current state
+struct poll_table {
+    void (*queue)(struct poll_table * pt, struct poll_waitq * waitq);
+};
+
+// for ->poll() implementations, registers the caller on waitq before the readiness is checked
+static inline void poll_wait(struct poll_waitq * waitq, struct poll_table * pt) {
+    if (pt != NULL && waitq != NULL)
+        pt->queue(pt, waitq);
+}
+
+void poll_waitq_add(struct poll_waitq * waitq, struct poll_entry * entry);
+void poll_waitq_remove(struct poll_entry * entry);
+// events are a hint of what changed, 0 meaning unknown, waiters recheck with ->poll() either way
+void poll_wake(struct poll_waitq * waitq, short events);
+
+// the readiness of file, POLLIN | POLLOUT for files that never block
+short poll_file(file_descriptor_t * file, struct poll_table * pt);
+
+short pipe_poll(file_descriptor_t * file, struct poll_table * pt);
+
+// timeout in milliseconds to an uptime in microseconds, -1 = forever
+time_t poll_deadline(int timeout);
+// sleeps on queue unless triggered got set, until woken up or past deadline
+// returns 1 on timeout, may return early, the caller rechecks
+char poll_sleep(thread_queue_t * queue, const volatile char * triggered, time_t deadline);
+
+// fds is a kernel accessible array, timeout in milliseconds, negative = forever
+int sys_poll(struct pollfd * fds, nfds_t nfds, int timeout);
+
+void epoll_init();
+int sys_epoll_create(int flags);
+int sys_epoll_ctl(int epfd, int op, int fd, struct epoll_event * event);
+int sys_epoll_wait(int epfd, struct epoll_event * events, int maxevents, int timeout);
+// drops the epoll registrations of file, called when its last instance gets closed
+void epoll_file_release(file_descriptor_t * file);
+
+#endif
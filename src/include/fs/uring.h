@@ -0,0 +1,15 @@
+#ifndef FS_URING_H
+#define FS_URING_H
+
+#include <UnstableOS/uring.h>
+
+// registers the ring device and starts the workers and the sq poller
+void uring_init();
+
+// params is a kernel accessible struct
+int sys_uring_setup(unsigned entries, struct uring_params * params);
+int sys_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags);
+// arg is a kernel accessible array of nr_args struct iovec or int depending on opcode
+int sys_uring_register(int fd, unsigned opcode, const void * arg, unsigned nr_args);
+
+#endif
@@ -21,6 +21,11 @@ so
 
 #include <dirent.h>
 #include <time.h>
+
+// size of a packed getdents record, rounded up so that the next one stays aligned
+#define DIRENT_RECLEN(namelen) \
+    ((sizeof(struct dirent) + (namelen) + 1 + _Alignof(struct dirent) - 1) & ~(_Alignof(struct dirent) - 1))
+
 struct vfs_ops {
     // implementations need to set the new file->size on change
     // implementations need to set the new btime on creat()
@@ -39,11 +44,14 @@ struct vfs_ops {
     // implementations should accept "." to mean the current directory
     // implementations need to fill the inode_t struct with enough info for a full stat()
     // flags primarily meant to pass to register inode to use for dev initialization
-    int (*lookup)   (superblock_t * sb, inode_t * last, const char * pathname, inode_t ** inode_out, unsigned short flags);
+    int (*lookup)   (superblock_t * sb, inode_t * last, const char * pathname, inode_t ** inode_out, unsigned int flags);
 
     // closing of the very last instance of an inode
     // also should sync (if supported) timestamps, mode, and uid/gid
     int (*release)   (inode_t *);
+    // optional, writes the timestamps of the inode to the fs, called on every change unless mounted lazytime
+    // otherwise timestamps only get written on release()
+    int (*write_times)(inode_t *);
 
     ssize_t (*pread) (file_descriptor_t * fd, void * buf, size_t n, off_t offset);
     ssize_t (*pwrite)(file_descriptor_t * fd, const void * buf, size_t n, off_t offset);
@@ -55,6 +63,10 @@ struct vfs_ops {
     // MT safety is guaranteed by sys_unlinkat, don't need to lock the inode separately
     int (*unlink)    (inode_t * file);
     int (*trunc)     (inode_t * file, off_t length);
+    // optional, writes back the dirty data and metadata of the file and waits for it to reach the disk
+    // with datasync only the metadata needed to read the data back (size, allocation), not the timestamps
+    // if missing, fsync() writes back the whole cache of the backing device
+    int (*fsync)     (inode_t * file, char datasync);
 
     int (*creat)     (inode_t * parent, const char * pathname, mode_t mode, inode_t ** inode_out);
     int (*mkdir)     (inode_t * parent, const char * pathname, mode_t mode, inode_t ** inode_out);
@@ -68,6 +80,14 @@ struct vfs_ops {
     // do not just read fd->off, use offset, fd->off is prone to races
     // always check valid offsets, seekdir isn't passed to vfs seek
     ssize_t (*readdir) (file_descriptor_t * fd, struct dirent * dent, size_t dent_size, off_t offset);
+    // optional batched readdir, packs as many entries as fit into buf, each d_reclen being DIRENT_RECLEN(strlen(d_name))
+    // same offsets as readdir, returns the amount of bytes written, 0 at the end, -EINVAL if not even one entry fits
+    // and has to set fd->off to the offset following the last returned entry
+    // if missing, sys_getdents falls back to calling readdir in a loop
+    ssize_t (*getdents)(file_descriptor_t * fd, void * buf, size_t n, off_t offset);
+    // optional, returns POLL* readiness and hooks pt onto the waitqs with poll_wait()
+    // if missing, files are always readable and writable
+    short (*poll)(file_descriptor_t * fd, struct poll_table * pt);
     //off_t(*telldir)(file_descriptor_t * fd); // handled via normal seek()
     //off_t(*seekdir)(file_descriptor_t * fd);
     //void(*rewinddir)(file_descriptor_t * fd);
@@ -78,6 +98,10 @@ struct vfs_ops {
     char chown_supported;
     char chgrp_supported;
 
+    // lookups can be cached by the vfs (see dcache.c), meaning lookup() results only change through
+    // creat(), mkdir(), unlink() and rename(), and the inode_t lookup() fills is all register_inode() needs
+    char dcache_supported;
+
     // constants for chown/chgrp
     uid_t uid_max;
     gid_t gid_max;
@@ -97,6 +121,16 @@ struct mount_tree {
     struct mount_tree * next; // next mount instance on this level
 } typedef mount_tree;
 
+// directory entry cache, see dcache.c
+void dcache_init();
+// sb->funcs->lookup() going through the cache, parent == NULL, "." and ".." always go to the driver
+int dcache_lookup(superblock_t * sb, inode_t * parent, const char * name, inode_t ** inode_out, unsigned int flags);
+// drops the entries pointing to the inode and the ones of names inside it (if a directory)
+// call after creating, unlinking or renaming
+void dcache_invalidate(const inode_t * inode);
+void dcache_invalidate_sb(const superblock_t * sb); // on umount
+void dcache_update_inode(const inode_t * inode); // from close_inode(), keeps the cached copies in sync once the inode is gone
+
 extern spinlock_t mount_tree_lock;
 extern struct mount_tree * root_mountpoint;
 
@@ -6,6 +6,8 @@
 #define LINEAR_FRAMEBUFFER_START ((void*)0xD0000000)
 #define LINEAR_FRAMEBUFFER_MAX_SIZE      0x10000000
 extern size_t framebuffer_size;
+extern size_t framebuffer_display_offset; // bytes into the mapping the visible screen starts at, moved by hw scrolling
+extern unsigned int framebuffer_cache_flags; // caching PTE flags of the mapping, for mapping it elsewhere
 
 extern unsigned int display_width, display_height;
 
@@ -49,10 +51,19 @@ struct gfx_funcs {
 
     void (*write_pixel_buffered)(unsigned int x, unsigned int y, uint32_t color, char use_palette);
 
+    // optional, set both or neither
+    // map_color converts a color into the raw value blit_rect takes
+    // blit_rect writes height rows of width raw values (stride apart in pixels) under a single lock, clipped to the display
+    uint32_t (*map_color)(uint32_t color, char use_palette);
+    void (*blit_rect)(unsigned int x, unsigned int y, unsigned int width, unsigned int height, const uint32_t * pixels, unsigned int stride);
+
     void (*fill_buffered)(unsigned int start_x, unsigned int end_x, unsigned start_y, unsigned int end_y, uint32_t color, char use_palette);
     void (*copy_region_unbuffered)(unsigned int x, unsigned int y, unsigned int width, unsigned int height, unsigned int final_x, unsigned int final_y);
     void (*hw_shift_pixels)(unsigned int pixels);
     void (*hw_shift_scanlines)(unsigned int lines);
+    // optional, the VRAM holds pages display_height scanlines apart, flip shows one of them and waits for the vertical retrace
+    // it moves the same display start hw shifting does, -1 returns the page count
+    long (*flip)(long page);
     long (*ioctl)(file_descriptor_t * file, unsigned long cmd, void * arg);
 };
 
@@ -83,19 +94,24 @@ void gfx_blit_char(
     unsigned int size_mult
 );
 
-void * gfx_realloc_back_framebuffer(size_t width, size_t height);
+void * gfx_realloc_back_framebuffer(size_t width, size_t height, size_t pitch, unsigned int pixel_size);
+// flags without PTE_PDE_PAGE_WRITE_THROUGH or PTE_PDE_PAGE_DONT_CACHE get a write-combining mapping where the cpu can do it
 void * gfx_remap_framebuffer(void * phys_start, size_t fb_size, unsigned int flags);
 void gfx_unmap_back_framebuffer();
 
 // heap allocated double buffered framebuffer for drivers to utilize when writing/reading pixels
+// in the native layout of the mode (raw values pixel_size bytes wide, rows pitch bytes apart), so that swapping is a memcpy
 // note: by itself, not used; changed by gfx_remap_framebuffer; always check if null! (not enough memory to allocate)
 #define BACK_FRAMEBUFFER_MAX_SIZE (16*1024*1024) // so that we don't waste 100MB+ of heap on double buffering
-extern uint32_t * back_framebuffer;
+extern void * back_framebuffer;
 extern size_t back_framebuffer_w;
 extern size_t back_framebuffer_h;
+extern size_t back_framebuffer_pitch;
+extern unsigned int back_framebuffer_pixel_size;
 
 #include "kernel_spinlock.h"
 extern spinlock_t framebuffer_lock; // use when accessing the back_framebuffer
 
 extern spinlock_t gfx_spinlock;
+extern spinlock_t glyph_cache_lock;
 #endif
\ No newline at end of file
@@ -85,9 +85,21 @@ unsigned char vbe_set_info(const struct VBE_modes_list * mode); // returns 0 on
 
 void vbe_clear();
 void vbe_write_pixel_buffered(unsigned int x, unsigned int y, uint32_t color, char use_palette);
+uint32_t vbe_map_color(uint32_t color, char use_palette);
+void vbe_blit_rect(unsigned int x, unsigned int y, unsigned int width, unsigned int height, const uint32_t * pixels, unsigned int stride);
 void vbe_copy_region_unbuffered(unsigned int x, unsigned int y, unsigned int width, unsigned int height, unsigned int final_x, unsigned int final_y);
 void vbe_fill_buffered(unsigned int start_x, unsigned int end_x, unsigned start_y, unsigned int end_y, uint32_t color, char use_palette);;
 uint32_t vbe_read_framebuffer(unsigned int x, unsigned int y);
 void vbe_hw_shift_pixels(unsigned int pixels);
 void vbe_hw_shift_scanlines(unsigned int scanlines);
+long vbe_flip(long page); // one page without panning (see vbe_set_panning)
+
+// for drivers that bypass the VRAM path but still have to keep the back framebuffer in sync
+// acquire framebuffer_lock before these, coordinates have to be within the back framebuffer
+void vbe_fill_back_framebuffer(unsigned int start_x, unsigned int end_x, unsigned int start_y, unsigned int end_y, uint32_t raw);
+void vbe_copy_back_framebuffer(unsigned int x, unsigned int y, unsigned int width, unsigned int height, unsigned int final_x, unsigned int final_y);
+
+// for drivers that can move the display start (vbe_funcs users like BGA), call after every mode set
+// virtual_height is in scanlines of the current pitch, set_display_start = NULL disables panning
+void vbe_set_panning(unsigned int virtual_height, void (*set_display_start)(unsigned int scanline));
 #endif
@@ -19,6 +19,7 @@
 #define VGA_PAGE_ADDR ((unsigned char*)0xA0000)
 #define VGA_VRAM_SIZE (1<<16)
 #define VGA_INPUT_STATUS_1_REGISTER 0x3DA 
+#define VGA_INPUT_STATUS_1_VRETRACE 0x8
 
 #define VGA_CRTC_IDX_REG 0x3D4
 #define VGA_CRTC_DATA_REG 0x3D5
@@ -90,6 +91,11 @@ uint32_t vga_read_pixel(unsigned int x, unsigned int y);
 // to a shadow framebuffer
 void vga_write_pixel_buffered(unsigned int x, unsigned int y, uint32_t color, char use_palette);
 
+// raw values for vga_blit_rect, palette indices on mode 12 and RGB8 otherwise
+uint32_t vga_map_color(uint32_t color, char use_palette);
+// to a shadow framebuffer, raw values get truncated to a byte
+void vga_blit_rect(unsigned int x, unsigned int y, unsigned int width, unsigned int height, const uint32_t * pixels, unsigned int stride);
+
 // blits/syncs part of the shadow framebuffer, inclusive
 void vga_swap_region(unsigned int start_x, unsigned int end_x, unsigned int start_y, unsigned int end_y);
 
@@ -99,6 +105,9 @@ void vga_clear_screen();
 
 void vga_fill_buffered(unsigned int start_x, unsigned int end_x, unsigned start_y, unsigned int end_y, uint32_t color, char use_palette);
 
+// mode X has 3 pages in the 64KiB plane window, the rest only one
+long vga_flip(long page);
+
 
 //NOTE:
 //QEMU has a bug that breaks scrolling and makes it show glitchy scanlines
@@ -26,4 +26,7 @@ uint8_t vga_rreg(uint16_t data_reg, uint8_t index);
 void vga_wrattr(uint8_t index, uint8_t data);
 uint8_t vga_rdattr(uint8_t index);
 
+// spins until the next vertical retrace starts, the CRTC latches the display start there
+void vga_wait_vretrace();
+
 #endif
\ No newline at end of file
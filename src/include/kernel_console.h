@@ -6,5 +6,6 @@
 
 void console_write(const char * s, size_t len);
 void console_blink_cursor();
+void console_panic();
 
 #endif
\ No newline at end of file
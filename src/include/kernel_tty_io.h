@@ -75,6 +75,8 @@ struct tty_t {
 
     struct termios params;
     char input_stopped, output_stopped; // see IXON, IXOFF
+
+    struct poll_waitq poll_waitq; // POLLIN on a flushed line (or any input if not canonical), POLLOUT on output restart
 } typedef tty_t;
 
 extern tty_t * terminals[TTY_LIMIT_KERNEL];
@@ -108,6 +110,7 @@ int tty_queue_putch(struct tty_queue * tq, char c, char onlret);
 ssize_t tty_pwrite(file_descriptor_t * file, const void * s, size_t n, off_t offset);
 ssize_t tty_pread(file_descriptor_t * file, void * s, size_t n, off_t offset);
 long tty_ioctl(file_descriptor_t * file, unsigned long request, void * arg);
+short tty_poll(file_descriptor_t * file, struct poll_table * pt);
 
 long tty_write_to_tty(const char * s, size_t n, dev_t dev);
 
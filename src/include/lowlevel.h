@@ -46,6 +46,7 @@
 #define CPUID_1_FFLAGS_D_GET_APIC(x) (((x)>>9)&1) // contains onboard apic
 #define CPUID_1_FFLAGS_D_GET_SEP(x)  (((x)>>11)&1) // has sysenter/sysexit
 #define CPUID_1_FFLAGS_D_GET_MTRR(x) (((x)>>12)&1) // memory type range register
+#define CPUID_1_FFLAGS_D_GET_PGE(x)  (((x)>>13)&1) // global pages
 #define CPUID_1_FFLAGS_D_GET_PAT(x)  (((x)>>16)&1) // MTRR in 4K linear granularity
 #define CPUID_1_FFLAGS_D_GET_ACPI(x) (((x)>>22)&1) // Onboard thermal control MSRs for ACPI
 #define CPUID_1_FFLAGS_D_GET_MMX(x)  (((x)>>23)&1)
@@ -71,6 +72,28 @@ enum cpuid_funcs {
     CPUID_VENDOR_FULL_3 = 0x80000004,
 };
 
+// model specific registers, only with CPUID_1_FFLAGS_D_GET_MSR
+#define MSR_MTRRCAP 0xFE
+#define MSR_MTRR_PHYSBASE(n) (0x200 + 2 * (n))
+#define MSR_MTRR_PHYSMASK(n) (0x201 + 2 * (n))
+#define MSR_PAT 0x277
+#define MSR_MTRR_DEF_TYPE 0x2FF
+
+#define MTRRCAP_GET_VCNT(x) ((x) & 0xFF) // variable range count
+#define MTRRCAP_WC 0x400 // write-combining supported
+#define MTRR_PHYSMASK_VALID 0x800
+#define MTRR_DEF_TYPE_ENABLE 0x800
+
+// for MTRRs and PAT entries
+enum memory_types {
+    MEMORY_TYPE_UC = 0,
+    MEMORY_TYPE_WC = 1,
+    MEMORY_TYPE_WT = 4,
+    MEMORY_TYPE_WP = 5,
+    MEMORY_TYPE_WB = 6,
+    MEMORY_TYPE_UC_MINUS = 7, // PAT only, an MTRR can still make it WC
+};
+
 
 #define X86_CONVENTIONAL_MEMORY_START 0x500
 #define X86_SEGMENT_SIZE 0xFFFF
@@ -98,7 +121,12 @@ void io_wait();
 
 char is_cpuid_supported();
 
+uint64_t rdmsr(uint32_t msr);
+void wrmsr(uint32_t msr, uint64_t value);
+
 extern char mtrr_available;
 extern char pat_available;
 extern char fxsave_available;
+extern char pse_available;
+extern char pge_available;
 #endif
\ No newline at end of file
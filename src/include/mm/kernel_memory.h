@@ -16,11 +16,14 @@ enum PTE_FLAGS {
     PTE_PDE_PAGE_ACCESSED_DURING_TRANSLATE = 32,
     PTE_PAGE_DIRTY = 64, // not applicable in PDE
     //PTE_PAGE_ATTRIBUTE_TABLE = 128, // = 0
-    //PTE_PDE_PAGE_GLOBAL = 256
+    PDE_PAGE_LARGE = 128, // PDE maps a 4MiB page directly, needs CR4.PSE
+    PTE_PDE_PAGE_GLOBAL = 256, // survives cr3 reloads, needs CR4.PGE; only for mappings identical in every address space
     PTE_PDE_USER1 = 512, // following values are free for us to use
     PTE_PDE_USER2 = 1024,
     PTE_PDE_USER3 = 2048,
 };
+#define PTE_PAGE_PAT PDE_PAGE_LARGE // same bit, in a 4KiB PTE it selects the upper half of the PAT
+#define PDE_PAGE_LARGE_PAT 0x1000 // the same for 4MiB pages, taken from the address bits
 #define PTE_FORK_WRITABLE PTE_PDE_USER1
 // this page was duplicated during fork() and was originally writable - replace on page fault
 
@@ -33,6 +36,9 @@ PTE structure for 4kib page sizes
                             0 - 7                                                 9 - 11           12 - 31
 present, r/w, user/kernel, writethrough, cache disable, accessed, dirty, 0, 0       0          bits 12-31 of address
 
+PDE structure for 4mib page sizes (PSE)
+                            0 - 7                                                          8         9 - 11    12     13 - 21   22 - 31
+present, r/w, user/kernel, writethrough, cache disable, accessed, dirty, 1 (page size)   global      0       PAT       0      bits 22-31 of address
 */
 
 #include "../kernel_spinlock.h"
@@ -41,6 +47,7 @@ extern spinlock_t address_spaces_lock;
 #define get_vaddr(pdidx, ptidx) ((void*)(((long)(pdidx) << 22) | ((long)(ptidx) << 12)))
 
 #define PAGE_SIZE_NO_PAE 0x1000
+#define PAGE_SIZE_LARGE_NO_PAE 0x400000
 #define PAGE_DIRECTORY_TYPE uint32_t
 #define PAGE_TABLE_TYPE PAGE_DIRECTORY_TYPE
 #define PAGE_DIRECTORY_ENTRIES 1024
@@ -70,9 +77,23 @@ void pffree(void * page);
 void pffree_1M(void * block_1M_start); // frees memory gotten by pfalloc_1M
 void * pfalloc_dup_page(void * page);
 void * pfalloc_ref_inc(void * page);
+unsigned long pf_get_refcount(void * page); // 0 for free and unmanaged frames
 
 void paging_map_phys_addr(void * src_phys_addr, void * target_virt_addr, unsigned int flags);
-void * paging_map_phys_addr_unspecified(void * phys_addr, unsigned int flags); // just naively maps a physical address to nearest free virtual address
+void paging_map_phys_addr_large(void * src_phys_addr, void * target_virt_addr, unsigned int flags); // maps a 4MiB page, both addresses 4MiB aligned, requires pse_available
+void * paging_map_phys_addr_unspecified(void * phys_addr, unsigned int flags); // maps a physical address to a free page of the kernel virtual address arena, paging_unmap_page() gives it back
+
+// kernel virtual address arena, the pages above the kernel heap and the pmm's page info that every address space shares
+void kvaddr_init(void * start, void * end);
+void * kvaddr_alloc(size_t pages); // reserves a contiguous range without mapping anything, rounded up to a power of 2 pages
+void kvaddr_free(void * vaddr); // unmap the range beforehand
+void * kvaddr_alloc_mapping(); // for paging_map_phys_addr_unspecified()
+void kvaddr_free_mapping(void * vaddr); // no-op for anything not from kvaddr_alloc_mapping()
+
+// short lived single page mappings into fixed per-cpu slots, interrupts are disabled until the last one is unmapped
+// unmap in the reverse order, don't sleep nor fault in between
+void * kmap_atomic(void * phys_addr, unsigned int flags);
+void kunmap_atomic(void * vaddr);
 
 void * paging_map(void * target_virt_addr, size_t n, unsigned int flags);
 void * paging_add_page(void * target_virt_addr, unsigned int flags); // adds a singular page, equivalent to paging_map(target_virt_addr, PAGE_SIZE_NO_PAE, flags)
@@ -82,7 +103,7 @@ void paging_remap(void * old_virt_addr, void * new_virt_addr, unsigned int flags
 void paging_change_flags(void * target_virt_addr, size_t n, unsigned int flags);
 
 void * paging_virt_addr_to_phys(void * virt);
-PAGE_TABLE_TYPE * paging_get_pte(const void * virt_addr); // returns the page table entry for a given address, NULL = not present (to check for permissions for example)
+PAGE_TABLE_TYPE * paging_get_pte(const void * virt_addr); // returns the page table entry for a given address, NULL = not present (to check for permissions for example), the PDE itself for 4MiB pages
 
 // returns a mapped page table (creating one if need be), caller's required to unmap
 // for future endeavors: it doesn't make sense to make a paging_get_pte_from_address_space
@@ -97,6 +118,11 @@ void print_page_table_entry(const void * pte);
 
 void setup_paging(unsigned long ident_map_end);
 
+// memory types of physical ranges, see mm/memtype.c
+void memtype_init(); // programs the PAT, done by setup_paging()
+unsigned int memtype_wc_flags(char large); // PTE (or 4MiB PDE) flags that make a mapping write-combining, 0 without PAT
+long memtype_mtrr_set_wc(void * phys_start, size_t size); // for CPUs with MTRRs but no PAT, 0 or -errno
+
 void kalloc_prepare(void * heap_struct_start, void * allocated_heap_top, void * maximum_heap_top);
 
 //#pragma clang diagnostic ignored "-Wignored-attributes"
@@ -114,6 +140,9 @@ PAGE_DIRECTORY_TYPE * paging_create_new_address_space(); // returns VIRTUAL addr
 void paging_print_address_space(PAGE_DIRECTORY_TYPE * pd_vaddr);
 // unmap all mmaped regions before calling
 void paging_destroy_address_space(PAGE_DIRECTORY_TYPE * pd_vaddr);
+// copies the current address space's PDEs of a kernel-only range (e.g. the framebuffer) into every other address space
+// caller has to hold address_spaces_lock so that nobody copies a stale kernel page directory in the meantime
+void paging_sync_kernel_pdes(void * start, size_t n);
 
 void * paging_get_page_from_address_space(PAGE_DIRECTORY_TYPE * pd_paddr, void * target_virt_addr, unsigned int flags);
 
@@ -131,7 +160,8 @@ void disable_paging();
 void enable_wp();
 void disable_wp();
 
-void flush_tlb();
+void flush_tlb(); // global entries stay
+void flush_tlb_global(); // everything, including global entries
 void flush_tlb_entry(void * vaddr);
 void flush_caches_writeback();
 
@@ -146,4 +176,7 @@ extern PAGE_DIRECTORY_TYPE * kernel_address_space_paddr;
 #define ___KERNEL_HEAP_BASE 0x05000000
 #define KERNEL_HEAP_BASE ((void*)___KERNEL_HEAP_BASE) // before gcc's default .text address of 0x08000000
 
+#define ___KERNEL_SHARED_END 0x08000000
+#define KERNEL_SHARED_END ((void*)___KERNEL_SHARED_END) // page tables below this are preallocated and shared by every address space
+
 #endif
\ No newline at end of file
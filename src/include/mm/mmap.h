@@ -16,6 +16,10 @@ struct vm_record {
 
     int prot;
     int private;
+
+    // sequential fault detection for read-ahead, in pages of the backing file
+    unsigned long ra_next;
+    unsigned short ra_pages;
 };
 
 struct page_fault_error {
@@ -12,5 +12,6 @@ void pmm_retain(size_t page_num);
 size_t pmm_get_usable_pages_end();
 size_t pmm_get_usable_page_count();
 size_t pmm_get_free_page_count();
+void* pmm_get_page_info_end(); // first virtual address after the page info structs
 #define pmm_size_to_order(size) ({ kassert(size != 0); __builtin_ctz(size / PAGE_SIZE); })
 #endif
@@ -0,0 +1,66 @@
+#ifndef MM_SWAP_H
+#define MM_SWAP_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include "kernel_memory.h"
+#include "../fs/fs.h"
+
+/*
+swap PTE structure (never present)
+    0          1 - 2            9               10            11           12 - 31
+    0    saved r/w, user   saved fork cow   1 (swapped)        0       swap slot number
+*/
+#define PTE_SWAPPED PTE_PDE_USER2
+// the page of a private file mapping wasn't modified since it was read in, reclaim can drop it instead of swapping it
+#define PTE_FILE_CLEAN PTE_PDE_USER3
+#define PTE_SWAP_SAVED_FLAGS (PTE_PDE_PAGE_WRITABLE | PTE_PDE_PAGE_USER_ACCESS | PTE_FORK_WRITABLE)
+#define PTE_IS_SWAPPED(pte) (((pte) & (PTE_PDE_PAGE_PRESENT | PTE_SWAPPED)) == PTE_SWAPPED)
+
+#define SWAP_MAX_SLOTS (1 << 20) // 20 bits of slot in the swap PTE, 4GiB of swap
+#define SWAP_CLUSTER_PAGES 16 // pages written out by a single reclaim batch
+#define SWAP_SCAN_BUDGET 1024 // PTEs looked at per reclaim batch
+
+// kswapd gets woken once the free page count drops below the low watermark and reclaims until the high one
+#define SWAP_LOW_WATERMARK_PAGES 256 // 1MiB
+#define SWAP_HIGH_WATERMARK_PAGES 512 // 2MiB
+#define SWAP_OOM_RETRIES 3 // how many reclaim passes an allocation waits on before giving up
+
+void swap_init(); // starts kswapd and activates a swap partition found by mbr_parse_table, call after the drives are initialized
+
+// remembers a partition marked as swap in the partition table, only the first one is used
+void swap_register_partition(dev_t partition);
+
+long sys_swapon(const char * path);
+long sys_swapoff(const char * path);
+
+// reads a swapped out page at vaddr (in the current address space) back in
+// returns 0 on success, -ENOENT if the page isn't swapped out, -ENOMEM or a read error otherwise
+// may sleep, don't call with spinlocks held
+long swap_in_page(void * vaddr);
+
+// same as paging_get_pte, but swaps the page back in first if need be
+PAGE_TABLE_TYPE * swap_get_pte(const void * vaddr);
+
+// returns the swap PTE at vaddr in the current address space, 0 if the page isn't swapped out
+PAGE_TABLE_TYPE swap_get_entry(const void * vaddr);
+
+// changes the flags restored on swap in of a swapped out page, no-op for any other page
+void swap_change_flags(void * vaddr, unsigned int flags);
+
+// reference counting of swap slots for swap PTEs being copied (fork()) or dropped (unmap, address space destruction)
+void swap_dup_entry(PAGE_TABLE_TYPE pte);
+void swap_free_entry(PAGE_TABLE_TYPE pte);
+
+// wakes up kswapd, safe to call from anywhere, including pfalloc()
+void swap_wake_reclaim();
+
+// wakes up kswapd and sleeps until it finishes a reclaim pass
+// returns 1 if there's a point in retrying the allocation
+// may sleep, don't call with spinlocks held
+char swap_wait_for_memory();
+
+// paging_add_page that waits on reclaim instead of failing right away when out of memory
+void * swap_add_page(void * target_virt_addr, unsigned int flags);
+
+#endif
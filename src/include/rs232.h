@@ -2,6 +2,8 @@
 #define RS232_H
 
 #define COM_MAX_BAUDRATE 115200
+#define COM_MIN_BAUDRATE 75
+#define COM_16550A_FIFO_SIZE 16 // tx, the rx trigger level is set by enum com_fifo
 
 enum com_errors {
     COM_ERR_INVALID_PORT = -1,
@@ -42,7 +44,10 @@ enum com_fifo { // don't move around, see COM_FCR_IRQ_LEVEL
 };
 
 char com_init(unsigned char com, unsigned int baudrate, enum com_data_bits data_bits, enum com_stop_bits stop_bits, enum com_parity parity, enum com_fifo buffered_bytes);
-long com_write(unsigned char com, const char * data, unsigned long len);
+long com_write(unsigned char com, const char * data, unsigned long len); // queues, only blocks when the tx ring is full
+unsigned int com_get_baudrate(unsigned char com); // 0 if not initialized
+long com_set_baudrate(unsigned char com, unsigned int baudrate); // waits for queued output to go out first
+void com_panic(); // unlocks the ports and switches writes to polling, for kprintf()
 
 #define COM_DELTA_RX 0
 #define COM_DELTA_TX 0
@@ -68,7 +73,16 @@ long com_write(unsigned char com, const char * data, unsigned long len);
 #define COM_IIR_NO_PENDING 1
 #define COM_IIR_INTERRUPT_STATE_MASK (3<<1) // 0, lowest priority, Modem Status, 1 = Tx holding register empty, 2 = recv data avail, 3 = reciever status
 #define COM_IIR_UART_16650_TIMEOUT_IRQ_PENDING (1<<3)
-#define COM_IIR_FIFO_BUFFER_STATE (3<<6) // 0 = no fifo, 1 = fifo enabled but unusable, 2 = fifo enabled
+#define COM_IIR_FIFO_BUFFER_STATE (3<<6) // 0 = no fifo, 2 = fifo enabled but unusable (16550), 3 = fifo enabled (16550A)
+#define COM_IIR_FIFO_UNUSABLE (2<<6)
+#define COM_IIR_FIFO_ENABLED (3<<6)
+
+enum com_iir_state { // see COM_IIR_INTERRUPT_STATE_MASK
+    COM_IIR_STATE_MODEM_STATUS,
+    COM_IIR_STATE_TX_EMPTY,
+    COM_IIR_STATE_RECV_DATA,
+    COM_IIR_STATE_LINE_STATUS
+};
 
 #define COM_FCR_ENABLE_FIFO 1
 #define COM_FCR_CLEAR_RX_FIFO (1<<1) // will be set back to 0 once finished
@@ -26,12 +26,15 @@
 
 #include "dev_ops.h"
 #include "kernel_tty_io.h"
+#include "kernel_console.h"
 #include "gfx.h"
 #include "gfx/vga.h"
 #include "include/gfx/vbe.h"
 #include "pci/pci.h"
 #include "block/ata/ata.h"
 #include "mm/pmm.h"
+#include "mm/swap.h"
+#include "fs/uring.h"
 
 // so we can link against libc
 void _init() {}
@@ -50,8 +53,11 @@ void panic(char * reason) {
     extern spinlock_t kalloc_lock;
     gfx_spinlock.state     = SPINLOCK_UNLOCKED; // in case panic happened during vga writes
     framebuffer_lock.state = SPINLOCK_UNLOCKED;
+    glyph_cache_lock.state = SPINLOCK_UNLOCKED;
     kalloc_lock.state      = SPINLOCK_UNLOCKED;
     back_framebuffer       = NULL; // in case it was a framebuffer page fault
+    com_panic(); // nothing might drain the serial output anymore
+    console_panic();
 
     // the most supported graphics mode
     // good idea for panics in graphics code
@@ -262,6 +268,8 @@ static void idle_func(void * _) {
 char mtrr_available   = 0;
 char pat_available    = 0;
 char fxsave_available = 0;
+char pse_available    = 0;
+char pge_available    = 0;
 
 
 static __attribute__((naked)) void enable_x87() {
@@ -302,6 +310,11 @@ static void setup_features() {
         mtrr_available = 1;
     if (CPUID_1_FFLAGS_D_GET_PAT(supported_features))
         pat_available = 1;
+    // CR4 bits themselves are set by setup_paging()
+    if (CPUID_1_FFLAGS_D_GET_PSE(supported_features))
+        pse_available = 1;
+    if (CPUID_1_FFLAGS_D_GET_PGE(supported_features))
+        pge_available = 1;
 
     if (CPUID_1_FFLAGS_D_GET_SSE(supported_features) && !fxsave_available)
         kprintf("\e[91mWarning: SSE without FXSR is not a supported combination, won't setup SSE\e[0m\n");
@@ -324,8 +337,8 @@ void kernel_entry(multiboot_info_t* mbd, unsigned int magic) {
 
     vga_init_graphics(); // preliminary setup to get any gfx output
 
-    com_init(0, 115200, COM_DATA_BITS_8, COM_STOP_BITS_1, COM_PARITY_NONE, COM_BUFFER_1);
-    com_init(1, 115200, COM_DATA_BITS_8, COM_STOP_BITS_1, COM_PARITY_NONE, COM_BUFFER_1);
+    com_init(0, 115200, COM_DATA_BITS_8, COM_STOP_BITS_1, COM_PARITY_NONE, COM_BUFFER_14);
+    com_init(1, 115200, COM_DATA_BITS_8, COM_STOP_BITS_1, COM_PARITY_NONE, COM_BUFFER_14);
 
     kprintf("Running " KERNEL_VERSION ", compiled at "__TIMESTAMP__"\n");
 
@@ -394,6 +407,7 @@ void kernel_entry(multiboot_info_t* mbd, unsigned int magic) {
 	kernel_mem_top = KERNEL_END; // FIXME: the new PMM manages its own memory, we shouldn't need to maintain this
 	setup_paging(boot_mem_top);
 	pmm_init_post_vmm();
+	kvaddr_init(pmm_get_page_info_end(), KERNEL_SHARED_END);
 	kprintf("Kernel: Total usable RAM: %lu bytes\n", pf_get_free_memory());
 #else
 	kernel_mem_top = page_frame_alloc_init(mbd, (void*)boot_mem_top);
@@ -401,6 +415,7 @@ void kernel_entry(multiboot_info_t* mbd, unsigned int magic) {
 
 	// initialize basic stuff
 	setup_paging(boot_mem_top);
+	kvaddr_init(kernel_mem_top, KERNEL_SHARED_END);
 #endif
 
     construct_descriptor_tables();
@@ -418,6 +433,7 @@ void kernel_entry(multiboot_info_t* mbd, unsigned int magic) {
 
     init_fds();
     init_inodes();
+    dcache_init();
     init_superblocks();
 
     gfx_remap_framebuffer(VGA_PAGE_ADDR, 128*1024, PTE_PDE_PAGE_WRITE_THROUGH);
@@ -441,6 +457,9 @@ void kernel_entry(multiboot_info_t* mbd, unsigned int magic) {
     extern void dev_initialize_static_devices();
     dev_initialize_static_devices();
 
+    swap_init(); // after the drives, so that it can pick up a swap partition
+    uring_init();
+
     early_init = 0;
 
     if (initrd_start + initrd_len > (void*)IDENT_MAPPING_MAX_ADDR)
@@ -74,6 +74,7 @@ void console_cursor_hide() {
         extern spinlock_t gfx_spinlock;
         if (gfx_spinlock.state     == SPINLOCK_LOCKED) return;
         if (framebuffer_lock.state == SPINLOCK_LOCKED) return;
+        if (glyph_cache_lock.state == SPINLOCK_LOCKED) return;
         cursor_busy = 1;
         cursor_currently_visible = 0;
 
@@ -118,6 +119,7 @@ void console_cursor_show() {
         extern spinlock_t gfx_spinlock;
         if (gfx_spinlock.state     == SPINLOCK_LOCKED) return;
         if (framebuffer_lock.state == SPINLOCK_LOCKED) return;
+        if (glyph_cache_lock.state == SPINLOCK_LOCKED) return;
 
         cursor_busy = 1;
         cursor_currently_visible = 1;
@@ -175,13 +177,12 @@ void console_redraw_range(int startx, int endx, int starty, int endy) {
 
     for (unsigned int y = starty; y <= endy; y++) {
         for (unsigned int x = startx; x <= endx; x++) {
-            if (!isprint(console_buffer[y * console_buffer_w + x].c)) continue;
-
-            gfx_blit_char(
-                console_buffer[y * console_buffer_w + x].c,
+            struct character_cell cell = console_buffer[y * console_buffer_w + x];
+            gfx_blit_char_buffered(
+                isprint(cell.c) ? cell.c : ' ',
                 x * console_font_width * FONT_MULTIPLIER, y * console_font_height * FONT_MULTIPLIER,
-                console_buffer[y * console_buffer_w + x].fg,
-                console_buffer[y * console_buffer_w + x].bg,
+                cell.fg,
+                cell.bg,
                 1,
                 FONT_MULTIPLIER
             );
@@ -189,27 +190,75 @@ void console_redraw_range(int startx, int endx, int starty, int endy) {
     }
 
     spinlock_release(&console_buffer_lock);
+
+    current_video_funcs->swap_region(
+        startx * console_font_width * FONT_MULTIPLIER, (endx + 1) * console_font_width * FONT_MULTIPLIER,
+        starty * console_font_height * FONT_MULTIPLIER, (endy + 1) * console_font_height * FONT_MULTIPLIER
+    );
+}
+
+// once there's a console_buffer, writes only change cells and mark them here
+// the whole batch then gets drawn and swapped once at the end of console_write
+// scrolls are deferred as well, so a screenful of output is one hw scroll instead of one per line
+static char damage_dirty = 0;
+static int damage_start_x, damage_end_x, damage_start_y, damage_end_y; // in cells, inclusive
+static int pending_scroll = 0; // lines
+static int console_write_depth = 0;
+static thread_t * console_write_owner = NULL; // thread that opened the batch
+static char console_panicked = 0; // draw straight to the screen, see console_panic()
+
+static void console_damage(int startx, int endx, int starty, int endy) {
+    if (!damage_dirty) {
+        damage_start_x = startx;
+        damage_end_x = endx;
+        damage_start_y = starty;
+        damage_end_y = endy;
+        damage_dirty = 1;
+        return;
+    }
+    if (startx < damage_start_x) damage_start_x = startx;
+    if (endx > damage_end_x) damage_end_x = endx;
+    if (starty < damage_start_y) damage_start_y = starty;
+    if (endy > damage_end_y) damage_end_y = endy;
+}
+
+static void console_flush() {
+    if (!damage_dirty && !pending_scroll) return;
+    console_cursor_hide();
+    cursor_busy = 1;
+
+    if (pending_scroll) {
+        // the lines scrolled in are already part of the damage
+        if (pending_scroll < console_buffer_h)
+            gfx_hw_scroll_scanlines(pending_scroll * console_font_height * FONT_MULTIPLIER);
+        pending_scroll = 0;
+    }
+    if (damage_dirty) {
+        damage_dirty = 0;
+        console_redraw_range(damage_start_x, damage_end_x, damage_start_y, damage_end_y);
+    }
+    cursor_busy = 0;
 }
 
 static void console_set_char(int x, int y, char c) {
     if (x >= display_width_chars / FONT_MULTIPLIER) return;
     if (y >= display_height_chars/ FONT_MULTIPLIER) return;
 
-    static char panicked_here = 0;
     char redraw = 0;
 
-    if (isprint(c)) {
-        gfx_blit_char(c, console_x*console_font_width*FONT_MULTIPLIER,
-                console_y*console_font_height*FONT_MULTIPLIER,
-        console_color_fg, console_color_bg, 1, FONT_MULTIPLIER);
-    } else if (c == CHAR_CELL_RELATED) {
-        gfx_blit_char(' ', console_x*console_font_width*FONT_MULTIPLIER,
-                console_y*console_font_height*FONT_MULTIPLIER,
-        console_color_fg, console_color_bg, 1, FONT_MULTIPLIER);
+    if (current_process == NULL || console_panicked) { // scheduler not initialized -> early boot -> no heap, draw right away
+        if (isprint(c)) {
+            gfx_blit_char(c, x*console_font_width*FONT_MULTIPLIER,
+                    y*console_font_height*FONT_MULTIPLIER,
+            console_color_fg, console_color_bg, 1, FONT_MULTIPLIER);
+        } else if (c == CHAR_CELL_RELATED) {
+            gfx_blit_char(' ', x*console_font_width*FONT_MULTIPLIER,
+                    y*console_font_height*FONT_MULTIPLIER,
+            console_color_fg, console_color_bg, 1, FONT_MULTIPLIER);
+        }
+        return;
     }
 
-    if (current_process == NULL || panicked_here) return; // scheduler not initialized -> early boot -> no heap
-
     spinlock_acquire_interruptible(&console_buffer_lock);
 
     if (console_buffer == NULL) { // early boot
@@ -218,7 +267,7 @@ static void console_set_char(int x, int y, char c) {
                 display_width_chars * display_height_chars /
                 FONT_MULTIPLIER / FONT_MULTIPLIER);
         if (console_buffer == NULL) {
-            panicked_here = 1; // so we don't deadlock on panic with spinlock_acquire
+            console_panicked = 1; // so we don't deadlock on panic with spinlock_acquire
             panic("Failed to allocate console canvas!\n");
         }
         memset(console_buffer, 0, sizeof(struct character_cell) *
@@ -236,7 +285,7 @@ static void console_set_char(int x, int y, char c) {
                 display_width_chars * display_height_chars /
                 FONT_MULTIPLIER / FONT_MULTIPLIER);
         if (console_buffer_2 == NULL) {
-            panicked_here = 1; // so we don't deadlock on panic with spinlock_acquire
+            console_panicked = 1; // so we don't deadlock on panic with spinlock_acquire
             panic("Failed to allocate console canvas!\n");
         }
 
@@ -284,34 +333,53 @@ static void console_set_char(int x, int y, char c) {
     spinlock_release(&console_buffer_lock);
 
     if (redraw)
-        console_redraw_range(0, console_buffer_w - 1, 0, console_buffer_h - 1);
+        console_damage(0, console_buffer_w - 1, 0, console_buffer_h - 1);
+    else
+        console_damage(x, x, y, y);
 }
 
 static void console_scroll(int lines) {
     console_cursor_hide();
-    cursor_busy = 1;
-    gfx_hw_scroll_scanlines(console_font_height*FONT_MULTIPLIER);
-    current_video_funcs->fill_buffered(0, display_width - 1,
-        display_height - console_font_height*FONT_MULTIPLIER, display_height - 1,
-        console_color_bg, 1
-    );
-    current_video_funcs->swap_region(0, display_width - 1,
-        display_height - console_font_height*FONT_MULTIPLIER, display_height - 1
-    );
-
-    if (current_process == NULL || console_buffer == NULL) return; // scheduler not initialized -> early boot -> no heap
+    cursor_busy = 1; // until the flush, the screen is behind console_buffer
+
+    if (current_process == NULL || console_buffer == NULL || console_panicked) { // scheduler not initialized -> early boot -> no heap
+        gfx_hw_scroll_scanlines(console_font_height*FONT_MULTIPLIER);
+        current_video_funcs->fill_buffered(0, display_width - 1,
+            display_height - console_font_height*FONT_MULTIPLIER, display_height - 1,
+            console_color_bg, 1
+        );
+        current_video_funcs->swap_region(0, display_width - 1,
+            display_height - console_font_height*FONT_MULTIPLIER, display_height - 1
+        );
+        return;
+    }
 
     spinlock_acquire(&console_buffer_lock);
-    memcpy(console_buffer,
+    if (lines > console_buffer_h) lines = console_buffer_h;
+    memmove(console_buffer,
         console_buffer + lines * console_buffer_w,
         (console_buffer_h - lines) * console_buffer_w * sizeof(struct character_cell)
     );
-    memset(console_buffer + (console_buffer_h - lines) * console_buffer_w,
-        0,
-        lines * console_buffer_w * sizeof(struct character_cell)
-    );
+    struct character_cell cc = {
+        .c = 0,
+        .fg = console_color_fg,
+        .bg = console_color_bg
+    };
+    for (int i = (console_buffer_h - lines) * console_buffer_w; i < console_buffer_h * console_buffer_w; i++)
+        console_buffer[i] = cc;
     spinlock_release(&console_buffer_lock);
-    cursor_busy = 0;
+
+    pending_scroll += lines;
+    if (damage_dirty) {
+        damage_start_y -= lines;
+        damage_end_y -= lines;
+        if (damage_end_y < 0) damage_dirty = 0;
+        else if (damage_start_y < 0) damage_start_y = 0;
+    }
+    console_damage(0, console_buffer_w - 1, console_buffer_h - lines, console_buffer_h - 1);
+
+    if (console_write_depth == 0)
+        console_flush();
 }
 
 static void handle_ansi_escapes(const char * ansi_sequence) {
@@ -330,6 +398,15 @@ static void handle_ansi_escapes(const char * ansi_sequence) {
     // in addition, panic() does \[H, which without sscanf would yield the same color and thus unreadable text
     if (early_init) return;
 
+    // these draw straight to the screen, the batch has to be there first
+    switch (ansi_sequence[strlen(ansi_sequence) - 1]) {
+        case 'J':
+        case 'K':
+        case 'S':
+        case 'T':
+            console_flush();
+    }
+
     switch (ansi_sequence[1]) { // 1 char escapes
         case 'm':
             reset_graphics:
@@ -786,6 +863,8 @@ static char ansi_escape_state_machine(char c) {
 }
 
 void console_write(const char * s, size_t len) {
+    if (console_write_depth == 0) console_write_owner = current_thread;
+    console_write_depth++;
     for (int i = 0; i < len; i++) {
         if (ansi_escape_state_machine(s[i])) continue;
 
@@ -817,10 +896,7 @@ void console_write(const char * s, size_t len) {
                 }
                 console_buffer[console_y * console_buffer_w + console_x].c = 0;
                 spinlock_release(&console_buffer_lock);
-                gfx_blit_char(' ',
-                    console_x * console_font_width * FONT_MULTIPLIER,
-                    console_y * console_font_height * FONT_MULTIPLIER,
-                    0, 0, 1, FONT_MULTIPLIER);
+                console_damage(console_x, console_x, console_y, console_y);
                 continue;
             }
             while (console_buffer[console_y * console_buffer_w + console_x - 1].c == CHAR_CELL_RELATED) {
@@ -832,10 +908,7 @@ void console_write(const char * s, size_t len) {
                     console_x --;
                 }
                 console_buffer[console_y * console_buffer_w + console_x].c = 0;
-                gfx_blit_char(' ',
-                    console_x * console_font_width * FONT_MULTIPLIER,
-                    console_y * console_font_height * FONT_MULTIPLIER,
-                    0, 0, 1, FONT_MULTIPLIER);
+                console_damage(console_x, console_x, console_y, console_y);
             }
             spinlock_release(&console_buffer_lock);
             ///*if (s[i] == 0x7F)*/ vga_put_char(0, vga_color, vga_x, vga_y); // assuming cursor is in front of text
@@ -866,10 +939,21 @@ void console_write(const char * s, size_t len) {
         console_x++;
     }
 
+    // tabs write through us, but a batch left open by a preempted thread shouldn't hold back our output
+    if (--console_write_depth > 0 && console_write_owner == current_thread) return;
+    console_flush();
     console_move_cursor(console_x, console_y);
 }
 
 
+// a panic may have interrupted a console_write, whose batch would then never get drawn
+// from here on everything goes straight to the screen, the console_buffer may be mid-update
+void console_panic() {
+    console_panicked = 1;
+    console_write_depth = 0;
+    console_write_owner = NULL;
+    console_buffer_lock.state = SPINLOCK_UNLOCKED;
+}
 
 #define TTY_SHIFT_MOD_MASK 0x7F
 #define TTY_OTHERS_START 87
@@ -2,12 +2,13 @@
 #include "include/kernel_exec.h"
 #include "include/kernel_sched.h"
 #include "include/mm/kernel_memory.h"
+#include "include/mm/swap.h"
 #include "../libc/src/include/string.h"
 #include "../libc/src/include/errno.h"
 #include <stddef.h>
 
 static char check_address(const void * address) {
-    PAGE_TABLE_TYPE * pte = paging_get_pte(address);
+    PAGE_TABLE_TYPE * pte = swap_get_pte(address);
     if (pte == NULL || (!(*pte & PTE_PDE_PAGE_USER_ACCESS) && current_process->ring != 0))
         return 0;
     return 1;
@@ -8,6 +8,7 @@
 #include <string.h>
 #include <stdint.h>
 #include "mm/mmap.h"
+#include "mm/swap.h"
 #include "rbtree.h"
 
 // TODO: when implementing SMP, maybe a race condition with fork() and exit()?
@@ -17,7 +18,14 @@ char fork_cow_page(void * fault_address) {
     if (*pte & PTE_FORK_WRITABLE) {
         void * old_page = paging_virt_addr_to_phys(fault_address);
         void * new_page = pfalloc_dup_page(old_page);
-        kassert(new_page);
+        for (int i = 0; new_page == NULL && i < SWAP_OOM_RETRIES; i++) {
+            if (!swap_wait_for_memory()) break;
+            pte = paging_get_pte(fault_address); // could've been swapped out while we slept
+            if (pte == NULL || !(*pte & PTE_FORK_WRITABLE)) return 1; // let the access retry
+            old_page = paging_virt_addr_to_phys(fault_address);
+            new_page = pfalloc_dup_page(old_page);
+        }
+        if (new_page == NULL) return -1;
 
         *pte &= PAGE_SIZE_NO_PAE - 1;
         *pte &= ~PTE_FORK_WRITABLE;
@@ -72,8 +80,7 @@ static PAGE_DIRECTORY_TYPE * fork_dup_address_space() {
                             PTE_PDE_PAGE_PRESENT |
                             PTE_PDE_PAGE_WRITABLE |
                             PTE_PDE_PAGE_USER_ACCESS;
-        new_ptes = paging_map_phys_addr_unspecified(new_ptes, PTE_PDE_PAGE_WRITABLE);
-        kassert(new_ptes);
+        new_ptes = kmap_atomic(new_ptes, PTE_PDE_PAGE_WRITABLE);
         //memset(new_ptes, 0, PAGE_TABLE_ENTRIES * sizeof(PAGE_TABLE_TYPE));
         memcpy(new_ptes, ptes, PAGE_TABLE_ENTRIES * sizeof(PAGE_TABLE_TYPE));
 
@@ -81,7 +88,11 @@ static PAGE_DIRECTORY_TYPE * fork_dup_address_space() {
             next_mmap_check_j = 0;
 
         for (int j = 0; j < PAGE_TABLE_ENTRIES; j++) {
-            if (!(ptes[j] & PTE_PDE_PAGE_PRESENT)) continue;
+            if (!(ptes[j] & PTE_PDE_PAGE_PRESENT)) {
+                if (PTE_IS_SWAPPED(ptes[j]))
+                    swap_dup_entry(ptes[j]);
+                continue;
+            }
             if (get_vaddr(i, j) == new_ptes ||
                 get_vaddr(i, j) == page_directory) {
                 new_ptes[j] = 0;
@@ -170,13 +181,13 @@ static PAGE_DIRECTORY_TYPE * fork_dup_address_space() {
             flush_tlb_entry(get_vaddr(i, j));
         }
 
-        paging_unmap_page(new_ptes);
+        kunmap_atomic(new_ptes);
     }
 
     // duplicate the thread stack
     // we do new pages for the stack since it would be always page faulting
 
-    int prev_pd_idx = 0; // to not call paging_map_phys_addr_unspecified over and over
+    int prev_pd_idx = 0; // to not remap the page table over and over
     PAGE_TABLE_TYPE * pt = NULL;
     for (void * i = current_thread->stack - current_thread->stack_size;
         i < current_thread->stack;
@@ -195,21 +206,20 @@ static PAGE_DIRECTORY_TYPE * fork_dup_address_space() {
         if (page_directory[pd_idx] == 0) {
             page_directory[pd_idx] = (long)pfalloc();
             kassert(page_directory[pd_idx]);
-            PAGE_TABLE_TYPE * temp = paging_map_phys_addr_unspecified((void*)(long)page_directory[pd_idx], PTE_PDE_PAGE_WRITABLE);
-            kassert(temp);
+            PAGE_TABLE_TYPE * temp = kmap_atomic((void*)(long)page_directory[pd_idx], PTE_PDE_PAGE_WRITABLE);
             memset(temp, 0, PAGE_TABLE_ENTRIES * sizeof(PAGE_TABLE_TYPE));
-            paging_unmap_page(temp);
+            kunmap_atomic(temp);
 
             page_directory[pd_idx] |= PTE_PDE_PAGE_PRESENT |
                                         PTE_PDE_PAGE_WRITABLE |
                                         PTE_PDE_PAGE_USER_ACCESS;
         }
-        if (pd_idx != prev_pd_idx) {
-            if (pt != NULL) paging_unmap_page(pt);
-            pt = paging_map_phys_addr_unspecified(
+        if (pt == NULL || pd_idx != prev_pd_idx) {
+            if (pt != NULL) kunmap_atomic(pt);
+            pt = kmap_atomic(
                 (void*)(unsigned long)(page_directory[pd_idx] & ~(PAGE_SIZE_NO_PAE - 1)),
                 PTE_PDE_PAGE_WRITABLE);
-            kassert(pt);
+            prev_pd_idx = pd_idx;
         }
 
 
@@ -223,7 +233,7 @@ static PAGE_DIRECTORY_TYPE * fork_dup_address_space() {
 
     }
 
-    paging_unmap_page(pt);
+    if (pt != NULL) kunmap_atomic(pt);
     paging_unmap_page(page_directory);
     enable_wp();
 
@@ -598,17 +598,19 @@ __attribute__((interrupt, no_caller_saved_registers)) void interr_pic_mouse(stru
     rand();
 }
 
-extern void com_recv_byte(char com);
+extern void com_interrupt(char com);
 __attribute__((interrupt, no_caller_saved_registers)) void interr_pic_com2(struct interr_frame * interrupt_frame) {
     fix_segments();
-    com_recv_byte(1);
+    com_interrupt(1);
+    pic_send_eoi(PIC_INTERR_COM2);
 
     rand();
 }
 
 __attribute__((interrupt, no_caller_saved_registers)) void interr_pic_com1(struct interr_frame * interrupt_frame) {
     fix_segments();
-    com_recv_byte(0);
+    com_interrupt(0);
+    pic_send_eoi(PIC_INTERR_COM1);
 
     rand();
 }
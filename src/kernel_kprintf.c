@@ -23,16 +23,15 @@ static inline void print_time() {
 }
 
 
-void kprintf_write(const char * buf, size_t count) { // TODO: rewrite, this is horrible...
+void kprintf_write(const char * buf, size_t count) {
     static char do_print_time = 0;
-    size_t i;
 
-    for (i = 0; i < count; i++) {
+    // a line at a time, so that the console can draw it in one go
+    while (count > 0) {
         if (do_print_time) {
             do_print_time = 0;
             print_time();
         }
-        if (buf[i] == '\n') do_print_time = 1;
 
         /*
         Normally, we would use the TTY system for the kernel log, however
@@ -44,18 +43,19 @@ void kprintf_write(const char * buf, size_t count) { // TODO: rewrite, this is h
         interrupted TTY calls (for example kernel_create_thread()
         call inside the ps/2 driver interrupting tty getch or putch)
         */
-
-        //if (__builtin_expect(kernel_task == NULL || kernel_task->fds[0] == NULL || kernel_task->fds[0]->inode == NULL, 0)) {
-            // the kernel doesn't use the tty subsystem and its ONLCR flag, so we need to emulate it
-            if (buf[i] == '\n') {
-                console_write(&(char){'\r'}, 1);
-                com_write(0, &(char){'\r'}, 1);
-            }
-            console_write(buf+i, 1);
-            com_write(0, buf+i, 1);
-        //} else {
-        //    tty_write(GET_DEV(DEV_MAJ_TTY, DEV_TTY_CONSOLE), buf+i, 1);
-        //}
+        size_t len = 0;
+        while (len < count && buf[len] != '\n') len++;
+        console_write(buf, len);
+        com_write(0, buf, len);
+        if (len == count) break;
+
+        // the kernel doesn't use the tty subsystem and its ONLCR flag, so we need to emulate it
+        console_write("\r\n", 2);
+        com_write(0, "\r\n", 2);
+        do_print_time = 1;
+
+        buf += len + 1;
+        count -= len + 1;
     }
 }
 
@@ -7,10 +7,12 @@
 #include "include/kernel_exec.h"
 #include "include/kernel_spinlock.h"
 #include "include/mm/kernel_memory.h"
+#include "include/mm/swap.h"
 #include "include/block/memdisk.h"
 #include "include/kernel_spinlock.h"
 #include "../libc/src/include/string.h"
 #include "include/gfx/vga.h"
+#include <errno.h>
 
 #pragma clang diagnostic ignored "-Wexcessive-regsave"
 
@@ -128,9 +130,21 @@ __attribute__((no_caller_saved_registers)) int page_fault_handler(unsigned long
             } else
                 spinlock_release(&memdisk_lock);
         } else { // overcommitment
+            long swapped = swap_in_page(fault_address);
+            if (swapped == 0) return 1;
+            if (swapped == -ENOMEM) {
+                kprintf("\e[0m\e[41mPage fault: Ran out of memory while swapping in! Killing task...\n");
+                current_process->do_cleanup = 1;
+                return 0;
+            }
+            if (swapped != -ENOENT) {
+                kprintf("Page fault: Failed reading swapped out page at %p (%ld)\n", fault_address, swapped);
+                return 2;
+            }
+
             // heap
             if (fault_address >= PROGRAM_HEAP_VADDR && fault_address <= current_process->program_break) {
-                if (paging_add_page(fault_address, PTE_PDE_PAGE_USER_ACCESS | PTE_PDE_PAGE_WRITABLE) == NULL) {
+                if (swap_add_page(fault_address, PTE_PDE_PAGE_USER_ACCESS | PTE_PDE_PAGE_WRITABLE) == NULL) {
                     kprintf("\e[0m\e[41mPage fault: Ran out of memory in heap overcommitment! Killing task...\n");
                     current_process->do_cleanup = 1;
                     return 0;
@@ -138,7 +152,7 @@ __attribute__((no_caller_saved_registers)) int page_fault_handler(unsigned long
                 // stack
             } else if (fault_address < current_thread->stack &&
                 fault_address >= current_thread->stack - PROGRAM_STACK_SIZE + current_thread->stack_guard_size) {
-                if (paging_add_page(fault_address, PTE_PDE_PAGE_USER_ACCESS | PTE_PDE_PAGE_WRITABLE) == NULL) {
+                if (swap_add_page(fault_address, PTE_PDE_PAGE_USER_ACCESS | PTE_PDE_PAGE_WRITABLE) == NULL) {
                     kprintf("\e[0m\e[41mPage fault: Ran out of memory in stack overcommitment! Killing task...\n");
                     current_process->do_cleanup = 1;
                     return 0;
@@ -149,7 +163,13 @@ __attribute__((no_caller_saved_registers)) int page_fault_handler(unsigned long
             if (res == -1) return 2;
         }
     } else if (error.W) { // fork() CoW
-        if (fork_cow_page(fault_address)) return 1;
+        switch (fork_cow_page(fault_address)) {
+            case 1: return 1;
+            case -1:
+                kprintf("\e[0m\e[41mPage fault: Ran out of memory in copy on write! Killing task...\n");
+                current_process->do_cleanup = 1;
+                return 0;
+        }
     }
     if (!error.U) { // don't wanna unnecessarily break the spinlocks
         gfx_spinlock.state = SPINLOCK_UNLOCKED;
@@ -479,12 +479,18 @@ static unsigned char mouse_buffer[4]; // 4 in case of 5 button/scroll wheel mous
 #include <errno.h>
 static spinlock_t ps2_driver_lock = {0};
 static thread_queue_t mouse_queue = {0};
+static struct poll_waitq mouse_poll_waitq = {0};
+// a packet came in since the last read, so that poll() has something to go by
+static char mouse_packet_ready = 0;
 
 ssize_t ps2_mouse_pread(file_descriptor_t * file, void * buf, size_t n, off_t offset) {
     if (offset) return -ESPIPE;
 
-    thread_queue_add(&mouse_queue, current_process, current_thread, SCHED_INTERR_SLEEP);
-    if (check_eintr()) return -EINTR;
+    if (!__atomic_exchange_n(&mouse_packet_ready, 0, __ATOMIC_ACQ_REL)) {
+        thread_queue_add(&mouse_queue, current_process, current_thread, SCHED_INTERR_SLEEP);
+        if (check_eintr()) return -EINTR;
+        __atomic_store_n(&mouse_packet_ready, 0, __ATOMIC_RELEASE);
+    }
 
 #ifdef PS2_MOUSE_LINUX_COMPAT
     memcpy(buf, mouse_buffer, n > 3 ? 3 : n);
@@ -495,8 +501,14 @@ ssize_t ps2_mouse_pread(file_descriptor_t * file, void * buf, size_t n, off_t of
 #endif
 }
 
+static short ps2_mouse_poll(file_descriptor_t * file, struct poll_table * pt) {
+    poll_wait(&mouse_poll_waitq, pt);
+    return __atomic_load_n(&mouse_packet_ready, __ATOMIC_ACQUIRE) ? POLLIN | POLLRDNORM : 0;
+}
+
 static const struct dev_operations psaux_ops = {
     .pread = ps2_mouse_pread,
+    .poll  = ps2_mouse_poll,
 };
 
 void ps2_init() {
@@ -885,6 +897,8 @@ static void ps2_mouse_driver_internal(char device_num) {
         default: break;
     }
 
+    __atomic_store_n(&mouse_packet_ready, 1, __ATOMIC_RELEASE);
+    poll_wake(&mouse_poll_waitq, POLLIN);
     thread_queue_unblock_all(&mouse_queue);
 }
 
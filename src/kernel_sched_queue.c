@@ -60,7 +60,8 @@ void thread_queue_unblock_all(thread_queue_t * thread_queue) {
 }
 
 // pprocess and thread here to allow adding other threads than current
-void __thread_queue_add(thread_queue_t * thread_queue, process_t * pprocess, thread_t * thread) {
+// returns 0 if there wasn't enough memory to extend the queue
+static char __thread_queue_add(thread_queue_t * thread_queue, process_t * pprocess, thread_t * thread) {
     if (__atomic_add_fetch(&thread->instances, 1, __ATOMIC_RELEASE) == UINT32_MAX) panic("Overflown thread instance count!");
 
     if (thread_queue->queue.parent_process == NULL) {
@@ -68,11 +69,14 @@ void __thread_queue_add(thread_queue_t * thread_queue, process_t * pprocess, thr
         thread_queue->queue.thread = thread;
         thread_queue->queue.prev = &thread_queue->queue;
         thread_queue->queue.prev->magic_queue_value = thread->magic_queue_value;
-        return;
+        return 1;
     }
 
     thread_queue->queue.prev->next = kalloc(sizeof(struct __thread_queue_inner));
-    if (!thread_queue->queue.prev->next) panic("Not enough memory to extend thread queue!");
+    if (!thread_queue->queue.prev->next) {
+        __atomic_sub_fetch(&thread->instances, 1, __ATOMIC_RELEASE);
+        return 0;
+    }
     memset(thread_queue->queue.prev->next, 0, sizeof(struct __thread_queue_inner));
 
     thread_queue->queue.prev->next->prev = thread_queue->queue.prev;
@@ -82,13 +86,14 @@ void __thread_queue_add(thread_queue_t * thread_queue, process_t * pprocess, thr
     thread_queue->queue.prev->parent_process = pprocess;
     thread_queue->queue.prev->thread = thread;
     thread_queue->queue.prev->magic_queue_value = thread->magic_queue_value;
+    return 1;
 }
 void thread_queue_add(thread_queue_t * thread_queue, process_t * pprocess, thread_t * thread, enum pstatus_t new_status) {
     spinlock_acquire(&thread_queue->queue_lock);
 
-    __thread_queue_add(thread_queue, pprocess, thread);
-
-    thread->status = new_status;
+    // out of memory (likely while waiting on reclaim), the caller gets a spurious wake up instead
+    if (__thread_queue_add(thread_queue, pprocess, thread))
+        thread->status = new_status;
     spinlock_release(&thread_queue->queue_lock);
 
     //kprintf("sleeping on thread id %d of process %d\n", thread->tid, pprocess->pid);
@@ -11,6 +11,8 @@
 #include "kernel_sched.h"
 #include "kernel_semaphore.h"
 #include "fs/fs.h"
+#include "fs/uring.h"
+#include "mm/swap.h"
 #include <pthread.h>
 #include "kernel_gdt_idt.h"
 #include "sys/mman.h"
@@ -23,6 +25,28 @@ extern void clear_screen_fatal(); // kernel_interrupts.c
 
 
 void kernel_syscall_dispatcher(mcontext_t * ctx);
+
+// copies the iovec array into the kernel, so that it can't change after all of the segments were checked
+static long syscall_copy_iovec(const struct iovec * uiov, int iovcnt, char writable, char in_kernel, struct iovec ** out) {
+    *out = NULL;
+    if (iovcnt < 0 || iovcnt > IOV_MAX) return -EINVAL;
+    if (iovcnt == 0) return 0;
+    if (!paging_check_address_range(uiov, iovcnt * sizeof(struct iovec), 0, in_kernel)) return -EFAULT;
+
+    struct iovec * iov = kalloc(iovcnt * sizeof(struct iovec));
+    if (iov == NULL) return -ENOMEM;
+    memcpy(iov, uiov, iovcnt * sizeof(struct iovec));
+
+    for (int i = 0; i < iovcnt; i++) {
+        if (iov[i].iov_len == 0) continue;
+        if (!paging_check_address_range(iov[i].iov_base, iov[i].iov_len, writable, in_kernel)) {
+            kfree(iov);
+            return -EFAULT;
+        }
+    }
+    *out = iov;
+    return 0;
+}
 // since we use system V abi, arg4 is pushed onto the stack by the user
 __attribute__((naked, no_caller_saved_registers)) void interr_syscall(struct interr_frame * interrupt_frame) {
     asm volatile (
@@ -199,9 +223,16 @@ void kernel_syscall_dispatcher(mcontext_t * ctx) {
             break;
         case SYSCALL_SYNC:
             return_value = 0;
+            sync_inodes();
             extern void hd_cache_flush();
             hd_cache_flush();
             break;
+        case SYSCALL_FSYNC:
+            return_value = sys_fsync(arg1, 0);
+            break;
+        case SYSCALL_FDATASYNC:
+            return_value = sys_fsync(arg1, 1);
+            break;
         case SYSCALL_PIPE2:
             if (!paging_check_address_range((int *)arg1, 2*sizeof(int), 1, in_kernel)) {
                 return_value = -EFAULT;
@@ -574,6 +605,131 @@ void kernel_syscall_dispatcher(mcontext_t * ctx) {
             rw_spinlock_release_read(&current_process->vm_lock);
             return_value = sys_mprotect((void*)arg1, arg2, arg3);
             goto syscall_exit_no_vm;
+        case SYSCALL_SWAPON:
+            return_value = sys_swapon((const char*)arg1);
+            break;
+        case SYSCALL_SWAPOFF:
+            return_value = sys_swapoff((const char*)arg1);
+            break;
+
+        case SYSCALL_GETDENTS:
+            if (!paging_check_address_range((void*)arg2, arg3, 1, in_kernel)) {
+                return_value = -EFAULT;
+                break;
+            }
+            return_value = sys_getdents(arg1, (void*)arg2, arg3);
+            break;
+
+        case SYSCALL_READV:
+        case SYSCALL_WRITEV:
+        case SYSCALL_PREADV:
+        case SYSCALL_PWRITEV: {
+            const char is_read = syscall_number == SYSCALL_READV || syscall_number == SYSCALL_PREADV;
+            struct iovec * iov = NULL;
+            return_value = syscall_copy_iovec((const struct iovec *)arg2, arg3, is_read, in_kernel, &iov);
+            if (return_value < 0)
+                break;
+
+            switch (syscall_number) {
+                case SYSCALL_READV:
+                    return_value = sys_readv(arg1, iov, arg3);
+                    break;
+                case SYSCALL_WRITEV:
+                    return_value = sys_writev(arg1, iov, arg3);
+                    break;
+                case SYSCALL_PREADV:
+                    return_value = sys_preadv(arg1, iov, arg3, arg4);
+                    break;
+                default:
+                    return_value = sys_pwritev(arg1, iov, arg3, arg4);
+                    break;
+            }
+            kfree(iov);
+            break;
+        }
+
+        case SYSCALL_COPY_FILE_RANGE:
+            if ((off_t*)arg2 != NULL && !paging_check_address_range((off_t*)arg2, sizeof(off_t), 1, in_kernel)) {
+                return_value = -EFAULT;
+                break;
+            }
+            if ((off_t*)arg4 != NULL && !paging_check_address_range((off_t*)arg4, sizeof(off_t), 1, in_kernel)) {
+                return_value = -EFAULT;
+                break;
+            }
+            return_value = sys_copy_file_range(arg1, (off_t*)arg2, arg3, (off_t*)arg4, (size_t)arg5, arg6);
+            break;
+
+        case SYSCALL_POLL:
+            if ((nfds_t)arg2 > FD_LIMIT_PROCESS) {
+                return_value = -EINVAL;
+                break;
+            }
+            if (arg2 != 0 && !paging_check_address_range((struct pollfd*)arg1, arg2 * sizeof(struct pollfd), 1, in_kernel)) {
+                return_value = -EFAULT;
+                break;
+            }
+            return_value = sys_poll((struct pollfd*)arg1, (nfds_t)arg2, arg3);
+            break;
+        case SYSCALL_EPOLL_CREATE:
+            return_value = sys_epoll_create(arg1);
+            break;
+        case SYSCALL_EPOLL_CTL: {
+            // copied, so that it can't change under epoll_ctl
+            struct epoll_event event;
+            if (arg2 != EPOLL_CTL_DEL) {
+                if (!paging_check_address_range((struct epoll_event*)arg4, sizeof(struct epoll_event), 0, in_kernel)) {
+                    return_value = -EFAULT;
+                    break;
+                }
+                event = *(struct epoll_event*)arg4;
+            }
+            return_value = sys_epoll_ctl(arg1, arg2, arg3, arg2 != EPOLL_CTL_DEL ? &event : NULL);
+            break;
+        }
+        case SYSCALL_EPOLL_WAIT:
+            if ((int)arg3 <= 0 || arg3 > EP_MAX_EVENTS) {
+                return_value = -EINVAL;
+                break;
+            }
+            if (!paging_check_address_range((struct epoll_event*)arg2, (size_t)arg3 * sizeof(struct epoll_event), 1, in_kernel)) {
+                return_value = -EFAULT;
+                break;
+            }
+            return_value = sys_epoll_wait(arg1, (struct epoll_event*)arg2, arg3, arg4);
+            break;
+        case SYSCALL_URING_SETUP:
+            if (!paging_check_address_range((struct uring_params*)arg2, sizeof(struct uring_params), 1, in_kernel)) {
+                return_value = -EFAULT;
+                break;
+            }
+            return_value = sys_uring_setup(arg1, (struct uring_params*)arg2);
+            break;
+        case SYSCALL_URING_ENTER:
+            return_value = sys_uring_enter(arg1, arg2, arg3, arg4);
+            break;
+        case SYSCALL_URING_REGISTER: {
+            size_t arg_size = 0;
+            if (arg2 == URING_REGISTER_BUFFERS) {
+                if ((unsigned)arg4 > URING_FIXED_BUFFERS_MAX) {
+                    return_value = -EINVAL;
+                    break;
+                }
+                arg_size = (unsigned)arg4 * sizeof(struct iovec);
+            } else if (arg2 == URING_REGISTER_FILES) {
+                if ((unsigned)arg4 > URING_FIXED_FILES_MAX) {
+                    return_value = -EINVAL;
+                    break;
+                }
+                arg_size = (unsigned)arg4 * sizeof(int);
+            }
+            if (arg_size && !paging_check_address_range((void*)arg3, arg_size, 0, in_kernel)) {
+                return_value = -EFAULT;
+                break;
+            }
+            return_value = sys_uring_register(arg1, arg2, (const void*)arg3, arg4);
+            break;
+        }
 
         default:
             return_value = -ENOSYS;
@@ -9,18 +9,20 @@
 #include "mm/kernel_memory.h"
 #include "gfx.h"
 #include "kernel_console.h"
+#include "rs232.h"
 #include <string.h>
 #include <sys/ioctl.h>
 
 spinlock_t tty_lock = {0};
 tty_t * terminals[TTY_LIMIT_KERNEL] = {0};
 
-long tty_open(inode_t * tty, unsigned short flags);
+long tty_open(inode_t * tty, unsigned int flags);
 long tty_close(inode_t * tty);
 static struct dev_operations tty_ops = {
     .pread = tty_pread,
     .pwrite = tty_pwrite,
     .ioctl = tty_ioctl,
+    .poll  = tty_poll,
     .open  = tty_open,
     .close = tty_close
 };
@@ -111,6 +113,19 @@ ECHOCTL \
 // missing everything
 #define TERMIOS_VALID_CFLAGS (0)
 
+// a UART has a single divisor for both directions, an input speed of 0 means the same as output
+// B0 (hang up) isn't supported and keeps the speed, as do ttys without a working serial port
+static long tty_apply_speed(tty_t * tty, struct termios * params) {
+    if (params->c_ispeed == 0) params->c_ispeed = params->c_ospeed;
+    if (params->c_ospeed == B0 || com_get_baudrate(tty->com_port) == 0) {
+        params->c_ispeed = tty->params.c_ispeed;
+        params->c_ospeed = tty->params.c_ospeed;
+        return 0;
+    }
+    if (params->c_ispeed != params->c_ospeed) return -EINVAL;
+    return com_set_baudrate(tty->com_port, params->c_ospeed);
+}
+
 long tty_ioctl(file_descriptor_t * file, unsigned long request, void * arg) {
     kassert(file);
     kassert(file->inode);
@@ -123,6 +138,9 @@ long tty_ioctl(file_descriptor_t * file, unsigned long request, void * arg) {
 
     if (!is_valid_tty(dev)) return -EINVAL; // no clue what to return here
 
+    struct termios params;
+    long ret;
+
     // ioctls which according to POSIX should send SIGTTOU to bg pgrp or otherwise special treatment
     switch (request) {
         case TIOCSPGRP:
@@ -181,9 +199,14 @@ long tty_ioctl(file_descriptor_t * file, unsigned long request, void * arg) {
         case TCSETS: // apply immediately
             if (paging_check_address_range(arg, sizeof(struct termios), 1, 0) == 0)
                 return -EFAULT;
+            memcpy(&params, arg, sizeof(struct termios));
 
             spinlock_acquire_interruptible(&tty_lock);
-            memcpy(&terminals[MINOR(dev)]->params, arg, sizeof(struct termios));
+            if ((ret = tty_apply_speed(terminals[MINOR(dev)], &params)) < 0) {
+                spinlock_release(&tty_lock);
+                return ret;
+            }
+            memcpy(&terminals[MINOR(dev)]->params, &params, sizeof(struct termios));
             terminals[MINOR(dev)]->params.c_iflag &= TERMIOS_VALID_IFLAGS;
             terminals[MINOR(dev)]->params.c_oflag &= TERMIOS_VALID_OFLAGS;
             terminals[MINOR(dev)]->params.c_lflag &= TERMIOS_VALID_LFLAGS;
@@ -194,21 +217,34 @@ long tty_ioctl(file_descriptor_t * file, unsigned long request, void * arg) {
             if (paging_check_address_range(arg, sizeof(struct termios), 1, 0) == 0)
                 return -EFAULT;
 
+            memcpy(&params, arg, sizeof(struct termios));
+
             spinlock_acquire_interruptible(&tty_lock);
 
             terminals[MINOR(dev)]->write(terminals[MINOR(dev)]);
 
-            memcpy(&terminals[MINOR(dev)]->params, arg, sizeof(struct termios));
+            if ((ret = tty_apply_speed(terminals[MINOR(dev)], &params)) < 0) {
+                spinlock_release(&tty_lock);
+                return ret;
+            }
+            memcpy(&terminals[MINOR(dev)]->params, &params, sizeof(struct termios));
             spinlock_release(&tty_lock);
             return 0;
         case TCSETSF: // apply after writing all and discarding unread input
             if (paging_check_address_range(arg, sizeof(struct termios), 1, 0) == 0)
                 return -EFAULT;
 
+            memcpy(&params, arg, sizeof(struct termios));
+
             spinlock_acquire_interruptible(&tty_lock);
 
             terminals[MINOR(dev)]->write(terminals[MINOR(dev)]);
 
+            if ((ret = tty_apply_speed(terminals[MINOR(dev)], &params)) < 0) {
+                spinlock_release(&tty_lock);
+                return ret;
+            }
+
             __atomic_store(
                         &terminals[MINOR(dev)]->iqueue.head,
                         &terminals[MINOR(dev)]->iqueue.tail,
@@ -216,7 +252,7 @@ long tty_ioctl(file_descriptor_t * file, unsigned long request, void * arg) {
                     );
             tty_flush_input(terminals[MINOR(dev)]);
 
-            memcpy(&terminals[MINOR(dev)]->params, arg, sizeof(struct termios));
+            memcpy(&terminals[MINOR(dev)]->params, &params, sizeof(struct termios));
             spinlock_release(&tty_lock);
             return 0;
         case TCXONC:
@@ -226,6 +262,7 @@ long tty_ioctl(file_descriptor_t * file, unsigned long request, void * arg) {
                     return 0;
                 case TCOON:
                     terminals[MINOR(dev)]->output_stopped = 0;
+                    poll_wake(&terminals[MINOR(dev)]->poll_waitq, POLLOUT);
                     thread_queue_unblock_all(&terminals[MINOR(dev)]->oqueue.ix_queue);
                     return 0;
                 case TCIOFF:
@@ -361,6 +398,8 @@ tty_t * tty_init_tty(tcflag_t imodes, tcflag_t lmodes, tcflag_t omodes, const un
         .params.c_iflag = imodes,
         .params.c_lflag = lmodes,
         .params.c_oflag = omodes,
+        .params.c_ispeed = com_get_baudrate(com_port),
+        .params.c_ospeed = com_get_baudrate(com_port),
     };
     memcpy(new_tty->params.c_cc, control_chars, sizeof(new_tty->params.c_cc));
 
@@ -385,7 +424,7 @@ static void tty_set_defaults(tty_t * tty) {
     memcpy(tty->params.c_cc, default_control_chars, sizeof(tty->params.c_cc));
 }
 
-long tty_open(inode_t * tty, unsigned short flags) {
+long tty_open(inode_t * tty, unsigned int flags) {
     kassert(tty);
     if (!S_ISCHR(tty->mode))
         return -1;
@@ -559,6 +598,7 @@ int tty_queue_putch(struct tty_queue * tq, char c, char onlret) {
 }
 
 void tty_flush_input(tty_t * tty) { // flush for reading on new line or EOF in case of canonical/line buffered mode
+    poll_wake(&tty->poll_waitq, POLLIN);
     thread_queue_unblock(&tty->iqueue.read_queue);
 }
 
@@ -649,11 +689,13 @@ static inline size_t tty_translate_line_incoming(const char * s, size_t n, tty_t
             }
             if (tty->params.c_cc[VSTART] != _POSIX_VDISABLE && checked == tty->params.c_cc[VSTART]) {
                 tty->output_stopped = 0;
+                poll_wake(&tty->poll_waitq, POLLOUT);
                 thread_queue_unblock_all(&tty->oqueue.ix_queue);
                 continue;
             }
             if (tty->params.c_iflag & IXANY) {
                 tty->output_stopped = 0;
+                poll_wake(&tty->poll_waitq, POLLOUT);
                 thread_queue_unblock_all(&tty->oqueue.ix_queue);
             }
 
@@ -902,6 +944,51 @@ ssize_t tty_pread(file_descriptor_t * file, void * s, size_t n, off_t offset) {
     return n;
 }
 
+// whether read() would return right away, in canonical mode that's once a whole line is in
+static char tty_input_ready(tty_t * tty) {
+    struct tty_queue * tq = &tty->iqueue;
+    if (!(tty->params.c_lflag & ICANON))
+        return !EMPTY(tq);
+
+    char ready = 0;
+    spinlock_acquire_interruptible(&tq->queue_lock);
+    for (size_t i = tq->head; i != tq->tail; i = (i + 1) % MAX_CANON) {
+        const char c = tq->buffer[i];
+        if (c == '\n' ||
+            (tty->params.c_cc[VEOF] != _POSIX_VDISABLE && c == tty->params.c_cc[VEOF]) ||
+            (tty->params.c_cc[VEOL] != _POSIX_VDISABLE && c == tty->params.c_cc[VEOL])) {
+            ready = 1;
+            break;
+        }
+    }
+    spinlock_release(&tq->queue_lock);
+    return ready;
+}
+
+short tty_poll(file_descriptor_t * file, struct poll_table * pt) {
+    dev_t dev = file->inode->device;
+    if (dev == GET_DEV(DEV_MAJ_TTY, DEV_TTY_CONSOLE))
+        dev = GET_DEV(DEV_MAJ_TTY, DEV_TTY_0);
+    if (dev == GET_DEV(DEV_MAJ_TTY, DEV_TTY_CURRENT)) {
+        spinlock_acquire(&current_process->lock);
+        dev = current_process->ctty;
+        spinlock_release(&current_process->lock);
+        if (dev == 0)
+            return POLLERR;
+    }
+    if (!is_valid_tty(dev)) return POLLERR;
+
+    tty_t * tty = terminals[MINOR(dev)];
+    poll_wait(&tty->poll_waitq, pt);
+
+    short revents = 0;
+    if (tty_input_ready(tty))
+        revents |= POLLIN | POLLRDNORM;
+    if (!tty->output_stopped)
+        revents |= POLLOUT;
+    return revents;
+}
+
 
 ssize_t tty_pwrite(file_descriptor_t * file, const void * s, size_t n, off_t offset) { // outputs data - writes data into write queue
     if (offset < 0) return -EINVAL;
@@ -75,4 +75,23 @@ char is_cpuid_supported() {
         : "=a"(is_supported) 
     );
     return is_supported!=0;
-}
\ No newline at end of file
+}
+
+uint64_t rdmsr(uint32_t msr) {
+    uint64_t value;
+    asm volatile (
+        "rdmsr"
+        : "=A"(value)
+        : "c"(msr)
+    );
+    return value;
+}
+
+void wrmsr(uint32_t msr, uint64_t value) {
+    asm volatile (
+        "wrmsr"
+        :
+        : "c"(msr), "A"(value)
+        : "memory"
+    );
+}
@@ -4,6 +4,7 @@
 #include "../../libc/src/include/stdio.h" // sprintf
 #include "../include/kernel.h"
 #include "../include/mm/kernel_memory.h"
+#include "../include/mm/swap.h"
 
 #include "kernel_exec.h"
 #include "../include/gfx/vga.h"
@@ -27,10 +28,26 @@ void flush_caches_writeback() {
     asm volatile ("wbinvd");
 }
 
-void flush_tlb() {
+void flush_tlb() { // a cr3 reload doesn't touch global entries
     asm volatile ("movl %cr3, %eax; movl %eax, %cr3");
 }
 
+void flush_tlb_global() {
+    if (!pge_available) {
+        flush_tlb();
+        return;
+    }
+    // toggling CR4.PGE drops global entries too
+    asm volatile (
+        "movl %%cr4, %%eax\n\t"
+        "andl $0xFFFFFF7F, %%eax\n\t"
+        "movl %%eax, %%cr4\n\t"
+        "orl $0x80, %%eax\n\t"
+        "movl %%eax, %%cr4\n\t"
+        ::: "eax", "memory"
+    );
+}
+
 void flush_tlb_entry(void * vaddr) {
     vaddr = (void*)((unsigned long)vaddr&~(PAGE_SIZE_NO_PAE-1));
     asm volatile (
@@ -62,19 +79,44 @@ void print_page_table_entry(const void * pte) {
     if ( *(uint32_t*)pte & PTE_PAGE_DIRTY) {
         kprintf("Dirty, ");
     }
+    if ( *(uint32_t*)pte & PTE_PDE_PAGE_GLOBAL) {
+        kprintf("Global, ");
+    }
     kprintf("\n");
 }
 
+// kernel mappings that are the same in every address space can stay in the tlb across cr3 reloads
+// memory below the kernel image is left out, v86 remaps it with user access
+static inline unsigned int paging_global_flag(const void * virt_addr) {
+    if (pge_available && virt_addr >= (void*)KERNEL_START && virt_addr < KERNEL_SHARED_END)
+        return PTE_PDE_PAGE_GLOBAL;
+    return 0;
+}
+
+static inline char paging_pde_is_large(uint32_t page_directory_idx) {
+    return (PDE_ADDR_VIRT[page_directory_idx] & (PTE_PDE_PAGE_PRESENT | PDE_PAGE_LARGE)) ==
+        (PTE_PDE_PAGE_PRESENT | PDE_PAGE_LARGE);
+}
+
+static inline void paging_check_not_large(void * virt_addr) {
+    if (paging_pde_is_large((uint32_t)virt_addr >> 22)) {
+        dkprintf("Attempted a 4KiB page operation inside a 4MiB page at vaddr 0x%p!\n", virt_addr);
+        dpanic("Illegal MMU operation");
+    }
+}
+
 static PAGE_TABLE_TYPE * paging_get_page_table_noalloc(void * virt_addr) {
     uint32_t page_directory_idx = (uint32_t)virt_addr >> 22;
 
     if (!(PDE_ADDR_VIRT[page_directory_idx] & PTE_PDE_PAGE_PRESENT))
         return NULL;
+    paging_check_not_large(virt_addr);
     return PTE_ADDR_VIRT_BASE + PAGE_TABLE_ENTRIES * page_directory_idx;
 }
 static PAGE_TABLE_TYPE * paging_get_page_table(void * virt_addr) {
     uint32_t page_directory_idx = (uint32_t)virt_addr >> 22;
 
+    paging_check_not_large(virt_addr);
     if (!(PDE_ADDR_VIRT[page_directory_idx] & PTE_PDE_PAGE_PRESENT))
     {
         PAGE_TABLE_TYPE * new_page = pfalloc();
@@ -102,16 +144,48 @@ void paging_map_phys_addr(void * src_phys_addr, void * target_virt_addr, unsigne
         dpanic("Illegal MMU operation");
     }
 
+    flags |= paging_global_flag(target_virt_addr);
     page_table[page_table_idx] = ((uint32_t)src_phys_addr & (~(PAGE_SIZE_NO_PAE-1))) | (flags & (PAGE_SIZE_NO_PAE-1)) | PTE_PDE_PAGE_PRESENT;
     sw_mem_barrier
     flush_tlb_entry(target_virt_addr);
 }
 
+// only for kernel-only ranges above the shared page tables, sync the PDEs to other address spaces afterwards
+void paging_map_phys_addr_large(void * src_phys_addr, void * target_virt_addr, unsigned int flags) {
+    kassert(pse_available);
+    kassert(target_virt_addr >= KERNEL_SHARED_END);
+    kassert(!((unsigned long)src_phys_addr & (PAGE_SIZE_LARGE_NO_PAE - 1)));
+    kassert(!((unsigned long)target_virt_addr & (PAGE_SIZE_LARGE_NO_PAE - 1)));
+
+    uint32_t page_directory_idx = (uint32_t)target_virt_addr >> 22;
+
+    if (PDE_ADDR_VIRT[page_directory_idx] & PTE_PDE_PAGE_PRESENT) {
+        PAGE_TABLE_TYPE * page_table = PTE_ADDR_VIRT_BASE + PAGE_TABLE_ENTRIES * page_directory_idx;
+        for (int i = 0; i < PAGE_TABLE_ENTRIES && !paging_pde_is_large(page_directory_idx); i++) {
+            if (!(page_table[i] & PTE_PDE_PAGE_PRESENT)) continue;
+            dkprintf("Attempted mapping 4MiB page 0x%p over a used page table at 0x%p\n", src_phys_addr, target_virt_addr);
+            dpanic("Illegal MMU operation");
+        }
+        if (paging_pde_is_large(page_directory_idx)) {
+            dkprintf("Attempted mapping 4MiB page 0x%p to already used virtual address 0x%p\n", src_phys_addr, target_virt_addr);
+            print_page_table_entry(PDE_ADDR_VIRT + page_directory_idx);
+            dpanic("Illegal MMU operation");
+        }
+        // the empty page table is left allocated, an address space that wasn't synced yet might still point at it
+    }
+
+    PDE_ADDR_VIRT[page_directory_idx] = ((uint32_t)src_phys_addr & ~(PAGE_SIZE_LARGE_NO_PAE - 1)) |
+        (flags & ((PAGE_SIZE_NO_PAE - 1) | PDE_PAGE_LARGE_PAT)) | PDE_PAGE_LARGE | PTE_PDE_PAGE_PRESENT;
+    sw_mem_barrier
+    flush_tlb_entry(target_virt_addr);
+}
+
 PAGE_TABLE_TYPE * paging_get_pte(const void * virt_addr) {
     uint32_t page_directory_idx = (uint32_t)virt_addr >> 22;
     uint32_t page_table_idx = (uint32_t)virt_addr >> 12 & (PAGE_TABLE_ENTRIES - 1);
 
     if (!(PDE_ADDR_VIRT[page_directory_idx] & PTE_PDE_PAGE_PRESENT)) return NULL;
+    if (paging_pde_is_large(page_directory_idx)) return &PDE_ADDR_VIRT[page_directory_idx]; // the flags sit at the same bits
 
     PAGE_TABLE_TYPE * pt = PTE_ADDR_VIRT_BASE + PAGE_TABLE_ENTRIES * page_directory_idx;
     
@@ -131,7 +205,7 @@ void * paging_add_page(void * target_virt_addr, unsigned int flags) {
     PAGE_TABLE_TYPE * page_table = paging_get_page_table(target_virt_addr);
     uint32_t page_table_idx = (uint32_t)target_virt_addr >> 12 & (PAGE_TABLE_ENTRIES - 1);
 
-    flags |= PTE_PDE_PAGE_PRESENT;
+    flags |= PTE_PDE_PAGE_PRESENT | paging_global_flag(target_virt_addr);
 
     if (page_table[page_table_idx] & PTE_PDE_PAGE_PRESENT) {
         if (flags ==
@@ -148,6 +222,8 @@ void * paging_add_page(void * target_virt_addr, unsigned int flags) {
         //dpanic("Illegal MMU operation");
         return NULL;
     }
+    if (PTE_IS_SWAPPED(page_table[page_table_idx])) // has to be swapped in instead
+        return NULL;
 
     void * new_page = pfalloc();
     if (new_page == NULL) {
@@ -198,7 +274,7 @@ void paging_change_flags(void * target_virt_addr, size_t n, unsigned int flags)
         }
 
         page_table[page_table_idx] &= ~(PAGE_SIZE_NO_PAE-1); // zero out flags
-        page_table[page_table_idx] |= flags & (PAGE_SIZE_NO_PAE-1);
+        page_table[page_table_idx] |= (flags | paging_global_flag(target_virt_addr)) & (PAGE_SIZE_NO_PAE-1);
         page_table[page_table_idx] |= PTE_PDE_PAGE_PRESENT;
         sw_mem_barrier
         flush_tlb_entry(target_virt_addr);
@@ -208,6 +284,14 @@ void paging_change_flags(void * target_virt_addr, size_t n, unsigned int flags)
 }
 
 void paging_unmap_page(void * virt_addr) {
+    uint32_t page_directory_idx = (uint32_t)virt_addr >> 22;
+    if (paging_pde_is_large(page_directory_idx)) { // 4MiB pages only ever go away whole
+        PDE_ADDR_VIRT[page_directory_idx] = 0;
+        sw_mem_barrier
+        flush_tlb_entry(virt_addr);
+        return;
+    }
+
     PAGE_TABLE_TYPE * page_table = paging_get_page_table_noalloc(virt_addr);
     if (page_table == NULL) return;
 
@@ -217,9 +301,13 @@ void paging_unmap_page(void * virt_addr) {
     //    dkprintf("Tried to unmap an already unmapped virtual page at requested vaddr 0x%x!\n", virt_addr);
     //    dpanic("Illegal MMU operation");
     //}
+    if (PTE_IS_SWAPPED(page_table[page_table_idx]))
+        swap_free_entry(page_table[page_table_idx]);
     page_table[page_table_idx] = 0;
     sw_mem_barrier
     flush_tlb_entry(virt_addr);
+
+    kvaddr_free_mapping(virt_addr);
 }
 
 void paging_unmap(void * target_virt_addr, size_t n) {
@@ -236,34 +324,11 @@ void paging_unmap(void * target_virt_addr, size_t n) {
 }
 
 void * paging_map_phys_addr_unspecified(void * phys_addr, unsigned int flags) {
-    phys_addr = (void *)((unsigned long)phys_addr & ~(PAGE_SIZE_NO_PAE - 1));
-
-    PAGE_TABLE_TYPE * pt;
-    for (unsigned int i = ((unsigned long)kernel_mem_top >> 22) + 1; i < PAGE_DIRECTORY_ENTRIES - 1; i++) {
-        if (!(PDE_ADDR_VIRT[i] & PTE_PDE_PAGE_PRESENT)) { // init space for new page table if missing
-            PAGE_TABLE_TYPE * new_page = pfalloc();
-            if (new_page == NULL) {
-                dpanic("Not enough memory for page table!\n");
-            }
-            PDE_ADDR_VIRT[i] = (unsigned long) new_page;
-            PDE_ADDR_VIRT[i] &= ~(PAGE_SIZE_NO_PAE-1);
-            PDE_ADDR_VIRT[i] |= PTE_PDE_PAGE_PRESENT | PTE_PDE_PAGE_WRITABLE | PTE_PDE_PAGE_USER_ACCESS;
-            sw_mem_barrier
-            flush_tlb_entry(PDE_ADDR_VIRT + i);
-            memset(PTE_ADDR_VIRT_BASE + PAGE_TABLE_ENTRIES * i, 0, PAGE_TABLE_ENTRIES*sizeof(PAGE_TABLE_TYPE));
-        }
-        for (int j = 0; j < PAGE_TABLE_ENTRIES; j++) {
-            pt = PTE_ADDR_VIRT_BASE + PAGE_TABLE_ENTRIES * i + j;
-            if (__builtin_expect(!(*pt & PTE_PDE_PAGE_PRESENT), 0)) {
-                *pt = (unsigned long) phys_addr;
-                *pt |= PTE_PDE_PAGE_PRESENT | flags;
-                sw_mem_barrier
-                flush_tlb_entry(get_vaddr(i,j));
-                return get_vaddr(i, j);
-            }
-        }
-    }
-    return NULL;
+    void * vaddr = kvaddr_alloc_mapping();
+    if (vaddr == NULL)
+        return NULL;
+    paging_map_phys_addr(phys_addr, vaddr, flags);
+    return vaddr;
 }
 
 void * paging_virt_addr_to_phys(void * virt) {
@@ -271,6 +336,8 @@ void * paging_virt_addr_to_phys(void * virt) {
     uint32_t page_table_idx = ((uint32_t)virt >> 12) & (PAGE_TABLE_ENTRIES - 1);
 
     if (!(PDE_ADDR_VIRT[page_directory_idx] & PTE_PDE_PAGE_PRESENT)) return NULL;
+    if (paging_pde_is_large(page_directory_idx))
+        return (void *)((PDE_ADDR_VIRT[page_directory_idx] & ~(PAGE_SIZE_LARGE_NO_PAE-1)) + ((uint32_t)virt & (PAGE_SIZE_LARGE_NO_PAE-1)));
 
     uint32_t * page_table = PTE_ADDR_VIRT_BASE + PAGE_TABLE_ENTRIES * page_directory_idx; // pointer arithmetic automatically scales by size of member
 
@@ -286,7 +353,7 @@ char paging_check_address_range(const void * addr, size_t n, char writable, char
     addr = (void*)((unsigned long) addr & ~(PAGE_SIZE_NO_PAE - 1));
 
     for (const void * iteraddr = addr; iteraddr < addr+n && iteraddr >= addr; iteraddr += PAGE_SIZE_NO_PAE) { // > addr in case we wrap around
-        const PAGE_TABLE_TYPE * pte = paging_get_pte(iteraddr);
+        const PAGE_TABLE_TYPE * pte = swap_get_pte(iteraddr);
         if (pte == NULL) {
             if (mmap_check_address(addr, writable))
                 continue;
@@ -295,7 +362,7 @@ char paging_check_address_range(const void * addr, size_t n, char writable, char
                     iteraddr >= PROGRAM_STACK_VADDR - PTHREAD_THREADS_MAX * PROGRAM_STACK_SIZE))
                 return 0;
             // overcommitment now to not waste time on pagefaults
-            if (paging_add_page((void *)iteraddr, PTE_PDE_PAGE_USER_ACCESS | PTE_PDE_PAGE_WRITABLE) == NULL)
+            if (swap_add_page((void *)iteraddr, PTE_PDE_PAGE_USER_ACCESS | PTE_PDE_PAGE_WRITABLE) == NULL)
                 return 0;
             continue;
         }
@@ -306,7 +373,7 @@ char paging_check_address_range(const void * addr, size_t n, char writable, char
             if (iteraddr <= kernel_mem_top) return 0;
 
             if (writable && !(*pte & PTE_PDE_PAGE_WRITABLE)) {
-                if (!fork_cow_page((void*)iteraddr) &&
+                if (fork_cow_page((void*)iteraddr) != 1 &&
                     !mmap_mark_page_dirty((void*)iteraddr)) return 0;
             }
             // the intel architecture allows writes into unwritable memory in ring 0 (see bit 16 of cr0),
@@ -339,6 +406,21 @@ void disable_wp() {
     );
 }
 
+static void enable_pse() {
+    asm volatile (
+        "mov %cr4, %eax\n\t"
+        "or $0x00000010, %eax\n\t" // pse bit (4)
+        "mov %eax, %cr4\n\t"
+    );
+}
+static void enable_pge() { // has to be done after paging is enabled
+    asm volatile (
+        "mov %cr4, %eax\n\t"
+        "or $0x00000080, %eax\n\t" // pge bit (7)
+        "mov %eax, %cr4\n\t"
+    );
+}
+
 void enable_paging() {
     asm volatile (
         "mov %cr0, %eax\n\t"
@@ -386,6 +468,12 @@ void setup_paging(unsigned long ident_map_end) {
     memset(page_directory, 0, PAGE_DIRECTORY_ENTRIES*sizeof(PAGE_DIRECTORY_TYPE));
     kprintf("Identity mapping 0x%.8x - 0x%.8lx...\n", 0, ident_map_top); // see TODO below, this will be wrong
     for (int i = 0; i < ident_map_top/PAGE_SIZE_NO_PAE/PAGE_TABLE_ENTRIES + (ident_map_top/PAGE_SIZE_NO_PAE % PAGE_TABLE_ENTRIES != 0)?1:0; i++) {
+        // the first 4MiB keep 4KiB pages, v86 copies that page table and VGA memory gets its own caching flags
+        if (i > 0 && pse_available) {
+            page_directory[i] = (i * PAGE_SIZE_LARGE_NO_PAE) | PTE_PDE_PAGE_PRESENT | PTE_PDE_PAGE_WRITABLE |
+                PDE_PAGE_LARGE | paging_global_flag(get_vaddr(i, 0));
+            continue;
+        }
         page_directory[i] = (uint32_t)pfalloc();
         if (page_directory[i] == 0) {
             dpanic("Not enough memory for identity mapping!\n");
@@ -393,7 +481,7 @@ void setup_paging(unsigned long ident_map_end) {
         memset((void*)page_directory[i], 0, PAGE_TABLE_ENTRIES*sizeof(PAGE_TABLE_TYPE));
         for (int j = 0; j < PAGE_TABLE_ENTRIES; j++) { // TODO: fix, otherwise identity mapping is always aligned to 4M boundaries, potentially wasting "a lot" of memory
             ((uint32_t*)page_directory[i])[j] = (i*PAGE_TABLE_ENTRIES + j) * PAGE_SIZE_NO_PAE;
-            ((uint32_t*)page_directory[i])[j] |= PTE_PDE_PAGE_PRESENT | PTE_PDE_PAGE_WRITABLE;
+            ((uint32_t*)page_directory[i])[j] |= PTE_PDE_PAGE_PRESENT | PTE_PDE_PAGE_WRITABLE | paging_global_flag(get_vaddr(i, j));
         }
         page_directory[i] &= ~(PAGE_SIZE_NO_PAE-1);
         page_directory[i] |= PTE_PDE_PAGE_PRESENT | PTE_PDE_PAGE_WRITABLE; 
@@ -404,7 +492,7 @@ void setup_paging(unsigned long ident_map_end) {
     //  so that the address space creation can rely on regular memcpy
     // the lower address to 0x0800'0000 should be enough,
     //  the kernel then only has the upper 750M which will remain the same after hardware init finishes
-    for (unsigned int i = 0; i < 0x07FFFFFF/PAGE_SIZE/PAGE_DIRECTORY_ENTRIES; i++) {
+    for (unsigned int i = 0; i < ___KERNEL_SHARED_END/PAGE_SIZE/PAGE_DIRECTORY_ENTRIES; i++) {
         if (page_directory[i])
             continue;
         page_directory[i] = (PAGE_TABLE_TYPE)pfalloc();
@@ -421,8 +509,13 @@ void setup_paging(unsigned long ident_map_end) {
 
     dkprintf("Enabling paging...\n");
 
+    if (pse_available)
+        enable_pse();
     paging_apply_address_space(kernel_address_space_paddr);
     enable_paging();
+    if (pge_available)
+        enable_pge();
+    memtype_init();
     paging_map_phys_addr(page_directory, KERNEL_ADDRESS_SPACE_VADDR, PTE_PDE_PAGE_WRITABLE);
 
     dkprintf("Remapping memory areas...\n");
@@ -6,37 +6,45 @@
 #include <string.h>
 #include "kernel.h"
 #include "mm/kernel_memory.h"
+#include "mm/swap.h"
 #include "kernel_spinlock.h"
 
 #define kprintf(fmt, ...) kprintf("MMAS: "fmt, ##__VA_ARGS__)
 #define dpanic(fmt) panic("MMAS: "fmt)
 
-PAGE_TABLE_TYPE * paging_get_pt_from_address_space(PAGE_DIRECTORY_TYPE * pd_vaddr, void * virt_addr) { // note: maps new page for the page table, it is the caller's responsibility to unmap
+// returns the physical address of the page table for virt_addr, allocating an empty one if need be
+static PAGE_TABLE_TYPE * paging_get_pt_paddr_from_address_space(PAGE_DIRECTORY_TYPE * pd_vaddr, void * virt_addr) {
     uint32_t page_directory_idx = (uint32_t)virt_addr >> 22;
 
-    PAGE_TABLE_TYPE * page_table = NULL;
+    if ((pd_vaddr[page_directory_idx] & (PTE_PDE_PAGE_PRESENT | PDE_PAGE_LARGE)) == (PTE_PDE_PAGE_PRESENT | PDE_PAGE_LARGE)) {
+        kprintf("Attempted getting the page table of a 4MiB page at vaddr 0x%p\n", virt_addr);
+        dpanic("Illegal MMU operation");
+    }
 
     if (!(pd_vaddr[page_directory_idx] & PTE_PDE_PAGE_PRESENT))
     {
         PAGE_TABLE_TYPE * new_page = pfalloc();
-
-        page_table = paging_map_phys_addr_unspecified(new_page, PTE_PDE_PAGE_WRITABLE);
-        memset(page_table, 0, PAGE_TABLE_ENTRIES*sizeof(PAGE_TABLE_TYPE));
-
         if (new_page == NULL) {
             dpanic("Not enough memory for page table!\n");
         }
+
+        PAGE_TABLE_TYPE * page_table = kmap_atomic(new_page, PTE_PDE_PAGE_WRITABLE);
+        memset(page_table, 0, PAGE_TABLE_ENTRIES*sizeof(PAGE_TABLE_TYPE));
+        kunmap_atomic(page_table);
+
         pd_vaddr[page_directory_idx] = (unsigned long) new_page;
         pd_vaddr[page_directory_idx] &= ~(PAGE_SIZE_NO_PAE-1);
         pd_vaddr[page_directory_idx] |= PTE_PDE_PAGE_PRESENT | PTE_PDE_PAGE_WRITABLE | PTE_PDE_PAGE_USER_ACCESS;
-    } else {
-        page_table = paging_map_phys_addr_unspecified((void*)((unsigned long)pd_vaddr[page_directory_idx] & ~(PAGE_SIZE_NO_PAE - 1)), PTE_PDE_PAGE_WRITABLE);
     }
-    return page_table;
+    return (PAGE_TABLE_TYPE *)((unsigned long)pd_vaddr[page_directory_idx] & ~(PAGE_SIZE_NO_PAE - 1));
+}
+
+PAGE_TABLE_TYPE * paging_get_pt_from_address_space(PAGE_DIRECTORY_TYPE * pd_vaddr, void * virt_addr) { // note: maps new page for the page table, it is the caller's responsibility to unmap
+    return paging_map_phys_addr_unspecified(paging_get_pt_paddr_from_address_space(pd_vaddr, virt_addr), PTE_PDE_PAGE_WRITABLE);
 }
 
 void paging_add_page_to_address_space(PAGE_DIRECTORY_TYPE * pd_vaddr, void *target_virt_addr, unsigned int flags) {
-    PAGE_TABLE_TYPE * page_table = paging_get_pt_from_address_space(pd_vaddr, target_virt_addr);
+    PAGE_TABLE_TYPE * page_table = kmap_atomic(paging_get_pt_paddr_from_address_space(pd_vaddr, target_virt_addr), PTE_PDE_PAGE_WRITABLE);
 
     uint32_t page_table_idx = (uint32_t)target_virt_addr >> 12 & (PAGE_TABLE_ENTRIES - 1);
     flags |= PTE_PDE_PAGE_PRESENT;
@@ -45,8 +53,10 @@ void paging_add_page_to_address_space(PAGE_DIRECTORY_TYPE * pd_vaddr, void *targ
         if (flags ==
             (((page_table[page_table_idx] & (PAGE_SIZE_NO_PAE - 1))
                     & ~PTE_PAGE_DIRTY)
-                        & ~PTE_PDE_PAGE_ACCESSED_DURING_TRANSLATE))
+                        & ~PTE_PDE_PAGE_ACCESSED_DURING_TRANSLATE)) {
+            kunmap_atomic(page_table);
             return;
+        }
 
         kprintf("Warning: Attempted adding a new page to already used virtual address 0x%p; pdidx: %lx, ptidx: %lx\nContents of page table:\n",
             target_virt_addr, (unsigned long)target_virt_addr >> 22, (unsigned long)page_table_idx);
@@ -54,6 +64,7 @@ void paging_add_page_to_address_space(PAGE_DIRECTORY_TYPE * pd_vaddr, void *targ
         print_page_table_entry(page_table + page_table_idx);
 
         //dpanic("Tried to remap an already mapped virtual page!");
+        kunmap_atomic(page_table);
         return;
     }
 
@@ -62,12 +73,12 @@ void paging_add_page_to_address_space(PAGE_DIRECTORY_TYPE * pd_vaddr, void *targ
         dpanic("Not enough free memory to add a new page!\n");
     }
 
-    void * mapped_page = paging_map_phys_addr_unspecified(new_page, PTE_PDE_PAGE_WRITABLE);
+    void * mapped_page = kmap_atomic(new_page, PTE_PDE_PAGE_WRITABLE);
     memset(mapped_page, 0, PAGE_SIZE_NO_PAE);
-    paging_unmap_page(mapped_page);
+    kunmap_atomic(mapped_page);
 
     page_table[page_table_idx] = ((uint32_t)new_page & ~(PAGE_SIZE_NO_PAE-1)) | (flags & (PAGE_SIZE_NO_PAE-1));
-    paging_unmap_page(page_table);
+    kunmap_atomic(page_table);
 }
 
 void * paging_get_page_from_address_space(PAGE_DIRECTORY_TYPE * pd_paddr, void * target_virt_addr, unsigned int flags) {
@@ -200,11 +211,16 @@ void paging_destroy_address_space(PAGE_DIRECTORY_TYPE * pd_vaddr) {
 
     for (int i = 0; i < PAGE_DIRECTORY_ENTRIES - 1; i++) {
         if (!(pd_vaddr[i] & PTE_PDE_PAGE_PRESENT)) continue;
+        if (pd_vaddr[i] & PDE_PAGE_LARGE) continue; // only ever used for kernel mappings
 
         if ((pd_vaddr[i] & ~(PAGE_SIZE_NO_PAE - 1)) != (KERNEL_ADDRESS_SPACE_VADDR[i] & ~(PAGE_SIZE_NO_PAE - 1))) { // we need to be careful around the kernel addresses
             PAGE_TABLE_TYPE * pte = paging_get_pt_from_address_space(pd_vaddr, (void*)(i*PAGE_TABLE_ENTRIES*PAGE_SIZE_NO_PAE));
             for (int j = 0; j < PAGE_TABLE_ENTRIES; j++) {
-                if (!(pte[j] & PTE_PDE_PAGE_PRESENT)) continue;
+                if (!(pte[j] & PTE_PDE_PAGE_PRESENT)) {
+                    if (PTE_IS_SWAPPED(pte[j]))
+                        swap_free_entry(pte[j]);
+                    continue;
+                }
 
                 // for example the v86 tasks uses these with a different PTE
                 // and so we probably don't want to free them
@@ -233,6 +249,16 @@ void paging_print_address_space(PAGE_DIRECTORY_TYPE * pd_vaddr) {
     if (pd_vaddr == NULL) return;
     PAGE_TABLE_TYPE * pt_vaddr;
     for (int i = 0; i < PAGE_DIRECTORY_ENTRIES; i++) {
+        if (pd_vaddr[i] & PDE_PAGE_LARGE) {
+            kprintf("0x%p - 0x%p -> 0x%lx - 0x%lx, flags: %hx (4MiB)\n",
+                get_vaddr(i, 0),
+                get_vaddr(i, 0) + (PAGE_SIZE_LARGE_NO_PAE-1),
+                (unsigned long)pd_vaddr[i] & ~(PAGE_SIZE_LARGE_NO_PAE-1),
+                (unsigned long)(pd_vaddr[i] & ~(PAGE_SIZE_LARGE_NO_PAE-1)) + (PAGE_SIZE_LARGE_NO_PAE-1),
+                (unsigned short)(pd_vaddr[i] & (PAGE_SIZE_NO_PAE-1))
+            );
+            continue;
+        }
         if (pd_vaddr[i] != 0) {
             pt_vaddr = paging_map_phys_addr_unspecified((void*)(pd_vaddr[i] & ~(PAGE_SIZE_NO_PAE-1)), PTE_PDE_PAGE_USER_ACCESS);
             kprintf("page table %d -> %p\n", i, (void*)(pd_vaddr[i] & ~(PAGE_SIZE_NO_PAE-1)));
@@ -250,4 +276,29 @@ void paging_print_address_space(PAGE_DIRECTORY_TYPE * pd_vaddr) {
             paging_unmap_page(pt_vaddr);
         }
     }
-}
\ No newline at end of file
+}
+
+void paging_sync_kernel_pdes(void * start, size_t n) {
+    unsigned long first = (unsigned long)start >> 22;
+    unsigned long count = (((unsigned long)start + n - 1) >> 22) - first + 1;
+    PAGE_DIRECTORY_TYPE * current_address_space = paging_get_address_space_paddr();
+
+    spinlock_acquire(&scheduler_lock);
+    if (current_address_space != kernel_address_space_paddr)
+        memcpy(KERNEL_ADDRESS_SPACE_VADDR + first, PDE_ADDR_VIRT + first, count * sizeof(PAGE_DIRECTORY_TYPE));
+
+    for (process_t * process = process_list; process != NULL; process = process->next) {
+        // >= 2 means the reaper is already tearing the address space down
+        if (process->do_cleanup >= 2 ||
+            process->address_space_paddr == current_address_space ||
+            process->address_space_paddr == kernel_address_space_paddr) continue;
+
+        PAGE_DIRECTORY_TYPE * mapped_pd = paging_map_phys_addr_unspecified(process->address_space_paddr, PTE_PDE_PAGE_WRITABLE);
+        kassert(mapped_pd);
+        memcpy(mapped_pd + first, PDE_ADDR_VIRT + first, count * sizeof(PAGE_DIRECTORY_TYPE));
+        paging_unmap_page(mapped_pd);
+    }
+    spinlock_release(&scheduler_lock);
+
+    flush_tlb_global();
+}
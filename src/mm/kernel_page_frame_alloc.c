@@ -109,19 +109,24 @@ void * pfalloc_dup_page(void * page) {
 
 
     void * new_frame = pfalloc();
-    kassert(new_frame);
-    void * mapped_new = paging_map_phys_addr_unspecified(new_frame, PTE_PDE_PAGE_WRITABLE);
-    kassert(mapped_new);
-    void * mapped_old = paging_map_phys_addr_unspecified(page, PTE_PDE_PAGE_WRITABLE);
-    kassert(mapped_old);
+    if (new_frame == NULL) return NULL;
+    void * mapped_new = kmap_atomic(new_frame, PTE_PDE_PAGE_WRITABLE);
+    void * mapped_old = kmap_atomic(page, 0);
 
     memcpy(mapped_new, mapped_old, PAGE_SIZE_NO_PAE);
-    paging_unmap_page(mapped_new);
-    paging_unmap_page(mapped_old);
+    kunmap_atomic(mapped_old);
+    kunmap_atomic(mapped_new);
 
     return new_frame;
 }
 
+unsigned long pf_get_refcount(void * page) {
+    if (page < page_frame_table_start_addr ||
+        page >= page_frame_table_start_addr + page_frame_table_entries*PAGE_SIZE_NO_PAE)
+        return 0;
+    return page_frame_table[((unsigned long)page - (unsigned long)page_frame_table_start_addr)/PAGE_SIZE_NO_PAE];
+}
+
 void * pfalloc_ref_inc(void * page) {
     if (page < page_frame_table_start_addr) {
         gfx_spinlock.state = SPINLOCK_UNLOCKED;
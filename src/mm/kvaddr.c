@@ -0,0 +1,204 @@
+// kernel virtual address arena for the mappings without a fixed address (temporary maps of page tables and frames, driver buffers)
+// a buddy allocator over the pages between the end of the pmm's page info and KERNEL_SHARED_END,
+// so that the mappings are visible from every address space
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "kernel.h"
+#include "mm/kernel_memory.h"
+#include "kernel_spinlock.h"
+
+#define kprintf(fmt, ...) kprintf("KVA: "fmt, ##__VA_ARGS__)
+
+#define KVADDR_ORDER_MAX 10 // 4MiB
+#define KVADDR_PAGES_MAX ((___KERNEL_SHARED_END - ___KERNEL_HEAP_BASE - KERNEL_HEAP_SIZE) / PAGE_SIZE) // everything above the kernel heap
+#define KVADDR_NIL 0xFFFF
+
+#define KMAP_SLOTS 16
+#define KMAP_BASE (KERNEL_SHARED_END - KMAP_SLOTS * PAGE_SIZE)
+
+enum kvaddr_state {
+    KVADDR_TAIL, // not the first page of a block
+    KVADDR_FREE,
+    KVADDR_USED,
+    KVADDR_USED_MAPPING, // single page from paging_map_phys_addr_unspecified(), released by paging_unmap_page()
+};
+
+static struct {
+    uint16_t free_next;
+    uint16_t free_prev;
+    uint8_t order;
+    uint8_t state;
+} kvaddr_pages[KVADDR_PAGES_MAX];
+
+static uint16_t freelists[KVADDR_ORDER_MAX + 1];
+static void * kvaddr_base = NULL;
+static size_t kvaddr_page_count = 0;
+static spinlock_t kvaddr_lock = {0};
+
+#define BLOCK_BUDDY(block, order) ((block) ^ (1UL << (order)))
+
+static void freelist_insert(size_t block, size_t order) {
+    kvaddr_pages[block].state = KVADDR_FREE;
+    kvaddr_pages[block].order = order;
+    kvaddr_pages[block].free_prev = KVADDR_NIL;
+    kvaddr_pages[block].free_next = freelists[order];
+    if (freelists[order] != KVADDR_NIL)
+        kvaddr_pages[freelists[order]].free_prev = block;
+    freelists[order] = block;
+}
+
+static void freelist_remove(size_t block) {
+    if (kvaddr_pages[block].free_prev != KVADDR_NIL)
+        kvaddr_pages[kvaddr_pages[block].free_prev].free_next = kvaddr_pages[block].free_next;
+    else
+        freelists[kvaddr_pages[block].order] = kvaddr_pages[block].free_next;
+    if (kvaddr_pages[block].free_next != KVADDR_NIL)
+        kvaddr_pages[kvaddr_pages[block].free_next].free_prev = kvaddr_pages[block].free_prev;
+}
+
+// only heads of free blocks are ever KVADDR_FREE, merged away heads go back to KVADDR_TAIL
+static void insert_free_block(size_t block, size_t order) {
+    while (order < KVADDR_ORDER_MAX) {
+        const size_t buddy = BLOCK_BUDDY(block, order);
+        if (buddy >= kvaddr_page_count ||
+            kvaddr_pages[buddy].state != KVADDR_FREE ||
+            kvaddr_pages[buddy].order != order)
+            break;
+
+        freelist_remove(buddy);
+        kvaddr_pages[buddy > block ? buddy : block].state = KVADDR_TAIL;
+        if (buddy < block)
+            block = buddy;
+        order++;
+    }
+    freelist_insert(block, order);
+}
+
+void kvaddr_init(void * start, void * end) {
+    kassert(kvaddr_base == NULL);
+    start = (void*)(((uintptr_t)start + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1));
+    if (end > KMAP_BASE)
+        end = KMAP_BASE;
+    kassert(start < end);
+
+    kvaddr_base = start;
+    kvaddr_page_count = (end - start) / PAGE_SIZE;
+    kassert(kvaddr_page_count <= KVADDR_PAGES_MAX);
+
+    memset(freelists, 0xFF, sizeof(freelists));
+    memset(kvaddr_pages, 0, sizeof(kvaddr_pages));
+
+    // largest aligned blocks first, so that the whole arena ends up as few blocks as possible
+    for (size_t block = 0; block < kvaddr_page_count;) {
+        size_t order = KVADDR_ORDER_MAX;
+        while ((block & ((1UL << order) - 1)) || block + (1UL << order) > kvaddr_page_count)
+            order--;
+        freelist_insert(block, order);
+        block += 1UL << order;
+    }
+
+    kprintf("Arena 0x%p - 0x%p, %lu temporary mapping slots at 0x%p\n", start, end, (unsigned long)KMAP_SLOTS, KMAP_BASE);
+}
+
+static void * __kvaddr_alloc(size_t pages, enum kvaddr_state state) {
+    if (pages == 0 || kvaddr_base == NULL)
+        return NULL;
+
+    size_t order = 0;
+    while ((1UL << order) < pages)
+        order++;
+    if (order > KVADDR_ORDER_MAX)
+        return NULL;
+
+    spinlock_acquire(&kvaddr_lock);
+
+    size_t block_order = order;
+    while (block_order <= KVADDR_ORDER_MAX && freelists[block_order] == KVADDR_NIL)
+        block_order++;
+    if (block_order > KVADDR_ORDER_MAX) {
+        spinlock_release(&kvaddr_lock);
+        return NULL;
+    }
+
+    const size_t block = freelists[block_order];
+    freelist_remove(block);
+
+    // split off the upper halves until we're at the requested size
+    while (block_order > order) {
+        block_order--;
+        freelist_insert(block + (1UL << block_order), block_order);
+    }
+
+    kvaddr_pages[block].state = state;
+    kvaddr_pages[block].order = order;
+
+    spinlock_release(&kvaddr_lock);
+    return kvaddr_base + block * PAGE_SIZE;
+}
+
+void * kvaddr_alloc(size_t pages) {
+    return __kvaddr_alloc(pages, KVADDR_USED);
+}
+
+void * kvaddr_alloc_mapping() {
+    return __kvaddr_alloc(1, KVADDR_USED_MAPPING);
+}
+
+static char kvaddr_in_arena(const void * vaddr) {
+    return kvaddr_base != NULL && vaddr >= kvaddr_base && vaddr < kvaddr_base + kvaddr_page_count * PAGE_SIZE;
+}
+
+void kvaddr_free(void * vaddr) {
+    kassert(kvaddr_in_arena(vaddr));
+    const size_t block = (vaddr - kvaddr_base) / PAGE_SIZE;
+
+    spinlock_acquire(&kvaddr_lock);
+    kassert(kvaddr_pages[block].state == KVADDR_USED || kvaddr_pages[block].state == KVADDR_USED_MAPPING); // Not an allocated block!
+    insert_free_block(block, kvaddr_pages[block].order);
+    spinlock_release(&kvaddr_lock);
+}
+
+void kvaddr_free_mapping(void * vaddr) {
+    if (!kvaddr_in_arena(vaddr))
+        return;
+    const size_t block = (vaddr - kvaddr_base) / PAGE_SIZE;
+
+    spinlock_acquire(&kvaddr_lock);
+    if (kvaddr_pages[block].state == KVADDR_USED_MAPPING)
+        insert_free_block(block, 0);
+    spinlock_release(&kvaddr_lock);
+}
+
+// the slots are a stack, interrupts stay off from the first kmap_atomic() to the last kunmap_atomic()
+// so that another thread can't push its own mappings in between
+static unsigned int kmap_depth = 0;
+static unsigned long kmap_eflags = 0;
+
+void * kmap_atomic(void * phys_addr, unsigned int flags) {
+    unsigned long eflags;
+    asm volatile ("pushf; pop %0; cli;" : "=R"(eflags));
+
+    if (kmap_depth == 0)
+        kmap_eflags = eflags;
+    kassert(kmap_depth < KMAP_SLOTS); // Ran out of temporary mapping slots!
+
+    void * vaddr = KMAP_BASE + kmap_depth++ * PAGE_SIZE;
+    PTE_ADDR_VIRT_BASE[(uintptr_t)vaddr >> 12] =
+        ((uintptr_t)phys_addr & ~(PAGE_SIZE - 1)) | (flags & (PAGE_SIZE - 1)) | PTE_PDE_PAGE_PRESENT;
+    flush_tlb_entry(vaddr);
+    return vaddr;
+}
+
+void kunmap_atomic(void * vaddr) {
+    vaddr = (void*)((uintptr_t)vaddr & ~(PAGE_SIZE - 1));
+    kassert(kmap_depth > 0);
+    kassert(vaddr == KMAP_BASE + (kmap_depth - 1) * PAGE_SIZE); // Unmapped out of order!
+
+    PTE_ADDR_VIRT_BASE[(uintptr_t)vaddr >> 12] = 0;
+    flush_tlb_entry(vaddr);
+
+    if (--kmap_depth == 0)
+        asm volatile ("push %0; popf;" :: "R"(kmap_eflags));
+}
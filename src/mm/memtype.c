@@ -0,0 +1,104 @@
+// memory types of physical ranges, for now only write-combining for linear framebuffers
+// with PAT (Pentium III onwards) the type is picked per mapping, entry 4 (PAT bit set, PCD and PWT clear)
+// is reprogrammed from write-back to write-combining, nothing else sets the PAT bit
+// PAT WC also wins over the UC MTRR firmware usually puts over the PCI hole
+// without PAT (Pentium Pro/II) a free variable MTRR covers the range instead, if it fits one
+// the i486 has neither, mappings stay as they were
+#include <stdint.h>
+#include <stddef.h>
+#include <errno.h>
+
+#include "kernel.h"
+#include "lowlevel.h"
+#include "mm/kernel_memory.h"
+
+#define PAT_WC_ENTRY 4
+#define MTRR_PHYS_ADDR_BITS 36 // CPUs that get here are P6 without PAT, later ones report more through CPUID but take the PAT path
+
+static char pat_wc = 0;
+static int mtrr_wc_index = -1; // the variable MTRR we took, reused on remaps
+
+void memtype_init() {
+    if (!pat_available) return;
+    // no mapping has the PAT bit set yet, so no cache flush is needed
+    uint64_t pat = rdmsr(MSR_PAT);
+    pat &= ~((uint64_t)0xFF << PAT_WC_ENTRY * 8);
+    pat |= (uint64_t)MEMORY_TYPE_WC << PAT_WC_ENTRY * 8;
+    wrmsr(MSR_PAT, pat);
+    pat_wc = 1;
+}
+
+unsigned int memtype_wc_flags(char large) {
+    if (!pat_wc) return 0;
+    return large ? PDE_PAGE_LARGE_PAT : PTE_PAGE_PAT;
+}
+
+// Intel SDM 11.11.7.2, the caches have to be off and flushed while the MTRRs change
+static unsigned long mtrr_change_begin(uint64_t * def_type) {
+    unsigned long eflags;
+    asm volatile ("pushf; pop %0; cli" : "=r"(eflags) :: "memory");
+    asm volatile (
+        "movl %%cr0, %%eax\n\t"
+        "orl $0x40000000, %%eax\n\t" // cd bit (30)
+        "andl $0xDFFFFFFF, %%eax\n\t" // nw bit (29)
+        "movl %%eax, %%cr0\n\t"
+        ::: "eax", "memory"
+    );
+    flush_caches_writeback();
+    flush_tlb_global();
+    *def_type = rdmsr(MSR_MTRR_DEF_TYPE);
+    wrmsr(MSR_MTRR_DEF_TYPE, *def_type & ~MTRR_DEF_TYPE_ENABLE);
+    return eflags;
+}
+
+static void mtrr_change_end(unsigned long eflags, uint64_t def_type) {
+    flush_caches_writeback();
+    flush_tlb_global();
+    wrmsr(MSR_MTRR_DEF_TYPE, def_type);
+    asm volatile (
+        "movl %%cr0, %%eax\n\t"
+        "andl $0xBFFFFFFF, %%eax\n\t"
+        "movl %%eax, %%cr0\n\t"
+        ::: "eax", "memory"
+    );
+    if (eflags & IA_32_EFL_SYSTEM_INTER_EN)
+        asm volatile ("sti");
+}
+
+long memtype_mtrr_set_wc(void * phys_start, size_t size) {
+    if (!mtrr_available) return -ENOSYS;
+    uint64_t cap = rdmsr(MSR_MTRRCAP);
+    if (!(cap & MTRRCAP_WC)) return -ENOSYS;
+
+    // a variable range is a power of two, aligned to its size
+    uint64_t range = PAGE_SIZE_NO_PAE;
+    while (range < size) range <<= 1;
+    if ((uintptr_t)phys_start & (range - 1)) return -EINVAL;
+    const uint64_t addr_mask = ((uint64_t)1 << MTRR_PHYS_ADDR_BITS) - 1;
+    const uint64_t mask = ~(range - 1) & addr_mask;
+
+    int slot = mtrr_wc_index;
+    for (unsigned int i = 0; i < MTRRCAP_GET_VCNT(cap); i++) {
+        if ((int)i == mtrr_wc_index) continue;
+        uint64_t other_mask = rdmsr(MSR_MTRR_PHYSMASK(i));
+        if (!(other_mask & MTRR_PHYSMASK_VALID)) {
+            if (slot == -1) slot = i;
+            continue;
+        }
+        // overlapping ranges combine, and an UC one would win over WC anyway
+        uint64_t common = other_mask & mask & ~(uint64_t)(PAGE_SIZE_NO_PAE - 1);
+        if (((uintptr_t)phys_start & common) == (rdmsr(MSR_MTRR_PHYSBASE(i)) & common))
+            return -EBUSY;
+    }
+    if (slot == -1) return -ENOSPC;
+
+    uint64_t def_type;
+    unsigned long eflags = mtrr_change_begin(&def_type);
+    wrmsr(MSR_MTRR_PHYSMASK(slot), 0);
+    wrmsr(MSR_MTRR_PHYSBASE(slot), (uintptr_t)phys_start | MEMORY_TYPE_WC);
+    wrmsr(MSR_MTRR_PHYSMASK(slot), mask | MTRR_PHYSMASK_VALID);
+    mtrr_change_end(eflags, def_type);
+
+    mtrr_wc_index = slot;
+    return 0;
+}
@@ -1,4 +1,5 @@
 #include "mm/kernel_memory.h"
+#include "mm/swap.h"
 #include "kernel.h"
 #include "kernel_spinlock.h"
 #include "fs/fs.h"
@@ -13,9 +14,104 @@
 
 #include "dev_ops.h"
 
-// TODO: Implement non-MAP_FIXED
 // TODO: Implement a page tracker for shared anonymous mappings, see todo in mmap_file
 
+#define MMAP_FAULT_AROUND_PAGES 16 // aligned window of already cached pages mapped on a shared fault, power of 2
+#define MMAP_READAHEAD_MIN_PAGES 4 // first read-ahead window once a sequential stream is detected
+#define MMAP_READAHEAD_MAX_PAGES 32 // 128KiB in a single filesystem read
+#define MMAP_READAHEAD_MIN_FREE (1<<20) // don't read ahead when memory is this tight
+
+// maps in pages of the window around the faulting page that are already in the inode's mmap page cache
+// the pages are mapped read only so that writes get marked dirty by a page fault
+// returns how many consecutive pages after the faulting one are now mapped
+// requires the mmap_pc_lock write lock
+static size_t mmap_fault_around(struct vm_record * vmr, void * page_addr, int mapping_flags) {
+    inode_t * inode = vmr->backing_fd->inode;
+    void * vmr_end = vmr->node.ptr + ((vmr->len + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1));
+
+    void * start = (void*)((uintptr_t)page_addr & ~(MMAP_FAULT_AROUND_PAGES*PAGE_SIZE - 1));
+    if (start < vmr->node.ptr)
+        start = vmr->node.ptr;
+    void * end = (void*)((uintptr_t)page_addr & ~(MMAP_FAULT_AROUND_PAGES*PAGE_SIZE - 1)) + MMAP_FAULT_AROUND_PAGES*PAGE_SIZE;
+    if (end > vmr_end || end < start)
+        end = vmr_end;
+
+    size_t consecutive = 0;
+    char in_run = 1;
+    for (void * addr = start; addr < end; addr += PAGE_SIZE) {
+        if (addr == page_addr)
+            continue;
+
+        off_t offset = addr - vmr->node.ptr + vmr->mapping_offset;
+        struct mmap_page_cache * mpc = NULL;
+        if (offset < inode->size && !paging_get_pte(addr))
+            mpc = (struct mmap_page_cache *)rbtree_search_exact((rbtree_t *)inode->mmap_page_cache, offset >> 12);
+
+        if (mpc) {
+            __atomic_add_fetch(&mpc->instances, 1, __ATOMIC_ACQUIRE);
+            paging_map_phys_addr(mpc->page, addr, mapping_flags & ~PTE_PDE_PAGE_WRITABLE);
+        }
+
+        if (addr > page_addr && in_run) {
+            if (mpc || paging_get_pte(addr))
+                consecutive++;
+            else
+                in_run = 0;
+        }
+    }
+    return consecutive;
+}
+
+// maps the faulting page and up to max_pages - 1 following pages that aren't mapped nor cached yet
+// so that they can be filled by a single filesystem read
+// returns the amount of consecutive pages mapped, 0 on OOM
+static size_t mmap_map_readahead(struct vm_record * vmr, void * page_addr, size_t max_pages, int fault_flags, int readahead_flags) {
+    inode_t * inode = vmr->backing_fd->inode;
+    void * vmr_end = vmr->node.ptr + ((vmr->len + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1));
+
+    if (!paging_add_page(page_addr, fault_flags))
+        return 0;
+
+    size_t pages = 1;
+    for (; pages < max_pages; pages++) {
+        void * addr = page_addr + pages*PAGE_SIZE;
+        off_t offset = addr - vmr->node.ptr + vmr->mapping_offset;
+
+        if (addr >= vmr_end || offset >= inode->size || paging_get_pte(addr) || swap_get_entry(addr))
+            break;
+        if (!vmr->private && rbtree_search_exact((rbtree_t *)inode->mmap_page_cache, offset >> 12))
+            break;
+        if (pf_get_free_memory() < MMAP_READAHEAD_MIN_FREE)
+            break;
+        if (!paging_add_page(addr, readahead_flags))
+            break;
+    }
+    return pages;
+}
+
+// unmaps and frees pages [from, to) mapped by mmap_map_readahead that didn't make it anywhere
+static void mmap_drop_readahead(void * page_addr, size_t from, size_t to) {
+    for (size_t i = from; i < to; i++) {
+        void * phys = paging_virt_addr_to_phys(page_addr + i*PAGE_SIZE);
+        paging_unmap_page(page_addr + i*PAGE_SIZE);
+        pffree(phys);
+    }
+}
+
+// grows the read-ahead window while faults keep coming in right after the previous ones
+static size_t mmap_readahead_window(struct vm_record * vmr, unsigned long page) {
+    if (page != vmr->ra_next) {
+        vmr->ra_pages = 0;
+        return 1;
+    }
+
+    size_t window = vmr->ra_pages ? vmr->ra_pages * 2 : MMAP_READAHEAD_MIN_PAGES;
+    if (window > MMAP_READAHEAD_MAX_PAGES)
+        window = MMAP_READAHEAD_MAX_PAGES;
+    vmr->ra_pages = window;
+    return window;
+}
+
 // returns 0 on valid, 1 on sigsegv, -1 on sigbus
 char mmap_page_fault(void * fault_addr, struct page_fault_error error) {
     rw_spinlock_acquire_read(&current_process->vm_lock);
@@ -42,7 +138,7 @@ char mmap_page_fault(void * fault_addr, struct page_fault_error error) {
             closest->prot & PROT_WRITE &&
             !closest->private &&
             closest->backing_fd &&
-            S_ISREG(closest->backing_fd->inode->instances)
+            S_ISREG(closest->backing_fd->inode->mode)
         ) { // mark the mmap cache dirty
             rw_spinlock_acquire_write(&closest->backing_fd->inode->mmap_pc_lock);
             struct mmap_page_cache * mpc =
@@ -70,9 +166,11 @@ char mmap_page_fault(void * fault_addr, struct page_fault_error error) {
     }
     kassert(closest->backing_fd);
 
-    if (!S_ISREG(closest->backing_fd->inode->mode))
+    if (!S_ISREG(closest->backing_fd->inode->mode)) {
+        rw_spinlock_release_read(&current_process->vm_lock);
         return -1;
         //panic("Missing pages for mmaped device");
+    }
 
     if ((off_t)(uintptr_t)fault_addr - closest->node.val + closest->mapping_offset > closest->backing_fd->inode->size) {
         rw_spinlock_release_read(&current_process->vm_lock);
@@ -80,7 +178,14 @@ char mmap_page_fault(void * fault_addr, struct page_fault_error error) {
     }
 
     char ret = 1;
+    void * page_addr = (void *)((uintptr_t)fault_addr & ~(PAGE_SIZE-1));
+    unsigned long page = target_offset >> 12;
+    size_t window = mmap_readahead_window(closest, page);
 
+    // shared pages are mapped read only until written to, so that they get marked dirty
+    int clean_flags = closest->private ? mapping_flags : mapping_flags & ~PTE_PDE_PAGE_WRITABLE;
+    if (!error.W)
+        mapping_flags = clean_flags;
 
     disable_wp(); // we plan on changing potentially unwritable sections
 
@@ -89,50 +194,66 @@ char mmap_page_fault(void * fault_addr, struct page_fault_error error) {
         struct mmap_page_cache * mpc =
             (void*)rbtree_search_exact(
                 (rbtree_t *)closest->backing_fd->inode->mmap_page_cache,
-                target_offset >> 12
+                page
         );
         if (mpc) {
             __atomic_add_fetch(&mpc->instances, 1, __ATOMIC_ACQUIRE);
             if (error.W)
                 __atomic_store_n(&mpc->dirty, 1, __ATOMIC_RELEASE);
-            else
-                mapping_flags &= ~PTE_PDE_PAGE_WRITABLE; // for flagging dirty by page fault
-            paging_map_phys_addr(mpc->page, fault_addr, mapping_flags);
+            paging_map_phys_addr(mpc->page, page_addr, mapping_flags);
+            closest->ra_next = page + 1 + mmap_fault_around(closest, page_addr, clean_flags);
             ret = 0;
             goto fin;
         }
     }
 
-    if (!paging_add_page(fault_addr, mapping_flags))
+    size_t pages = mmap_map_readahead(closest, page_addr, window, mapping_flags, clean_flags);
+    if (!pages)
         goto fin;
 
-    size_t to_read = 4096;
-    if (((uintptr_t)fault_addr & ~(PAGE_SIZE - 1)) - closest->node.val + 4096 > closest->len && closest->private)
-        to_read = closest->len % PAGE_SIZE;
+    size_t to_read = pages * PAGE_SIZE;
+    // the rest of the last page of a private mapping has to stay zeroed (think .bss)
+    if (closest->private && (size_t)(page_addr - closest->node.ptr) + to_read > closest->len)
+        to_read = closest->len - (page_addr - closest->node.ptr);
 
-    if (pread_file(closest->backing_fd,
-            (void*)((uintptr_t)fault_addr & ~(PAGE_SIZE - 1)), to_read,
-                target_offset)
-        < 0) {
+    if (pread_file(closest->backing_fd, page_addr, to_read, target_offset) < 0) {
+        mmap_drop_readahead(page_addr, 0, pages);
         ret = -1;
         goto fin;
     }
 
-    if (!closest->private) {
-        struct mmap_page_cache * new_entry = kalloc(sizeof(struct mmap_page_cache));
-        if (!new_entry)
-            goto fin;
+    if (closest->private) {
+        // reading the file in dirtied the pages, reclaim can drop them until the program writes into them itself
+        for (size_t i = 0; i < pages; i++) {
+            PAGE_TABLE_TYPE * pte = paging_get_pte(page_addr + i*PAGE_SIZE);
+            *pte = (*pte & ~PTE_PAGE_DIRTY) | PTE_FILE_CLEAN;
+            flush_tlb_entry(page_addr + i*PAGE_SIZE);
+        }
+    }
 
-        new_entry->node.val = target_offset >> 12;
-        new_entry->instances = 1;
-        new_entry->dirty = (char)error.W;
+    if (!closest->private) {
+        for (size_t i = 0; i < pages; i++) {
+            struct mmap_page_cache * new_entry = kalloc(sizeof(struct mmap_page_cache));
+            if (!new_entry) {
+                // uncached pages would leak on munmap, so drop the rest of the read-ahead
+                mmap_drop_readahead(page_addr, i, pages);
+                if (i == 0)
+                    goto fin;
+                pages = i;
+                break;
+            }
 
-        fault_addr = (void *)((uintptr_t)fault_addr & ~(PAGE_SIZE-1));
-        new_entry->page = paging_virt_addr_to_phys(fault_addr);
+            new_entry->node.val = page + i;
+            new_entry->instances = 1;
+            new_entry->dirty = i == 0 ? (char)error.W : 0;
+            new_entry->page = paging_virt_addr_to_phys(page_addr + i*PAGE_SIZE);
 
-        rbtree_add((rbtree_t **)&closest->backing_fd->inode->mmap_page_cache,
-                    (rbtree_t*)new_entry);
+            rbtree_add((rbtree_t **)&closest->backing_fd->inode->mmap_page_cache,
+                        (rbtree_t*)new_entry);
+        }
+        mmap_fault_around(closest, page_addr, clean_flags);
     }
+    closest->ra_next = page + pages;
 
     ret = 0;
 
@@ -173,6 +294,39 @@ static struct vm_record * mmap_split_record(struct vm_record ** vm, struct vm_re
 
 int munmap_to_vmr(struct vm_record ** vmr_tree, void *addr, size_t len, char ignore_missing, char was_empty);
 
+#define MMAP_LOWEST_VADDR ((void*)0x08000000) // GCC's entry + end of our kernel structures
+#define MMAP_HIGHEST_VADDR ((void*)PROGRAM_PCB_VADDR) // pcb, tls, heap, stack, framebuffer, mmio
+
+static char mmap_range_free(const struct vm_record * vmr, void * addr, size_t len) {
+    const struct vm_record * prev =
+        (const struct vm_record *)rbtree_search_lte((const rbtree_t *)vmr, (uintptr_t)addr + len - 1);
+    return !prev || prev->node.ptr + prev->len <= addr;
+}
+
+// picks an address for mmap() without MAP_FIXED
+// takes the hint if the range is free, otherwise the highest free range below the pcb,
+// so that anonymous mappings grow down towards the ELF and away from it
+static void * mmap_find_free_range(const struct vm_record * vmr, void * hint, size_t len) {
+    len = (len + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    if (len == 0 || len > (size_t)(MMAP_HIGHEST_VADDR - MMAP_LOWEST_VADDR))
+        return NULL;
+
+    if (hint && !((uintptr_t)hint % PAGE_SIZE) &&
+        hint >= MMAP_LOWEST_VADDR && hint <= MMAP_HIGHEST_VADDR - len &&
+        mmap_range_free(vmr, hint, len))
+        return hint;
+
+    void * end = (void*)((uintptr_t)MMAP_HIGHEST_VADDR & ~(PAGE_SIZE - 1));
+    while (end - MMAP_LOWEST_VADDR >= len) {
+        const struct vm_record * prev =
+            (const struct vm_record *)rbtree_search_lte((const rbtree_t *)vmr, (uintptr_t)end - 1);
+        if (!prev || prev->node.ptr + prev->len <= end - len)
+            return end - len;
+        end = (void*)((uintptr_t)prev->node.ptr & ~(PAGE_SIZE - 1));
+    }
+    return NULL;
+}
+
 void *mmap_to_vmr(struct vm_record ** vmr, void *addr, size_t len, int prot, int flags, file_descriptor_t * file, off_t off) {
     if (len == 0 || off < 0 || !vmr)
         return (void*)-EINVAL;
@@ -180,12 +334,13 @@ void *mmap_to_vmr(struct vm_record ** vmr, void *addr, size_t len, int prot, int
         return (void*)-EBADF;
 
     if (!(flags & MAP_FIXED)) {
-        kprintf("stub: mmap() without MAP_FIXED not yet supported\n");
-        return (void*)-ENOTSUP;
+        addr = mmap_find_free_range(*vmr, addr, len);
+        if (!addr)
+            return (void*)-ENOMEM;
     }
     if ((uintptr_t)addr + len < (uintptr_t)addr ||
-        addr + len > (void *) PROGRAM_PCB_VADDR || // pcb, tls, heap, stack, framebuffer, mmio
-        addr < (void*)0x08000000 // GCC's entry + end of our kernel structures
+        addr + len > MMAP_HIGHEST_VADDR ||
+        addr < MMAP_LOWEST_VADDR
     ) {
         return (void*)-ENOMEM;
     }
@@ -282,18 +437,19 @@ void *mmap_to_vmr(struct vm_record ** vmr, void *addr, size_t len, int prot, int
 }
 void *mmap_file(void *addr, size_t len, int prot, int flags, file_descriptor_t * file, off_t off) {
     rw_spinlock_acquire_write(&current_process->vm_lock);
-    munmap_to_vmr(&current_process->vm, addr, len, 1, 0);
+    if (flags & MAP_FIXED)
+        munmap_to_vmr(&current_process->vm, addr, len, 1, 0);
     void * ret = mmap_to_vmr(&current_process->vm, addr, len, prot, flags, file, off);
     rw_spinlock_release_write(&current_process->vm_lock);
     return ret;
 }
 
 void *sys_mmap(void * addr, size_t len, int prot, int flags, int fd, off_t off) {
-    if (fd < 0 || fd >= FD_LIMIT_PROCESS) return (void*)-EBADF;
-
     file_descriptor_t * file = NULL;
 
     if (!(flags & MAP_ANONYMOUS)) {
+        if (fd < 0 || fd >= FD_LIMIT_PROCESS) return (void*)-EBADF;
+
         spinlock_acquire(&current_process->lock);
         file = current_process->fds[fd];
         if (file != NULL) {
@@ -366,6 +522,8 @@ int sys_mprotect(void * addr, size_t len, int prot) {
             for (size_t j = 0; j < pages_to_change; j++) {
                 if (paging_virt_addr_to_phys(addr + (i+j)*PAGE_SIZE))
                     paging_change_flags(addr + (i+j)*PAGE_SIZE, 1, mapping_flags);
+                else
+                    swap_change_flags(addr + (i+j)*PAGE_SIZE, mapping_flags);
             }
         }
         i += pages_to_change;
@@ -389,7 +547,11 @@ static void munmap_vmr(struct vm_record * vmr, char was_empty) {
     if (vmr->private || !vmr->backing_fd) {
         for (void * i = vmr->node.ptr; i < vmr->node.ptr + vmr->len; i += PAGE_SIZE) {
             void * phys = NULL;
-            if ((phys = paging_virt_addr_to_phys(i)) == NULL) continue;
+            if ((phys = paging_virt_addr_to_phys(i)) == NULL) {
+                if (swap_get_entry(i))
+                    paging_unmap_page(i); // frees the swap slot
+                continue;
+            }
             paging_unmap_page(i);
             pffree(phys);
         }
@@ -2,6 +2,7 @@
 
 #include "mm/pmm.h"
 #include "mm/kernel_memory.h"
+#include "mm/swap.h"
 
 #include <stdbool.h>
 #include <string.h>
@@ -562,6 +563,11 @@ size_t pmm_get_free_page_count()
 	return free_page_count;
 }
 
+void* pmm_get_page_info_end()
+{
+	return (void*)(PAGES_START + usable_pages_end * sizeof(page_info_t));
+}
+
 // Satisfy the old interface
 
 unsigned long pf_get_free_memory()
@@ -571,7 +577,10 @@ unsigned long pf_get_free_memory()
 
 void* pfalloc()
 {
-	return (void*)(pmm_alloc(0) * PAGE_SIZE);
+	void* page = (void*)(pmm_alloc(0) * PAGE_SIZE);
+	if (free_page_count < SWAP_LOW_WATERMARK_PAGES)
+		swap_wake_reclaim();
+	return page;
 }
 
 void* pfalloc_1M()
@@ -592,19 +601,27 @@ void pffree_1M(void* block_1M_start)
 void* pfalloc_dup_page(void* page)
 {
 	void* new_frame = pfalloc();
-	kassert(new_frame);
-	void* mapped_new = paging_map_phys_addr_unspecified(new_frame, PTE_PDE_PAGE_WRITABLE);
-	kassert(mapped_new);
-	void* mapped_old = paging_map_phys_addr_unspecified(page, PTE_PDE_PAGE_WRITABLE);
-	kassert(mapped_old);
+	if (new_frame == NULL)
+		return NULL;
+	void* mapped_new = kmap_atomic(new_frame, PTE_PDE_PAGE_WRITABLE);
+	void* mapped_old = kmap_atomic(page, 0);
 
 	memcpy(mapped_new, mapped_old, PAGE_SIZE);
-	paging_unmap_page(mapped_new);
-	paging_unmap_page(mapped_old);
+	kunmap_atomic(mapped_old);
+	kunmap_atomic(mapped_new);
 
 	return new_frame;
 }
 
+unsigned long pf_get_refcount(void* page)
+{
+	// unlocked read, only meant as a hint for page reclaim
+	const size_t page_num = (uintptr_t)page / PAGE_SIZE;
+	if (page_num == 0 || page_num >= usable_pages_end || PAGE_INFO(page_num).order == ORDER_TAIL)
+		return 0;
+	return PAGE_INFO(page_num).refcount;
+}
+
 void* pfalloc_ref_inc(void* page)
 {
 	pmm_retain((uintptr_t)page / PAGE_SIZE);
@@ -0,0 +1,597 @@
+#include "mm/swap.h"
+#include "mm/kernel_memory.h"
+#include "mm/mmap.h"
+#include "kernel.h"
+#include "kernel_sched.h"
+#include "kernel_spinlock.h"
+#include "fs/fs.h"
+#include "rbtree.h"
+
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+
+#define kprintf(fmt, ...) kprintf("swap: "fmt, ##__VA_ARGS__)
+
+// the page reclaim is a second chance clock over the PTEs of every process, which is about as close to LRU as we can get
+// without reverse mappings, it only ever takes:
+//  - anonymous pages of the heap and of private mappings, which go to swap
+//  - unmodified pages of private file mappings, which get dropped and reread on the next fault
+// stacks, tls, the pcb and MAP_SHARED mappings (owned by the inode page caches) stay resident
+
+static spinlock_t swap_lock = {0}; // slot map, swap device, and installing swap PTEs outside of kswapd
+
+static file_descriptor_t * swap_file = NULL;
+static uint16_t * swap_map = NULL; // reference count of each slot, slot 0 is never used as it holds the swap partition header
+static size_t swap_slots = 0;
+static size_t swap_slots_used = 0;
+static size_t swap_next_slot = 1;
+
+static dev_t swap_partition = 0;
+static char swap_partition_found = 0;
+
+static thread_t * kswapd = NULL;
+static char kswapd_wanted = 0;
+static char kswapd_backoff = 0; // the last pass didn't free anything, ignore watermark wake ups until someone waits on us
+static thread_queue_t swap_waiters = {0};
+
+// copies of the pages being written out by kswapd
+// pages aren't unmapped until their copy is safely on the disk, so nobody ever has to read from here
+static unsigned char * swap_cluster = NULL;
+static struct swap_victim {
+    process_t * process;
+    pid_t pid;
+    PAGE_DIRECTORY_TYPE * address_space;
+    void * vaddr;
+    PAGE_TABLE_TYPE pte;
+    unsigned long slot;
+} swap_victims[SWAP_CLUSTER_PAGES];
+
+// clock hand
+static pid_t scan_pid = 0;
+static void * scan_addr = NULL;
+
+// the PTE for vaddr in the current address space, NULL if there's no page table for it
+static PAGE_TABLE_TYPE * swap_pte_ptr(const void * vaddr) {
+    if ((PDE_ADDR_VIRT[(uintptr_t)vaddr >> 22] & (PTE_PDE_PAGE_PRESENT | PDE_PAGE_LARGE)) != PTE_PDE_PAGE_PRESENT)
+        return NULL;
+    return PTE_ADDR_VIRT_BASE + ((uintptr_t)vaddr >> 12);
+}
+
+// swap_lock held
+static unsigned long swap_slot_alloc() {
+    if (swap_file == NULL || swap_slots_used + 1 >= swap_slots)
+        return 0;
+    for (size_t i = 0; i < swap_slots; i++) {
+        unsigned long slot = swap_next_slot;
+        if (++swap_next_slot >= swap_slots)
+            swap_next_slot = 1;
+        if (swap_map[slot] == 0) {
+            swap_map[slot] = 1;
+            swap_slots_used++;
+            return slot;
+        }
+    }
+    return 0;
+}
+
+// swap_lock held
+static void swap_slot_put(unsigned long slot) {
+    kassert(slot != 0 && slot < swap_slots);
+    kassert(swap_map[slot] != 0);
+    if (--swap_map[slot] == 0)
+        swap_slots_used--;
+}
+
+void swap_dup_entry(PAGE_TABLE_TYPE pte) {
+    kassert(PTE_IS_SWAPPED(pte));
+    spinlock_acquire(&swap_lock);
+    kassert((pte >> 12) < swap_slots);
+    kassert(swap_map[pte >> 12] != 0 && swap_map[pte >> 12] != UINT16_MAX);
+    swap_map[pte >> 12]++;
+    spinlock_release(&swap_lock);
+}
+
+void swap_free_entry(PAGE_TABLE_TYPE pte) {
+    kassert(PTE_IS_SWAPPED(pte));
+    spinlock_acquire(&swap_lock);
+    swap_slot_put(pte >> 12);
+    spinlock_release(&swap_lock);
+}
+
+PAGE_TABLE_TYPE swap_get_entry(const void * vaddr) {
+    const PAGE_TABLE_TYPE * pte = swap_pte_ptr(vaddr);
+    if (pte == NULL || !PTE_IS_SWAPPED(*pte))
+        return 0;
+    return *pte;
+}
+
+void swap_change_flags(void * vaddr, unsigned int flags) {
+    spinlock_acquire(&swap_lock);
+    PAGE_TABLE_TYPE * pte = swap_pte_ptr(vaddr);
+    if (pte != NULL && PTE_IS_SWAPPED(*pte))
+        *pte = (*pte & ~PTE_SWAP_SAVED_FLAGS) | (flags & (PTE_PDE_PAGE_WRITABLE | PTE_PDE_PAGE_USER_ACCESS));
+    spinlock_release(&swap_lock);
+}
+
+long swap_in_page(void * vaddr) {
+    vaddr = (void*)((uintptr_t)vaddr & ~(PAGE_SIZE - 1));
+    PAGE_TABLE_TYPE entry = swap_get_entry(vaddr);
+    if (!entry)
+        return -ENOENT;
+    unsigned long slot = entry >> 12;
+
+    // our own reference keeps both the slot and the swap device around while we sleep on the read
+    spinlock_acquire(&swap_lock);
+    swap_map[slot]++;
+    file_descriptor_t * file = swap_file;
+    spinlock_release(&swap_lock);
+
+    // the read has to be able to sleep, we're usually called from the page fault handler which has interrupts off
+    unsigned long eflags;
+    asm volatile ("pushf; pop %0; sti" : "=r"(eflags) :: "memory");
+
+    long ret = 0;
+    void * frame = pfalloc();
+    for (int i = 0; frame == NULL && i < SWAP_OOM_RETRIES; i++) {
+        swap_wait_for_memory();
+        frame = pfalloc();
+    }
+    if (frame == NULL) {
+        ret = -ENOMEM;
+        goto fin;
+    }
+
+    void * mapped = paging_map_phys_addr_unspecified(frame, PTE_PDE_PAGE_WRITABLE);
+    kassert(mapped);
+    ssize_t read = pread_file(file, mapped, PAGE_SIZE, (off_t)slot * PAGE_SIZE);
+    paging_unmap_page(mapped);
+    if (read != PAGE_SIZE) {
+        pffree(frame);
+        ret = read < 0 ? read : -EIO;
+        goto fin;
+    }
+
+    spinlock_acquire(&swap_lock);
+    // the page could've been unmapped, or swapped in by another thread in the meantime
+    PAGE_TABLE_TYPE * pte = swap_pte_ptr(vaddr);
+    if (pte != NULL && *pte == entry) {
+        unsigned int flags = entry & PTE_SWAP_SAVED_FLAGS;
+        if (flags & PTE_FORK_WRITABLE) // every sharer reads its own copy, so there's nothing to copy on write anymore
+            flags = (flags & ~PTE_FORK_WRITABLE) | PTE_PDE_PAGE_WRITABLE;
+        *pte = (uintptr_t)frame | flags | PTE_PDE_PAGE_PRESENT;
+        flush_tlb_entry(vaddr);
+        swap_slot_put(slot); // the reference of the swap PTE
+        frame = NULL;
+    }
+    swap_slot_put(slot);
+    spinlock_release(&swap_lock);
+
+    if (frame != NULL)
+        pffree(frame);
+    asm volatile ("push %0; popf" :: "r"(eflags) : "memory");
+    return 0;
+
+    fin:
+    spinlock_acquire(&swap_lock);
+    swap_slot_put(slot);
+    spinlock_release(&swap_lock);
+    asm volatile ("push %0; popf" :: "r"(eflags) : "memory");
+    return ret;
+}
+
+PAGE_TABLE_TYPE * swap_get_pte(const void * vaddr) {
+    PAGE_TABLE_TYPE * pte = paging_get_pte(vaddr);
+    if (pte == NULL && swap_in_page((void*)vaddr) == 0)
+        pte = paging_get_pte(vaddr);
+    return pte;
+}
+
+void swap_wake_reclaim() {
+    if (kswapd == NULL || kswapd_backoff)
+        return;
+    kswapd_wanted = 1;
+    if (kswapd->status == SCHED_UNINTERR_SLEEP)
+        kswapd->status = SCHED_RUNNABLE;
+}
+
+char swap_wait_for_memory() {
+    if (kswapd == NULL || current_thread == kswapd)
+        return 0;
+
+    unsigned long eflags;
+    asm volatile ("pushf; pop %0; cli;" : "=R"(eflags));
+    kswapd_backoff = 0;
+    swap_wake_reclaim();
+    // kswapd can't run before we're queued up, so we can't miss the wake up
+    thread_queue_add(&swap_waiters, current_process, current_thread, SCHED_UNINTERR_SLEEP);
+    asm volatile ("push %0; popf;" :: "R"(eflags));
+
+    return pf_get_free_memory() != 0;
+}
+
+void * swap_add_page(void * target_virt_addr, unsigned int flags) {
+    void * ret = paging_add_page(target_virt_addr, flags);
+    for (int i = 0; ret == NULL && i < SWAP_OOM_RETRIES; i++) {
+        if (pf_get_free_memory() >= 2 * PAGE_SIZE) // failed for another reason than memory (+ a possible page table)
+            break;
+        swap_wait_for_memory();
+        ret = paging_add_page(target_virt_addr, flags);
+    }
+    return ret;
+}
+
+// processes holding vm_lock are inside a syscall or a fault handler, and may be in the middle of using their pages
+// a user buffer taken from under a syscall would fault while the kernel holds its spinlocks (hd_cache_lock, fs_lock...)
+// and swapping it back in can need those very locks, so the process is left alone until it's back in userspace
+static char swap_process_reclaimable(const process_t * process) {
+    return process->ring != 0 &&
+        process->do_cleanup == 0 &&
+        process->threads != NULL &&
+        process->address_space_paddr != NULL &&
+        process->vm_lock.wlock.state == SPINLOCK_UNLOCKED &&
+        process->vm_lock.vlock.state == SPINLOCK_UNLOCKED && // a reader on its way in
+        process->vm_lock.value == 0;
+}
+
+// the process with the lowest pid >= pid, NULL if there's none
+static process_t * swap_process_from(pid_t pid) {
+    process_t * found = NULL;
+    for (process_t * process = process_list; process != NULL; process = process->next) {
+        if (process->pid >= pid && (found == NULL || process->pid < found->pid))
+            found = process;
+    }
+    return found;
+}
+
+// finds the first reclaimable region of the process at or above addr, returns 0 if there's none
+static char swap_next_region(const process_t * process, void * addr, void ** start, void ** end, const struct vm_record ** vmr_out) {
+    const struct vm_record * vmr =
+        (const struct vm_record *)rbtree_search_lte((const rbtree_t *)process->vm, (uintptr_t)addr);
+    if (vmr == NULL || vmr->node.ptr + vmr->len <= addr)
+        vmr = (const struct vm_record *)rbtree_search_gte((const rbtree_t *)process->vm, (uintptr_t)addr);
+    while (vmr != NULL && !vmr->private)
+        vmr = (const struct vm_record *)rbtree_search_gte((const rbtree_t *)process->vm, vmr->node.val + 1);
+
+    void * heap_start = addr > PROGRAM_HEAP_VADDR ? addr : PROGRAM_HEAP_VADDR;
+    void * heap_end = (void*)(((uintptr_t)process->program_break + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1));
+
+    if (vmr != NULL && (heap_start >= heap_end || vmr->node.ptr < heap_start)) {
+        *start = addr > vmr->node.ptr ? addr : vmr->node.ptr;
+        *end = vmr->node.ptr + ((vmr->len + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1));
+        *vmr_out = vmr;
+        return 1;
+    }
+    if (heap_start < heap_end) {
+        *start = heap_start;
+        *end = heap_end;
+        *vmr_out = NULL;
+        return 1;
+    }
+    return 0;
+}
+
+// picks pages to reclaim, starting at the clock hand
+// clean private file pages are dropped right away, the rest gets copied to swap_cluster with a reserved slot
+// runs in the victim's address space under scheduler_lock and swap_lock, returns the amount of victims
+static size_t swap_scan(void ** dropped, size_t * dropped_count) {
+    size_t victims = 0, scanned = 0;
+    char wrapped = 0;
+
+    process_t * process = swap_process_from(scan_pid);
+    if (process == NULL) {
+        wrapped = 1;
+        process = swap_process_from(0);
+    }
+
+    #define SCAN_LIMITS (scanned < SWAP_SCAN_BUDGET && victims < SWAP_CLUSTER_PAGES && *dropped_count < SWAP_CLUSTER_PAGES)
+    while (process != NULL && SCAN_LIMITS) {
+        if (process->pid != scan_pid) {
+            scan_pid = process->pid;
+            scan_addr = NULL;
+        }
+
+        if (swap_process_reclaimable(process)) {
+            paging_apply_address_space(process->address_space_paddr);
+
+            void * start, * end;
+            const struct vm_record * vmr;
+            while (SCAN_LIMITS && swap_next_region(process, scan_addr, &start, &end, &vmr)) {
+                for (scan_addr = start; scan_addr < end && scan_addr >= start && SCAN_LIMITS; scan_addr += PAGE_SIZE) {
+                    scanned++;
+                    PAGE_TABLE_TYPE * pte = swap_pte_ptr(scan_addr);
+                    if (pte == NULL) { // skip the entire page table
+                        scan_addr = (void*)(((uintptr_t)scan_addr & ~(PAGE_SIZE_LARGE_NO_PAE - 1)) + PAGE_SIZE_LARGE_NO_PAE - PAGE_SIZE);
+                        continue;
+                    }
+                    if (!(*pte & PTE_PDE_PAGE_PRESENT))
+                        continue;
+                    if (*pte & PTE_PDE_PAGE_ACCESSED_DURING_TRANSLATE) { // second chance
+                        *pte &= ~PTE_PDE_PAGE_ACCESSED_DURING_TRANSLATE;
+                        flush_tlb_entry(scan_addr);
+                        continue;
+                    }
+
+                    void * frame = (void*)(*pte & ~(PAGE_SIZE - 1));
+                    // shared with a forked process, or not a frame we manage
+                    if (pf_get_refcount(frame) != 1)
+                        continue;
+
+                    if (vmr != NULL && vmr->backing_fd != NULL &&
+                        (*pte & (PTE_FILE_CLEAN | PTE_PAGE_DIRTY)) == PTE_FILE_CLEAN)
+                    {
+                        *pte = 0;
+                        flush_tlb_entry(scan_addr);
+                        dropped[(*dropped_count)++] = frame;
+                        continue;
+                    }
+
+                    unsigned long slot = swap_slot_alloc();
+                    if (!slot)
+                        continue;
+                    memcpy(swap_cluster + victims * PAGE_SIZE, scan_addr, PAGE_SIZE);
+                    swap_victims[victims++] = (struct swap_victim) {
+                        .process = process,
+                        .pid = process->pid,
+                        .address_space = process->address_space_paddr,
+                        .vaddr = scan_addr,
+                        .pte = *pte,
+                        .slot = slot,
+                    };
+                }
+                if (!SCAN_LIMITS)
+                    break;
+            }
+            if (!SCAN_LIMITS)
+                break;
+        }
+
+        process = swap_process_from(scan_pid + 1);
+        if (process == NULL && !wrapped) {
+            wrapped = 1;
+            process = swap_process_from(0);
+        }
+        scan_pid = process != NULL ? process->pid : 0;
+        scan_addr = NULL;
+    }
+    #undef SCAN_LIMITS
+
+    return victims;
+}
+
+// swaps the written out victims out for real, unless they changed while we were writing
+// runs under scheduler_lock and swap_lock, returns the amount of freed frames added to frames
+static size_t swap_commit(size_t victims, void ** frames) {
+    size_t freed = 0;
+    for (size_t i = 0; i < victims; i++) {
+        struct swap_victim * victim = &swap_victims[i];
+
+        process_t * process = NULL;
+        if (victim->process != NULL) {
+            for (process = process_list; process != NULL; process = process->next)
+                if (process == victim->process) break;
+        }
+        if (process == NULL ||
+            process->pid != victim->pid ||
+            process->address_space_paddr != victim->address_space ||
+            !swap_process_reclaimable(process))
+            goto release;
+
+        if (paging_get_address_space_paddr() != victim->address_space)
+            paging_apply_address_space(victim->address_space);
+
+        PAGE_TABLE_TYPE * pte = swap_pte_ptr(victim->vaddr);
+        const PAGE_TABLE_TYPE ignored = PTE_PDE_PAGE_ACCESSED_DURING_TRANSLATE | PTE_PAGE_DIRTY;
+        if (pte == NULL || (*pte & ~ignored) != (victim->pte & ~ignored))
+            goto release;
+        void * frame = (void*)(*pte & ~(PAGE_SIZE - 1));
+        if (pf_get_refcount(frame) != 1 ||
+            memcmp(victim->vaddr, swap_cluster + i * PAGE_SIZE, PAGE_SIZE) != 0)
+            goto release;
+
+        *pte = (victim->slot << 12) | PTE_SWAPPED | (*pte & PTE_SWAP_SAVED_FLAGS);
+        flush_tlb_entry(victim->vaddr);
+        frames[freed++] = frame;
+        continue;
+
+        release:
+        swap_slot_put(victim->slot);
+    }
+    return freed;
+}
+
+// a single batch of the clock, returns the amount of freed frames
+static size_t swap_reclaim_batch() {
+    void * dropped[SWAP_CLUSTER_PAGES];
+    void * swapped[SWAP_CLUSTER_PAGES];
+    size_t dropped_count = 0;
+
+    // interrupts stay off while we go through other address spaces
+    spinlock_acquire(&scheduler_lock);
+    spinlock_acquire(&swap_lock);
+    PAGE_DIRECTORY_TYPE * old_cr3 = paging_get_address_space_paddr();
+    size_t victims = swap_scan(dropped, &dropped_count);
+    paging_apply_address_space(old_cr3);
+    file_descriptor_t * file = swap_file; // can't go away, the victims hold slots
+    spinlock_release(&swap_lock);
+    spinlock_release(&scheduler_lock);
+
+    // merges runs of consecutive slots into single writes
+    for (size_t i = 0; i < victims;) {
+        size_t run = 1;
+        while (i + run < victims && swap_victims[i + run].slot == swap_victims[i].slot + run)
+            run++;
+
+        if (pwrite_file(file, swap_cluster + i * PAGE_SIZE, run * PAGE_SIZE, (off_t)swap_victims[i].slot * PAGE_SIZE) != (ssize_t)(run * PAGE_SIZE)) {
+            kprintf("Warning: failed writing %lu pages to slot %lu\n", (unsigned long)run, swap_victims[i].slot);
+            for (size_t j = i; j < i + run; j++)
+                swap_victims[j].process = NULL;
+        }
+        i += run;
+    }
+
+    size_t swapped_count = 0;
+    if (victims) {
+        spinlock_acquire(&scheduler_lock);
+        spinlock_acquire(&swap_lock);
+        old_cr3 = paging_get_address_space_paddr();
+        swapped_count = swap_commit(victims, swapped);
+        paging_apply_address_space(old_cr3);
+        spinlock_release(&swap_lock);
+        spinlock_release(&scheduler_lock);
+    }
+
+    for (size_t i = 0; i < dropped_count; i++)
+        pffree(dropped[i]);
+    for (size_t i = 0; i < swapped_count; i++)
+        pffree(swapped[i]);
+    return dropped_count + swapped_count;
+}
+
+#define KSWAPD_IDLE_BATCHES 8 // a full clock sweep has to go around twice, first one only clears accessed bits
+
+static __attribute__((noreturn)) void swap_kswapd(void * arg) {
+    while (1) {
+        asm volatile("cli");
+        if (!kswapd_wanted) {
+            kswapd->status = SCHED_UNINTERR_SLEEP;
+            reschedule();
+            continue;
+        }
+        kswapd_wanted = 0;
+        asm volatile("sti");
+
+        size_t reclaimed = 0;
+        for (int idle = 0; idle < KSWAPD_IDLE_BATCHES &&
+            pf_get_free_memory() < SWAP_HIGH_WATERMARK_PAGES * PAGE_SIZE;) {
+            size_t batch = swap_reclaim_batch();
+            reclaimed += batch;
+            idle = batch ? 0 : idle + 1;
+        }
+        kswapd_backoff = reclaimed == 0 && pf_get_free_memory() < SWAP_HIGH_WATERMARK_PAGES * PAGE_SIZE;
+
+        thread_queue_unblock_all_nonreentrant(&swap_waiters);
+    }
+}
+
+static long swap_activate(file_descriptor_t * file) {
+    off_t size = seek_file(file, 0, SEEK_END);
+    if (size < 0)
+        return size;
+
+    size_t slots = size / PAGE_SIZE;
+    if (slots > SWAP_MAX_SLOTS)
+        slots = SWAP_MAX_SLOTS;
+    if (slots < 2)
+        return -EINVAL;
+
+    uint16_t * map = kalloc(slots * sizeof(uint16_t));
+    if (map == NULL)
+        return -ENOMEM;
+    memset(map, 0, slots * sizeof(uint16_t));
+
+    spinlock_acquire(&swap_lock);
+    if (swap_file != NULL) {
+        spinlock_release(&swap_lock);
+        kfree(map);
+        return -EBUSY;
+    }
+    swap_file = file;
+    swap_map = map;
+    swap_slots = slots;
+    swap_slots_used = 0;
+    swap_next_slot = 1;
+    kswapd_backoff = 0;
+    spinlock_release(&swap_lock);
+
+    kprintf("Using %lu KiB of swap\n", (unsigned long)(slots - 1) * (PAGE_SIZE / 1024));
+    return 0;
+}
+
+void swap_register_partition(dev_t partition) {
+    if (swap_partition_found)
+        return;
+    swap_partition = partition;
+    swap_partition_found = 1;
+}
+
+void swap_init() {
+    swap_cluster = kalloc(SWAP_CLUSTER_PAGES * PAGE_SIZE);
+    kassert(swap_cluster);
+
+    spinlock_acquire(&scheduler_lock);
+    kswapd = kernel_create_thread(kernel_task, current_thread, swap_kswapd, NULL, 0);
+    spinlock_release(&scheduler_lock);
+    kassert(kswapd);
+
+    if (!swap_partition_found)
+        return;
+
+    file_descriptor_t * file = NULL;
+    long ret = open_raw_device(swap_partition, O_RDWR, &file);
+    if (ret >= 0 && file != NULL)
+        ret = swap_activate(file);
+    if (ret < 0) {
+        kprintf("Warning: can't use swap partition %hx (%ld)\n", swap_partition, ret);
+        if (file != NULL)
+            close_file(file);
+    }
+}
+
+long sys_swapon(const char * path) {
+    inode_t * inode = NULL;
+    long ret = openat_inode((inode_t*)AT_FDCWD, path, O_RDWR, 0, &inode, 0);
+    if (ret < 0 || inode == NULL)
+        return ret;
+    if (!S_ISREG(inode->mode) && !S_ISBLK(inode->mode)) {
+        close_inode(inode);
+        return -EINVAL;
+    }
+
+    spinlock_acquire(&kernel_fd_lock);
+    file_descriptor_t * file = get_free_fd();
+    spinlock_release(&kernel_fd_lock);
+    if (file == NULL) {
+        close_inode(inode);
+        return -ENFILE;
+    }
+
+    file->inode = inode;
+    file->flags = O_RDWR;
+
+    ret = swap_activate(file);
+    if (ret < 0)
+        close_file(file);
+    return ret;
+}
+
+long sys_swapoff(const char * path) {
+    inode_t * inode = NULL;
+    long ret = openat_inode((inode_t*)AT_FDCWD, path, O_RDONLY, 0, &inode, 0);
+    if (ret < 0 || inode == NULL)
+        return ret;
+
+    file_descriptor_t * file = NULL;
+    uint16_t * map = NULL;
+
+    spinlock_acquire(&swap_lock);
+    if (swap_file == NULL || swap_file->inode != inode) {
+        ret = -EINVAL;
+    } else if (swap_slots_used) {
+        ret = -EBUSY; // we don't page everything back in, the swapped out pages have to go away first
+    } else {
+        file = swap_file;
+        map = swap_map;
+        swap_file = NULL;
+        swap_map = NULL;
+        swap_slots = 0;
+    }
+    spinlock_release(&swap_lock);
+
+    close_inode(inode);
+    if (file != NULL) {
+        close_file(file);
+        kfree(map);
+    }
+    return ret;
+}
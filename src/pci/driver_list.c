@@ -3,6 +3,7 @@
 #include "pci/pci.h"
 
 extern char bga_init(struct pci_device);
+extern char cirrus_init(struct pci_device);
 const struct pci_driver pci_drivers[] = {
     { // bochs graphics adapter
         .vendor_id = 0x1234,
@@ -11,6 +12,13 @@ const struct pci_driver pci_drivers[] = {
         .subclass = 0x0,
         .init = bga_init,
     },
+    { // cirrus logic gd5446
+        .vendor_id = 0x1013,
+        .device_id = 0x00B8,
+        .class = 0x3,
+        .subclass = 0x0,
+        .init = cirrus_init,
+    },
     {.init = NULL} // guarding NULL
 };
 
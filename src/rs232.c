@@ -1,5 +1,9 @@
+// 8250/16450/16550 UARTs
+// output goes into a ring per port, drained in FIFO sized bursts from the tx holding register empty interrupt
+// input is taken off the FIFO in the interrupt and handed to the tty in batches by the driver thread
 #include <stdint.h>
 #include <stddef.h>
+#include <errno.h>
 #include "rs232.h"
 #include "../libc/src/include/UnstableOS/devs.h"
 #include "kernel_tty_io.h"
@@ -8,6 +12,11 @@
 #include "kernel_sched.h"
 
 #define RS232_IO_TIMEOUT 1024
+#define COM_IRQ_MAX_PASSES 16 // of the IIR, in case the UART never stops reporting something
+
+#define COM_TX_RING_SIZE 4096 // powers of two, the indices are free running
+#define COM_RX_RING_SIZE 1024
+#define COM_RX_BATCH 64 // bytes per tty_write_to_tty() call
 
 #define kprintf(fmt, ...) kprintf("RS-232 driver: "fmt, ##__VA_ARGS__)
 
@@ -18,7 +27,41 @@ enum com_state {
     COM_UNINITIALIZED, // will just skip writes
     COM_INITIALIZED
 };
-char com_states[COM_PORTS] = {COM_UNINITIALIZED};
+
+struct com_port {
+    char state;
+    char tx_irq; // whether the tx holding register empty interrupt is enabled
+    unsigned char tx_burst; // bytes the UART takes at once, the FIFO size or 1 without one
+    unsigned int baudrate;
+    spinlock_t lock; // the rings and the registers, taken by the interrupt too, so threads have to hold it with interrupts off
+
+    size_t tx_head, tx_tail;
+    size_t rx_head, rx_tail;
+    char tx_ring[COM_TX_RING_SIZE];
+    char rx_ring[COM_RX_RING_SIZE];
+};
+static struct com_port com_ports[COM_PORTS] = {0};
+
+static char com_polled = 0; // after a panic, no more interrupts will drain the rings
+
+static inline char com_ready_to_write(unsigned char com) {
+    return inb(com_addresses[com] + COM_DELTA_LINE_STATUS) & COM_LSR_TX_HOLDING_REGISTER_EMPTY;
+}
+static inline char com_ready_to_recv(unsigned char com) {
+    return inb(com_addresses[com] + COM_DELTA_LINE_STATUS) & COM_LSR_DATA_READY;
+}
+
+static void com_set_divisor(unsigned char com, unsigned int baudrate) {
+    uint16_t divisor = COM_MAX_BAUDRATE/baudrate;
+    uint8_t line_control = inb(com_addresses[com] + COM_DELTA_LINE_CONTROL);
+    outb(com_addresses[com] + COM_DELTA_LINE_CONTROL, line_control | COM_MSB_DLAB_BIT_MASK);
+    io_wait();
+    outb(com_addresses[com] + COM_DELTA_DLAB_LSB_BAUD, divisor & 0xFF);
+    outb(com_addresses[com] + COM_DELTA_DLAB_MSB_BAUD, divisor >> 8);
+    io_wait();
+    outb(com_addresses[com] + COM_DELTA_LINE_CONTROL, line_control & ~COM_MSB_DLAB_BIT_MASK);
+}
+
 char com_init(unsigned char com, unsigned int baudrate, enum com_data_bits data_bits, enum com_stop_bits stop_bits, enum com_parity parity, enum com_fifo buffered_bytes) {
     if (com >= COM_PORTS) {
         kprintf("Invalid COM port to initialize specified (%d)!\n", com);
@@ -29,7 +72,7 @@ char com_init(unsigned char com, unsigned int baudrate, enum com_data_bits data_
         return COM_ERR_INVALID_BAUDRATE;
     }
 
-    if (baudrate < 75) {
+    if (baudrate < COM_MIN_BAUDRATE) {
         kprintf("Baudrate way too low for COM%d!\n", com);
         return COM_ERR_BAUDRATE_TOO_LOW;
     }
@@ -59,23 +102,28 @@ char com_init(unsigned char com, unsigned int baudrate, enum com_data_bits data_
     }
     kprintf("Initializing port %d with baud rate %u\n", com, baudrate);
 
-    // set the baud rate
-    baudrate = COM_MAX_BAUDRATE/baudrate;
-    uint8_t brlow  = baudrate &  0xFF;
-    uint8_t brhigh = baudrate >> 8;
+    struct com_port * port = &com_ports[com];
     outb(com_addresses[com] + COM_DELTA_IRQ_EN, 0);
-    outb(com_addresses[com] + COM_DELTA_LINE_CONTROL, COM_MSB_DLAB_BIT_MASK);
-    io_wait();
-    outb(com_addresses[com] + COM_DELTA_DLAB_LSB_BAUD, brlow);
-    outb(com_addresses[com] + COM_DELTA_DLAB_MSB_BAUD, brhigh);
-    io_wait();
-
 
     uint8_t line_control = (data_bits & 0x3) | ((stop_bits & 1) << 2) | ((parity & 0x7) << 3);
     outb(com_addresses[com] + COM_DELTA_LINE_CONTROL, line_control);
+    com_set_divisor(com, baudrate);
 
     uint8_t fifo_control = COM_FCR_ENABLE_FIFO | COM_FCR_CLEAR_RX_FIFO | COM_FCR_CLEAR_TX_FIFO | (buffered_bytes << 6);
     outb(com_addresses[com] + COM_DELTA_FIFO_CONTROL, fifo_control);
+    io_wait();
+
+    port->tx_burst = 1;
+    switch (inb(com_addresses[com] + COM_DELTA_IIR) & COM_IIR_FIFO_BUFFER_STATE) {
+        case COM_IIR_FIFO_ENABLED:
+            port->tx_burst = COM_16550A_FIFO_SIZE;
+            break;
+        case COM_IIR_FIFO_UNUSABLE: // the original 16550, its FIFO loses data
+            outb(com_addresses[com] + COM_DELTA_FIFO_CONTROL, 0);
+            kprintf("COM%d has a broken FIFO, not using it\n", com);
+            break;
+        default: break; // 8250/16450
+    }
 
     outb(com_addresses[com] + COM_DELTA_MODEM_CONTROL, COM_MCR_LOOP); // enable loopback to test com port
     io_wait();
@@ -89,33 +137,83 @@ char com_init(unsigned char com, unsigned int baudrate, enum com_data_bits data_
         return 1;
     }
 
+    port->baudrate = baudrate;
+    port->tx_irq = 0;
+    port->tx_head = port->tx_tail = 0;
+    port->rx_head = port->rx_tail = 0;
+
     uint8_t modem_control = COM_MCR_OUT1 | COM_MCR_OUT2 | COM_MCR_RTS;
     outb(com_addresses[com] + COM_DELTA_MODEM_CONTROL, modem_control);
     outb(com_addresses[com] + COM_DELTA_IRQ_EN, COM_IRQ_EN_RECV_DATA_AVAIL);
-    com_states[com] = COM_INITIALIZED;
+    port->state = COM_INITIALIZED;
     return 0;
 }
 
+unsigned int com_get_baudrate(unsigned char com) {
+    if (com >= COM_PORTS || com_ports[com].state == COM_UNINITIALIZED) return 0;
+    return com_ports[com].baudrate;
+}
 
-static inline char com_ready_to_write(unsigned char com) {
-    return inb(com_addresses[com] + COM_DELTA_LINE_STATUS) & COM_LSR_TX_HOLDING_REGISTER_EMPTY;
+long com_set_baudrate(unsigned char com, unsigned int baudrate) {
+    if (com >= COM_PORTS || com_ports[com].state == COM_UNINITIALIZED) return -ENODEV;
+    if (baudrate < COM_MIN_BAUDRATE || baudrate > COM_MAX_BAUDRATE || (COM_MAX_BAUDRATE % baudrate) != 0)
+        return -EINVAL;
+
+    struct com_port * port = &com_ports[com];
+    if (port->baudrate == baudrate) return 0;
+
+    // what's already queued goes out at the old rate
+    while (__atomic_load_n(&port->tx_head, __ATOMIC_ACQUIRE) != __atomic_load_n(&port->tx_tail, __ATOMIC_ACQUIRE) && !com_polled)
+        reschedule();
+
+    spinlock_acquire(&port->lock);
+    // the FIFO is empty by now, only the shift register might still be going
+    for (int i = 0; i < RS232_IO_TIMEOUT && !(inb(com_addresses[com] + COM_DELTA_LINE_STATUS) & COM_LSR_TX_EMPTY); i++)
+        io_wait();
+    com_set_divisor(com, baudrate);
+    port->baudrate = baudrate;
+    spinlock_release(&port->lock);
+    return 0;
 }
-static inline char com_ready_to_recv(unsigned char com) {
-    return inb(com_addresses[com] + COM_DELTA_LINE_STATUS) & COM_LSR_DATA_READY;
+
+
+// acquire port->lock before this, and only when the tx holding register is empty
+static void com_tx_burst(unsigned char com) {
+    struct com_port * port = &com_ports[com];
+    for (int i = 0; i < port->tx_burst && port->tx_head != port->tx_tail; i++) {
+        outb(com_addresses[com] + COM_DELTA_TX, port->tx_ring[port->tx_head % COM_TX_RING_SIZE]);
+        port->tx_head++;
+    }
 }
 
-#define EMPTY(tq) ((tq)->head == (tq)->tail)
-#define DEC(tq) ((tq)->head = ((tq)->head+1)%MAX_CANON)
+// acquire port->lock before this
+// the tx interrupt is only on while there's something to send, otherwise it would keep firing
+static void com_tx_irq_update(unsigned char com) {
+    struct com_port * port = &com_ports[com];
+    char needed = port->tx_head != port->tx_tail && !com_polled;
+    if (needed == port->tx_irq) return;
+    port->tx_irq = needed;
+    outb(com_addresses[com] + COM_DELTA_IRQ_EN, COM_IRQ_EN_RECV_DATA_AVAIL | (needed ? COM_IRQ_EN_TX_HOLD_REG_EMPTY : 0));
+}
 
-size_t tty_com_write(tty_t * tty) { // assumes tty queue to be locked
-    if (com_states[(int)tty->com_port] == COM_UNINITIALIZED) return 0;
+// acquire port->lock before this, only for polling after a panic when interrupts are off anyway
+static void com_tx_wait_burst(unsigned char com) {
+    for (int _ = 0; _ < RS232_IO_TIMEOUT && !com_ready_to_write(com); _++) {}
+    com_tx_burst(com);
+}
 
-    size_t written = 0;
-    while (!EMPTY(&tty->oqueue)) {
-        com_write(tty->com_port, &tty->oqueue.buffer[tty->oqueue.head], 1);
-        DEC(&tty->oqueue);
-        written++;
+size_t tty_com_write(tty_t * tty) { // assumes tty queue to be locked
+    if (com_get_baudrate(tty->com_port) == 0) return 0;
+
+    struct tty_queue * tq = &tty->oqueue;
+    size_t written = REMAIN(tq);
+    if (tq->head <= tq->tail) {
+        com_write(tty->com_port, tq->buffer + tq->head, tq->tail - tq->head);
+    } else {
+        com_write(tty->com_port, tq->buffer + tq->head, MAX_CANON - tq->head);
+        com_write(tty->com_port, tq->buffer, tq->tail);
     }
+    tq->head = tq->tail;
 
     return written;
 }
@@ -125,68 +223,121 @@ long com_write(unsigned char com, const char * data, unsigned long len) {
         kprintf("Invalid COM port to write to specified (%d)!\n", com);
         return -1;
     }
-    if (com_states[com] == COM_UNINITIALIZED) return 0;
+    struct com_port * port = &com_ports[com];
+    if (port->state == COM_UNINITIALIZED) return 0;
 
+    spinlock_acquire(&port->lock);
     for (unsigned long i = 0; i < len; i++) {
-        for (int _ = 0; _ < RS232_IO_TIMEOUT && !com_ready_to_write(com); _++) {}
-        outb(com_addresses[com], data[i]); 
+        // the interrupt isn't keeping up (or interrupts are off, like early in boot), make room the old way
+        if (port->tx_tail - port->tx_head == COM_TX_RING_SIZE) {
+            // waiting on the UART happens without the lock, so that interrupts stay as the caller had them
+            spinlock_release(&port->lock);
+            for (int _ = 0; _ < RS232_IO_TIMEOUT && !com_ready_to_write(com); _++) {}
+            spinlock_acquire(&port->lock);
+            if (port->tx_tail - port->tx_head == COM_TX_RING_SIZE) // the interrupt might have made room meanwhile
+                com_tx_burst(com);
+        }
+        port->tx_ring[port->tx_tail % COM_TX_RING_SIZE] = data[i];
+        port->tx_tail++;
+    }
+
+    if (com_polled) {
+        while (port->tx_head != port->tx_tail)
+            com_tx_wait_burst(com);
+    } else if (!port->tx_irq && com_ready_to_write(com)) {
+        com_tx_burst(com); // the interrupt only comes once the register empties again, so start it off
     }
+    com_tx_irq_update(com);
+    spinlock_release(&port->lock);
     return len;
 }
 
+void com_panic() {
+    com_polled = 1;
+    for (int i = 0; i < COM_PORTS; i++)
+        com_ports[i].lock.state = SPINLOCK_UNLOCKED;
+}
+
 
-static spinlock_t com_driver_lock = {0};
 static thread_t * com_driver_thread = NULL;
-static volatile char com_pending = -1;
-static __attribute__((noreturn)) void com_driver_loop() {
+static thread_queue_t com_driver_queue = {0};
+static volatile char com_rx_pending = 0;
+static __attribute__((noreturn)) void com_driver_loop(void * arg) {
+    char batch[COM_RX_BATCH];
     while (1) {
-        if (__builtin_expect(com_pending == -1, 0)) {
-            com_driver_thread->status = SCHED_UNINTERR_SLEEP;
-            reschedule();
-        } else {
-            spinlock_acquire_interruptible(&com_driver_lock);
-            while (com_ready_to_recv(com_pending)) {
-                unsigned char data = inb(com_addresses[(int)com_pending]);
-                tty_write_to_tty((char*)&data, 1, GET_DEV(DEV_MAJ_TTY, DEV_TTY_S0 + com_pending));
-                io_wait(); // just in case
+        asm volatile ("cli"); // input arriving between the check and the queue add would be missed otherwise
+        if (!com_rx_pending) {
+            thread_queue_add(&com_driver_queue, kernel_task, current_thread, SCHED_UNINTERR_SLEEP);
+            asm volatile ("sti");
+            continue;
+        }
+        com_rx_pending = 0;
+        asm volatile ("sti");
+
+        for (int com = 0; com < COM_PORTS; com++) {
+            struct com_port * port = &com_ports[com];
+            while (1) {
+                size_t n = 0;
+                spinlock_acquire(&port->lock);
+                while (n < COM_RX_BATCH && port->rx_head != port->rx_tail) {
+                    batch[n++] = port->rx_ring[port->rx_head % COM_RX_RING_SIZE];
+                    port->rx_head++;
+                }
+                spinlock_release(&port->lock);
+                if (n == 0) break;
+                tty_write_to_tty(batch, n, GET_DEV(DEV_MAJ_TTY, DEV_TTY_S0 + com));
             }
-            asm volatile ("cli;");
-            pic_send_eoi(PIC_INTERR_COM1);
-            pic_send_eoi(PIC_INTERR_COM2);
-
-            pic_unmask_irq(PIC_INTERR_COM1);
-            pic_unmask_irq(PIC_INTERR_COM2);
-
-            com_pending = -1;
-            spinlock_release(&com_driver_lock);
         }
     }
 }
 
-void com_recv_byte(char com) { // called by interrupt
+void com_interrupt(char com) { // called by interrupt, before the EOI
     if (com < 0 || com >= COM_PORTS) {
         kprintf("Invalid COM port specified from interrupt handler (%d)!\n", com);
         return;
     }
+    struct com_port * port = &com_ports[(int)com];
+    if (port->state == COM_UNINITIALIZED) return;
+
+    char received = 0;
+    spinlock_acquire_nonreentrant(&port->lock); // interrupts are off, threads only hold it with them off as well
+    // the IRQ is edge triggered, anything left pending would never raise it again
+    for (int i = 0; i < COM_IRQ_MAX_PASSES; i++) {
+        uint8_t iir = inb(com_addresses[(int)com] + COM_DELTA_IIR);
+        if (iir & COM_IIR_NO_PENDING) break;
+
+        switch ((iir & COM_IIR_INTERRUPT_STATE_MASK) >> 1) {
+            case COM_IIR_STATE_RECV_DATA: // also the FIFO timeout
+                while (com_ready_to_recv(com)) {
+                    char data = inb(com_addresses[(int)com] + COM_DELTA_RX);
+                    if (port->rx_tail - port->rx_head == COM_RX_RING_SIZE) continue; // discards new input, like the tty queue
+                    port->rx_ring[port->rx_tail % COM_RX_RING_SIZE] = data;
+                    port->rx_tail++;
+                    received = 1;
+                }
+                break;
+            case COM_IIR_STATE_TX_EMPTY:
+                // a com_write() could have refilled it since
+                if (com_ready_to_write(com))
+                    com_tx_burst(com);
+                com_tx_irq_update(com);
+                break;
+            case COM_IIR_STATE_LINE_STATUS:
+                inb(com_addresses[(int)com] + COM_DELTA_LINE_STATUS);
+                break;
+            case COM_IIR_STATE_MODEM_STATUS:
+                inb(com_addresses[(int)com] + COM_DELTA_MODEM_STATUS);
+                break;
+        }
+    }
+    spinlock_release(&port->lock);
+
+    if (!received) return;
     if (com_driver_thread == NULL) {
         spinlock_acquire(&scheduler_lock);
-        com_driver_thread = kernel_create_thread(kernel_task, current_thread, (void (*)(void*))com_driver_loop, NULL, 0);
+        com_driver_thread = kernel_create_thread(kernel_task, current_thread, com_driver_loop, NULL, 0);
         spinlock_release(&scheduler_lock);
     }
-    // so that we can do interruptible spinlocks
-    switch (com) {
-        case 0:
-        case 1:
-            pic_mask_irq(PIC_INTERR_COM1);
-            pic_mask_irq(PIC_INTERR_COM2);
-        default: break;
-    }
-    asm volatile ("sti");
-
-    while (com_pending != -1) {com_driver_thread->status = SCHED_RUNNABLE; reschedule();}
-
-    spinlock_acquire(&com_driver_lock);
-    com_pending = com;
-    com_driver_thread->status = SCHED_RUNNABLE;
-    spinlock_release(&com_driver_lock);
-}
\ No newline at end of file
+    com_rx_pending = 1;
+    thread_queue_unblock_nonreentrant(&com_driver_queue);
+}
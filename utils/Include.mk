@@ -16,7 +16,7 @@ else
 UTILS_BUILD_DIR := $(MAKE_ROOT)/build/utils
 endif
 
-UTILS := cat clear echo ls mkdir mount pwd rename rm rmdir setsid sleep stty umount xxd ysh dd zrezset
+UTILS := cat clear echo ls mkdir mount pwd rename rm rmdir setsid sleep stty swapoff swapon umount xxd ysh dd zrezset
 UTILS_BINS = $(patsubst %, $(UTILS_BUILD_DIR)/%, $(UTILS))
 
 UTILS_CFLAGS := $(CFLAGS) -ffreestanding -Ofast -g $(LIBC_INCLUDES) -MMD -MP -fPIE -pie -Wl,--no-dynamic-linker
@@ -6,6 +6,7 @@
 #include <ctype.h>
 #include <string.h>
 #define CAT_BUFFER 4096
+#define CAT_COPY_CHUNK 0x100000 // the kernel caps a copy_file_range() call at this anyway
 
 char number_lines = 0; // 1 = normal, 2 = nonempty
 char nonprinting = 0; // 1 = normal, 2 = with tabs, 4 = with eol
@@ -48,6 +49,25 @@ static char print_fd(int fd, const char * file_name) {
         return 0;
     }
 
+    // nothing to transform, let the kernel move the data
+    if (!number_lines && !nonprinting) {
+        fflush(stdout);
+        ssize_t copied = 0;
+        char any = 0;
+        while ((copied = copy_file_range(fd, NULL, STDOUT_FILENO, NULL, CAT_COPY_CHUNK, 0)) > 0)
+            any = 1;
+        if (copied == 0)
+            return 0;
+        // old kernel or fds the kernel can't copy between (O_APPEND from >> among others), do it the slow way
+        if (any) {
+            if (file_name)
+                fprintf(stderr, "cat: error while copying %s: %s\n", file_name, strerror(errno));
+            else
+                perror("cat: standard input");
+            return 1;
+        }
+    }
+
     unsigned char buf[CAT_BUFFER];
 
     ssize_t read_bytes = 0;
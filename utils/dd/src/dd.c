@@ -175,6 +175,25 @@ void signal_handler(int sig) {
     should_exit = 1;
 }
 
+#define DD_COPY_MAX 0x100000 // the kernel caps a single copy_file_range() at this
+#define DD_TRANSFORM_CONVS 0x3F // ascii, ebcdic, ibm, lcase, ucase, swab
+
+// one block with copy_file_range(), split up if bs is bigger than what the kernel copies in one go
+// returns the amount copied, stops at the first short copy like read() would
+static ssize_t copy_block(int in_fd, int out_fd, off_t bs) {
+    off_t done = 0;
+    while (done < bs) {
+        const size_t chunk = bs - done > DD_COPY_MAX ? DD_COPY_MAX : bs - done;
+        ssize_t copied = copy_file_range(in_fd, NULL, out_fd, NULL, chunk, 0);
+        if (copied < 0)
+            return done > 0 ? done : -1;
+        done += copied;
+        if (copied < chunk)
+            break;
+    }
+    return done;
+}
+
 int main(int argc, char ** argv) {
     char * temp;
     char * input = NULL, * output = NULL;
@@ -322,11 +341,6 @@ int main(int argc, char ** argv) {
     if (trunc)
         ftruncate(out_fd, seek);
 
-    unsigned char * block = malloc(bs);
-    if (block == NULL) {
-        fprintf(stderr, "%s: Can't allocate block buffer: %s\n", argv[0], strerror(errno));
-        return 1;
-    }
     ssize_t read_amount = 0;
     ssize_t write_amount = 0;
 
@@ -338,6 +352,42 @@ int main(int argc, char ** argv) {
     start_time = time(NULL);
     signal(SIGINT, signal_handler);
 
+    // without conversions the data doesn't need to come up here at all
+    // noerror needs to tell read errors from write errors, so it takes the slow path
+    if (!(convs & (DD_TRANSFORM_CONVS | 0x80))) {
+        while (!should_exit &&
+                read_blocks + read_partial_blocks < count &&
+                (write_amount = copy_block(in_fd, out_fd, bs)) > 0
+        ) {
+            if (write_amount < bs) {
+                read_partial_blocks ++;
+                written_partial_blocks ++;
+            } else {
+                read_blocks ++;
+                written_blocks ++;
+            }
+            written_bytes += write_amount;
+
+            if (do_status)
+                display_progress();
+        }
+        if (should_exit || write_amount == 0)
+            goto done;
+        // nothing copied yet and the kernel can't do it for these fds (whatever the reason), fall back to read()/write()
+        if (read_blocks + read_partial_blocks > 0) {
+            fprintf(stderr, "%s: error copying '%s' to '%s': %s\n", argv[0], input, output, strerror(errno));
+            fprintf(stderr, "%llu+%llu records in\n", read_blocks, read_partial_blocks);
+            fprintf(stderr, "%llu+%llu records out\n", written_blocks, written_partial_blocks);
+            return 1;
+        }
+    }
+
+    unsigned char * block = malloc(bs);
+    if (block == NULL) {
+        fprintf(stderr, "%s: Can't allocate block buffer: %s\n", argv[0], strerror(errno));
+        return 1;
+    }
+
     try_again:
     while (!should_exit &&
             read_blocks + read_partial_blocks < count &&
@@ -380,6 +430,7 @@ int main(int argc, char ** argv) {
         return 1;
     }
 
+    done:
     fprintf(stderr, "%llu+%llu records in\n", read_blocks, read_partial_blocks);
     fprintf(stderr, "%llu+%llu records out\n", written_blocks, written_partial_blocks);
 
@@ -5,7 +5,8 @@ int main(int argc, char ** argv) {
     if (argc < 4 || argc > 5) {
         fprintf(stderr, "Usage: %s [fs_type] [srcdev] [mountpoint] <options>\n", argv[0]);
         fprintf(stderr, "Supported filesystems:\n\tdevfs\n\ttarfs\n\tfat\n");
-        fprintf(stderr, "Supported options:\n\tro\n\trw (default)\n");
+        fprintf(stderr, "Supported options (comma separated):\n\tro\n\trw (default)\n"
+            "\tnoatime\n\trelatime\n\tstrictatime (default)\n\tlazytime\n\tnolazytime (default)\n");
         return 1;
     }
     int fs_type = 0;
@@ -23,13 +24,25 @@ int main(int argc, char ** argv) {
     }
 
     if (argc == 5) {
-        if (strcmp(argv[4], "rw") == 0)
-            options = 0;
-        if (strcmp(argv[4], "ro") == 0)
-            options = MOUNT_RDONLY;
-        else {
-            fprintf(stderr, "mount: Unknown option %s\n", argv[4]);
-            return 1;
+        for (char * option = strtok(argv[4], ","); option != NULL; option = strtok(NULL, ",")) {
+            if (strcmp(option, "rw") == 0)
+                options &= ~MOUNT_RDONLY;
+            else if (strcmp(option, "ro") == 0)
+                options |= MOUNT_RDONLY;
+            else if (strcmp(option, "noatime") == 0)
+                options = (options & ~MOUNT_RELATIME) | MOUNT_NOATIME;
+            else if (strcmp(option, "relatime") == 0)
+                options = (options & ~MOUNT_NOATIME) | MOUNT_RELATIME;
+            else if (strcmp(option, "strictatime") == 0)
+                options &= ~(MOUNT_NOATIME | MOUNT_RELATIME);
+            else if (strcmp(option, "lazytime") == 0)
+                options |= MOUNT_LAZYTIME;
+            else if (strcmp(option, "nolazytime") == 0)
+                options &= ~MOUNT_LAZYTIME;
+            else {
+                fprintf(stderr, "mount: Unknown option %s\n", option);
+                return 1;
+            }
         }
     }
 
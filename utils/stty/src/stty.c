@@ -182,6 +182,11 @@ void visible(unsigned char c, char * buf) {
 
 void print_termios_structure(const struct termios * termios, char show_all) {
     char printed = 0;
+    if (cfgetispeed(termios) != cfgetospeed(termios))
+        printf("ispeed %u baud; ospeed %u baud;\n", cfgetispeed(termios), cfgetospeed(termios));
+    else
+        printf("speed %u baud;\n", cfgetospeed(termios));
+
     // control characters
     for (int i = 0; i < NCCS; i++) {
         if (termios->c_cc[i] == tty_default_settings.c_cc[i] && !show_all) continue;
@@ -283,7 +288,10 @@ void show_help(const char * argv0) {
         "\tsusp\tCHAR\tRaises a SIGTSTP to the foreground process group\n\n"
         "Special settings\n"
         "\tmin\tN\tIn non-canonical mode specifies minimum N bytes to read\n"
-        "\ttime\tN\tIn non-canonical mode specifies read timeout in deciseconds\n\n"
+        "\ttime\tN\tIn non-canonical mode specifies read timeout in deciseconds\n"
+        "\tispeed\tN\tSets the input speed to N baud\n"
+        "\tospeed\tN\tSets the output speed to N baud\n"
+        "\tN\t\tSets both speeds to N baud\n\n"
         "Control settings\n"
         "\t* currently none supported\n\n"
         "Input settings\n"
@@ -482,7 +490,10 @@ int main(int argc, char *argv[]) {
             continue;
         }
         if (strcmp(argv[i], "sane") == 0) {
+            speed_t ispeed = cfgetispeed(&expected), ospeed = cfgetospeed(&expected);
             memcpy(&expected, &tty_default_settings, sizeof(struct termios));
+            cfsetispeed(&expected, ispeed);
+            cfsetospeed(&expected, ospeed);
             continue;
         }
 
@@ -528,7 +539,33 @@ int main(int argc, char *argv[]) {
         }
         if (found_flag) continue;
 
-        // missing all control flags and baud rates as they are not supported in the kernel
+        // missing all control flags as they are not supported in the kernel
+
+        // speeds
+        if (strcmp(argv[i], "ispeed") == 0 || strcmp(argv[i], "ospeed") == 0 || (argv[i][0] >= '0' && argv[i][0] <= '9')) {
+            char direction = 'b'; // i, o or both
+            const char * speed_arg = argv[i];
+            if (argv[i][0] == 'i' || argv[i][0] == 'o') {
+                if (i + 1 >= argc) {
+                    fprintf(stderr, "stty: missing argument to '%s'\n", argv[i]);
+                    fprintf(stderr, "'stty --help' for more information.\n");
+                    return 1;
+                }
+                direction = argv[i][0];
+                speed_arg = argv[++i];
+            }
+            char * end = NULL;
+            errno = 0;
+            unsigned long speed = strtoul(speed_arg, &end, 10);
+            if (direction == 'b' && *end != '\0') goto modeline; // -g output starts with digits too
+            if (errno != 0 || *end != '\0' || end == speed_arg) {
+                fprintf(stderr, "stty: invalid integer argument: '%s'\n", speed_arg);
+                return 1;
+            }
+            if (direction != 'o') cfsetispeed(&expected, speed);
+            if (direction != 'i') cfsetospeed(&expected, speed);
+            continue;
+        }
 
         // special chars
         found_flag = 0;
@@ -566,6 +603,7 @@ int main(int argc, char *argv[]) {
         }
         if (found_flag) continue;
 
+        modeline:
         if (parse_modeline(argv[i], &expected)) continue;
 
         errored:
@@ -0,0 +1,13 @@
+#include <UnstableOS/swap.h>
+#include <stdio.h>
+int main(int argc, char ** argv) {
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s [file]\n", argv[0]);
+        return 1;
+    }
+
+    int ret = swapoff(argv[1]);
+    if (ret < 0)
+        perror("swapoff");
+    return ret;
+}